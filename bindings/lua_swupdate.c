@@ -385,6 +385,7 @@ int luaopen_lua_swupdate(lua_State *L){
 	LUA_PUSH_INT("SOURCE_DOWNLOADER", SOURCE_DOWNLOADER);
 	LUA_PUSH_INT("SOURCE_LOCAL", SOURCE_LOCAL);
 	LUA_PUSH_INT("SOURCE_CHUNKS_DOWNLOADER", SOURCE_CHUNKS_DOWNLOADER);
+	LUA_PUSH_INT("SOURCE_MULTICAST", SOURCE_MULTICAST);
 	lua_settable(L, -3);
 
 	auxiliar_newclass(L, "swupdate_progress", progress_methods);
@@ -55,7 +55,8 @@ lua_swupdate.sourcetype = {
     SOURCE_SURICATTA         = 2,
     SOURCE_DOWNLOADER        = 3,
     SOURCE_LOCAL             = 4,
-    SOURCE_CHUNKS_DOWNLOADER = 5
+    SOURCE_CHUNKS_DOWNLOADER = 5,
+    SOURCE_MULTICAST         = 6
 }
 
 
@@ -0,0 +1,237 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "bufstream.h"
+#include "util.h"
+
+struct bufstream_slot {
+	unsigned char *data;
+	size_t len;
+};
+
+struct bufstream {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct bufstream_slot *slots;
+	unsigned int nbufs;
+	size_t bufsize;
+	unsigned int head;	/* slot read by the consumer */
+	unsigned int count;	/* slots handed to the consumer */
+	size_t rpos;		/* consumer position in head slot */
+	size_t wlen;		/* bytes in the slot being filled */
+	bool eof;
+	bool aborted;
+};
+
+struct bufstream *bufstream_new(unsigned int nbufs, size_t bufsize)
+{
+	struct bufstream *s;
+	unsigned int i;
+
+	if (!nbufs || !bufsize)
+		return NULL;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	s->slots = calloc(nbufs, sizeof(*s->slots));
+	if (!s->slots) {
+		bufstream_free(s);
+		return NULL;
+	}
+	s->nbufs = nbufs;
+	s->bufsize = bufsize;
+	for (i = 0; i < nbufs; i++) {
+		s->slots[i].data = malloc(bufsize);
+		if (!s->slots[i].data) {
+			bufstream_free(s);
+			return NULL;
+		}
+	}
+
+	return s;
+}
+
+void bufstream_free(struct bufstream *s)
+{
+	unsigned int i;
+
+	if (!s)
+		return;
+
+	for (i = 0; s->slots && i < s->nbufs; i++)
+		free(s->slots[i].data);
+	free(s->slots);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	free(s);
+}
+
+/*
+ * Return the free space of the slot being filled, waiting
+ * until the consumer has released a slot if all are full
+ */
+void *bufstream_get_wbuf(struct bufstream *s, size_t *size)
+{
+	struct bufstream_slot *slot;
+	void *buf = NULL;
+
+	pthread_mutex_lock(&s->lock);
+	while (s->count == s->nbufs && !s->aborted)
+		pthread_cond_wait(&s->cond, &s->lock);
+	if (!s->aborted && !s->eof) {
+		slot = &s->slots[(s->head + s->count) % s->nbufs];
+		buf = slot->data + s->wlen;
+		*size = s->bufsize - s->wlen;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return buf;
+}
+
+static void bufstream_push_slot(struct bufstream *s)
+{
+	s->slots[(s->head + s->count) % s->nbufs].len = s->wlen;
+	s->count++;
+	s->wlen = 0;
+	pthread_cond_broadcast(&s->cond);
+}
+
+/*
+ * Account len bytes written into the buffer returned by
+ * bufstream_get_wbuf(), a full slot is passed to the consumer
+ */
+int bufstream_commit(struct bufstream *s, size_t len)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&s->lock);
+	if (s->aborted) {
+		ret = -EPIPE;
+	} else {
+		s->wlen += len;
+		if (s->wlen == s->bufsize)
+			bufstream_push_slot(s);
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return ret;
+}
+
+/*
+ * Copying writer, it can be used as writeimage callback
+ */
+int bufstream_write(void *out, const void *buf, size_t len)
+{
+	struct bufstream *s = (struct bufstream *)out;
+	const unsigned char *data = buf;
+	void *wbuf;
+	size_t size;
+
+	while (len) {
+		wbuf = bufstream_get_wbuf(s, &size);
+		if (!wbuf)
+			return -EPIPE;
+		size = min(size, len);
+		memcpy(wbuf, data, size);
+		if (bufstream_commit(s, size))
+			return -EPIPE;
+		data += size;
+		len -= size;
+	}
+
+	return 0;
+}
+
+/*
+ * End of data: a partially filled slot is passed, too
+ */
+void bufstream_close(struct bufstream *s)
+{
+	pthread_mutex_lock(&s->lock);
+	if (!s->eof && !s->aborted) {
+		if (s->wlen)
+			bufstream_push_slot(s);
+		s->eof = true;
+		pthread_cond_broadcast(&s->cond);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Return the data available in the current slot without
+ * copying it, 0 at end of data
+ */
+ssize_t bufstream_peek(struct bufstream *s, const void **data)
+{
+	struct bufstream_slot *slot;
+	ssize_t ret;
+
+	pthread_mutex_lock(&s->lock);
+	while (!s->count && !s->eof && !s->aborted)
+		pthread_cond_wait(&s->cond, &s->lock);
+	if (s->aborted) {
+		ret = -EPIPE;
+	} else if (!s->count) {
+		ret = 0;
+	} else {
+		slot = &s->slots[s->head];
+		*data = slot->data + s->rpos;
+		ret = slot->len - s->rpos;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return ret;
+}
+
+/*
+ * Release len bytes returned by bufstream_peek(), the slot is given
+ * back to the producer when it is completely consumed
+ */
+void bufstream_consume(struct bufstream *s, size_t len)
+{
+	pthread_mutex_lock(&s->lock);
+	s->rpos += len;
+	if (s->count && s->rpos >= s->slots[s->head].len) {
+		s->rpos = 0;
+		s->head = (s->head + 1) % s->nbufs;
+		s->count--;
+		pthread_cond_broadcast(&s->cond);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+ssize_t bufstream_read(struct bufstream *s, void *buf, size_t len)
+{
+	const void *data;
+	ssize_t n;
+
+	n = bufstream_peek(s, &data);
+	if (n <= 0)
+		return n;
+	n = min((size_t)n, len);
+	memcpy(buf, data, n);
+	bufstream_consume(s, n);
+
+	return n;
+}
+
+void bufstream_abort(struct bufstream *s)
+{
+	pthread_mutex_lock(&s->lock);
+	s->aborted = true;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
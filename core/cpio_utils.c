@@ -26,6 +26,7 @@
 #include "util.h"
 #include "sslapi.h"
 #include "progress.h"
+#include "bufstream.h"
 
 #define MODULE_NAME "cpio"
 
@@ -35,7 +36,8 @@
 
 typedef enum {
 	INPUT_FROM_FD,
-	INPUT_FROM_MEMORY
+	INPUT_FROM_MEMORY,
+	INPUT_FROM_STREAM
 } input_type_t;
 
 int get_cpiohdr(unsigned char *buf, struct filehdr *fhdr)
@@ -221,6 +223,7 @@ struct InputState
 	int fdin;
 	input_type_t source;
 	unsigned char *inbuf;
+	struct bufstream *stream;
 	size_t pos;
 	size_t nbytes;
 	unsigned long *offs;
@@ -251,11 +254,58 @@ static int input_step(void *state, void *buffer, size_t size)
 		ret = size;
 		s->pos += size;
 		break;
+	case INPUT_FROM_STREAM:
+		ret = bufstream_read(s->stream, buffer, size);
+		if (ret < 0) {
+			ERROR("Failure in stream: %s", strerror(-ret));
+			return -EFAULT;
+		}
+		if (s->dgst) {
+			if (swupdate_HASH_update(s->dgst, buffer, ret) < 0)
+				return -EFAULT;
+		}
+		for (int i = 0; i < ret; i++)
+			s->checksum += ((unsigned char *)buffer)[i];
+		break;
 	}
 	s->nbytes -= ret;
 	return ret;
 }
 
+/*
+ * Without decryption and decompression, data from a stream
+ * are passed to the callback directly from the stream buffers
+ */
+static int input_stream_zerocopy(struct InputState *s, void *out,
+				 writeimage callback)
+{
+	const void *data;
+	ssize_t len;
+	size_t i;
+
+	len = bufstream_peek(s->stream, &data);
+	if (len < 0) {
+		ERROR("Failure in stream: %s", strerror(-len));
+		return -EFAULT;
+	}
+	len = min_t(size_t, len, s->nbytes);
+	if (!len)
+		return 0;
+
+	if (s->dgst && swupdate_HASH_update(s->dgst, data, len) < 0)
+		return -EFAULT;
+	for (i = 0; i < (size_t)len; i++)
+		s->checksum += ((const unsigned char *)data)[i];
+
+	if (callback(out, data, len) < 0)
+		return -ENOSPC;
+
+	bufstream_consume(s->stream, len);
+	s->nbytes -= len;
+
+	return len;
+}
+
 struct DecryptState
 {
 	PipelineStep upstream_step;
@@ -429,7 +479,7 @@ static int zstd_step(void* state, void* buffer, size_t size)
 
 #endif
 
-static int __swupdate_copy(int fdin, unsigned char *inbuf, void *out, size_t nbytes, unsigned long *offs, unsigned long long seek,
+static int __swupdate_copy(int fdin, unsigned char *inbuf, struct bufstream *stream, void *out, size_t nbytes, unsigned long *offs, unsigned long long seek,
 	int skip_file, int __attribute__ ((__unused__)) compressed,
 	uint32_t *checksum, unsigned char *hash, bool encrypted, const char *imgivt, writeimage callback)
 {
@@ -493,6 +543,9 @@ static int __swupdate_copy(int fdin, unsigned char *inbuf, void *out, size_t nby
 	if (inbuf) {
 		input_state.inbuf = inbuf;
 		input_state.source = INPUT_FROM_MEMORY;
+	} else if (stream) {
+		input_state.stream = stream;
+		input_state.source = INPUT_FROM_STREAM;
 	}
 
 	PipelineStep step = NULL;
@@ -614,6 +667,14 @@ static int __swupdate_copy(int fdin, unsigned char *inbuf, void *out, size_t nby
 #endif
 
 	for (;;) {
+		if (stream && step == &input_step && !skip_file) {
+			ret = input_stream_zerocopy(&input_state, out, callback);
+			if (ret < 0)
+				goto copyfile_exit;
+			if (ret == 0)
+				break;
+			goto copyfile_progress;
+		}
 		ret = step(state, buffer, sizeof buffer);
 		if (ret < 0) {
 			goto copyfile_exit;
@@ -636,6 +697,7 @@ static int __swupdate_copy(int fdin, unsigned char *inbuf, void *out, size_t nby
 			goto copyfile_exit;
 		}
 
+copyfile_progress:
 		percent = (unsigned)(100ULL * (nbytes - input_state.nbytes) / nbytes);
 		if (percent != prevpercent) {
 			prevpercent = percent;
@@ -670,7 +732,7 @@ static int __swupdate_copy(int fdin, unsigned char *inbuf, void *out, size_t nby
 		}
 	}
 
-	if (!inbuf) {
+	if (!inbuf && !stream) {
 		ret = fill_buffer(fdin, buffer, NPAD_BYTES(*offs), offs, checksum, NULL);
 		if (ret < 0)
 			DEBUG("Padding bytes are not read, ignoring");
@@ -708,6 +770,7 @@ int copyfile(int fdin, void *out, size_t nbytes, unsigned long *offs, unsigned l
 	uint32_t *checksum, unsigned char *hash, bool encrypted, const char *imgivt, writeimage callback)
 {
 	return __swupdate_copy(fdin,
+				NULL,
 				NULL,
 				out,
 				nbytes,
@@ -727,6 +790,7 @@ int copybuffer(unsigned char *inbuf, void *out, size_t nbytes, int __attribute__
 {
 	return __swupdate_copy(-1,
 				inbuf,
+				NULL,
 				out,
 				nbytes,
 				NULL,
@@ -742,6 +806,22 @@ int copybuffer(unsigned char *inbuf, void *out, size_t nbytes, int __attribute__
 
 int copyimage(void *out, struct img_type *img, writeimage callback)
 {
+	if (img->stream)
+		return __swupdate_copy(-1,
+				NULL,
+				img->stream,
+				out,
+				img->size,
+				(unsigned long *)&img->offset,
+				img->seek,
+				0, /* no skip */
+				img->compressed,
+				&img->checksum,
+				img->sha256,
+				img->is_encrypted,
+				img->ivt_ascii,
+				callback);
+
 	return copyfile(img->fdin,
 			out,
 			img->size,
@@ -34,6 +34,7 @@
 #include "pctl.h"
 #include "swupdate_vars.h"
 #include "lua_util.h"
+#include "blkdev_cache.h"
 
 /*
  * function returns:
@@ -285,6 +286,15 @@ int install_single_image(struct img_type *img, bool dry_run)
 			hnd->desc);
 	}
 
+	/*
+	 * The handler could have changed the filesystem or the
+	 * partition on the device, even if it failed
+	 */
+	if (strlen(img->device))
+		blkdev_cache_invalidate(img->device);
+	if (strlen(img->path))
+		blkdev_cache_invalidate(img->path);
+
 	swupdate_progress_step_completed();
 
 	return ret;
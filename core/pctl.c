@@ -58,6 +58,11 @@ int pid = 0;
 
 int sw_sockfd = -1;
 
+/*
+ * In a subprocess, the task it was started as
+ */
+static struct swupdate_task *self;
+
 /*
  * This allows waiting for initial threads to be ready before spawning subprocesses
  */
@@ -119,6 +124,32 @@ void wait_threads_ready(void)
 	pthread_mutex_unlock(&threads_towait_lock);
 }
 
+/*
+ * Subsystems that are not required to answer IPC requests
+ * (crypto, Lua handlers, sw-versions) are initialized in background
+ * to let the IPC socket be available as soon as possible.
+ * An install must wait until they are ready.
+ */
+static bool deferred_init_done = false;
+static pthread_mutex_t deferred_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t deferred_init_cond = PTHREAD_COND_INITIALIZER;
+
+void deferred_init_ready(void)
+{
+	pthread_mutex_lock(&deferred_init_lock);
+	deferred_init_done = true;
+	pthread_cond_broadcast(&deferred_init_cond);
+	pthread_mutex_unlock(&deferred_init_lock);
+}
+
+void wait_deferred_init(void)
+{
+	pthread_mutex_lock(&deferred_init_lock);
+	while (!deferred_init_done)
+		pthread_cond_wait(&deferred_init_cond, &deferred_init_lock);
+	pthread_mutex_unlock(&deferred_init_lock);
+}
+
 /*
  * spawn_process forks and start a new process
  * under a new user
@@ -141,6 +172,7 @@ static int spawn_process(struct swupdate_task *task,
 		return -1;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &task->started);
 	process_id = fork();
 
 
@@ -179,6 +211,7 @@ static int spawn_process(struct swupdate_task *task,
 
 	/* Save new pid */
 	pid = getpid();
+	self = task;
 
 	notify_init();
 
@@ -551,6 +584,19 @@ void *ipc_thread_fn(void *data)
 	fd_set readfds;
 	int retval;
 	server_ipc_fn fn = (server_ipc_fn)data;
+	struct timespec now;
+	long elapsed;
+
+	/*
+	 * From here on the subprocess answers IPC requests:
+	 * this is the time it needed to be ready after fork()
+	 */
+	if (self) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - self->started.tv_sec) * 1000000 +
+			  (now.tv_nsec - self->started.tv_nsec) / 1000;
+		TRACE("Startup: %s ready after %ld us", self->name, elapsed);
+	}
 
 	while (1) {
 		FD_ZERO(&readfds);
@@ -43,6 +43,7 @@
 #include "progress.h"
 #include "pctl.h"
 #include "state.h"
+#include "blkdev_cache.h"
 #include "bootloader.h"
 #include "hw-compatibility.h"
 
@@ -134,6 +135,26 @@ static bool update_transaction_state(struct swupdate_cfg *software, update_state
 	return true;
 }
 
+#ifdef CONFIG_MTD
+/*
+ * Only scripts of type postinstall are known not to have
+ * a pre-install part, shell and Lua scripts can have one
+ */
+static bool has_preinstall_scripts(struct imglist *scripts)
+{
+	struct img_type *img;
+
+	LIST_FOREACH(img, scripts, next) {
+		if (strcmp(img->type, "postinstall")) {
+			TRACE("%s can run before install, no pre-erase", img->fname);
+			return true;
+		}
+	}
+
+	return false;
+}
+#endif
+
 static int extract_files(int fd, struct swupdate_cfg *software)
 {
 	int status = STREAM_WAIT_DESCRIPTION;
@@ -193,6 +214,21 @@ static int extract_files(int fd, struct swupdate_cfg *software)
 			if (mkswu_hook_pre(software, output_file)) {
 				return -1;
 			}
+#ifdef CONFIG_MTD
+			/*
+			 * Start erasing MTD regions flagged for it while
+			 * the rest of the SWU is read: the flash is going to
+			 * be changed from now on. Pre-install scripts run
+			 * after the SWU is read and must find the flash
+			 * untouched, there is no pre-erase if there are any.
+			 */
+			if (!software->parms.dry_run &&
+			    !has_preinstall_scripts(&software->scripts) &&
+			    flash_preerase_start(&software->images) > 0) {
+				update_transaction_state(software, STATE_IN_PROGRESS);
+				installed_directly = true;
+			}
+#endif
 			status = STREAM_DATA;
 			break;
 
@@ -543,6 +579,13 @@ void *network_initializer(void *data)
 		stream_wkup = false;
 		inst.status = RUN;
 		pthread_mutex_unlock(&stream_mutex);
+
+		/* crypto and handlers could be still initializing */
+		wait_deferred_init();
+
+		/* devices could be changed since the last update */
+		blkdev_cache_invalidate(NULL);
+
 		if (mkswu_lock())
 			ret = -EIO;
 		notify(START, RECOVERY_NO_ERROR, INFOLEVEL, "Software Update started !");
@@ -675,6 +718,9 @@ void *network_initializer(void *data)
 			}
 
 			ret = install_images(software);
+#ifdef CONFIG_MTD
+			flash_preerase_stop();
+#endif
 			if (ret != 0) {
 				update_transaction_state(software, STATE_FAILED);
 				notify(FAILURE, RECOVERY_ERROR, ERRORLEVEL, "Installation failed !");
@@ -725,6 +771,10 @@ void *network_initializer(void *data)
 		 */
 		software->parms = parms;
 
+#ifdef CONFIG_MTD
+		flash_preerase_stop();
+#endif
+
 		/* release temp files we may have created */
 		cleanup_files(software);
 
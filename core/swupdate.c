@@ -23,6 +23,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <time.h>
 
 #include "bsdqueue.h"
 #include "cpiohdr.h"
@@ -38,6 +39,7 @@
 #include "lua_util.h"
 #include "mongoose_interface.h"
 #include "download_interface.h"
+#include "multicast_interface.h"
 #include "network_ipc.h"
 #include "network_utils.h"
 #include "sslapi.h"
@@ -67,6 +69,9 @@ static struct swupdate_cfg swcfg;
 int loglevel = ERRORLEVEL;
 int exit_code = EXIT_SUCCESS;
 
+/* Used to trace the time spent at startup */
+static struct timespec startup_time;
+
 #ifdef CONFIG_MTD
 /* Global MTD configuration */
 static struct flash_description flashdesc;
@@ -106,6 +111,9 @@ static struct option long_options[] = {
 #endif
 	{"loglevel", required_argument, NULL, 'l'},
 	{"max-version", required_argument, NULL, '3'},
+#ifdef CONFIG_MULTICAST
+	{"multicast", required_argument, NULL, 'D'},
+#endif
 	{"no-downgrading", required_argument, NULL, 'N'},
 	{"no-reinstalling", required_argument, NULL, 'R'},
 	{"no-state-marker", no_argument, NULL, 'm'},
@@ -186,6 +194,11 @@ static void usage(char *programname)
 		" -d, --download [OPTIONS]       : Parameters to be passed to the downloader\n");
 	download_print_help();
 #endif
+#ifdef CONFIG_MULTICAST
+	fprintf(stdout,
+		" -D, --multicast [OPTIONS]      : Parameters to be passed to the multicast receiver\n");
+	multicast_print_help();
+#endif
 #ifdef CONFIG_SURICATTA
 	fprintf(stdout,
 		" -u, --suricatta [OPTIONS]      : Parameters to be passed to suricatta\n");
@@ -270,11 +283,74 @@ static void swupdate_init(struct swupdate_cfg *sw)
 	LIST_INIT(&sw->bootloader);
 	LIST_INIT(&sw->extprocs);
 	sw->cert_purpose = SSL_PURPOSE_DEFAULT;
+}
+
+/*
+ * Print the time elapsed since SWUpdate was started,
+ * helpful to check what is delaying the startup
+ */
+static void startup_mark(const char *step)
+{
+	struct timespec now;
+	long elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - startup_time.tv_sec) * 1000 +
+		  (now.tv_nsec - startup_time.tv_nsec) / 1000000;
+	TRACE("Startup: %s after %ld ms", step, elapsed);
+}
+
+/*
+ * Initialize subsystems that are not required to answer IPC
+ * requests. This runs in background once the subprocesses are
+ * started, and the first install request waits until it has
+ * finished. Errors are returned to main(), that exits.
+ */
+static void *deferred_initializer(void *data)
+{
+	swupdate_cfg_handle *handle = (swupdate_cfg_handle *)data;
+
+	/* main() waits for the thread itself */
+	thread_ready();
 
 #ifdef CONFIG_MTD
 	mtd_init();
 	ubi_init();
+	startup_mark("MTD / UBI initialized");
 #endif
+
+	if (strlen(swcfg.publickeyfname) || strlen(swcfg.gpg_home_directory)) {
+		if (swupdate_dgst_init(&swcfg, swcfg.publickeyfname)) {
+			fprintf(stderr,
+				 "Error: Crypto cannot be initialized.\n");
+			return (void *)-1;
+		}
+	}
+
+	/*
+	 * If an AES key is passed, load it to allow
+	 * to decrypt images
+	 */
+	if (strlen(swcfg.aeskeyfname)) {
+		if (load_decryption_key(swcfg.aeskeyfname)) {
+			fprintf(stderr,
+				"Error: Key file does not contain a valid AES key.\n");
+			return (void *)-1;
+		}
+	}
+	startup_mark("keys loaded");
+
+	lua_handlers_init(NULL);
+	print_registered_handlers();
+	startup_mark("handlers registered");
+
+	/* Read sw-versions */
+	get_sw_versions(handle, &swcfg);
+
+	startup_mark("deferred initialization done");
+	deferred_init_ready();
+
+	return NULL;
 }
 
 static int parse_cert_purpose(const char *text)
@@ -469,6 +545,16 @@ int main(int argc, char **argv)
 #endif
 	char **dwlav = NULL;
 	int dwlac = 0;
+#ifdef CONFIG_MULTICAST
+	int opt_D = 0;
+	char *mcastoptions;
+	char **mcastav = NULL;
+	int mcastac = 0;
+#endif
+	pthread_t deferred_init;
+	void *deferred_res;
+
+	clock_gettime(CLOCK_MONOTONIC, &startup_time);
 
 #ifdef CONFIG_MTD
 	memset(&flashdesc, 0, sizeof(flashdesc));
@@ -482,6 +568,9 @@ int main(int argc, char **argv)
 #ifdef CONFIG_DOWNLOAD
 	strcat(main_options, "d:");
 #endif
+#ifdef CONFIG_MULTICAST
+	strcat(main_options, "D:");
+#endif
 #ifdef CONFIG_SURICATTA
 	strcat(main_options, "u:");
 #endif
@@ -587,6 +676,7 @@ int main(int argc, char **argv)
 		(void)read_module_settings(&handle, "logcolors", read_console_settings, &swcfg);
 		(void)read_module_settings(&handle, "processes", read_processes_settings, &swcfg);
 	}
+	startup_mark("configuration parsed");
 
 	/*
 	 * Command line should be parsed a second time
@@ -600,10 +690,10 @@ int main(int argc, char **argv)
 	/* Process options with getopt */
 	while ((c = getopt_long(argc, argv, main_options,
 				long_options, NULL)) != EOF) {
-		if (optarg && *optarg == '-' && (c != 'd' && c != 'u' && c != 'w')) {
+		if (optarg && *optarg == '-' && (c != 'd' && c != 'u' && c != 'w' && c != 'D')) {
 			/* An option's value starting with '-' is not allowed except
-			 * for downloader, webserver, and suricatta doing their own
-			 * argv parsing.
+			 * for downloader, webserver, suricatta and multicast receiver
+			 * doing their own argv parsing.
 			 */
 			c = '?';
 		}
@@ -703,6 +793,18 @@ int main(int argc, char **argv)
 			opt_d = 1;
 			free(dwloptions);
 			break;
+#endif
+#ifdef CONFIG_MULTICAST
+		case 'D':
+			if (asprintf(&mcastoptions,"%s %s", argv[0], optarg) ==
+			ENOMEM_ASPRINTF) {
+				ERROR("Cannot allocate memory for multicast options.");
+				exit(EXIT_FAILURE);
+			}
+			mcastav = splitargs(mcastoptions, &mcastac);
+			opt_D = 1;
+			free(mcastoptions);
+			break;
 #endif
 		case 'H':
 			if (opt_to_hwrev(optarg, &swcfg.hw) < 0)
@@ -804,14 +906,6 @@ int main(int argc, char **argv)
 
 	swupdate_crypto_init();
 
-	if (strlen(swcfg.publickeyfname) || strlen(swcfg.gpg_home_directory)) {
-		if (swupdate_dgst_init(&swcfg, swcfg.publickeyfname)) {
-			fprintf(stderr,
-				 "Error: Crypto cannot be initialized.\n");
-			exit(EXIT_FAILURE);
-		}
-	}
-
 	setenv("SWUPDATE_VERSION", SWU_VER, 1);
 	printf("%s\n", BANNER);
 	printf("Licensed under GPLv2. See source distribution for detailed "
@@ -843,24 +937,9 @@ int main(int argc, char **argv)
 		mtd_set_ubiblacklist(swcfg.mtdblacklist);
 #endif
 
-	/*
-	 * If an AES key is passed, load it to allow
-	 * to decrypt images
-	 */
-	if (strlen(swcfg.aeskeyfname)) {
-		if (load_decryption_key(swcfg.aeskeyfname)) {
-			fprintf(stderr,
-				"Error: Key file does not contain a valid AES key.\n");
-			exit(EXIT_FAILURE);
-		}
-	}
-
-	lua_handlers_init(NULL);
-
 	if(!get_hw_revision(&swcfg.hw))
 		INFO("Running on %s Revision %s", swcfg.hw.boardname, swcfg.hw.revision);
 
-	print_registered_handlers();
 	if (swcfg.syslog_enabled) {
 		if (syslog_init()) {
 			ERROR("failed to initialize syslog notifier");
@@ -880,9 +959,6 @@ int main(int argc, char **argv)
 			swcfg.parms.running_mode);
 	}
 
-	/* Read sw-versions */
-	get_sw_versions(&handle, &swcfg);
-
 	/*
 	 *  Start daemon if just a check is required
 	 *  SWUpdate will exit after the check
@@ -896,6 +972,7 @@ int main(int argc, char **argv)
 
 	/* wait for threads to be done before starting children */
 	wait_threads_ready();
+	startup_mark("IPC ready");
 
 	/* Start embedded web server */
 #if defined(CONFIG_MONGOOSE)
@@ -934,6 +1011,17 @@ int main(int argc, char **argv)
 		freeargs(dwlav);
 	}
 #endif
+#ifdef CONFIG_MULTICAST
+	if (opt_D) {
+		uid_t uid;
+		gid_t gid;
+		read_settings_user_id(&handle, "multicast", &uid, &gid);
+		start_subprocess(SOURCE_MULTICAST, "multicast", uid, gid,
+				 cfgfname, mcastac,
+				 mcastav, start_multicast_receiver);
+		freeargs(mcastav);
+	}
+#endif
 #if defined(CONFIG_DELTA)
 	{
 		uid_t uid;
@@ -966,6 +1054,20 @@ int main(int argc, char **argv)
 		freeargs(dwlav);
 	}
 
+	startup_mark("subprocesses started");
+
+	/*
+	 * Crypto, handlers and sw-versions are not needed to answer
+	 * IPC requests or by the subprocesses: initialize them only now,
+	 * while both already run. The children are forked without exec,
+	 * so they must be started before, not to inherit a half
+	 * initialized state. An install request waits for the end.
+	 */
+	deferred_init = start_thread(deferred_initializer, &handle);
+	pthread_join(deferred_init, &deferred_res);
+	if (deferred_res)
+		exit(EXIT_FAILURE);
+
 	if (opt_i) {
 		exit_code = install_from_file(fname, opt_c);
 	}
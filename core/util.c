@@ -26,6 +26,7 @@
 #include <regex.h>
 #include <string.h>
 #include <dirent.h>
+#include <pthread.h>
 #include "swupdate_dict.h"
 #include "swupdate_image.h"
 
@@ -1090,9 +1091,30 @@ out:
 	return root;
 }
 
+/*
+ * The root device does not change while SWUpdate runs,
+ * scan it once for each device mounted as "/"
+ */
+static struct {
+	dev_t dev;
+	char *device;
+} root_cache;
+static pthread_mutex_t root_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
 char *get_root_device(void)
 {
 	char *root = NULL;
+	struct stat info;
+
+	if (stat("/", &info) < 0)
+		info.st_dev = 0;
+
+	pthread_mutex_lock(&root_cache_lock);
+	if (root_cache.device && info.st_dev && root_cache.dev == info.st_dev) {
+		root = strdup(root_cache.device);
+		pthread_mutex_unlock(&root_cache_lock);
+		return root;
+	}
 
 	root = get_root_from_partitions();
 	if (!root)
@@ -1100,6 +1122,13 @@ char *get_root_device(void)
 	if (!root)
 		root = get_root_from_cmdline();
 
+	if (root && info.st_dev) {
+		free(root_cache.device);
+		root_cache.device = strdup(root);
+		root_cache.dev = info.st_dev;
+	}
+	pthread_mutex_unlock(&root_cache_lock);
+
 	return root;
 }
 
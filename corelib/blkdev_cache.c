@@ -0,0 +1,374 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <blkid/blkid.h>
+#include "util.h"
+#include "blkdev_cache.h"
+
+#define BLKDEV_MAX_PROBE_THREADS	8
+#define PROC_PARTITIONS			"/proc/partitions"
+
+enum {
+	TAG_TYPE,
+	TAG_UUID,
+	TAG_LABEL,
+	TAG_PARTUUID,
+	TAG_MAX
+};
+
+static const char *tag_names[TAG_MAX] = {
+	[TAG_TYPE] = "TYPE",
+	[TAG_UUID] = "UUID",
+	[TAG_LABEL] = "LABEL",
+	[TAG_PARTUUID] = "PARTUUID"
+};
+
+/*
+ * Names of the values set by the low-level probe: the partition
+ * UUID comes from the partitions chain, not from the superblock.
+ */
+static const char *probe_names[TAG_MAX] = {
+	[TAG_TYPE] = "TYPE",
+	[TAG_UUID] = "UUID",
+	[TAG_LABEL] = "LABEL",
+	[TAG_PARTUUID] = "PART_ENTRY_UUID"
+};
+
+struct blkdev_entry {
+	char *devname;
+	dev_t devno;
+	bool valid;
+	char *tags[TAG_MAX];
+};
+
+static struct blkdev_cache {
+	struct blkdev_entry *entries;
+	unsigned int count;
+	char *partitions;	/* content of /proc/partitions when probed */
+	unsigned int next;	/* next entry to be probed by a thread */
+} cache;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int tag_index(const char *tag)
+{
+	int i;
+
+	for (i = 0; i < TAG_MAX; i++)
+		if (!strcmp(tag, tag_names[i]))
+			return i;
+
+	return -1;
+}
+
+static void clear_tags(struct blkdev_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < TAG_MAX; i++) {
+		free(entry->tags[i]);
+		entry->tags[i] = NULL;
+	}
+}
+
+static void probe_device(const char *devname, char **tags)
+{
+	blkid_probe pr;
+	const char *value;
+	size_t len;
+	int fd, i;
+
+	fd = open(devname, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+	if (fd < 0)
+		return;
+
+	pr = blkid_new_probe();
+	if (!pr || blkid_probe_set_device(pr, fd, 0, 0)) {
+		if (pr)
+			blkid_free_probe(pr);
+		close(fd);
+		return;
+	}
+
+	blkid_probe_enable_superblocks(pr, 1);
+	blkid_probe_set_superblocks_flags(pr, BLKID_SUBLKS_TYPE |
+					  BLKID_SUBLKS_UUID | BLKID_SUBLKS_LABEL);
+	blkid_probe_enable_partitions(pr, 1);
+	blkid_probe_set_partitions_flags(pr, BLKID_PARTS_ENTRY_DETAILS);
+
+	/* each call returns the result of the next chain */
+	while (blkid_do_probe(pr) == 0) {
+		for (i = 0; i < TAG_MAX; i++) {
+			if (tags[i])
+				continue;
+			if (!blkid_probe_lookup_value(pr, probe_names[i], &value, &len) &&
+			    len > 0)
+				tags[i] = strndup(value, len);
+		}
+	}
+
+	blkid_free_probe(pr);
+	close(fd);
+}
+
+static void *probe_thread(void *data)
+{
+	struct blkdev_cache *c = (struct blkdev_cache *)data;
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&c->next, 1, __ATOMIC_RELAXED)) < c->count) {
+		probe_device(c->entries[i].devname, c->entries[i].tags);
+		c->entries[i].valid = true;
+	}
+
+	return NULL;
+}
+
+static char *read_partitions(void)
+{
+	char *buf = NULL;
+	size_t size = 0, len = 0;
+	ssize_t n;
+	int fd;
+
+	fd = open(PROC_PARTITIONS, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	do {
+		if (len + 1 >= size) {
+			char *tmp;
+			size = size ? size * 2 : 4096;
+			tmp = realloc(buf, size);
+			if (!tmp) {
+				free(buf);
+				close(fd);
+				return NULL;
+			}
+			buf = tmp;
+		}
+		n = read(fd, buf + len, size - len - 1);
+		if (n > 0)
+			len += n;
+	} while (n > 0 || (n < 0 && errno == EINTR));
+
+	close(fd);
+	buf[len] = '\0';
+
+	return buf;
+}
+
+static void cache_free(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache.count; i++) {
+		clear_tags(&cache.entries[i]);
+		free(cache.entries[i].devname);
+	}
+	free(cache.entries);
+	free(cache.partitions);
+	memset(&cache, 0, sizeof(cache));
+}
+
+/*
+ * Probe all block devices, must be called with cache_lock
+ */
+static int cache_populate(char *partitions)
+{
+	pthread_t threads[BLKDEV_MAX_PROBE_THREADS];
+	unsigned int maj, min, nthreads, started = 0, i;
+	unsigned long long nblocks;
+	char name[128];
+	char *line, *saveptr = NULL;
+	char *lines = strdup(partitions);
+
+	if (!lines) {
+		free(partitions);
+		return -ENOMEM;
+	}
+
+	cache_free();
+	cache.partitions = partitions;
+
+	for (line = strtok_r(lines, "\n", &saveptr); line;
+	     line = strtok_r(NULL, "\n", &saveptr)) {
+		struct blkdev_entry *entries;
+
+		if (sscanf(line, "%u %u %llu %127s", &maj, &min, &nblocks, name) != 4)
+			continue;
+		entries = realloc(cache.entries, (cache.count + 1) * sizeof(*entries));
+		if (!entries)
+			break;
+		cache.entries = entries;
+		memset(&entries[cache.count], 0, sizeof(*entries));
+		if (asprintf(&entries[cache.count].devname, "/dev/%s", name) < 0)
+			break;
+		entries[cache.count].devno = makedev(maj, min);
+		cache.count++;
+	}
+	free(lines);
+
+	nthreads = min_t(long, sysconf(_SC_NPROCESSORS_ONLN), BLKDEV_MAX_PROBE_THREADS);
+	nthreads = min(nthreads, cache.count);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, probe_thread, &cache))
+			break;
+		started++;
+	}
+	/* the caller probes too, this works even if no thread was started */
+	probe_thread(&cache);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	TRACE("Probed %u block devices with %u threads", cache.count, started + 1);
+
+	return 0;
+}
+
+/*
+ * Probe again all devices if the partitions were changed,
+ * must be called with cache_lock
+ */
+static int cache_refresh(void)
+{
+	char *partitions = read_partitions();
+
+	if (!partitions)
+		return -ENOENT;
+
+	if (cache.partitions && !strcmp(partitions, cache.partitions)) {
+		free(partitions);
+		return 0;
+	}
+
+	return cache_populate(partitions);
+}
+
+static void revalidate(struct blkdev_entry *entry)
+{
+	if (entry->valid)
+		return;
+	clear_tags(entry);
+	probe_device(entry->devname, entry->tags);
+	entry->valid = true;
+}
+
+static struct blkdev_entry *cache_lookup(dev_t devno)
+{
+	unsigned int i;
+
+	if (cache_refresh())
+		return NULL;
+
+	for (i = 0; i < cache.count; i++) {
+		if (cache.entries[i].devno != devno)
+			continue;
+		revalidate(&cache.entries[i]);
+		return &cache.entries[i];
+	}
+
+	return NULL;
+}
+
+char *blkdev_cache_get_tag(const char *device, const char *tag)
+{
+	struct blkdev_entry *entry;
+	char *tags[TAG_MAX] = { NULL };
+	struct stat st;
+	char *value = NULL;
+	int index = tag_index(tag);
+	int i;
+
+	if (index < 0 || !device)
+		return NULL;
+
+	if (!stat(device, &st) && S_ISBLK(st.st_mode)) {
+		pthread_mutex_lock(&cache_lock);
+		entry = cache_lookup(st.st_rdev);
+		if (entry && entry->tags[index])
+			value = strdup(entry->tags[index]);
+		pthread_mutex_unlock(&cache_lock);
+		if (entry)
+			return value;
+	}
+
+	/* Files and devices not in /proc/partitions are not cached */
+	probe_device(device, tags);
+	value = tags[index];
+	for (i = 0; i < TAG_MAX; i++)
+		if (i != index)
+			free(tags[i]);
+
+	return value;
+}
+
+/*
+ * Return a NULL terminated array with the
+ * devices having tag=value, NULL if there is no one.
+ */
+char **blkdev_cache_find_tag(const char *tag, const char *value)
+{
+	char **devices = NULL, **tmp;
+	unsigned int i, found = 0;
+	int index = tag_index(tag);
+
+	if (index < 0 || !value)
+		return NULL;
+
+	pthread_mutex_lock(&cache_lock);
+	cache_refresh();
+	for (i = 0; i < cache.count; i++) {
+		struct blkdev_entry *entry = &cache.entries[i];
+
+		revalidate(entry);
+		if (!entry->tags[index] || strcmp(entry->tags[index], value))
+			continue;
+		tmp = realloc(devices, (found + 2) * sizeof(*devices));
+		if (!tmp)
+			break;
+		devices = tmp;
+		devices[found] = strdup(entry->devname);
+		if (!devices[found])
+			break;
+		devices[++found] = NULL;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return devices;
+}
+
+/*
+ * Drop the cached data of a device after it was written,
+ * or of all devices if device is NULL
+ */
+void blkdev_cache_invalidate(const char *device)
+{
+	struct stat st;
+	unsigned int i;
+
+	pthread_mutex_lock(&cache_lock);
+	if (!device) {
+		cache_free();
+	} else if (!stat(device, &st) && S_ISBLK(st.st_mode)) {
+		for (i = 0; i < cache.count; i++)
+			if (cache.entries[i].devno == st.st_rdev)
+				cache.entries[i].valid = false;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -17,6 +17,7 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
 #include <curl/curl.h>
 #include <generated/autoconf.h>
 #include <unistd.h>
@@ -27,32 +28,71 @@
 #include "channel.h"
 #include "channel_curl.h"
 #include "progress.h"
+#include "peer_cache.h"
 #include <json-c/json.h>
 
 #define SPEED_LOW_BYTES_SEC 8
 #define SPEED_LOW_TIME_SEC 300
 #define KEEPALIVE_DELAY 204L
 #define KEEPALIVE_INTERVAL 120L
+#define REPLY_BUFFER_MIN_SIZE (16 * 1024)
+#define REPLY_BUFFER_MAX_PRESIZE (64 * 1024 * 1024)
+/* A peer is in the LAN: give up early if it does not answer or stalls */
+#define PEER_CONNECT_TIMEOUT 3L
+#define PEER_LOW_SPEED_TIME 10L
+/*
+ * Mirrors are ranked by the speed they deliver the first bytes of the
+ * file with. A mirror below the minimum speed for MIRROR_LOW_SPEED_TIME,
+ * not counting the time the installer does not take the data, is left
+ * for the next one. Without minimum speed set, it is the speed of the
+ * probe divided by MIRROR_SPEED_DIVISOR.
+ */
+#define MIRROR_PROBE_SIZE (256 * 1024)
+#define MIRROR_PROBE_TIMEOUT 10L
+#define MIRROR_LOW_SPEED_TIME 15L
+#define MIRROR_SPEED_DIVISOR 4
 
 typedef struct {
 	char *memory;
 	size_t size;
+	size_t capacity;
+	/* JSON replies are parsed while they are received */
+	struct json_tokener *tokener;
+	struct json_object *json;
+	enum json_tokener_error json_res;
 } output_data_t;
 
+typedef struct {
+	channel_data_t *channel_data;
+	int output;
+	output_data_t *outdata;
+	channel_t *this;
+	struct peer_cache *peer_cache;
+	double blocked;		/* s spent waiting for the installer */
+} write_callback_t;
+
 typedef struct {
 	char *proxy;
 	char *effective_url;
 	char *redirect_url;
 	CURL *handle;
 	struct curl_slist *header;
+	/* Operation in progress, it can outlive the call for asynchronous operations */
+	output_data_t outdata;
+	write_callback_t wrdata;
+	channel_data_t *op_data;
+	channel_method_t op_method;
 } channel_curl_t;
 
 typedef struct {
-	channel_data_t *channel_data;
-	int output;
-	output_data_t *outdata;
-	channel_t *this;
-} write_callback_t;
+	const char *url;
+	unsigned int order;	/* in the list, ties are kept in order */
+	size_t probe_bytes;
+	double probe_speed;	/* B/s, 0 if the probe failed */
+	unsigned long long bytes;
+	double time;		/* s in the network, without the installer */
+	unsigned int failures;
+} mirror_stats_t;
 
 typedef struct {
 	curl_off_t total_download_size;
@@ -60,6 +100,17 @@ typedef struct {
 	sourcetype source; /* SWUpdate module that triggered the download. */
 } download_callback_data_t;
 
+/* Speed of the transfer from a mirror, checked by the progress callback */
+typedef struct {
+	download_callback_data_t *progress;	/* NULL if not tracked */
+	write_callback_t *wrdata;
+	long min_speed;		/* B/s, 0 for none */
+	double start;		/* window of the measure */
+	double blocked;
+	curl_off_t bytes;
+	bool too_slow;
+} mirror_watch_t;
+
 static const char *method_desc[] = {
 	[CHANNEL_GET] = "GET",
 	[CHANNEL_POST] = "POST",
@@ -172,6 +223,14 @@ channel_op_res_t channel_open(channel_t *this, void *cfg)
 	return CHANNEL_OK;
 }
 
+static double monotonic_time(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
 static channel_op_res_t result_channel_callback_ipc;
 size_t channel_callback_ipc(void *streamdata, size_t size, size_t nmemb,
 				   write_callback_t *data)
@@ -196,14 +255,21 @@ size_t channel_callback_ipc(void *streamdata, size_t size, size_t nmemb,
 	if (!data->channel_data->http_response_code)
 		channel_map_http_code(data->this, &data->channel_data->http_response_code);
 
-	if (!data->channel_data->noipc &&
-		ipc_send_data(data->output, streamdata, (int)(size * nmemb)) <
-	    0) {
-		ERROR("Writing into SWUpdate IPC stream failed.");
-		result_channel_callback_ipc = CHANNEL_EIO;
-		return 0;
+	if (!data->channel_data->noipc) {
+		/* the installer blocks the write while it is busy */
+		double start = monotonic_time();
+		int ret = ipc_send_data(data->output, streamdata, (int)(size * nmemb));
+
+		data->blocked += monotonic_time() - start;
+		if (ret < 0) {
+			ERROR("Writing into SWUpdate IPC stream failed.");
+			result_channel_callback_ipc = CHANNEL_EIO;
+			return 0;
+		}
 	}
 
+	peer_cache_write(data->peer_cache, streamdata, size * nmemb);
+
 	if (data->channel_data->dwlwrdata) {
 		return data->channel_data->dwlwrdata(streamdata, size, nmemb, data->channel_data);
 	}
@@ -268,15 +334,47 @@ size_t channel_callback_membuffer(void *streamdata, size_t size, size_t nmemb,
 
 	size_t realsize = size * nmemb;
 	output_data_t *mem = data->outdata;
+	size_t needed = mem->size + realsize + 1;
 
-	mem->memory = realloc(mem->memory, mem->size + realsize + 1);
-	if (mem->memory == NULL) {
-		ERROR("Channel get operation failed with OOM");
-		return 0;
+	if (needed > mem->capacity) {
+		size_t capacity = max(mem->capacity * 2, (size_t)REPLY_BUFFER_MIN_SIZE);
+		curl_off_t length = -1;
+		char *memory;
+
+		/*
+		 * Reserve the whole reply at once if the server
+		 * sent the length, grow geometrically otherwise.
+		 */
+		if (!mem->size && data->this && data->this->priv &&
+		    curl_easy_getinfo(((channel_curl_t *)data->this->priv)->handle,
+				      CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+				      &length) == CURLE_OK &&
+		    length > 0 && length < REPLY_BUFFER_MAX_PRESIZE)
+			capacity = max(capacity, (size_t)length + 1);
+		capacity = max(capacity, needed);
+
+		memory = realloc(mem->memory, capacity);
+		if (memory == NULL) {
+			ERROR("Channel get operation failed with OOM");
+			return 0;
+		}
+		mem->memory = memory;
+		mem->capacity = capacity;
 	}
 	memcpy(&(mem->memory[mem->size]), streamdata, realsize);
 	mem->size += realsize;
 	mem->memory[mem->size] = 0;
+
+	/*
+	 * Feed the JSON parser with the received chunk, errors
+	 * are reported after the transfer by parse_reply().
+	 * Data after the first complete object is ignored.
+	 */
+	if (mem->tokener && !mem->json && mem->json_res == json_tokener_continue) {
+		mem->json = json_tokener_parse_ex(mem->tokener, streamdata, (int)realsize);
+		mem->json_res = json_tokener_get_error(mem->tokener);
+	}
+
 	return realsize;
 }
 
@@ -478,6 +576,48 @@ static int channel_callback_xferinfo_legacy(void *p, double dltotal, double dlno
 }
 #endif
 
+/*
+ * Progress callback while getting the file from a mirror: the speed is
+ * measured over MIRROR_LOW_SPEED_TIME of network time, the time spent
+ * waiting for the installer is not counted. Aborts the transfer if the
+ * mirror is too slow.
+ */
+static int mirror_callback_xferinfo(void *p, curl_off_t dltotal, curl_off_t dlnow,
+				    curl_off_t ultotal, curl_off_t ulnow)
+{
+	mirror_watch_t *w = (mirror_watch_t *)p;
+	double now, net;
+
+	if (w->progress)
+		(void)channel_callback_xferinfo(w->progress, dltotal, dlnow,
+						ultotal, ulnow);
+	if (!w->min_speed)
+		return 0;
+
+	now = monotonic_time();
+	net = now - w->start - (w->wrdata->blocked - w->blocked);
+	if (net < MIRROR_LOW_SPEED_TIME)
+		return 0;
+	if ((dlnow - w->bytes) / net < w->min_speed) {
+		w->too_slow = true;
+		return 1;
+	}
+	w->start = now;
+	w->blocked = w->wrdata->blocked;
+	w->bytes = dlnow;
+
+	return 0;
+}
+
+#if LIBCURL_VERSION_NUM < 0x072000
+static int mirror_callback_xferinfo_legacy(void *p, double dltotal, double dlnow,
+					   double ultotal, double ulnow)
+{
+	return mirror_callback_xferinfo(p, (curl_off_t)dltotal, (curl_off_t)dlnow,
+					(curl_off_t)ultotal, (curl_off_t)ulnow);
+}
+#endif
+
 static size_t channel_callback_headers(char *buffer, size_t size, size_t nitems, void *userdata)
 {
 	channel_data_t *channel_data = (channel_data_t *)userdata;
@@ -966,12 +1106,23 @@ static channel_op_res_t setup_reply_buffer(CURL *handle, write_callback_t *wrdat
 {
 	wrdata->outdata->memory = NULL;
 	wrdata->outdata->size = 0;
+	wrdata->outdata->capacity = 0;
+	wrdata->outdata->tokener = NULL;
+	wrdata->outdata->json = NULL;
+	wrdata->outdata->json_res = json_tokener_continue;
 
 	if ((wrdata->outdata->memory = malloc(1)) == NULL) {
 		ERROR("Channel buffer reservation failed with OOM.");
 		return CHANNEL_ENOMEM;
 	}
 	*wrdata->outdata->memory = '\0';
+	wrdata->outdata->capacity = 1;
+
+	if (wrdata->channel_data->format == CHANNEL_PARSE_JSON &&
+	    (wrdata->outdata->tokener = json_tokener_new()) == NULL) {
+		ERROR("Channel JSON parser reservation failed with OOM.");
+		return CHANNEL_ENOMEM;
+	}
 
 	if ((curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION,
 			      channel_callback_membuffer) != CURLE_OK) ||
@@ -995,20 +1146,25 @@ static channel_op_res_t parse_reply(channel_data_t *channel_data, output_data_t
 
 	if (channel_data->format == CHANNEL_PARSE_JSON) {
 		assert(channel_data->json_reply == NULL);
-		enum json_tokener_error json_res;
-		struct json_tokener *json_tokenizer = json_tokener_new();
-		do {
-			channel_data->json_reply = json_tokener_parse_ex(
-			    json_tokenizer, chunk->memory, (int)chunk->size);
-		} while ((json_res = json_tokener_get_error(json_tokenizer)) ==
-			 json_tokener_continue);
-		/* json_tokenizer is not used for json_tokener_error_desc, hence can be freed here. */
-		json_tokener_free(json_tokenizer);
-		if (json_res != json_tokener_success) {
+		if (!chunk->tokener) {
+			ERROR("Channel reply was not parsed.");
+			return CHANNEL_EBADMSG;
+		}
+		/*
+		 * The chunks were already parsed while received, signal
+		 * the end of data for values that are not delimited (numbers).
+		 */
+		if (!chunk->json && chunk->json_res == json_tokener_continue) {
+			chunk->json = json_tokener_parse_ex(chunk->tokener, "", 1);
+			chunk->json_res = json_tokener_get_error(chunk->tokener);
+		}
+		if (chunk->json_res != json_tokener_success || !chunk->json) {
 			ERROR("Error while parsing channel's returned JSON data: %s",
-			      json_tokener_error_desc(json_res));
+			      json_tokener_error_desc(chunk->json_res));
 			return CHANNEL_EBADMSG;
 		}
+		channel_data->json_reply = chunk->json;
+		chunk->json = NULL;
 	}
 
 	if (channel_data->format == CHANNEL_PARSE_RAW) {
@@ -1026,6 +1182,18 @@ static channel_op_res_t parse_reply(channel_data_t *channel_data, output_data_t
 	return CHANNEL_OK;
 }
 
+static void free_reply_buffer(output_data_t *chunk)
+{
+	free(chunk->memory);
+	chunk->memory = NULL;
+	if (chunk->json)
+		json_object_put(chunk->json);
+	chunk->json = NULL;
+	if (chunk->tokener)
+		json_tokener_free(chunk->tokener);
+	chunk->tokener = NULL;
+}
+
 static CURLcode channel_set_read_callback(channel_curl_t *handle, channel_data_t *channel_data)
 {
 
@@ -1035,35 +1203,49 @@ static CURLcode channel_set_read_callback(channel_curl_t *handle, channel_data_t
 		curl_easy_setopt(handle, CURLOPT_READDATA, channel_data);
 }
 
-static channel_op_res_t channel_post_method(channel_t *this, void *data, int method)
+/*
+ * Setup the curl handle for a GET, POST, PUT, PATCH or DELETE operation
+ * with reply in memory. The state of the operation is kept in the channel
+ * until channel_complete() is called.
+ */
+static channel_op_res_t channel_prepare(channel_t *this, channel_data_t *channel_data,
+					channel_method_t method)
 {
 	channel_curl_t *channel_curl = this->priv;
-	assert(data != NULL);
+	assert(channel_data != NULL);
 	assert(channel_curl->handle != NULL);
 
 	channel_op_res_t result = CHANNEL_OK;
-	channel_data_t *channel_data = (channel_data_t *)data;
 	channel_data->offs = 0;
-	output_data_t outdata = {};
-	write_callback_t wrdata = { .this = this, .channel_data = channel_data, .outdata = &outdata };
+	channel_data->http_response_code = 0;
+	memset(&channel_curl->outdata, 0, sizeof(channel_curl->outdata));
+	channel_curl->wrdata = (write_callback_t){ .this = this,
+						   .channel_data = channel_data,
+						   .outdata = &channel_curl->outdata };
+	channel_curl->op_data = channel_data;
+	channel_curl->op_method = method;
 
 	if ((result = channel_set_content_type(this, channel_data)) !=
 	    CHANNEL_OK) {
 		ERROR("Set content-type option failed.");
-		goto cleanup_header;
+		return result;
 	}
 
 	if ((result = channel_set_options(this, channel_data)) != CHANNEL_OK) {
 		ERROR("Set channel option failed.");
-		goto cleanup_header;
+		return result;
 	}
 
-	if ((result = setup_reply_buffer(channel_curl->handle, &wrdata)) != CHANNEL_OK) {
-		goto cleanup_header;
+	if ((result = setup_reply_buffer(channel_curl->handle, &channel_curl->wrdata)) != CHANNEL_OK) {
+		return result;
 	}
 
 	CURLcode curl_result = CURLE_OK;
 	switch (method)  {
+	case CHANNEL_GET:
+		curl_result = curl_easy_setopt(channel_curl->handle, CURLOPT_CUSTOMREQUEST, "GET");
+		break;
+
 	case CHANNEL_PATCH:
 	case CHANNEL_POST:
 		if (method == CHANNEL_PATCH)
@@ -1094,18 +1276,43 @@ static channel_op_res_t channel_post_method(channel_t *this, void *data, int met
 	}
 
 	if (curl_result != CURLE_OK) {
-		result = CHANNEL_EINIT;
 		ERROR("Set %s channel method option failed.", method_desc[method]);
-		goto cleanup_header;
+		return CHANNEL_EINIT;
 	}
 
 	if (channel_data->debug) {
-		TRACE("%s to %s: %s", method_desc[method], channel_data->url, channel_data->request_body);
+		if (method == CHANNEL_GET)
+			DEBUG("Trying to GET %s", channel_data->url);
+		else
+			TRACE("%s to %s: %s", method_desc[method], channel_data->url, channel_data->request_body);
 	}
 
-	CURLcode curlrc = curl_easy_perform(channel_curl->handle);
+	return CHANNEL_OK;
+}
+
+static void channel_cleanup_operation(channel_t *this)
+{
+	channel_curl_t *channel_curl = this->priv;
+
+	free_reply_buffer(&channel_curl->outdata);
+	curl_easy_reset(channel_curl->handle);
+	curl_slist_free_all(channel_curl->header);
+	channel_curl->header = NULL;
+	channel_curl->op_data = NULL;
+}
+
+/*
+ * Evaluate the result of the transfer set up by channel_prepare()
+ */
+static channel_op_res_t channel_complete(channel_t *this, CURLcode curlrc)
+{
+	channel_curl_t *channel_curl = this->priv;
+	channel_data_t *channel_data = channel_curl->op_data;
+	channel_op_res_t result;
+
 	if (curlrc != CURLE_OK) {
-		ERROR("Channel %s operation failed (%d): '%s'", method_desc[method], curlrc,
+		ERROR("Channel %s operation failed (%d): '%s'",
+		      method_desc[channel_curl->op_method], curlrc,
 		      curl_easy_strerror(curlrc));
 		result = channel_map_curl_error(curlrc);
 		goto cleanup_header;
@@ -1118,21 +1325,60 @@ static channel_op_res_t channel_post_method(channel_t *this, void *data, int met
 	if (channel_data->nocheckanswer)
 		goto cleanup_header;
 
-	channel_log_reply(result, channel_data, &outdata);
+	channel_log_reply(result, channel_data, &channel_curl->outdata);
 
 	if (result == CHANNEL_OK) {
-	    result = parse_reply(channel_data, &outdata);
+	    result = parse_reply(channel_data, &channel_curl->outdata);
 	}
 
 cleanup_header:
-	outdata.memory != NULL ? free(outdata.memory) : (void)0;
-	curl_easy_reset(channel_curl->handle);
-	curl_slist_free_all(channel_curl->header);
-	channel_curl->header = NULL;
+	channel_cleanup_operation(this);
 
 	return result;
 }
 
+static channel_op_res_t channel_do_method(channel_t *this, void *data, channel_method_t method)
+{
+	channel_curl_t *channel_curl = this->priv;
+	channel_op_res_t result;
+
+	result = channel_prepare(this, (channel_data_t *)data, method);
+	if (result != CHANNEL_OK) {
+		channel_cleanup_operation(this);
+		return result;
+	}
+
+	return channel_complete(this, curl_easy_perform(channel_curl->handle));
+}
+
+channel_op_res_t channel_curl_start(channel_t *this, channel_data_t *channel_data,
+				    channel_method_t method, void *multi, void *priv)
+{
+	channel_curl_t *channel_curl = this->priv;
+	channel_op_res_t result;
+
+	result = channel_prepare(this, channel_data, method);
+	if (result == CHANNEL_OK &&
+	    (curl_easy_setopt(channel_curl->handle, CURLOPT_PRIVATE, priv) != CURLE_OK ||
+	     curl_multi_add_handle((CURLM *)multi, channel_curl->handle) != CURLM_OK)) {
+		ERROR("Cannot start asynchronous %s operation.", method_desc[method]);
+		result = CHANNEL_EINIT;
+	}
+	if (result != CHANNEL_OK)
+		channel_cleanup_operation(this);
+
+	return result;
+}
+
+channel_op_res_t channel_curl_finish(channel_t *this, void *multi, int curlrc)
+{
+	channel_curl_t *channel_curl = this->priv;
+
+	(void)curl_multi_remove_handle((CURLM *)multi, channel_curl->handle);
+
+	return channel_complete(this, (CURLcode)curlrc);
+}
+
 channel_op_res_t channel_put(channel_t *this, void *data)
 {
 	assert(data != NULL);
@@ -1145,7 +1391,7 @@ channel_op_res_t channel_put(channel_t *this, void *data)
 	case CHANNEL_POST:
 	case CHANNEL_PATCH:
 	case CHANNEL_DELETE:
-		return channel_post_method(this, data, channel_data->method);
+		return channel_do_method(this, data, channel_data->method);
 	default:
 		TRACE("Channel method (POST, PUT, PATCH) is not set !");
 		return CHANNEL_EINIT;
@@ -1233,7 +1479,7 @@ channel_op_res_t channel_put_file(channel_t *this, void *data)
 	}
 
 cleanup_header:
-	outdata.memory != NULL ? free(outdata.memory) : (void)0;
+	free_reply_buffer(&outdata);
 	curl_easy_reset(channel_curl->handle);
 	curl_slist_free_all(channel_curl->header);
 	channel_curl->header = NULL;
@@ -1241,6 +1487,409 @@ cleanup_header:
 	return result;
 }
 
+#if defined(CONFIG_PEER_CACHE)
+/*
+ * Ask the peers in turn for the file, each one resumes where the
+ * previous one stopped. A failing peer is not an error: if no peer
+ * delivers the whole file, the origin server is asked to resume after
+ * the bytes got from the peers.
+ *
+ * The peers get a copy of the handle without the credentials meant for
+ * the origin server: the headers (with the auth token), the user and
+ * password and the client certificate. The copy is the handle of the
+ * channel while the peers are asked, so that the response code of a
+ * peer is the one checked, and it replaces the original handle if a
+ * peer delivered the file.
+ */
+static channel_op_res_t channel_get_from_peers(channel_curl_t *channel_curl,
+					       channel_data_t *channel_data,
+					       unsigned long long *total_bytes_downloaded,
+					       bool *done)
+{
+	CURL *origin = channel_curl->handle;
+	CURL *handle;
+#if LIBCURL_VERSION_NUM >= 0x73700
+	curl_off_t bytes_downloaded;
+#else
+	double bytes_downloaded;
+#endif
+	channel_op_res_t result = CHANNEL_OK;
+	CURLcode curlrc;
+	char *url;
+
+	*done = false;
+	handle = curl_easy_duphandle(origin);
+	if (!handle)
+		return CHANNEL_EINIT;
+	if ((curl_easy_setopt(handle, CURLOPT_HTTPHEADER, NULL) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_USERPWD, NULL) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_SSLCERT, NULL) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_SSLKEY, NULL) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT,
+			      PEER_CONNECT_TIMEOUT) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME,
+			      PEER_LOW_SPEED_TIME) != CURLE_OK)) {
+		curl_easy_cleanup(handle);
+		return CHANNEL_EINIT;
+	}
+	channel_curl->handle = handle;
+
+	for (char **peer = channel_data->peers; *peer && !*done; peer++) {
+		url = peer_cache_url(*peer, channel_data->peer_key);
+		if (!url) {
+			result = CHANNEL_ENOMEM;
+			goto out;
+		}
+		if ((curl_easy_setopt(handle, CURLOPT_URL, url) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_RESUME_FROM_LARGE,
+				      (curl_off_t)*total_bytes_downloaded) != CURLE_OK)) {
+			free(url);
+			result = CHANNEL_EINIT;
+			goto out;
+		}
+
+		DEBUG("Trying to GET %s from peer", url);
+		curlrc = curl_easy_perform(handle);
+		if (curl_easy_getinfo(handle,
+#if LIBCURL_VERSION_NUM >= 0x73700
+				      CURLINFO_SIZE_DOWNLOAD_T,
+#else
+				      CURLINFO_SIZE_DOWNLOAD,
+#endif
+				      &bytes_downloaded) == CURLE_OK)
+			*total_bytes_downloaded += bytes_downloaded;
+		if (curlrc == CURLE_OK) {
+			INFO("File downloaded from peer %s", *peer);
+			*done = true;
+		} else if (result_channel_callback_ipc != CHANNEL_OK) {
+			free(url);
+			result = result_channel_callback_ipc;
+			goto out;
+		} else {
+			DEBUG("Peer %s cannot deliver the file (%d): '%s'", *peer,
+			      curlrc, curl_easy_strerror(curlrc));
+		}
+		free(url);
+	}
+	if (*done) {
+		curl_easy_cleanup(origin);
+		return CHANNEL_OK;
+	}
+
+	if (*total_bytes_downloaded)
+		INFO("Got %llu bytes from peers, resuming from origin",
+		     *total_bytes_downloaded);
+	/* the response code of the peer must not be taken for the origin's */
+	channel_data->http_response_code = 0;
+	if (curl_easy_setopt(origin, CURLOPT_RESUME_FROM_LARGE,
+			     (curl_off_t)*total_bytes_downloaded) != CURLE_OK)
+		result = CHANNEL_EINIT;
+
+out:
+	channel_curl->handle = origin;
+	curl_easy_cleanup(handle);
+
+	return result;
+}
+#endif
+
+static size_t mirror_probe_write(char __attribute__ ((__unused__)) *ptr,
+				 size_t size, size_t nmemb, void *data)
+{
+	size_t *bytes = (size_t *)data;
+
+	*bytes += size * nmemb;
+
+	/* a server ignoring the range sends the whole file */
+	return *bytes > MIRROR_PROBE_SIZE ? 0 : size * nmemb;
+}
+
+static int mirror_cmp(const void *a, const void *b)
+{
+	const mirror_stats_t *m1 = (const mirror_stats_t *)a;
+	const mirror_stats_t *m2 = (const mirror_stats_t *)b;
+
+	if (m1->probe_speed != m2->probe_speed)
+		return m1->probe_speed < m2->probe_speed ? 1 : -1;
+	return (int)m1->order - (int)m2->order;
+}
+
+/*
+ * Get the beginning of the file from all mirrors at once, on copies
+ * of the channel's handle, and sort them from the fastest.
+ */
+static void channel_probe_mirrors(channel_curl_t *channel_curl,
+				  mirror_stats_t *mirrors, size_t count)
+{
+	char range[32];
+	CURL **handles;
+	CURLM *multi;
+	CURLMsg *msg;
+	int running, pending;
+
+	snprintf(range, sizeof(range), "0-%d", MIRROR_PROBE_SIZE - 1);
+	multi = curl_multi_init();
+	handles = calloc(count, sizeof(*handles));
+	if (!multi || !handles)
+		goto out;
+
+	for (size_t i = 0; i < count; i++) {
+		CURL *handle = curl_easy_duphandle(channel_curl->handle);
+
+		if (!handle)
+			continue;
+		if ((curl_easy_setopt(handle, CURLOPT_URL, mirrors[i].url) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_RESUME_FROM_LARGE,
+				      (curl_off_t)0) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_RANGE, range) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION,
+				      mirror_probe_write) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_WRITEDATA,
+				      &mirrors[i].probe_bytes) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, NULL) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_HEADERDATA, NULL) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 1L) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT,
+				      MIRROR_PROBE_TIMEOUT) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_TIMEOUT,
+				      MIRROR_PROBE_TIMEOUT) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_PRIVATE, &mirrors[i]) != CURLE_OK) ||
+		    (curl_multi_add_handle(multi, handle) != CURLM_OK)) {
+			curl_easy_cleanup(handle);
+			continue;
+		}
+		handles[i] = handle;
+	}
+
+	do {
+		(void)curl_multi_perform(multi, &running);
+		while ((msg = curl_multi_info_read(multi, &pending))) {
+			mirror_stats_t *mirror = NULL;
+			double time = 0;
+
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			(void)curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE,
+						(char **)&mirror);
+			if (!mirror)
+				continue;
+			(void)curl_easy_getinfo(msg->easy_handle, CURLINFO_TOTAL_TIME, &time);
+			if ((msg->data.result == CURLE_OK ||
+			     mirror->probe_bytes > MIRROR_PROBE_SIZE) && time > 0) {
+				mirror->probe_speed = mirror->probe_bytes / time;
+				DEBUG("Mirror %s: %.0f kB/s", mirror->url,
+				      mirror->probe_speed / 1024);
+			} else {
+				WARN("Mirror %s does not answer (%d): '%s'", mirror->url,
+				     msg->data.result, curl_easy_strerror(msg->data.result));
+			}
+		}
+		if (running)
+			(void)curl_multi_wait(multi, NULL, 0, 1000, NULL);
+	} while (running);
+
+out:
+	for (size_t i = 0; handles && i < count; i++) {
+		if (!handles[i])
+			continue;
+		curl_multi_remove_handle(multi, handles[i]);
+		curl_easy_cleanup(handles[i]);
+	}
+	free(handles);
+	if (multi)
+		curl_multi_cleanup(multi);
+
+	qsort(mirrors, count, sizeof(*mirrors), mirror_cmp);
+}
+
+static void channel_account_mirror(CURL *handle, mirror_stats_t *mirror,
+				   unsigned long long bytes, double blocked,
+				   bool failed)
+{
+	double time = 0;
+
+	(void)curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &time);
+	mirror->bytes += bytes;
+	if (time > blocked)
+		mirror->time += time - blocked;
+	if (failed)
+		mirror->failures++;
+}
+
+static CURLcode mirror_set_progress(CURL *handle, mirror_watch_t *w)
+{
+	CURLcode ret;
+
+#if LIBCURL_VERSION_NUM >= 0x072000
+	if (w) {
+		ret = curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION,
+				       mirror_callback_xferinfo);
+		if (ret == CURLE_OK)
+			ret = curl_easy_setopt(handle, CURLOPT_XFERINFODATA, w);
+	} else {
+		ret = curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION,
+				       channel_callback_xferinfo);
+	}
+#else
+	if (w) {
+		ret = curl_easy_setopt(handle, CURLOPT_PROGRESSFUNCTION,
+				       mirror_callback_xferinfo_legacy);
+		if (ret == CURLE_OK)
+			ret = curl_easy_setopt(handle, CURLOPT_PROGRESSDATA, w);
+	} else {
+		ret = curl_easy_setopt(handle, CURLOPT_PROGRESSFUNCTION,
+				       channel_callback_xferinfo_legacy);
+	}
+#endif
+	return ret;
+}
+
+/*
+ * Get the file from the mirrors, the fastest first. When a mirror fails,
+ * stalls or gets slower than the minimum speed, the next one resumes
+ * where it stopped. The speed is the one of the network: the time the
+ * installer does not take the data is not counted, so that a slow
+ * installer does not make the download switch mirror. The last mirror
+ * has no minimum speed, there is no other one to switch to. If no mirror
+ * delivers the whole file, the handle is set up for the usual retries
+ * on the fastest mirror.
+ */
+static channel_op_res_t channel_get_from_mirrors(channel_curl_t *channel_curl,
+						 channel_data_t *channel_data,
+						 write_callback_t *wrdata,
+						 download_callback_data_t *progress,
+						 mirror_stats_t *mirrors, size_t count,
+						 unsigned long long *total_bytes_downloaded,
+						 bool *done)
+{
+	CURL *handle = channel_curl->handle;
+#if LIBCURL_VERSION_NUM >= 0x73700
+	curl_off_t bytes_downloaded;
+#else
+	double bytes_downloaded;
+#endif
+	CURLcode curlrc;
+	mirror_watch_t watch = { .progress = progress, .wrdata = wrdata };
+
+	channel_probe_mirrors(channel_curl, mirrors, count);
+
+	if ((mirror_set_progress(handle, &watch) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 0L) != CURLE_OK))
+		return CHANNEL_EINIT;
+
+	*done = false;
+	for (size_t i = 0; i < count && !*done; i++) {
+		mirror_stats_t *mirror = &mirrors[i];
+
+		watch.min_speed = channel_data->mirror_min_speed ?
+			(long)channel_data->mirror_min_speed :
+			(long)(mirror->probe_speed / MIRROR_SPEED_DIVISOR);
+		if (i == count - 1)
+			watch.min_speed = 0;
+		else if (watch.min_speed && watch.min_speed < SPEED_LOW_BYTES_SEC)
+			watch.min_speed = SPEED_LOW_BYTES_SEC;
+		watch.start = monotonic_time();
+		watch.blocked = wrdata->blocked;
+		watch.bytes = 0;
+		watch.too_slow = false;
+
+		channel_data->http_response_code = 0;
+		if ((curl_easy_setopt(handle, CURLOPT_URL, mirror->url) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_RESUME_FROM_LARGE,
+				      (curl_off_t)*total_bytes_downloaded) != CURLE_OK))
+			return CHANNEL_EINIT;
+
+		if (watch.min_speed)
+			DEBUG("Trying to GET %s from %llu, at least %ld B/s", mirror->url,
+			      *total_bytes_downloaded, watch.min_speed);
+		else
+			DEBUG("Trying to GET %s from %llu", mirror->url,
+			      *total_bytes_downloaded);
+		curlrc = curl_easy_perform(handle);
+		bytes_downloaded = 0;
+		(void)curl_easy_getinfo(handle,
+#if LIBCURL_VERSION_NUM >= 0x73700
+					CURLINFO_SIZE_DOWNLOAD_T,
+#else
+					CURLINFO_SIZE_DOWNLOAD,
+#endif
+					&bytes_downloaded);
+		*total_bytes_downloaded += bytes_downloaded;
+		channel_account_mirror(handle, mirror, bytes_downloaded,
+				       wrdata->blocked - watch.blocked,
+				       curlrc != CURLE_OK);
+		if (curlrc == CURLE_OK) {
+			*done = true;
+		} else if (result_channel_callback_ipc != CHANNEL_OK) {
+			return result_channel_callback_ipc;
+		} else if (watch.too_slow) {
+			WARN("Mirror %s below %ld B/s after %llu bytes", mirror->url,
+			     watch.min_speed, *total_bytes_downloaded);
+		} else {
+			WARN("Mirror %s failed after %llu bytes (%d): '%s'", mirror->url,
+			     *total_bytes_downloaded, curlrc, curl_easy_strerror(curlrc));
+		}
+	}
+
+	/* back to the usual progress tracking */
+	if (progress) {
+		if ((mirror_set_progress(handle, NULL) != CURLE_OK) ||
+		    (curl_easy_setopt(handle, CURLOPT_XFERINFODATA, progress) != CURLE_OK))
+			return CHANNEL_EINIT;
+	} else if (curl_easy_setopt(handle, CURLOPT_NOPROGRESS, 1L) != CURLE_OK) {
+		return CHANNEL_EINIT;
+	}
+	if (*done)
+		return CHANNEL_OK;
+
+	channel_data->http_response_code = 0;
+	if ((curl_easy_setopt(handle, CURLOPT_URL, mirrors[0].url) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_FAILONERROR, 0L) != CURLE_OK) ||
+	    (curl_easy_setopt(handle, CURLOPT_RESUME_FROM_LARGE,
+			      (curl_off_t)*total_bytes_downloaded) != CURLE_OK))
+		return CHANNEL_EINIT;
+
+	return CHANNEL_OK;
+}
+
+/*
+ * Log the statistics of the mirrors and send them to the progress
+ * interface, as many as the notification can take.
+ */
+static void channel_report_mirrors(mirror_stats_t *mirrors, size_t count)
+{
+	char buf[NOTIFY_BUF_SIZE - 32];
+	size_t len;
+	int n;
+
+	len = snprintf(buf, sizeof(buf), "{ \"mirrors\" : [");
+	for (size_t i = 0; i < count; i++) {
+		mirror_stats_t *m = &mirrors[i];
+		double speed = m->time > 0 ? m->bytes / m->time : 0;
+
+		INFO("Mirror %s: probe %.0f kB/s, %llu bytes in %.1f s (%.0f kB/s), %u failures",
+		     m->url, m->probe_speed / 1024, m->bytes, m->time,
+		     speed / 1024, m->failures);
+
+		n = snprintf(buf + len, sizeof(buf) - len,
+			     "%s { \"url\" : \"%s\", \"probe\" : %.0f, \"bytes\" : %llu, "
+			     "\"time\" : %.1f, \"speed\" : %.0f, \"failures\" : %u }",
+			     i ? "," : "", m->url, m->probe_speed, m->bytes, m->time,
+			     speed, m->failures);
+		/* the closing brackets must fit too */
+		if (n < 0 || (size_t)n + 4 >= sizeof(buf) - len) {
+			buf[len] = '\0';
+			break;
+		}
+		len += n;
+	}
+	snprintf(buf + len, sizeof(buf) - len, " ] }");
+	notify(SUBPROCESS, MIRRORS, DEBUGLEVEL, buf);
+}
+
 channel_op_res_t channel_get_file(channel_t *this, void *data)
 {
 	channel_curl_t *channel_curl = this->priv;
@@ -1251,6 +1900,8 @@ channel_op_res_t channel_get_file(channel_t *this, void *data)
 
 	channel_op_res_t result = CHANNEL_OK;
 	channel_data_t *channel_data = (channel_data_t *)data;
+	mirror_stats_t *mirrors = NULL;
+	size_t nmirrors = 0;
 	channel_data->http_response_code = 0;
 
 	if (channel_data->usessl) {
@@ -1289,6 +1940,7 @@ channel_op_res_t channel_get_file(channel_t *this, void *data)
 	}
 
 	download_callback_data_t download_data;
+	bool progress = false;
 	download_data.source = channel_data->source;
 
 	/*
@@ -1300,9 +1952,11 @@ channel_op_res_t channel_get_file(channel_t *this, void *data)
 								&download_data) == CHANNEL_EINIT) {
 			WARN("Failed to get total download size for URL %s.",
 				channel_data->url);
-	} else
+	} else {
 		INFO("Total download size is %" CURL_FORMAT_CURL_OFF_TU " kB.",
 			download_data.total_download_size / 1024);
+		progress = true;
+	}
 
 	}
 
@@ -1359,6 +2013,11 @@ channel_op_res_t channel_get_file(channel_t *this, void *data)
 	unsigned char try_count = 0;
 	CURLcode curlrc = CURLE_OK;
 
+	/* Tee the file into the peer cache, the cached file included */
+	if (!channel_data->range)
+		wrdata.peer_cache = peer_cache_start(channel_data->peer_cache,
+						     channel_data->peer_key);
+
 	if (channel_data->cached_file) {
 
 		total_bytes_downloaded = resume_cache_file(channel_data->cached_file,
@@ -1376,6 +2035,47 @@ channel_op_res_t channel_get_file(channel_t *this, void *data)
 		}
 	}
 
+#if defined(CONFIG_PEER_CACHE)
+	if (channel_data->peers && channel_data->peers[0] && !channel_data->range) {
+		bool done;
+
+		if (!peer_cache_valid_key(channel_data->peer_key)) {
+			DEBUG("SHA-256 of the file unknown, peers are not asked");
+		} else {
+			result = channel_get_from_peers(channel_curl, channel_data,
+							&total_bytes_downloaded, &done);
+			if (result != CHANNEL_OK)
+				goto cleanup_file;
+			if (done)
+				goto transfer_done;
+		}
+	}
+#endif
+
+	/* the URL is the first mirror */
+	if (channel_data->mirrors && channel_data->mirrors[0] && !channel_data->range) {
+		bool done;
+
+		nmirrors = count_string_array((const char **)channel_data->mirrors) + 1;
+		mirrors = calloc(nmirrors, sizeof(*mirrors));
+		if (!mirrors) {
+			result = CHANNEL_ENOMEM;
+			goto cleanup_file;
+		}
+		for (size_t i = 0; i < nmirrors; i++) {
+			mirrors[i].url = i ? channel_data->mirrors[i - 1] : channel_data->url;
+			mirrors[i].order = i;
+		}
+		result = channel_get_from_mirrors(channel_curl, channel_data, &wrdata,
+						  progress ? &download_data : NULL,
+						  mirrors, nmirrors,
+						  &total_bytes_downloaded, &done);
+		if (result != CHANNEL_OK)
+			goto cleanup_file;
+		if (done)
+			goto transfer_done;
+	}
+
 	/*
 	 * If there is a cache file, read data from cache first
 	 * and load from URL the remaining data
@@ -1420,6 +2120,8 @@ channel_op_res_t channel_get_file(channel_t *this, void *data)
 			TRACE("Channel awakened from sleep.");
 		}
 
+		double blocked = wrdata.blocked;
+
 		curlrc = curl_easy_perform(channel_curl->handle);
 		result = channel_map_curl_error(curlrc);
 		if (result == CHANNEL_ENONET) {
@@ -1454,9 +2156,14 @@ channel_op_res_t channel_get_file(channel_t *this, void *data)
 			goto cleanup_file;
 		}
 		total_bytes_downloaded += bytes_downloaded;
+		if (mirrors)
+			channel_account_mirror(channel_curl->handle, &mirrors[0],
+					       bytes_downloaded, wrdata.blocked - blocked,
+					       result != CHANNEL_OK);
 
 	} while (++try_count && (result != CHANNEL_OK));
 
+transfer_done:
 	channel_log_effective_url(this);
 
 	DEBUG("Channel downloaded %llu bytes ~ %llu MiB.",
@@ -1488,6 +2195,11 @@ channel_op_res_t channel_get_file(channel_t *this, void *data)
 	}
 
 cleanup_file:
+	peer_cache_finish(wrdata.peer_cache, result == CHANNEL_OK);
+	if (mirrors) {
+		channel_report_mirrors(mirrors, nmirrors);
+		free(mirrors);
+	}
 	/* NOTE ipc_end() calls close() but does not return its error code,
 	 *      so use close() here directly to issue an error in case.
 	 *      Also, for a given file handle, calling ipc_end() would make
@@ -1510,67 +2222,5 @@ cleanup_header:
 
 channel_op_res_t channel_get(channel_t *this, void *data)
 {
-	channel_curl_t *channel_curl = this->priv;
-	assert(data != NULL);
-	assert(channel_curl->handle != NULL);
-
-	channel_op_res_t result = CHANNEL_OK;
-	channel_data_t *channel_data = (channel_data_t *)data;
-	channel_data->http_response_code = 0;
-	output_data_t outdata = {};
-	write_callback_t wrdata = { .this = this, .channel_data = channel_data, .outdata = &outdata };
-
-	if ((result = channel_set_content_type(this, channel_data)) !=
-	    CHANNEL_OK) {
-		ERROR("Set content-type option failed.");
-		goto cleanup_header;
-	}
-
-	if ((result = channel_set_options(this, channel_data)) != CHANNEL_OK) {
-		ERROR("Set channel option failed.");
-		goto cleanup_header;
-	}
-
-	if (curl_easy_setopt(channel_curl->handle, CURLOPT_CUSTOMREQUEST, "GET") !=
-	    CURLE_OK) {
-		ERROR("Set GET channel method option failed.");
-		result = CHANNEL_EINIT;
-		goto cleanup_header;
-	}
-
-	if ((result = setup_reply_buffer(channel_curl->handle, &wrdata)) != CHANNEL_OK) {
-		goto cleanup_header;
-	}
-
-	if (channel_data->debug) {
-		DEBUG("Trying to GET %s", channel_data->url);
-	}
-	CURLcode curlrc = curl_easy_perform(channel_curl->handle);
-	if (curlrc != CURLE_OK) {
-		ERROR("Channel get operation failed (%d): '%s'", curlrc,
-		      curl_easy_strerror(curlrc));
-		result = channel_map_curl_error(curlrc);
-		goto cleanup_header;
-	}
-
-	channel_log_effective_url(this);
-
-	result = channel_map_http_code(this, &channel_data->http_response_code);
-
-	if (channel_data->nocheckanswer)
-		goto cleanup_header;
-
-	channel_log_reply(result, channel_data, &outdata);
-
-	if (result == CHANNEL_OK) {
-	    result = parse_reply(channel_data, &outdata);
-	}
-
-cleanup_header:
-	outdata.memory != NULL ? free(outdata.memory) : (void)0;
-	curl_easy_reset(channel_curl->handle);
-	curl_slist_free_all(channel_curl->header);
-	channel_curl->header = NULL;
-
-	return result;
+	return channel_do_method(this, data, CHANNEL_GET);
 }
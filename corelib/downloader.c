@@ -36,6 +36,8 @@ static struct option long_options[] = {
     {"retrywait", required_argument, NULL, 'w'},
     {"timeout", required_argument, NULL, 't'},
     {"authentication", required_argument, NULL, 'a'},
+    {"sha256", required_argument, NULL, 's'},
+    {"mirrors", required_argument, NULL, 'm'},
     {NULL, 0, NULL, 0}};
 
 static channel_data_t channel_options = {
@@ -112,6 +114,28 @@ static int download_settings(void *elem, void  __attribute__ ((__unused__)) *dat
 		&opt->retry_sleep);
 	get_field(LIBCFG_PARSER, elem, "timeout",
 		&opt->low_speed_timeout);
+	get_field(LIBCFG_PARSER, elem, "mirror-min-speed",
+		&opt->mirror_min_speed);
+
+	char mirrors[SWUPDATE_GENERAL_STRING_SIZE * 4];
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "mirrors", mirrors);
+	if (strlen(mirrors)) {
+		free_string_array(opt->mirrors);
+		opt->mirrors = string_split(mirrors, ',');
+	}
+
+#if defined(CONFIG_PEER_CACHE)
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "peer-cache", tmp);
+	if (strlen(tmp)) {
+		SETSTRING(opt->peer_cache, tmp);
+	}
+	char peers[SWUPDATE_GENERAL_STRING_SIZE * 4];
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "peers", peers);
+	if (strlen(peers)) {
+		free_string_array(opt->peers);
+		opt->peers = string_split(peers, ',');
+	}
+#endif
 
 	return 0;
 }
@@ -155,6 +179,24 @@ static server_op_res_t download_server_ipc(int fd)
 			 */
 			channel_options.auth = strdup(json_object_get_string(json_data));
 		}
+
+		/*
+		 * SHA-256 of the SWU, to get it from peers
+		 */
+		json_data = json_get_path_key(json_root, (const char *[]){"sha256", NULL});
+		if (json_data) {
+			channel_options.peer_key = strdup(json_object_get_string(json_data));
+		}
+
+		/*
+		 * Other URLs of the same SWU, comma separated
+		 */
+		free_string_array(channel_options.mirrors);
+		channel_options.mirrors = NULL;
+		json_data = json_get_path_key(json_root, (const char *[]){"mirrors", NULL});
+		if (json_data) {
+			channel_options.mirrors = string_split(json_object_get_string(json_data), ',');
+		}
 		break;
 	default:
 		result = SERVER_EERR;
@@ -183,8 +225,12 @@ static server_op_res_t download_server_ipc(int fd)
 		if (channel_options.auth != NULL) {
 			free(channel_options.auth);
 		}
+		free(channel_options.peer_key);
+		free_string_array(channel_options.mirrors);
 		channel_options.url = NULL;
 		channel_options.auth = NULL;
+		channel_options.peer_key = NULL;
+		channel_options.mirrors = NULL;
 
 		result = update_result == SUCCESS ? SERVER_OK : SERVER_EERR;
 	}
@@ -202,7 +248,10 @@ void download_print_help(void)
 	    "\t                         is broken (0 means indefinitely retries) (default: %d)\n"
 	    "\t  -w, --retrywait      timeout to wait before retrying retries (default: %d)\n"
 	    "\t  -t, --timeout          timeout to check if a connection is lost (default: %d)\n"
-	    "\t  -a, --authentication   authentication information as username:password\n",
+	    "\t  -a, --authentication   authentication information as username:password\n"
+	    "\t  -s, --sha256           SHA-256 of the .swu, peers are asked for it first\n"
+	    "\t  -m, --mirrors          other URLs of the .swu, comma separated, the fastest\n"
+	    "\t                         is taken and the others are kept as fallback\n",
 	    DL_DEFAULT_RETRIES, DL_LOWSPEED_TIME, CHANNEL_DEFAULT_RESUME_DELAY);
 }
 
@@ -220,7 +269,7 @@ int start_download_server(const char *fname, int argc, char *argv[])
 	/* reset to optind=1 to parse download's argument vector */
 	optind = 1;
 	int choice = 0;
-	while ((choice = getopt_long(argc, argv, "t:u:w:r:a:",
+	while ((choice = getopt_long(argc, argv, "t:u:w:r:a:s:m:",
 				     long_options, NULL)) != -1) {
 		switch (choice) {
 		case 't':
@@ -238,6 +287,13 @@ int start_download_server(const char *fname, int argc, char *argv[])
 		case 'r':
 			channel_options.retries = strtoul(optarg, NULL, 10);
 			break;
+		case 's':
+			SETSTRING(channel_options.peer_key, optarg);
+			break;
+		case 'm':
+			free_string_array(channel_options.mirrors);
+			channel_options.mirrors = string_split(optarg, ',');
+			break;
 		case '?':
 		default:
 			return -EINVAL;
@@ -52,6 +52,7 @@ static void fill_switch_cmd(struct mmc_ioc_cmd *cmd, __u8 index, __u8 value)
 	cmd->flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
 }
 
+#ifndef MMC_IOC_MULTI_CMD
 static int emmc_write_extcsd_value(int fd, __u8 index, __u8 value, unsigned int timeout_ms)
 {
 	int ret = 0;
@@ -67,7 +68,8 @@ static int emmc_write_extcsd_value(int fd, __u8 index, __u8 value, unsigned int
 		ERROR("eMMC ioctl return error %d", ret);
 
 	return ret;
-} /* end of imported code */
+}
+#endif /* end of imported code */
 
 int emmc_get_active_bootpart(int fd)
 {
@@ -89,22 +91,124 @@ int emmc_get_active_bootpart(int fd)
 	return active;
 }
 
-int emmc_write_bootpart(int fd, int bootpart)
+/*
+ * Send all EXT_CSD changes in one MMC_IOC_MULTI_CMD, followed by
+ * a SEND_STATUS to check that the switches were accepted. Changes
+ * are then applied without other requests in between.
+ */
+int emmc_write_extcsd_values(int fd, const struct emmc_extcsd_value *values,
+			     unsigned int n)
 {
-	uint8_t value;
+#ifdef MMC_IOC_MULTI_CMD
+	struct mmc_ioc_multi_cmd *multi;
+	struct mmc_ioc_cmd *status;
+	unsigned int i;
 	int ret;
-	uint8_t extcsd[512];
 
+	multi = calloc(1, sizeof(*multi) + (n + 1) * sizeof(struct mmc_ioc_cmd));
+	if (!multi)
+		return -ENOMEM;
+
+	multi->num_of_cmds = n + 1;
+	for (i = 0; i < n; i++)
+		fill_switch_cmd(&multi->cmds[i], values[i].index, values[i].value);
+
+	/* RCA is always 1 for eMMC */
+	status = &multi->cmds[n];
+	status->opcode = MMC_SEND_STATUS;
+	status->arg = 1 << 16;
+	status->flags = MMC_RSP_SPI_R2 | MMC_RSP_R1 | MMC_CMD_AC;
+
+	ret = ioctl(fd, MMC_IOC_MULTI_CMD, multi);
+	if (ret)
+		ERROR("eMMC ioctl return error %d", ret);
+	else if (status->response[0] & R1_SWITCH_ERROR) {
+		ERROR("eMMC rejected EXT_CSD switch, status 0x%08x",
+		      status->response[0]);
+		ret = -EIO;
+	}
+
+	free(multi);
+	return ret;
+#else
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < n && !ret; i++)
+		ret = emmc_write_extcsd_value(fd, values[i].index, values[i].value, 0);
+
+	return ret;
+#endif
+}
+
+static uint8_t emmc_bootpart_config(uint8_t part_config, int bootpart)
+{
 	/*
 	 * Do not clear BOOT_ACK
 	 */
+	return (part_config & (1 << 6)) | (((bootpart + 1) & 0x3) << 3);
+}
+
+int emmc_write_bootpart(int fd, int bootpart)
+{
+	struct emmc_extcsd_value v = { .index = EXT_CSD_PART_CONFIG };
+	int ret;
+	uint8_t extcsd[512];
+
 	ret = emmc_read_extcsd(fd, extcsd);
-	value = extcsd[EXT_CSD_PART_CONFIG] & (1 << 6);
+	if (ret)
+		return ret;
 
-	bootpart = ((bootpart + 1) & 0x3) << 3;
-	value |= bootpart;
+	v.value = emmc_bootpart_config(extcsd[EXT_CSD_PART_CONFIG], bootpart);
 
-	ret = emmc_write_extcsd_value(fd, EXT_CSD_PART_CONFIG, value, 0);
+	return emmc_write_extcsd_values(fd, &v, 1);
+}
 
-	return ret;
+/*
+ * Switch to the other boot partition with a single EXT_CSD read.
+ * Returns the new active boot partition, the unchanged active one
+ * if it is not a HW boot partition, or a negative value on error.
+ */
+int emmc_toggle_bootpart(int fd)
+{
+	struct emmc_extcsd_value v = { .index = EXT_CSD_PART_CONFIG };
+	uint8_t extcsd[512];
+	int active;
+
+	if (emmc_read_extcsd(fd, extcsd))
+		return -EIO;
+
+	active = ((extcsd[EXT_CSD_PART_CONFIG] & 0x38) >> 3) - 1;
+	if (active < 0 || active > 1)
+		return active;
+
+	active = (active == 0) ? 1 : 0;
+	v.value = emmc_bootpart_config(extcsd[EXT_CSD_PART_CONFIG], active);
+
+	return emmc_write_extcsd_values(fd, &v, 1) ? -EIO : active;
+}
+
+/*
+ * Return the size in bytes the eMMC prefers writes to be
+ * aligned to, that is the high capacity erase group or the
+ * optimal write size if it is larger, or a negative value
+ * if it cannot be retrieved
+ */
+long emmc_get_write_unit(int fd)
+{
+	uint8_t extcsd[512];
+	long unit = -1;
+
+	if (emmc_read_extcsd(fd, extcsd))
+		return -EIO;
+
+	/* 512 KiB units, valid if ERASE_GROUP_DEF is set */
+	if (extcsd[EXT_CSD_ERASE_GROUP_DEF] & 0x1)
+		unit = extcsd[EXT_CSD_HC_ERASE_GRP_SIZE] * 512 * 1024L;
+
+	/* 4 KiB units, since eMMC 5.0 */
+	if (extcsd[EXT_CSD_REV] >= 7)
+		unit = max(unit, extcsd[EXT_CSD_OPTIMAL_WRITE_SIZE] * 4096L);
+
+	return unit > 0 ? unit : -EINVAL;
 }
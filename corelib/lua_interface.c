@@ -432,23 +432,171 @@ copyfile_exit:
 	return 2;
 }
 
-static int istream_read_callback(void *out, const void *buf, size_t len)
+#define LUA_BUFFER_MT		"swupdate.buffer"
+#define LUA_BUFFER_CHUNK_MIN	(4 * 1024)
+#define LUA_BUFFER_CHUNK_MAX	(16 * 1024 * 1024)
+
+/*
+ * Byte buffer handed to image:read() callbacks when a chunk size is
+ * passed: the same userdata is refilled for every chunk, so no Lua
+ * string is created unless the callback asks for one.
+ */
+struct lua_buffer {
+	size_t size;
+	size_t len;
+	unsigned char data[];
+};
+
+struct istream_read_ctx {
+	lua_State *L;
+	struct lua_buffer *buf;	/* NULL: chunks are passed as strings */
+};
+
+static struct lua_buffer *check_buffer(lua_State *L)
 {
-	lua_State* L = (lua_State*)out;
-	if (len > LUAL_BUFFERSIZE) {
-		ERROR("I/O buffer size is larger than Lua's buffer size %d", LUAL_BUFFERSIZE);
-		return -1;
+	return (struct lua_buffer *)luaL_checkudata(L, 1, LUA_BUFFER_MT);
+}
+
+/*
+ * Convert the optional arguments i, j at index into a range,
+ * with the same rules as string.sub()
+ */
+static void buffer_range(lua_State *L, struct lua_buffer *b, int index,
+			 size_t *start, size_t *end)
+{
+	lua_Integer len = (lua_Integer)b->len;
+	lua_Integer i = luaL_optinteger(L, index, 1);
+	lua_Integer j = luaL_optinteger(L, index + 1, -1);
+
+	if (i < 0)
+		i = len + i + 1;
+	if (j < 0)
+		j = len + j + 1;
+	if (i < 1)
+		i = 1;
+	if (j > len)
+		j = len;
+
+	*start = (size_t)i - 1;
+	*end = (i > j) ? *start : (size_t)j;
+}
+
+static int l_buffer_len(lua_State *L)
+{
+	lua_pushinteger(L, (lua_Integer)check_buffer(L)->len);
+	return 1;
+}
+
+static int l_buffer_tostring(lua_State *L)
+{
+	struct lua_buffer *b = check_buffer(L);
+
+	lua_pushlstring(L, (const char *)b->data, b->len);
+	return 1;
+}
+
+static int l_buffer_sub(lua_State *L)
+{
+	struct lua_buffer *b = check_buffer(L);
+	size_t start, end;
+
+	buffer_range(L, b, 2, &start, &end);
+	lua_pushlstring(L, (const char *)b->data + start, end - start);
+	return 1;
+}
+
+static int l_buffer_byte(lua_State *L)
+{
+	struct lua_buffer *b = check_buffer(L);
+	lua_Integer i = luaL_optinteger(L, 2, 1);
+	lua_Integer j = luaL_optinteger(L, 3, i);
+	size_t start, end;
+
+	/* as string.byte(), j defaults to i */
+	lua_settop(L, 1);
+	lua_pushinteger(L, i);
+	lua_pushinteger(L, j);
+	buffer_range(L, b, 2, &start, &end);
+	luaL_checkstack(L, (int)(end - start), "buffer slice too long");
+	for (size_t k = start; k < end; k++)
+		lua_pushinteger(L, b->data[k]);
+	return (int)(end - start);
+}
+
+/*
+ * buffer:write(f [, i [, j]]): write (a slice of) the buffer to a
+ * file descriptor number or to a Lua file handle, without going
+ * through a Lua string
+ */
+static int l_buffer_write(lua_State *L)
+{
+	struct lua_buffer *b = check_buffer(L);
+	size_t start, end;
+	ssize_t ret;
+	int fd;
+
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		fd = (int)lua_tointeger(L, 2);
+	} else {
+		luaL_Stream *lstream = (luaL_Stream *)luaL_checkudata(L, 2, LUA_FILEHANDLE);
+		if (!lstream->f)
+			return luaL_error(L, "attempt to use a closed file");
+		/* keep the order of data buffered by Lua's file:write() */
+		fflush(lstream->f);
+		fd = fileno(lstream->f);
+	}
+
+	buffer_range(L, b, 3, &start, &end);
+	while (start < end) {
+		ret = write(fd, b->data + start, end - start);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			lua_pushnil(L);
+			lua_pushstring(L, strerror(errno));
+			return 2;
+		}
+		start += ret;
+	}
+
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static const luaL_Reg l_buffer_methods[] = {
+	{ "len", l_buffer_len },
+	{ "sub", l_buffer_sub },
+	{ "byte", l_buffer_byte },
+	{ "write", l_buffer_write },
+	{ "tostring", l_buffer_tostring },
+	{ NULL, NULL }
+};
+
+static void register_buffer_type(lua_State *L)
+{
+	if (!luaL_newmetatable(L, LUA_BUFFER_MT)) {
+		lua_pop(L, 1);
+		return;
 	}
+	lua_newtable(L);
+	luaL_setfuncs(L, l_buffer_methods, 0);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, l_buffer_len);
+	lua_setfield(L, -2, "__len");
+	lua_pushcfunction(L, l_buffer_tostring);
+	lua_setfield(L, -2, "__tostring");
+	lua_pop(L, 1);
+}
 
+static int istream_call(lua_State *L, bool buffer)
+{
 	luaL_checktype(L, 2, LUA_TFUNCTION);
 	lua_pushvalue(L, 2);
+	if (buffer)
+		lua_pushvalue(L, 3);
+	else
+		lua_insert(L, -2);
 
-	luaL_Buffer lbuffer;
-	luaL_buffinit(L, &lbuffer);
-	char *buffer = luaL_prepbuffsize(&lbuffer, len);
-	memcpy(buffer, buf, len);
-	luaL_addsize(&lbuffer, len);
-	luaL_pushresult(&lbuffer);
 	if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
 		ERROR("Lua error in callback: %s", lua_tostring(L, -1));
 		lua_pop(L, 1);
@@ -457,20 +605,63 @@ static int istream_read_callback(void *out, const void *buf, size_t len)
 	return 0;
 }
 
+static int istream_read_callback(void *out, const void *buf, size_t len)
+{
+	struct istream_read_ctx *ctx = (struct istream_read_ctx *)out;
+	struct lua_buffer *b = ctx->buf;
+	const unsigned char *data = buf;
+	size_t n;
+
+	if (!b) {
+		lua_pushlstring(ctx->L, (const char *)buf, len);
+		return istream_call(ctx->L, false);
+	}
+
+	while (len) {
+		n = min(len, b->size - b->len);
+		memcpy(b->data + b->len, data, n);
+		b->len += n;
+		data += n;
+		len -= n;
+		if (b->len == b->size) {
+			if (istream_call(ctx->L, true))
+				return -1;
+			b->len = 0;
+		}
+	}
+	return 0;
+}
+
 static int l_istream_read(lua_State* L)
 {
 	luaL_checktype(L, 1, LUA_TTABLE);
 	luaL_checktype(L, 2, LUA_TFUNCTION);
 
 	struct img_type img = {};
+	struct istream_read_ctx ctx = { .L = L };
 	uint32_t checksum = 0;
+	lua_Integer chunk = luaL_optinteger(L, 3, 0);
+
+	lua_settop(L, 2);
+	if (chunk > 0) {
+		if (chunk < LUA_BUFFER_CHUNK_MIN)
+			chunk = LUA_BUFFER_CHUNK_MIN;
+		if (chunk > LUA_BUFFER_CHUNK_MAX)
+			chunk = LUA_BUFFER_CHUNK_MAX;
+		ctx.buf = (struct lua_buffer *)lua_newuserdata(L,
+				sizeof(struct lua_buffer) + chunk);
+		ctx.buf->size = chunk;
+		ctx.buf->len = 0;
+		luaL_getmetatable(L, LUA_BUFFER_MT);
+		lua_setmetatable(L, -2);
+	}
 
 	lua_pushvalue(L, 1);
 	table2image(L, &img);
 	lua_pop(L, 1);
 
 	int ret = copyfile(img.fdin,
-				 L,
+				 &ctx,
 				 img.size,
 				 (unsigned long *)&img.offset,
 				 img.seek,
@@ -482,7 +673,16 @@ static int l_istream_read(lua_State* L)
 				 img.ivt_ascii,
 				 istream_read_callback);
 
-	lua_pop(L, 1);
+	/* hand out the last partial chunk */
+	if (ret >= 0 && ctx.buf && ctx.buf->len) {
+		if (istream_call(L, true))
+			ret = -1;
+	}
+	/* the buffer is no longer valid outside of the callback */
+	if (ctx.buf)
+		ctx.buf->len = 0;
+
+	lua_settop(L, 1);
 	update_table(L, &img);
 	lua_pop(L, 1);
 
@@ -1272,6 +1472,7 @@ static int luaopen_swupdate(lua_State *L)
 	if (is_type(L, LUA_TYPE_HANDLER)) {
 		/* register handler-specific functions to swupdate module table. */
 		luaL_setfuncs(L, l_swupdate_handler, 0);
+		register_buffer_type(L);
 
 		/* export the handler mask enum */
 		lua_pushstring(L, "HANDLER_MASK");
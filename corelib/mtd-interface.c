@@ -16,9 +16,11 @@
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include "bsdqueue.h"
 #include "util.h"
 #include "flash.h"
+#include "swupdate_image.h"
 
 static char mtd_ubi_blacklist[100] = { 0 };
 
@@ -28,7 +30,49 @@ static char mtd_ubi_blacklist[100] = { 0 };
  */
 #define EMPTY_BYTE	0xFF
 
-int flash_erase_sector(int mtdnum, off_t start, size_t size)
+/*
+ * Speculative erase: MTD regions that are going to be fully
+ * rewritten are erased by a background thread while the SWU
+ * is still streaming. Jobs are served in the order of the images
+ * in sw-description, that is the order the handlers need them.
+ */
+struct preerase_job {
+	int mtdnum;
+	off_t start;
+	size_t size;
+	int ret;
+	bool done;
+	bool used;
+	SIMPLEQ_ENTRY(preerase_job) next;
+};
+
+SIMPLEQ_HEAD(preerase_list, preerase_job);
+
+static struct {
+	struct preerase_list jobs;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	bool stop;
+} preerase = {
+	.jobs = SIMPLEQ_HEAD_INITIALIZER(preerase.jobs),
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static bool preerase_cancelled(void)
+{
+	bool stop;
+
+	pthread_mutex_lock(&preerase.lock);
+	stop = preerase.stop;
+	pthread_mutex_unlock(&preerase.lock);
+
+	return stop;
+}
+
+static int erase_sectors(int mtdnum, off_t start, size_t size, bool background)
 {
 	int fd;
 	char mtd_device[80];
@@ -75,6 +119,11 @@ int flash_erase_sector(int mtdnum, off_t start, size_t size)
 
 	for (eb = eb_start; eb < eb_end; eb++) {
 
+		if (background && preerase_cancelled()) {
+			ret = -EINTR;
+			goto erase_out;
+		}
+
 		/* Always skip bad sectors */
 		if (!noskipbad) {
 			int isbad = mtd_is_bad(mtd, fd, eb);
@@ -146,6 +195,209 @@ erase_out:
 	return ret;
 }
 
+/*
+ * Check if the start of the region was already scheduled for a
+ * background erase and wait for the part of it still outstanding.
+ * Returns how many bytes from start are erased, a negative value
+ * if the caller must erase the whole region itself.
+ */
+static long long preerase_wait(int mtdnum, off_t start)
+{
+	struct preerase_job *job;
+	long long ret = -ENOENT;
+
+	pthread_mutex_lock(&preerase.lock);
+	SIMPLEQ_FOREACH(job, &preerase.jobs, next) {
+		if (job->used || job->mtdnum != mtdnum)
+			continue;
+		if (start < job->start ||
+		    start >= job->start + (off_t)job->size)
+			continue;
+
+		if (!job->done)
+			TRACE("Waiting for background erase of /dev/mtd%d", mtdnum);
+		while (!job->done)
+			pthread_cond_wait(&preerase.cond, &preerase.lock);
+
+		/*
+		 * A region is handed out once: a second image targeting it
+		 * may find data written by the first one.
+		 */
+		job->used = true;
+		if (!job->ret)
+			ret = job->start + job->size - start;
+		break;
+	}
+	pthread_mutex_unlock(&preerase.lock);
+
+	return ret;
+}
+
+int flash_erase_sector(int mtdnum, off_t start, size_t size)
+{
+	struct flash_description *flash = get_flash_info();
+	struct mtd_dev_info *mtd;
+	long long erased;
+
+	if (!SIMPLEQ_EMPTY(&preerase.jobs) &&
+	    mtd_dev_present(flash->libmtd, mtdnum)) {
+		mtd = &flash->mtd_info[mtdnum].mtd;
+		if (start < mtd->size && mtd->eb_size) {
+			if (!size || start + size > mtd->size)
+				size = mtd->size - start;
+			erased = preerase_wait(mtdnum, start);
+			if (erased > 0) {
+				/* the job erased whole blocks */
+				erased = start + erased;
+				if (erased % mtd->eb_size)
+					erased += mtd->eb_size - erased % mtd->eb_size;
+				if (erased >= (long long)(start + size))
+					return 0;
+				/* only the rest of the region is left */
+				TRACE("Erasing /dev/mtd%d from %lld, before was erased in background",
+				      mtdnum, erased);
+				size = start + size - erased;
+				start = erased;
+			}
+		}
+	}
+
+	return erase_sectors(mtdnum, start, size, false);
+}
+
+static void *preerase_thread(void __attribute__ ((__unused__)) *data)
+{
+	struct preerase_job *job;
+	int ret;
+
+	/*
+	 * The list is not changed until the thread is joined,
+	 * just the state of each job is protected by the lock.
+	 */
+	SIMPLEQ_FOREACH(job, &preerase.jobs, next) {
+		if (preerase_cancelled())
+			ret = -EINTR;
+		else
+			ret = erase_sectors(job->mtdnum, job->start, job->size, true);
+
+		if (ret && ret != -EINTR)
+			WARN("Background erase of /dev/mtd%d failed, erase will be retried",
+			     job->mtdnum);
+
+		pthread_mutex_lock(&preerase.lock);
+		job->ret = ret;
+		job->done = true;
+		pthread_cond_broadcast(&preerase.cond);
+		pthread_mutex_unlock(&preerase.lock);
+	}
+
+	return NULL;
+}
+
+int flash_preerase_start(struct imglist *images)
+{
+	struct flash_description *flash = get_flash_info();
+	struct mtd_dev_info *mtd;
+	struct preerase_job *job;
+	struct img_type *img;
+	long long size;
+	char *value;
+	int mtdnum, count = 0;
+
+	if (preerase.running || !flash->libmtd)
+		return 0;
+
+	LIST_FOREACH(img, images, next) {
+		if (strcmp(img->type, "flash") ||
+		    !strtobool(dict_get_value(&img->properties, "preerase")))
+			continue;
+
+		if (strlen(img->mtdname))
+			mtdnum = get_mtd_from_name(img->mtdname);
+		else
+			mtdnum = get_mtd_from_device(img->device);
+		if (mtdnum < 0 || !mtd_dev_present(flash->libmtd, mtdnum)) {
+			WARN("Cannot pre-erase %s: MTD not found", img->fname);
+			continue;
+		}
+		mtd = &flash->mtd_info[mtdnum].mtd;
+		if (img->seek >= mtd->size)
+			continue;
+
+		/*
+		 * Erase the same region as the handler: for compressed or
+		 * encrypted images it is known from the properties, and
+		 * without them the handler erases up to the end of the MTD.
+		 * The size of other images is not yet known when
+		 * sw-description is parsed and must be given, if the image
+		 * turns out to be larger the handler erases the rest.
+		 */
+		value = dict_get_value(&img->properties,
+				       img->compressed ? "decompressed-size" :
+				       img->is_encrypted ? "decrypted-size" : "preerase-size");
+		if (value)
+			size = ustrtoull(value, NULL, 0);
+		else if (img->compressed || img->is_encrypted)
+			size = mtd->size - img->seek;
+		else if (img->size > 0)
+			size = img->size;
+		else
+			size = 0;
+		if (size <= 0) {
+			WARN("Cannot pre-erase %s: size unknown, set preerase-size",
+			     img->fname);
+			continue;
+		}
+		if (img->seek + size > mtd->size)
+			size = mtd->size - img->seek;
+
+		job = calloc(1, sizeof(*job));
+		if (!job) {
+			ERROR("OOM scheduling pre-erase");
+			break;
+		}
+		job->mtdnum = mtdnum;
+		job->start = img->seek;
+		job->size = size;
+		SIMPLEQ_INSERT_TAIL(&preerase.jobs, job, next);
+		TRACE("Pre-erase of /dev/mtd%d scheduled (start: %lld, size: %lld) for %s",
+		      mtdnum, (long long)img->seek, size, img->fname);
+		count++;
+	}
+
+	if (!count)
+		return 0;
+
+	preerase.stop = false;
+	if (pthread_create(&preerase.thread, NULL, preerase_thread, NULL)) {
+		ERROR("Cannot start pre-erase thread, erasing synchronously");
+		flash_preerase_stop();
+		return 0;
+	}
+	preerase.running = true;
+
+	return count;
+}
+
+void flash_preerase_stop(void)
+{
+	struct preerase_job *job;
+
+	if (preerase.running) {
+		pthread_mutex_lock(&preerase.lock);
+		preerase.stop = true;
+		pthread_mutex_unlock(&preerase.lock);
+		pthread_join(preerase.thread, NULL);
+		preerase.running = false;
+	}
+
+	while (!SIMPLEQ_EMPTY(&preerase.jobs)) {
+		job = SIMPLEQ_FIRST(&preerase.jobs);
+		SIMPLEQ_REMOVE_HEAD(&preerase.jobs, next);
+		free(job);
+	}
+}
+
 int flash_erase(int mtdnum)
 {
 	return flash_erase_sector(mtdnum, 0, 0);
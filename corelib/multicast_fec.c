@@ -0,0 +1,191 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+/*
+ * Erasure code for the multicast distribution: data blocks are sent
+ * as they are, parity block j is sum(C[j][i] * data[i]) with C a Cauchy
+ * matrix, C[j][i] = 1 / (x_j + y_i) where y_i = i and x_j = k + j.
+ * Any square submatrix of a Cauchy matrix is invertible, so any k of
+ * the k + r blocks rebuild the data.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "multicast.h"
+
+/* GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 */
+static unsigned char gf_exp[2 * 255];
+static unsigned char gf_log[256];
+static bool gf_ready;
+
+static void gf_init(void)
+{
+	unsigned int i, x = 1;
+
+	if (gf_ready)
+		return;
+	for (i = 0; i < 255; i++) {
+		gf_exp[i] = gf_exp[i + 255] = x;
+		gf_log[x] = i;
+		x <<= 1;
+		if (x & 0x100)
+			x ^= 0x11d;
+	}
+	gf_ready = true;
+}
+
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+	if (!a || !b)
+		return 0;
+	return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_inv(unsigned char a)
+{
+	return gf_exp[255 - gf_log[a]];
+}
+
+static unsigned char cauchy(unsigned int k, unsigned int j, unsigned int i)
+{
+	return gf_inv((k + j) ^ i);
+}
+
+/* dst += c * src */
+static void gf_mul_add(unsigned char *dst, const unsigned char *src,
+		       unsigned char c, size_t len)
+{
+	const unsigned char *exp;
+	size_t n;
+
+	if (!c)
+		return;
+	exp = &gf_exp[gf_log[c]];
+	for (n = 0; n < len; n++) {
+		if (src[n])
+			dst[n] ^= exp[gf_log[src[n]]];
+	}
+}
+
+void fec_encode(unsigned int k, unsigned int r, unsigned char * const *data,
+		unsigned char **parity, size_t len)
+{
+	unsigned int i, j;
+
+	gf_init();
+	for (j = 0; j < r; j++) {
+		memset(parity[j], 0, len);
+		for (i = 0; i < k; i++)
+			gf_mul_add(parity[j], data[i], cauchy(k, j, i), len);
+	}
+}
+
+/* Gauss-Jordan elimination of the m x m matrix a into inv */
+static int gf_invert(unsigned char *a, unsigned char *inv, unsigned int m)
+{
+	unsigned int row, col, i;
+	unsigned char c;
+
+	memset(inv, 0, m * m);
+	for (i = 0; i < m; i++)
+		inv[i * m + i] = 1;
+
+	for (col = 0; col < m; col++) {
+		for (row = col; row < m && !a[row * m + col]; row++)
+			;
+		if (row == m)
+			return -1;
+		if (row != col) {
+			for (i = 0; i < m; i++) {
+				c = a[row * m + i];
+				a[row * m + i] = a[col * m + i];
+				a[col * m + i] = c;
+				c = inv[row * m + i];
+				inv[row * m + i] = inv[col * m + i];
+				inv[col * m + i] = c;
+			}
+		}
+		c = gf_inv(a[col * m + col]);
+		for (i = 0; i < m; i++) {
+			a[col * m + i] = gf_mul(a[col * m + i], c);
+			inv[col * m + i] = gf_mul(inv[col * m + i], c);
+		}
+		for (row = 0; row < m; row++) {
+			if (row == col || !a[row * m + col])
+				continue;
+			c = a[row * m + col];
+			for (i = 0; i < m; i++) {
+				a[row * m + i] ^= gf_mul(a[col * m + i], c);
+				inv[row * m + i] ^= gf_mul(inv[col * m + i], c);
+			}
+		}
+	}
+
+	return 0;
+}
+
+int fec_decode(unsigned int k, unsigned int r, unsigned char **blocks,
+	       const bool *present, size_t len)
+{
+	unsigned int missing[FEC_MAX_BLOCKS], parity[FEC_MAX_BLOCKS];
+	unsigned int m = 0, p = 0, i, j, t;
+	unsigned char *a, *inv, *sums;
+	int ret = -1;
+
+	for (i = 0; i < k; i++) {
+		if (!present[i])
+			missing[m++] = i;
+	}
+	if (!m)
+		return 0;
+	for (j = 0; j < r && p < m; j++) {
+		if (present[k + j])
+			parity[p++] = j;
+	}
+	if (p < m)
+		return -1;
+
+	gf_init();
+	a = malloc(m * m);
+	inv = malloc(m * m);
+	sums = malloc(m * len);
+	if (!a || !inv || !sums)
+		goto out;
+
+	/*
+	 * Remove the contribution of the data blocks received from the
+	 * parity blocks: what is left only depends on the missing ones.
+	 */
+	for (j = 0; j < m; j++) {
+		unsigned char *s = &sums[j * len];
+
+		memcpy(s, blocks[k + parity[j]], len);
+		for (i = 0; i < k; i++) {
+			if (present[i])
+				gf_mul_add(s, blocks[i], cauchy(k, parity[j], i), len);
+		}
+		for (t = 0; t < m; t++)
+			a[j * m + t] = cauchy(k, parity[j], missing[t]);
+	}
+	if (gf_invert(a, inv, m))
+		goto out;
+
+	for (t = 0; t < m; t++) {
+		memset(blocks[missing[t]], 0, len);
+		for (j = 0; j < m; j++)
+			gf_mul_add(blocks[missing[t]], &sums[j * len], inv[t * m + j], len);
+	}
+	ret = 0;
+
+out:
+	free(a);
+	free(inv);
+	free(sums);
+	return ret;
+}
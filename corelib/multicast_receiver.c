@@ -0,0 +1,524 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+/*
+ * Receiver of a SWU distributed by multicast (see tools/swupdate-multicast.c).
+ * Groups are rebuilt as soon as enough blocks are received and passed
+ * in order to the installer. A group that cannot be rebuilt is waited
+ * for in the next round of the sender. If the session stalls, the rest
+ * of the SWU can be loaded from a fallback URL.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+#include "util.h"
+#include "network_ipc.h"
+#include "parselib.h"
+#include "swupdate_settings.h"
+#include "multicast.h"
+#include "multicast_interface.h"
+#if defined(CONFIG_CHANNEL_CURL)
+#include "channel.h"
+#include "channel_curl.h"
+#endif
+
+#define MCAST_DEFAULT_WINDOW	128	/* groups kept ahead of the installer */
+#define MCAST_DEFAULT_TIMEOUT	30
+#define MCAST_RCVBUF		(4 * 1024 * 1024)
+#define MCAST_MAX_BUFFER	(64 * 1024 * 1024)	/* blocks of a session */
+
+struct mcast_options {
+	char *group;
+	char *iface;
+	unsigned int port;
+	unsigned int window;
+	unsigned int timeout;
+	char *fallback_url;
+};
+
+struct mcast_slot {
+	uint32_t group;
+	bool used;
+	unsigned int received;
+	bool present[FEC_MAX_BLOCKS];
+};
+
+struct mcast_session {
+	uint32_t id;
+	uint64_t size;
+	unsigned int block_size;
+	unsigned int k;
+	unsigned int r;
+	uint32_t groups;
+	uint32_t next;			/* next group for the installer */
+	unsigned int window;		/* groups buffered */
+	unsigned long long delivered;
+	struct mcast_slot *slots;	/* window of groups */
+	unsigned char *blocks;
+	int ipcfd;
+	time_t last;			/* last packet of the session */
+	unsigned long long packets;
+	unsigned int rebuilt;
+};
+
+static struct option long_options[] = {
+	{"group", required_argument, NULL, 'g'},
+	{"port", required_argument, NULL, 'p'},
+	{"interface", required_argument, NULL, 'i'},
+	{"window", required_argument, NULL, 'w'},
+	{"timeout", required_argument, NULL, 't'},
+	{"fallback-url", required_argument, NULL, 'u'},
+	{NULL, 0, NULL, 0}};
+
+static struct mcast_options opts = {
+	.port = MCAST_DEFAULT_PORT,
+	.window = MCAST_DEFAULT_WINDOW,
+	.timeout = MCAST_DEFAULT_TIMEOUT,
+};
+
+/* Session installed or given up, its next rounds are ignored */
+static uint32_t last_session;
+static bool last_session_valid;
+
+static int multicast_settings(void *elem, void  __attribute__ ((__unused__)) *data)
+{
+	char tmp[SWUPDATE_GENERAL_STRING_SIZE];
+
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "group", tmp);
+	if (strlen(tmp))
+		SETSTRING(opts.group, tmp);
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "interface", tmp);
+	if (strlen(tmp))
+		SETSTRING(opts.iface, tmp);
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "fallback-url", tmp);
+	if (strlen(tmp))
+		SETSTRING(opts.fallback_url, tmp);
+	get_field(LIBCFG_PARSER, elem, "port", &opts.port);
+	get_field(LIBCFG_PARSER, elem, "window", &opts.window);
+	get_field(LIBCFG_PARSER, elem, "timeout", &opts.timeout);
+
+	return 0;
+}
+
+static unsigned char *slot_blocks(struct mcast_session *s, struct mcast_slot *slot)
+{
+	return s->blocks + (size_t)(slot - s->slots) * (s->k + s->r) * s->block_size;
+}
+
+static struct mcast_session *session_new(const struct mcast_hdr *hdr)
+{
+	struct mcast_session *s;
+	size_t group_size;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->id = ntohl(hdr->session);
+	s->size = be64toh(hdr->size);
+	s->block_size = ntohs(hdr->block_size);
+	s->k = hdr->k;
+	s->r = hdr->r;
+	s->groups = mcast_groups(s->size, s->block_size, s->k);
+	s->ipcfd = -1;
+	s->last = time(NULL);
+
+	/*
+	 * The geometry comes from the network: the buffers are bounded,
+	 * whatever the window is, and no larger than the whole SWU.
+	 */
+	group_size = (size_t)(s->k + s->r) * s->block_size;
+	s->window = min_t(unsigned long long, opts.window, s->groups);
+	if ((unsigned long long)s->window * group_size > MCAST_MAX_BUFFER) {
+		s->window = max_t(size_t, MCAST_MAX_BUFFER / group_size, 1);
+		WARN("Multicast session %08x: window reduced to %u groups",
+		     s->id, s->window);
+	}
+	s->slots = calloc(s->window, sizeof(*s->slots));
+	s->blocks = malloc(s->window * group_size);
+	if (!s->slots || !s->blocks) {
+		ERROR("Multicast session needs %zu bytes, reduce the window",
+		      s->window * group_size);
+		free(s->slots);
+		free(s->blocks);
+		free(s);
+		return NULL;
+	}
+
+	INFO("Multicast session %08x: %llu bytes, %u groups of %u + %u blocks of %u bytes",
+	     s->id, (unsigned long long)s->size, s->groups, s->k, s->r, s->block_size);
+
+	return s;
+}
+
+static int session_install_start(struct mcast_session *s)
+{
+	struct swupdate_request req;
+
+	swupdate_prepare_req(&req);
+	req.source = SOURCE_MULTICAST;
+	for (int retries = 3; retries >= 0; retries--) {
+		s->ipcfd = ipc_inst_start_ext(&req, sizeof(req));
+		if (s->ipcfd > 0)
+			return 0;
+		sleep(1);
+	}
+	ERROR("Cannot open SWUpdate IPC stream: %s", strerror(errno));
+	s->ipcfd = -1;
+
+	return -EIO;
+}
+
+static int session_send(struct mcast_session *s, const void *buf, size_t len)
+{
+	if (s->ipcfd < 0 && session_install_start(s))
+		return -EIO;
+	if (ipc_send_data(s->ipcfd, (char *)buf, len) < 0) {
+		ERROR("Writing into SWUpdate IPC stream failed");
+		return -EIO;
+	}
+	s->delivered += len;
+
+	return 0;
+}
+
+/*
+ * The session ends when the SWU was installed or when it is given up:
+ * with an incomplete stream, the installer reports the failure.
+ */
+static void session_end(struct mcast_session *s)
+{
+	RECOVERY_STATUS result = FAILURE;
+	ipc_message msg;
+
+	if (s->ipcfd >= 0) {
+		close(s->ipcfd);
+		result = ipc_wait_for_complete(NULL);
+	}
+	if (s->delivered == s->size && result == SUCCESS) {
+		INFO("Multicast session %08x installed: %llu packets, %u groups rebuilt",
+		     s->id, s->packets, s->rebuilt);
+		msg.data.procmsg.len = 0;
+		if (ipc_postupdate(&msg) != 0 || msg.type != ACK)
+			ERROR("Running post-update failed");
+	} else {
+		ERROR("Multicast session %08x failed after %llu of %llu bytes",
+		      s->id, s->delivered, (unsigned long long)s->size);
+	}
+
+	last_session = s->id;
+	last_session_valid = true;
+	free(s->slots);
+	free(s->blocks);
+	free(s);
+}
+
+/* Pass the groups that can be rebuilt to the installer, in order */
+static int session_deliver(struct mcast_session *s)
+{
+	unsigned char *ptrs[FEC_MAX_BLOCKS];
+	struct mcast_slot *slot;
+	unsigned int k, i;
+	unsigned char *data;
+	size_t len;
+
+	while (s->next < s->groups) {
+		slot = &s->slots[s->next % s->window];
+		k = mcast_group_blocks(s->size, s->block_size, s->k, s->next);
+		if (!slot->used || slot->group != s->next || slot->received < k)
+			return 0;
+
+		data = slot_blocks(s, slot);
+		for (i = 0; i < k + s->r; i++)
+			ptrs[i] = data + (size_t)i * s->block_size;
+		for (i = 0; i < k && slot->present[i]; i++)
+			;
+		if (i < k) {
+			if (fec_decode(k, s->r, ptrs, slot->present, s->block_size))
+				return -EINVAL;
+			s->rebuilt++;
+		}
+
+		len = min_t(unsigned long long, (size_t)k * s->block_size,
+			    s->size - s->delivered);
+		if (session_send(s, data, len))
+			return -EIO;
+		slot->used = false;
+		s->next++;
+	}
+
+	return 0;
+}
+
+static void session_packet(struct mcast_session *s, const struct mcast_hdr *hdr,
+			   const unsigned char *payload)
+{
+	uint32_t group = ntohl(hdr->group);
+	struct mcast_slot *slot;
+	unsigned int k;
+
+	if (be64toh(hdr->size) != s->size || ntohs(hdr->block_size) != s->block_size ||
+	    hdr->k != s->k || hdr->r != s->r || group >= s->groups)
+		return;
+	s->packets++;
+	s->last = time(NULL);
+	/* already installed or too far ahead, it comes again in the next round */
+	if (group < s->next || group - s->next >= s->window)
+		return;
+	k = mcast_group_blocks(s->size, s->block_size, s->k, group);
+	if (hdr->index >= k + s->r)
+		return;
+
+	slot = &s->slots[group % s->window];
+	if (!slot->used) {
+		slot->used = true;
+		slot->group = group;
+		slot->received = 0;
+		memset(slot->present, 0, sizeof(slot->present));
+	}
+	if (slot->present[hdr->index] || slot->received >= k)
+		return;
+
+	memcpy(slot_blocks(s, slot) + (size_t)hdr->index * s->block_size,
+	       payload, s->block_size);
+	slot->present[hdr->index] = true;
+	slot->received++;
+}
+
+#if defined(CONFIG_CHANNEL_CURL)
+static size_t fallback_write(char *streamdata, size_t size, size_t nmemb, void *data)
+{
+	channel_data_t *channel_data = (channel_data_t *)data;
+	struct mcast_session *s = (struct mcast_session *)channel_data->user;
+
+	/* the server must resume where the multicast stopped */
+	if (s->delivered && channel_data->http_response_code != 206) {
+		ERROR("Fallback server does not support ranges (HTTP %ld)",
+		      channel_data->http_response_code);
+		return 0;
+	}
+	if (s->delivered + size * nmemb > s->size ||
+	    session_send(s, streamdata, size * nmemb))
+		return 0;
+
+	return size * nmemb;
+}
+
+static void session_fallback(struct mcast_session *s)
+{
+	channel_data_t channel_data = {
+		.url = opts.fallback_url,
+		.source = SOURCE_MULTICAST,
+		.retries = CHANNEL_DEFAULT_RESUME_TRIES,
+		.retry_sleep = CHANNEL_DEFAULT_RESUME_DELAY,
+		.noipc = true,
+		.dwlwrdata = fallback_write,
+		.user = s,
+	};
+	channel_t *channel;
+	char range[32];
+
+	INFO("Multicast session %08x stalled, loading from %llu from %s",
+	     s->id, s->delivered, opts.fallback_url);
+
+	snprintf(range, sizeof(range), "%llu-", s->delivered);
+	channel_data.range = range;
+	channel = channel_new();
+	if (!channel)
+		return;
+	if (channel->open(channel, &channel_data) == CHANNEL_OK) {
+		if (channel->get_file(channel, &channel_data) != CHANNEL_OK)
+			ERROR("Loading from %s failed", opts.fallback_url);
+		channel->close(channel);
+	}
+	free(channel);
+}
+#endif
+
+static bool valid_packet(const struct mcast_hdr *hdr, ssize_t len)
+{
+	unsigned int block_size = ntohs(hdr->block_size);
+
+	return len >= (ssize_t)sizeof(*hdr) &&
+		ntohl(hdr->magic) == MCAST_MAGIC &&
+		hdr->version == MCAST_VERSION &&
+		block_size && block_size <= MCAST_MAX_BLOCK &&
+		len == (ssize_t)(sizeof(*hdr) + block_size) &&
+		hdr->k && hdr->k + hdr->r <= FEC_MAX_BLOCKS &&
+		be64toh(hdr->size);
+}
+
+static int mcast_socket(void)
+{
+	struct sockaddr_in addr;
+	struct ip_mreqn mreq;
+	int fd, on = 1, rcvbuf = MCAST_RCVBUF;
+
+	memset(&mreq, 0, sizeof(mreq));
+	if (inet_pton(AF_INET, opts.group ? opts.group : MCAST_DEFAULT_GROUP,
+		      &mreq.imr_multiaddr) != 1) {
+		ERROR("Wrong multicast group %s", opts.group);
+		return -1;
+	}
+	/* the interface is given by name or by address */
+	if (opts.iface && inet_pton(AF_INET, opts.iface, &mreq.imr_address) != 1) {
+		mreq.imr_ifindex = if_nametoindex(opts.iface);
+		if (!mreq.imr_ifindex) {
+			ERROR("Unknown interface %s", opts.iface);
+			return -1;
+		}
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ERROR("Cannot create socket: %s", strerror(errno));
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	/* blocks arrive faster than the installer takes them at times */
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opts.port);
+	addr.sin_addr = mreq.imr_multiaddr;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) {
+		ERROR("Cannot join multicast group %s:%u: %s",
+		      opts.group ? opts.group : MCAST_DEFAULT_GROUP, opts.port,
+		      strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+void multicast_print_help(void)
+{
+	fprintf(
+	    stdout,
+	    "\tmulticast arguments:\n"
+	    "\t  -g, --group <address>      multicast group (default: %s)\n"
+	    "\t  -p, --port <port>          UDP port (default: %d)\n"
+	    "\t  -i, --interface <if>       interface name or address to join the group\n"
+	    "\t  -w, --window <groups>      groups buffered ahead of the installer (default: %d)\n"
+	    "\t  -t, --timeout <s>          a session without data for <s> is stalled (default: %d)\n"
+	    "\t  -u, --fallback-url <url>   URL of the SWU to complete a stalled session\n",
+	    MCAST_DEFAULT_GROUP, MCAST_DEFAULT_PORT, MCAST_DEFAULT_WINDOW,
+	    MCAST_DEFAULT_TIMEOUT);
+}
+
+int start_multicast_receiver(const char *cfgfname, int argc, char *argv[])
+{
+	struct mcast_session *s = NULL;
+	struct mcast_hdr *hdr;
+	unsigned char *buf;
+	struct pollfd pfd;
+	ssize_t len;
+	int choice;
+
+	if (cfgfname) {
+		swupdate_cfg_handle handle;
+		swupdate_cfg_init(&handle);
+		if (swupdate_cfg_read_file(&handle, cfgfname) == 0) {
+			read_module_settings(&handle, "multicast", multicast_settings, NULL);
+		}
+		swupdate_cfg_destroy(&handle);
+	}
+
+	/* reset to optind=1 to parse multicast's argument vector */
+	optind = 1;
+	while ((choice = getopt_long(argc, argv, "g:p:i:w:t:u:",
+				     long_options, NULL)) != -1) {
+		switch (choice) {
+		case 'g':
+			SETSTRING(opts.group, optarg);
+			break;
+		case 'p':
+			opts.port = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			SETSTRING(opts.iface, optarg);
+			break;
+		case 'w':
+			opts.window = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			opts.timeout = strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			SETSTRING(opts.fallback_url, optarg);
+			break;
+		case '?':
+		default:
+			return -EINVAL;
+		}
+	}
+	if (!opts.window)
+		opts.window = 1;
+
+	pfd.fd = mcast_socket();
+	if (pfd.fd < 0)
+		exit(EXIT_FAILURE);
+	pfd.events = POLLIN;
+	buf = malloc(sizeof(*hdr) + MCAST_MAX_BLOCK);
+	if (!buf)
+		exit(EXIT_FAILURE);
+	hdr = (struct mcast_hdr *)buf;
+	signal(SIGPIPE, SIG_IGN);
+
+	INFO("Multicast receiver waiting on %s:%u",
+	     opts.group ? opts.group : MCAST_DEFAULT_GROUP, opts.port);
+
+	for (;;) {
+		if (poll(&pfd, 1, 1000) > 0) {
+			len = recv(pfd.fd, buf, sizeof(*hdr) + MCAST_MAX_BLOCK, 0);
+			if (valid_packet(hdr, len)) {
+				uint32_t id = ntohl(hdr->session);
+
+				/*
+				 * Anybody on the network can send a packet: another
+				 * session (a restarted sender) is only taken once the
+				 * running one is over or has timed out without data.
+				 */
+				if (!s && !(last_session_valid && last_session == id))
+					s = session_new(hdr);
+				if (s && s->id == id) {
+					session_packet(s, hdr, buf + sizeof(*hdr));
+					if (session_deliver(s) || s->next == s->groups) {
+						session_end(s);
+						s = NULL;
+					}
+				}
+			}
+		}
+
+		if (s && time(NULL) - s->last > opts.timeout) {
+#if defined(CONFIG_CHANNEL_CURL)
+			if (opts.fallback_url)
+				session_fallback(s);
+#endif
+			session_end(s);
+			s = NULL;
+		}
+	}
+
+	return 0;
+}
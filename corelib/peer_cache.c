@@ -0,0 +1,191 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+
+#include "sslapi.h"
+#include "util.h"
+#include "peer_cache.h"
+
+#define KEY_LEN		(SHA256_HASH_LENGTH * 2)
+
+struct peer_cache {
+	int dirfd;
+	int fd;
+	char tmp[32];
+	char key[KEY_LEN + 1];
+	struct swupdate_digest *dgst;
+	unsigned long long size;
+};
+
+bool peer_cache_valid_key(const char *key)
+{
+	size_t i;
+
+	if (!key)
+		return false;
+	for (i = 0; i < KEY_LEN; i++) {
+		if (!isxdigit((unsigned char)key[i]))
+			return false;
+	}
+
+	return key[i] == '\0';
+}
+
+char *peer_cache_url(const char *peer, const char *key)
+{
+	size_t len = strlen(peer);
+	char *url;
+	size_t i;
+
+	while (len && peer[len - 1] == '/')
+		len--;
+	if (asprintf(&url, "%.*s%s%s", (int)len, peer, PEER_CACHE_URI, key) == ENOMEM_ASPRINTF)
+		return NULL;
+	/* files are stored with lowercase names */
+	for (i = strlen(url) - KEY_LEN; url[i]; i++)
+		url[i] = tolower((unsigned char)url[i]);
+
+	return url;
+}
+
+static void peer_cache_free(struct peer_cache *pc)
+{
+	if (pc->fd >= 0) {
+		close(pc->fd);
+		unlinkat(pc->dirfd, pc->tmp, 0);
+	}
+	if (pc->dirfd >= 0)
+		close(pc->dirfd);
+	if (pc->dgst)
+		swupdate_HASH_cleanup(pc->dgst);
+	free(pc);
+}
+
+struct peer_cache *peer_cache_start(const char *dir, const char *key)
+{
+	struct peer_cache *pc;
+	char *path;
+
+	if (!dir)
+		return NULL;
+
+	path = strdup(dir);
+	if (!path || mkpath(path, 0755)) {
+		WARN("Peer cache %s cannot be created, SWU not shared", dir);
+		free(path);
+		return NULL;
+	}
+	free(path);
+
+	pc = calloc(1, sizeof(*pc));
+	if (!pc)
+		return NULL;
+	pc->fd = -1;
+	pc->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	pc->dgst = swupdate_HASH_init(SHA_DEFAULT);
+	if (pc->dirfd < 0 || !pc->dgst) {
+		WARN("Peer cache %s cannot be used, SWU not shared", dir);
+		peer_cache_free(pc);
+		return NULL;
+	}
+	if (peer_cache_valid_key(key)) {
+		for (size_t i = 0; i <= KEY_LEN; i++)
+			pc->key[i] = tolower((unsigned char)key[i]);
+	}
+
+	/* not named after a key, the webserver does not serve it while written */
+	snprintf(pc->tmp, sizeof(pc->tmp), ".tmp-%d", getpid());
+	pc->fd = openat(pc->dirfd, pc->tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (pc->fd < 0) {
+		WARN("Cannot write into peer cache %s: %s", dir, strerror(errno));
+		peer_cache_free(pc);
+		return NULL;
+	}
+
+	return pc;
+}
+
+void peer_cache_write(struct peer_cache *pc, const void *buf, size_t len)
+{
+	if (!pc || pc->fd < 0)
+		return;
+
+	/* caching is best effort, the download goes on without it */
+	if (copy_write(&pc->fd, buf, len) ||
+	    swupdate_HASH_update(pc->dgst, buf, len)) {
+		WARN("Writing into peer cache failed, SWU not shared");
+		close(pc->fd);
+		unlinkat(pc->dirfd, pc->tmp, 0);
+		pc->fd = -1;
+		return;
+	}
+	pc->size += len;
+}
+
+/* Only the last SWU is served, drop the older ones */
+static void peer_cache_prune(struct peer_cache *pc, const char *keep)
+{
+	struct dirent *de;
+	DIR *d;
+	int fd;
+
+	fd = dup(pc->dirfd);
+	d = fd < 0 ? NULL : fdopendir(fd);
+	if (!d) {
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	while ((de = readdir(d))) {
+		if (strcmp(de->d_name, keep) && strcmp(de->d_name, pc->tmp) &&
+		    (peer_cache_valid_key(de->d_name) || !strncmp(de->d_name, ".tmp-", 5)))
+			unlinkat(pc->dirfd, de->d_name, 0);
+	}
+	closedir(d);
+}
+
+void peer_cache_finish(struct peer_cache *pc, bool success)
+{
+	unsigned char md[SHA256_HASH_LENGTH];
+	char digest[KEY_LEN + 1];
+	unsigned int mdlen;
+
+	if (!pc)
+		return;
+	if (!success || pc->fd < 0 || !pc->size)
+		goto out;
+
+	if (swupdate_HASH_final(pc->dgst, md, &mdlen) != 1 || fsync(pc->fd))
+		goto out;
+	hash_to_ascii(md, digest);
+	if (strlen(pc->key) && strcmp(pc->key, digest)) {
+		WARN("Downloaded SWU has SHA-256 %s, %s expected: not shared",
+		     digest, pc->key);
+		goto out;
+	}
+	if (renameat(pc->dirfd, pc->tmp, pc->dirfd, digest)) {
+		WARN("SWU cannot be stored in peer cache: %s", strerror(errno));
+		goto out;
+	}
+	close(pc->fd);
+	pc->fd = -1;
+	peer_cache_prune(pc, digest);
+	INFO("SWU %s (%llu bytes) shared with peers", digest, pc->size);
+
+out:
+	peer_cache_free(pc);
+}
@@ -18,6 +18,9 @@
 int channel_settings(void *elem, void *data)
 {
 	char tmp[128];
+#if defined(CONFIG_PEER_CACHE)
+	char peers[SWUPDATE_GENERAL_STRING_SIZE * 4];
+#endif
 	channel_data_t *chan = (channel_data_t *)data;
 
 	get_field(LIBCFG_PARSER, elem, "retry",
@@ -49,6 +52,16 @@ int channel_settings(void *elem, void *data)
 	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "interface", tmp);
 	if (strlen(tmp))
 		SETSTRING(chan->iface, tmp);
+#if defined(CONFIG_PEER_CACHE)
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "peer-cache", tmp);
+	if (strlen(tmp))
+		SETSTRING(chan->peer_cache, tmp);
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "peers", peers);
+	if (strlen(peers)) {
+		free_string_array(chan->peers);
+		chan->peers = string_split(peers, ',');
+	}
+#endif
 
 	return 0;
 }
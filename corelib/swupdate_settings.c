@@ -18,6 +18,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <assert.h>
 #include "generated/autoconf.h"
@@ -34,6 +35,58 @@ struct run_as {
 	gid_t groupid;
 };
 
+/*
+ * The configuration file is parsed once by the main process.
+ * Subprocesses (webserver, suricatta, downloader) are forked
+ * after it and inherit the parsed tree, so they do not need
+ * to read and parse the file again.
+ * The tree is released when the file changes and no handle
+ * refers to it anymore, and when the process exits.
+ */
+static struct {
+	config_t cfg;
+	char *filename;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	unsigned int users;	/* handles referring to cfg */
+	pid_t owner;		/* process users belong to */
+	bool valid;
+} parsed_cfg;
+
+static pthread_mutex_t parsed_cfg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool is_parsed_cfg(const char *filename, struct stat *st)
+{
+	if (!parsed_cfg.valid || strcmp(parsed_cfg.filename, filename))
+		return false;
+
+	return parsed_cfg.dev == st->st_dev && parsed_cfg.ino == st->st_ino &&
+		parsed_cfg.mtime.tv_sec == st->st_mtim.tv_sec &&
+		parsed_cfg.mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+/* Called with parsed_cfg_lock held */
+static void release_parsed_cfg(void)
+{
+	if (!parsed_cfg.valid)
+		return;
+	config_destroy(&parsed_cfg.cfg);
+	free(parsed_cfg.filename);
+	parsed_cfg.filename = NULL;
+	parsed_cfg.valid = false;
+}
+
+static void parsed_cfg_exit(void)
+{
+	/* another thread may still be reading it, then leave it */
+	if (pthread_mutex_trylock(&parsed_cfg_lock))
+		return;
+	if (!parsed_cfg.users || parsed_cfg.owner != getpid())
+		release_parsed_cfg();
+	pthread_mutex_unlock(&parsed_cfg_lock);
+}
+
 static config_setting_t *find_settings_node(config_t *cfg,
 						const char *field)
 {
@@ -78,7 +131,7 @@ int read_module_settings(swupdate_cfg_handle *handle, const char *module, settin
 	if (handle == NULL || !fcn)
 		return -EINVAL;
 
-	elem = find_settings_node(&handle->cfg, module);
+	elem = find_settings_node(handle->shared ? handle->shared : &handle->cfg, module);
 
 	if (!elem) {
 		DEBUG("No config settings found for module %s", module);
@@ -161,17 +214,88 @@ int settings_into_dict(void *settings, void *data)
 void swupdate_cfg_init(swupdate_cfg_handle *handle)
 {
 	config_init(&handle->cfg);
+	handle->shared = NULL;
 }
 
 /*
  * Read all settings from filename.
+ * If the same file was already parsed and it was not changed,
+ * the handle refers to the already parsed settings until
+ * swupdate_cfg_destroy() is called.
  */
 int swupdate_cfg_read_file(swupdate_cfg_handle *handle, const char *filename)
 {
-	if (read_settings_file(&handle->cfg, filename) != CONFIG_TRUE) {
-		ERROR("Error reading configuration file %s", filename);
+	static bool exit_registered;
+	struct stat st;
+
+	if (!filename)
 		return -EINVAL;
+
+	handle->shared = NULL;
+	pthread_mutex_lock(&parsed_cfg_lock);
+
+	/*
+	 * Handles of the parent are never released in a forked
+	 * subprocess, they do not count here
+	 */
+	if (parsed_cfg.owner != getpid()) {
+		parsed_cfg.owner = getpid();
+		parsed_cfg.users = 0;
+	}
+
+	if (stat(filename, &st)) {
+		pthread_mutex_unlock(&parsed_cfg_lock);
+		if (read_settings_file(&handle->cfg, filename) != CONFIG_TRUE) {
+			ERROR("Error reading configuration file %s", filename);
+			return -EINVAL;
+		}
+		return 0;
 	}
+
+	if (is_parsed_cfg(filename, &st)) {
+		DEBUG("Reusing parsed config file %s", filename);
+	} else if (parsed_cfg.valid && parsed_cfg.users) {
+		/*
+		 * The file changed or it is another one, and the old
+		 * settings are still in use: read it just for this handle
+		 */
+		pthread_mutex_unlock(&parsed_cfg_lock);
+		if (read_settings_file(&handle->cfg, filename) != CONFIG_TRUE) {
+			ERROR("Error reading configuration file %s", filename);
+			return -EINVAL;
+		}
+		return 0;
+	} else {
+		release_parsed_cfg();
+		config_init(&parsed_cfg.cfg);
+		if (read_settings_file(&parsed_cfg.cfg, filename) != CONFIG_TRUE) {
+			config_destroy(&parsed_cfg.cfg);
+			pthread_mutex_unlock(&parsed_cfg_lock);
+			ERROR("Error reading configuration file %s", filename);
+			return -EINVAL;
+		}
+		parsed_cfg.filename = strdup(filename);
+		if (!parsed_cfg.filename) {
+			config_destroy(&parsed_cfg.cfg);
+			pthread_mutex_unlock(&parsed_cfg_lock);
+			return -ENOMEM;
+		}
+		parsed_cfg.dev = st.st_dev;
+		parsed_cfg.ino = st.st_ino;
+		parsed_cfg.mtime = st.st_mtim;
+		parsed_cfg.valid = true;
+		if (!exit_registered)
+			exit_registered = !atexit(parsed_cfg_exit);
+	}
+
+	/*
+	 * Not a copy of parsed_cfg.cfg: the settings point back to it,
+	 * handle->cfg is left empty.
+	 */
+	parsed_cfg.users++;
+	handle->shared = &parsed_cfg.cfg;
+	pthread_mutex_unlock(&parsed_cfg_lock);
+
 	return 0;
 }
 
@@ -180,5 +304,13 @@ int swupdate_cfg_read_file(swupdate_cfg_handle *handle, const char *filename)
  */
 void swupdate_cfg_destroy(swupdate_cfg_handle *handle)
 {
+	if (handle->shared) {
+		pthread_mutex_lock(&parsed_cfg_lock);
+		/* the parent's handles are not counted in a subprocess */
+		if (parsed_cfg.owner == getpid() && parsed_cfg.users)
+			parsed_cfg.users--;
+		pthread_mutex_unlock(&parsed_cfg_lock);
+		handle->shared = NULL;
+	}
 	config_destroy(&handle->cfg);
 }
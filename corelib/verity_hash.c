@@ -0,0 +1,521 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+/*
+ * Computation of a dm-verity hash tree while data is streamed.
+ * The layout is the same as generated by veritysetup (format 1):
+ * each data block is hashed together with the salt, hashes are
+ * stored in hash blocks and the levels of the tree are written
+ * starting from the top level. The root hash is the hash of the
+ * single block of the top level.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "util.h"
+#include "sslapi.h"
+#include "verity_hash.h"
+
+#define VERITY_MAX_LEVELS	63
+
+struct verity_level {
+	unsigned long long first_block;	/* position in the tree, in hash blocks */
+	unsigned long long index;	/* current hash block in this level */
+	unsigned int entries;		/* hashes in current block */
+	unsigned char *block;
+};
+
+struct verity_hash;
+
+struct verity_worker {
+	struct verity_hash *v;
+	unsigned int id;
+	pthread_t thread;
+};
+
+struct verity_hash {
+	struct verity_hash_cfg cfg;
+	unsigned int digest_size;
+	unsigned int digest_size_full;
+	unsigned int hash_per_block_bits;
+	unsigned long long data_blocks;
+	unsigned long long hashed_blocks;
+	unsigned long long tree_blocks;
+	unsigned int nlevels;
+	struct verity_level levels[VERITY_MAX_LEVELS];
+	unsigned char root[VERITY_MAX_DIGEST_SIZE];
+
+	/* Data block not yet complete */
+	unsigned char *pending;
+	size_t pending_len;
+
+	/* Hashes of the data blocks of the current chunk */
+	unsigned char *leaves;
+	unsigned long long leaves_size;
+
+	/* Pool of threads to hash data blocks in parallel */
+	struct verity_worker workers[VERITY_MAX_THREADS];
+	unsigned int nworkers;
+	pthread_mutex_t lock;
+	pthread_cond_t wkup;
+	pthread_cond_t done;
+	const unsigned char *job_buf;
+	unsigned long long job_blocks;
+	unsigned int job_gen;
+	unsigned int running;
+	int job_err;
+	bool stop;
+};
+
+static unsigned int get_bits_down(unsigned long long u)
+{
+	unsigned int i = 0;
+
+	while ((u >> i) > 1U)
+		i++;
+	return i;
+}
+
+static unsigned int get_bits_up(unsigned long long u)
+{
+	unsigned int i = 0;
+
+	while ((1ULL << i) < u)
+		i++;
+	return i;
+}
+
+static bool is_power_of_2(unsigned int n)
+{
+	return n && !(n & (n - 1));
+}
+
+static int verity_hash_block(struct verity_hash *v, const unsigned char *block,
+			     size_t len, unsigned char *digest)
+{
+	struct swupdate_digest *dgst;
+	unsigned int md_len;
+	int ret = -EFAULT;
+
+	dgst = swupdate_HASH_init(v->cfg.algo);
+	if (!dgst)
+		return -EFAULT;
+
+	if (v->cfg.salt_size &&
+	    swupdate_HASH_update(dgst, v->cfg.salt, v->cfg.salt_size))
+		goto out;
+	if (swupdate_HASH_update(dgst, block, len))
+		goto out;
+	if (swupdate_HASH_final(dgst, digest, &md_len) != 1)
+		goto out;
+
+	ret = 0;
+out:
+	swupdate_HASH_cleanup(dgst);
+	return ret;
+}
+
+static int verity_write_block(struct verity_hash *v, const unsigned char *block,
+			      unsigned long long pos)
+{
+	off_t offset = v->cfg.offset + (off_t)(pos * v->cfg.hash_block_size);
+	size_t written = 0;
+	ssize_t ret;
+
+	while (written < v->cfg.hash_block_size) {
+		ret = pwrite(v->cfg.fd, block + written,
+			     v->cfg.hash_block_size - written, offset + written);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Cannot write hash tree: %s", strerror(errno));
+			return -EIO;
+		}
+		written += ret;
+	}
+
+	return 0;
+}
+
+static int verity_add_hash(struct verity_hash *v, unsigned int level,
+			   const unsigned char *digest);
+
+/*
+ * Current hash block of a level is complete: store it
+ * and add its hash to the upper level
+ */
+static int verity_flush_level(struct verity_hash *v, unsigned int level)
+{
+	struct verity_level *l = &v->levels[level];
+	unsigned char digest[VERITY_MAX_DIGEST_SIZE];
+	int ret;
+
+	if (v->cfg.fd >= 0) {
+		ret = verity_write_block(v, l->block, l->first_block + l->index);
+		if (ret)
+			return ret;
+	}
+
+	ret = verity_hash_block(v, l->block, v->cfg.hash_block_size, digest);
+	if (ret)
+		return ret;
+
+	memset(l->block, 0, v->cfg.hash_block_size);
+	l->entries = 0;
+	l->index++;
+
+	return verity_add_hash(v, level + 1, digest);
+}
+
+static int verity_add_hash(struct verity_hash *v, unsigned int level,
+			   const unsigned char *digest)
+{
+	struct verity_level *l;
+
+	/* Top of the tree reached */
+	if (level == v->nlevels) {
+		memcpy(v->root, digest, v->digest_size);
+		return 0;
+	}
+
+	l = &v->levels[level];
+	memcpy(l->block + l->entries * v->digest_size_full, digest, v->digest_size);
+	l->entries++;
+	if (l->entries == (1U << v->hash_per_block_bits))
+		return verity_flush_level(v, level);
+
+	return 0;
+}
+
+static int verity_hash_leaves(struct verity_hash *v, const unsigned char *buf,
+			      unsigned long long first, unsigned long long last)
+{
+	unsigned long long i;
+	int ret;
+
+	for (i = first; i < last; i++) {
+		ret = verity_hash_block(v, buf + i * v->cfg.data_block_size,
+					v->cfg.data_block_size,
+					v->leaves + i * v->digest_size);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static unsigned long long stripe_start(struct verity_hash *v, unsigned int id)
+{
+	return v->job_blocks * id / (v->nworkers + 1);
+}
+
+static void *verity_worker_thread(void *data)
+{
+	struct verity_worker *w = (struct verity_worker *)data;
+	struct verity_hash *v = w->v;
+	unsigned int gen = 0;
+	int ret;
+
+	pthread_mutex_lock(&v->lock);
+	for (;;) {
+		while (!v->stop && v->job_gen == gen)
+			pthread_cond_wait(&v->wkup, &v->lock);
+		if (v->stop)
+			break;
+		gen = v->job_gen;
+		pthread_mutex_unlock(&v->lock);
+
+		ret = verity_hash_leaves(v, v->job_buf, stripe_start(v, w->id),
+					 stripe_start(v, w->id + 1));
+
+		pthread_mutex_lock(&v->lock);
+		if (ret)
+			v->job_err = ret;
+		if (--v->running == 0)
+			pthread_cond_signal(&v->done);
+	}
+	pthread_mutex_unlock(&v->lock);
+
+	return NULL;
+}
+
+/*
+ * Hash a number of complete data blocks, distributing them
+ * to the worker threads, and add the hashes to the tree
+ */
+static int verity_hash_chunk(struct verity_hash *v, const unsigned char *buf,
+			     unsigned long long nblocks)
+{
+	unsigned long long i;
+	int ret;
+
+	if (v->hashed_blocks + nblocks > v->data_blocks) {
+		ERROR("Data exceeds the size of the hash tree");
+		return -EFBIG;
+	}
+
+	if (nblocks > v->leaves_size) {
+		unsigned char *tmp = realloc(v->leaves, nblocks * v->digest_size);
+		if (!tmp)
+			return -ENOMEM;
+		v->leaves = tmp;
+		v->leaves_size = nblocks;
+	}
+
+	if (!v->nworkers || nblocks <= v->nworkers) {
+		ret = verity_hash_leaves(v, buf, 0, nblocks);
+	} else {
+		pthread_mutex_lock(&v->lock);
+		v->job_buf = buf;
+		v->job_blocks = nblocks;
+		v->running = v->nworkers;
+		v->job_err = 0;
+		v->job_gen++;
+		pthread_cond_broadcast(&v->wkup);
+		pthread_mutex_unlock(&v->lock);
+
+		/* The caller takes the first stripe */
+		ret = verity_hash_leaves(v, buf, 0, stripe_start(v, 1));
+
+		pthread_mutex_lock(&v->lock);
+		while (v->running)
+			pthread_cond_wait(&v->done, &v->lock);
+		if (!ret)
+			ret = v->job_err;
+		pthread_mutex_unlock(&v->lock);
+	}
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nblocks; i++) {
+		ret = verity_add_hash(v, 0, v->leaves + i * v->digest_size);
+		if (ret)
+			return ret;
+	}
+	v->hashed_blocks += nblocks;
+
+	return 0;
+}
+
+struct verity_hash *verity_hash_init(struct verity_hash_cfg *cfg,
+				     unsigned long long data_size)
+{
+	struct verity_hash *v;
+	unsigned long long pos;
+	unsigned int i, bits;
+	int level;
+
+	if (!cfg->algo)
+		cfg->algo = "sha256";
+
+	if (!is_power_of_2(cfg->data_block_size) || cfg->data_block_size < 512 ||
+	    !is_power_of_2(cfg->hash_block_size) || cfg->hash_block_size < 512) {
+		ERROR("Hash tree: block sizes must be a power of 2 (at least 512)");
+		return NULL;
+	}
+	if (!data_size) {
+		ERROR("Hash tree: data size not set");
+		return NULL;
+	}
+	if (cfg->salt_size > VERITY_MAX_SALT_SIZE) {
+		ERROR("Hash tree: salt too long");
+		return NULL;
+	}
+
+	v = calloc(1, sizeof(*v));
+	if (!v)
+		return NULL;
+
+	v->cfg = *cfg;
+	if (!strcmp(cfg->algo, "sha256"))
+		v->digest_size = 32;
+	else if (!strcmp(cfg->algo, "sha1"))
+		v->digest_size = 20;
+	else {
+		ERROR("Hash tree: unsupported hash %s", cfg->algo);
+		free(v);
+		return NULL;
+	}
+	v->digest_size_full = 1U << get_bits_up(v->digest_size);
+	v->hash_per_block_bits = get_bits_down(cfg->hash_block_size / v->digest_size_full);
+	v->data_blocks = (data_size + cfg->data_block_size - 1) / cfg->data_block_size;
+
+	/* Levels needed to reduce the tree to a single hash block */
+	bits = v->hash_per_block_bits;
+	while (bits * v->nlevels < 64 && (v->data_blocks - 1) >> (bits * v->nlevels))
+		v->nlevels++;
+	if (v->nlevels > VERITY_MAX_LEVELS) {
+		ERROR("Hash tree: too many levels");
+		free(v);
+		return NULL;
+	}
+
+	/* Upper levels are stored first */
+	pos = 0;
+	for (level = v->nlevels - 1; level >= 0; level--) {
+		unsigned int shift = bits * (level + 1);
+		unsigned long long nblocks = shift < 64 ?
+			(v->data_blocks + (1ULL << shift) - 1) >> shift : 1;
+
+		v->levels[level].first_block = pos;
+		v->levels[level].block = calloc(1, cfg->hash_block_size);
+		if (!v->levels[level].block)
+			goto out_free;
+		pos += nblocks;
+	}
+	v->tree_blocks = pos;
+
+	v->pending = malloc(cfg->data_block_size);
+	if (!v->pending)
+		goto out_free;
+
+	pthread_mutex_init(&v->lock, NULL);
+	pthread_cond_init(&v->wkup, NULL);
+	pthread_cond_init(&v->done, NULL);
+
+	if (cfg->threads > 1) {
+		v->nworkers = min_t(unsigned int, cfg->threads, VERITY_MAX_THREADS) - 1;
+		for (i = 0; i < v->nworkers; i++) {
+			v->workers[i].v = v;
+			v->workers[i].id = i + 1;
+			if (pthread_create(&v->workers[i].thread, NULL,
+					   verity_worker_thread, &v->workers[i])) {
+				ERROR("Hash tree: cannot create threads");
+				v->nworkers = i;
+				verity_hash_free(v);
+				return NULL;
+			}
+		}
+	}
+
+	TRACE("Hash tree: %llu data blocks, %u levels, %llu bytes",
+	      v->data_blocks, v->nlevels, verity_hash_tree_size(v));
+
+	return v;
+
+out_free:
+	for (i = 0; i < v->nlevels; i++)
+		free(v->levels[i].block);
+	free(v);
+	return NULL;
+}
+
+int verity_hash_update(struct verity_hash *v, const unsigned char *buf, size_t len)
+{
+	size_t bs = v->cfg.data_block_size;
+	size_t n;
+	int ret;
+
+	/* Complete a data block split between two buffers */
+	if (v->pending_len) {
+		n = min_t(size_t, len, bs - v->pending_len);
+		memcpy(v->pending + v->pending_len, buf, n);
+		v->pending_len += n;
+		buf += n;
+		len -= n;
+		if (v->pending_len < bs)
+			return 0;
+		ret = verity_hash_chunk(v, v->pending, 1);
+		if (ret)
+			return ret;
+		v->pending_len = 0;
+	}
+
+	n = len / bs;
+	if (n) {
+		ret = verity_hash_chunk(v, buf, n);
+		if (ret)
+			return ret;
+	}
+
+	len -= n * bs;
+	if (len) {
+		memcpy(v->pending, buf + n * bs, len);
+		v->pending_len = len;
+	}
+
+	return 0;
+}
+
+int verity_hash_final(struct verity_hash *v, unsigned char *root_hash)
+{
+	unsigned int i;
+	int ret;
+
+	/* Last data block is padded with zeroes */
+	if (v->pending_len) {
+		memset(v->pending + v->pending_len, 0,
+		       v->cfg.data_block_size - v->pending_len);
+		ret = verity_hash_chunk(v, v->pending, 1);
+		if (ret)
+			return ret;
+		v->pending_len = 0;
+	}
+
+	if (v->hashed_blocks != v->data_blocks) {
+		ERROR("Hash tree: got %llu data blocks, expected %llu",
+		      v->hashed_blocks, v->data_blocks);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < v->nlevels; i++) {
+		if (v->levels[i].entries) {
+			ret = verity_flush_level(v, i);
+			if (ret)
+				return ret;
+		}
+	}
+
+	if (v->cfg.fd >= 0 && fsync(v->cfg.fd) && errno != EINVAL) {
+		ERROR("Cannot sync hash tree: %s", strerror(errno));
+		return -EIO;
+	}
+
+	memcpy(root_hash, v->root, v->digest_size);
+
+	return 0;
+}
+
+unsigned int verity_hash_digest_size(struct verity_hash *v)
+{
+	return v->digest_size;
+}
+
+unsigned long long verity_hash_tree_size(struct verity_hash *v)
+{
+	return v->tree_blocks * v->cfg.hash_block_size;
+}
+
+void verity_hash_free(struct verity_hash *v)
+{
+	unsigned int i;
+
+	if (!v)
+		return;
+
+	pthread_mutex_lock(&v->lock);
+	v->stop = true;
+	pthread_cond_broadcast(&v->wkup);
+	pthread_mutex_unlock(&v->lock);
+	for (i = 0; i < v->nworkers; i++)
+		pthread_join(v->workers[i].thread, NULL);
+
+	pthread_mutex_destroy(&v->lock);
+	pthread_cond_destroy(&v->wkup);
+	pthread_cond_destroy(&v->done);
+
+	for (i = 0; i < v->nlevels; i++)
+		free(v->levels[i].block);
+	free(v->pending);
+	free(v->leaves);
+	free(v);
+}
@@ -251,6 +251,27 @@ end
 -- suricatta.server.register(check_cancel_callback, suricatta.server.CALLBACK_CHECK_CANCEL)
 
 
+--- Last progress percentage reported to remote, for rate limiting.
+local progress_reported = { step = -1, percent = -1 }
+
+--- Check whether a progress percentage should not be reported to remote.
+--
+-- Queued progress messages for the same step are replaced by newer ones,
+-- so not every percentage is seen by `progress_callback()`: Report when
+-- a 5% boundary is crossed.
+--
+--- @param  step     number  Current step, 0 while downloading
+--- @param  percent  number  Percentage of the step
+--- @return boolean          # Whether to skip reporting this percentage
+local function progress_ratelimit(step, percent)
+    if progress_reported.step == step and math.floor(progress_reported.percent / 5) == math.floor(percent / 5) then
+        return true
+    end
+    progress_reported.step, progress_reported.percent = step, percent
+    return false
+end
+
+
 --- Progress thread callback handling progress reporting to remote.
 --
 -- Deliberately just uploading the JSON content while not respecting
@@ -271,7 +292,7 @@ function progress_callback(message)
     local logmessage
     if message.dwl_percent > 0 and message.dwl_percent <= 100 and message.cur_step == 0 then
         -- Rate limit progress messages sent to server.
-        if message.dwl_percent % 5 ~= 0 then
+        if progress_ratelimit(0, message.dwl_percent) then
             return suricatta.status.OK
         end
         if gs.job.typ == jobtype.INSTALL then
@@ -285,7 +306,7 @@ function progress_callback(message)
         end
     elseif message.dwl_percent == 100 and message.cur_step > 0 then
         -- Rate limit progress messages sent to server.
-        if message.cur_percent % 5 ~= 0 then
+        if progress_ratelimit(message.cur_step, message.cur_percent) then
             return suricatta.status.OK
         end
         logmessage = escape(
@@ -9,8 +9,8 @@
 #include <stdio.h>
 #include <util.h>
 #include <handler.h>
-#include <blkid/blkid.h>
 #include <fs_interface.h>
+#include <blkdev_cache.h>
 
 #if defined(CONFIG_EXT_FILESYSTEM)
 static inline int ext_mkfs_short(const char *device_name, const char *fstype)
@@ -45,33 +45,7 @@ static struct supported_filesystems fs[] = {
 
 char *diskformat_fs_detect(char *device)
 {
-	const char *value;
-	char *s = NULL;
-	size_t len;
-	blkid_probe pr;
-
-	pr = blkid_new_probe_from_filename(device);
-
-	if (!pr) {
-		ERROR("%s: failed to create libblkid probe",
-			  device);
-		return NULL;
-	}
-
-	while (blkid_do_probe(pr) == 0) {
-		if (blkid_probe_lookup_value(pr, "TYPE", &value, &len)) {
-			ERROR("blkid_probe_lookup_value failed");
-			break;
-		}
-
-		if (len > 0) {
-			s = strndup(value, len);
-			break;
-		}
-	}
-	blkid_free_probe(pr);
-
-	return s;
+	return blkdev_cache_get_tag(device, "TYPE");
 }
 
 int diskformat_fs_exists(char *device, char *fstype)
@@ -108,6 +82,7 @@ int diskformat_mkfs(char *device, char *fstype)
 
 	TRACE("Creating %s file system on %s", fstype, device);
 	ret = fs[index].mkfs(device, fstype);
+	blkdev_cache_invalidate(device);
 
 	if (ret) {
 		ERROR("creating %s file system on %s failed. %d",
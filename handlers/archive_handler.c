@@ -9,6 +9,7 @@
 #include <locale.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/xattr.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -37,8 +38,14 @@ pthread_t extract_thread;
 struct extract_data {
 	int flags;
 	int exitval;
+	bool incremental;
+	bool check_content;
+	unsigned int written;
+	unsigned int unchanged;
 };
 
+#define COMPARE_BUF_SIZE	(64 * 1024)
+
 static int
 copy_data(struct archive *ar, struct archive *aw, struct archive_entry *entry)
 {
@@ -77,6 +84,255 @@ copy_data(struct archive *ar, struct archive *aw, struct archive_entry *entry)
 	}
 }
 
+/*
+ * Extended attributes, ACLs and file flags are only restored by
+ * archive_write_disk, so a file is kept only if there is nothing
+ * to restore: the xattrs on disk are the ones in the entry, and
+ * neither the entry nor the file carry ACLs, and the entry has no
+ * file flags. The "system." namespace holds the ACLs on Linux and
+ * is checked with them.
+ */
+static bool attrs_unchanged(int fd, struct archive_entry *entry, int flags)
+{
+	const char *name;
+	const void *value;
+	size_t size;
+	char *names = NULL, *buf = NULL, *p;
+	ssize_t len, n;
+	unsigned long set, clear;
+	int count;
+	bool ret = false;
+
+	if (flags & ARCHIVE_EXTRACT_FFLAGS) {
+		archive_entry_fflags(entry, &set, &clear);
+		if (set || clear)
+			return false;
+	}
+
+	if (flags & ARCHIVE_EXTRACT_ACL) {
+		if (archive_entry_acl_count(entry, ARCHIVE_ENTRY_ACL_TYPE_ACCESS |
+						   ARCHIVE_ENTRY_ACL_TYPE_DEFAULT |
+						   ARCHIVE_ENTRY_ACL_TYPE_NFS4))
+			return false;
+		if (fgetxattr(fd, "system.posix_acl_access", NULL, 0) >= 0 ||
+		    fgetxattr(fd, "system.nfs4_acl", NULL, 0) >= 0)
+			return false;
+	}
+
+	if (!(flags & ARCHIVE_EXTRACT_XATTR))
+		return true;
+
+	len = flistxattr(fd, NULL, 0);
+	if (len < 0)
+		return errno == ENOTSUP && !archive_entry_xattr_count(entry);
+	if (len) {
+		names = malloc(len);
+		if (!names)
+			return false;
+		len = flistxattr(fd, names, len);
+		if (len < 0)
+			goto out;
+	}
+
+	/* every xattr on disk must be in the entry with the same value */
+	count = 0;
+	for (p = names; p < names + len; p += strlen(p) + 1) {
+		bool found = false;
+
+		if (!strncmp(p, "system.", 7))
+			continue;
+		count++;
+		archive_entry_xattr_reset(entry);
+		while (archive_entry_xattr_next(entry, &name, &value, &size) ==
+		       ARCHIVE_OK) {
+			if (strcmp(name, p))
+				continue;
+			free(buf);
+			buf = malloc(size ? size : 1);
+			if (!buf)
+				goto out;
+			n = fgetxattr(fd, p, buf, size);
+			found = n >= 0 && (size_t)n == size &&
+				!memcmp(buf, value, size);
+			break;
+		}
+		if (!found)
+			goto out;
+	}
+	/* and nothing more in the entry */
+	ret = count == archive_entry_xattr_count(entry);
+
+out:
+	free(buf);
+	free(names);
+	return ret;
+}
+
+/*
+ * Regular file already on disk that may be kept: same type and size,
+ * the same mtime unless the content is compared, and no extended
+ * attributes to restore. Returns it open for reading, or -1 if it
+ * must be extracted.
+ */
+static int open_unchanged(struct extract_data *data, struct archive_entry *entry)
+{
+	const char *name = archive_entry_pathname(entry);
+	struct stat st;
+	int fd;
+
+	if (archive_entry_filetype(entry) != AE_IFREG ||
+	    archive_entry_hardlink(entry) || !archive_entry_size_is_set(entry))
+		return -1;
+	if (lstat(name, &st) || !S_ISREG(st.st_mode) ||
+	    st.st_size != archive_entry_size(entry))
+		return -1;
+	/* the executable bits are always extracted */
+	if (!(data->flags & ARCHIVE_EXTRACT_PERM) &&
+	    (st.st_mode & 0111) != (archive_entry_perm(entry) & 0111))
+		return -1;
+	if (!data->check_content &&
+	    (!archive_entry_mtime_is_set(entry) ||
+	     st.st_mtim.tv_sec != archive_entry_mtime(entry) ||
+	     (archive_entry_mtime_nsec(entry) &&
+	      st.st_mtim.tv_nsec != archive_entry_mtime_nsec(entry))))
+		return -1;
+
+	fd = open(name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (!attrs_unchanged(fd, entry, data->flags)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * The existing file is kept: fix up its metadata the way
+ * archive_write_disk would have done it.
+ */
+static int fixup_unchanged(int fd, struct archive_entry *entry, int flags)
+{
+	const char *name = archive_entry_pathname(entry);
+	struct timespec times[2] = {
+		{ .tv_nsec = UTIME_OMIT },
+		{ .tv_nsec = UTIME_OMIT },
+	};
+
+	if ((flags & ARCHIVE_EXTRACT_OWNER) &&
+	    fchown(fd, archive_entry_uid(entry), archive_entry_gid(entry))) {
+		ERROR("Cannot set owner of %s: %s", name, strerror(errno));
+		return -EFAULT;
+	}
+	if ((flags & ARCHIVE_EXTRACT_PERM) &&
+	    fchmod(fd, archive_entry_perm(entry))) {
+		ERROR("Cannot set mode of %s: %s", name, strerror(errno));
+		return -EFAULT;
+	}
+	if (flags & ARCHIVE_EXTRACT_TIME) {
+		if (archive_entry_atime_is_set(entry)) {
+			times[0].tv_sec = archive_entry_atime(entry);
+			times[0].tv_nsec = archive_entry_atime_nsec(entry);
+		}
+		if (archive_entry_mtime_is_set(entry)) {
+			times[1].tv_sec = archive_entry_mtime(entry);
+			times[1].tv_nsec = archive_entry_mtime_nsec(entry);
+		}
+		if (futimens(fd, times)) {
+			ERROR("Cannot set times of %s: %s", name, strerror(errno));
+			return -EFAULT;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Compare the data of the entry with the file open in fd. On the first
+ * difference the entry is written, its head taken from the old file
+ * that stays readable through fd after archive_write_header() has
+ * replaced it. *written tells which of the two happened.
+ */
+static int
+compare_data(struct archive *ar, struct archive *aw, struct archive_entry *entry,
+	     int fd, bool *written)
+{
+	const char *name = archive_entry_pathname(entry);
+	unsigned char *old;
+	const void *buff;
+	size_t size, n;
+	int64_t pos = 0, offset;
+	ssize_t len;
+	int r;
+
+	*written = false;
+	old = malloc(COMPARE_BUF_SIZE);
+	if (!old)
+		return ARCHIVE_FATAL;
+
+	for (;;) {
+		r = archive_read_data_block(ar, &buff, &size, &offset);
+		if (r == ARCHIVE_EOF) {
+			free(old);
+			return ARCHIVE_OK;
+		}
+		if (r != ARCHIVE_OK && r != ARCHIVE_WARN) {
+			ERROR("archive_read_data_block(): %s for '%s': %s",
+			      archive_error_string(ar), name,
+			      strerror(archive_errno(ar)));
+			free(old);
+			return r;
+		}
+
+		/* tar sparse entries have holes, just rewrite them */
+		for (n = 0; offset == pos && n < size; n += len) {
+			len = pread(fd, old, min_t(size_t, size - n, COMPARE_BUF_SIZE),
+				    pos + n);
+			if (len <= 0 || memcmp(old, (const char *)buff + n, len))
+				break;
+		}
+		if (offset == pos && n == size) {
+			pos += size;
+			continue;
+		}
+		break;
+	}
+
+	if (debug)
+		TRACE("%s differs at %lld", name, (long long)pos);
+	*written = true;
+	r = archive_write_header(aw, entry);
+	if (r != ARCHIVE_OK) {
+		ERROR("archive_write_header(): %s: %s",
+		      archive_error_string(aw), strerror(archive_errno(aw)));
+		free(old);
+		return r;
+	}
+	for (int64_t done = 0; done < pos; done += len) {
+		len = pread(fd, old, min_t(int64_t, pos - done, COMPARE_BUF_SIZE), done);
+		if (len <= 0) {
+			ERROR("Cannot read back %s: %s", name, strerror(errno));
+			free(old);
+			return ARCHIVE_FATAL;
+		}
+		r = archive_write_data_block(aw, old, len, done);
+		if (r != ARCHIVE_OK)
+			break;
+	}
+	free(old);
+	if (r == ARCHIVE_OK)
+		r = archive_write_data_block(aw, buff, size, offset);
+	if (r != ARCHIVE_OK) {
+		ERROR("archive_write_data_block(): %s for '%s': %s",
+		      archive_error_string(aw), name,
+		      strerror(archive_errno(aw)));
+		return r;
+	}
+
+	return copy_data(ar, aw, entry);
+}
+
 static void *
 extract(void *p)
 {
@@ -88,6 +344,7 @@ extract(void *p)
 	struct archive *ext = NULL;
 	struct archive_entry *entry = NULL;
 	int r;
+	int fd;
 	int flags;
 	struct extract_data *data = (struct extract_data *)p;
 	flags = data->flags;
@@ -171,17 +428,43 @@ extract(void *p)
 		if (debug)
 			TRACE("Extracting %s", archive_entry_pathname(entry));
 
-		r = archive_write_header(ext, entry);
-		if (r != ARCHIVE_OK) {
-			ERROR("archive_write_header(): %s: %s",
-			      archive_error_string(ext),
-			      strerror(archive_errno(ext)));
-			goto out;
+		fd = data->incremental ? open_unchanged(data, entry) : -1;
+		if (fd >= 0 && !data->check_content) {
+			r = fixup_unchanged(fd, entry, flags);
+			close(fd);
+			if (r)
+				goto out;
+			data->unchanged++;
+			continue;
 		}
+		if (fd >= 0) {
+			bool written;
+
+			r = compare_data(a, ext, entry, fd, &written);
+			if (r == ARCHIVE_OK && !written &&
+			    fixup_unchanged(fd, entry, flags))
+				r = ARCHIVE_FATAL;
+			close(fd);
+			if (r != ARCHIVE_OK)
+				goto out;
+			if (!written) {
+				data->unchanged++;
+				continue;
+			}
+		} else {
+			r = archive_write_header(ext, entry);
+			if (r != ARCHIVE_OK) {
+				ERROR("archive_write_header(): %s: %s",
+				      archive_error_string(ext),
+				      strerror(archive_errno(ext)));
+				goto out;
+			}
 
-		r = copy_data(a, ext, entry);
-		if (r != ARCHIVE_OK)
-			goto out; /* warning already printed in copy_data() */
+			r = copy_data(a, ext, entry);
+			if (r != ARCHIVE_OK)
+				goto out; /* warning already printed in copy_data() */
+		}
+		data->written++;
 
 		r = archive_write_finish_entry(ext);
 		if (r != ARCHIVE_OK)  {
@@ -223,6 +506,132 @@ out:
 	pthread_exit(NULL);
 }
 
+/*
+ * Remove path relative to the directory dirfd without following
+ * symlinks: each parent is opened with O_NOFOLLOW, so that the entry
+ * removed is always beneath dirfd. A symlink as last component is
+ * removed itself. Returns 0 or -errno, -ELOOP if a parent is a
+ * symlink or not a directory.
+ */
+static int remove_beneath(int dirfd, const char *path)
+{
+	char *name, *next, *saveptr;
+	char *p = strdupa(path);
+	int cur = dirfd, fd;
+	int ret = 0;
+
+	name = strtok_r(p, "/", &saveptr);
+	while (name && (next = strtok_r(NULL, "/", &saveptr))) {
+		if (strcmp(name, ".")) {
+			fd = openat(cur, name,
+				    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+			if (fd < 0) {
+				ret = (errno == ELOOP || errno == ENOTDIR) ?
+					-ELOOP : -errno;
+				goto out;
+			}
+			if (cur != dirfd)
+				close(cur);
+			cur = fd;
+		}
+		name = next;
+	}
+
+	/* the destination itself is not removed */
+	if (!name || !strcmp(name, ".")) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (unlinkat(cur, name, 0) &&
+	    (errno != EISDIR || unlinkat(cur, name, AT_REMOVEDIR)))
+		ret = -errno;
+
+out:
+	if (cur != dirfd)
+		close(cur);
+
+	return ret;
+}
+
+/*
+ * Remove the entries listed in the file name (extracted before in
+ * TMPDIR), one path relative to the destination (the current
+ * directory) per line. Directories are removed only if empty.
+ */
+static int remove_listed(const char *name)
+{
+	char *fname = NULL, *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	unsigned int removed = 0;
+	int ret = 0, err;
+	int dirfd;
+	FILE *fp;
+
+	if (asprintf(&fname, "%s%s", get_tmpdir(), name) == ENOMEM_ASPRINTF) {
+		ERROR("Path too long: %s", get_tmpdir());
+		return -ENOMEM;
+	}
+	fp = fopen(fname, "r");
+	if (!fp) {
+		ERROR("Cannot open %s: %s", fname, strerror(errno));
+		free(fname);
+		return -ENOENT;
+	}
+	dirfd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		ERROR("Cannot open destination directory: %s", strerror(errno));
+		fclose(fp);
+		free(fname);
+		return -EFAULT;
+	}
+
+	while ((len = getline(&line, &size, fp)) > 0) {
+		char *path = line;
+
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		while (*path == '/')
+			path++;
+		if (!*path || *path == '#')
+			continue;
+		if (!strcmp(path, "..") || !strncmp(path, "../", 3) ||
+		    strstr(path, "/../") || (len >= 3 && !strcmp(line + len - 3, "/.."))) {
+			ERROR("%s: refusing to remove %s", name, path);
+			ret = -EINVAL;
+			break;
+		}
+		err = remove_beneath(dirfd, path);
+		if (err) {
+			if (err == -ENOENT)
+				continue;
+			if (err == -ENOTEMPTY || err == -EEXIST) {
+				WARN("%s not removed, directory not empty", path);
+				continue;
+			}
+			if (err == -ELOOP)
+				ERROR("%s: refusing to remove %s, a parent is a symlink "
+				      "or not a directory", name, path);
+			else
+				ERROR("Cannot remove %s: %s", path, strerror(-err));
+			ret = err == -ELOOP ? -EINVAL : -EFAULT;
+			break;
+		}
+		if (debug)
+			TRACE("Removed %s", path);
+		removed++;
+	}
+
+	if (!ret)
+		INFO("%u entries removed as listed in %s", removed, name);
+	close(dirfd);
+	free(line);
+	fclose(fp);
+	free(fname);
+
+	return ret;
+}
+
 static int install_archive_image(struct img_type *img,
 	void __attribute__ ((__unused__)) *data)
 {
@@ -238,6 +647,7 @@ static int install_archive_image(struct img_type *img,
 	int exitval = -EFAULT;
 	char *DATADST_DIR = NULL;
 	char *FIFO = NULL;
+	char *incr_check, *remove_list;
 
 	if (strlen(img->path) == 0) {
 		ERROR("Missing path attribute");
@@ -317,8 +727,21 @@ static int install_archive_image(struct img_type *img,
 		img->fname, path,
 		img->preserve_attributes ? "preserving" : "ignoring");
 
-	tf.flags = 0;
+	memset(&tf, 0, sizeof(tf));
 	tf.exitval = -EFAULT;
+	tf.incremental = strtobool(dict_get_value(&img->properties, "incremental"));
+	incr_check = dict_get_value(&img->properties, "incremental-check");
+	if (!incr_check || !strcmp(incr_check, "mtime")) {
+		tf.check_content = false;
+	} else if (!strcmp(incr_check, "content")) {
+		tf.check_content = true;
+	} else {
+		ERROR("Unknown incremental-check %s", incr_check);
+		exitval = -EINVAL;
+		goto out;
+	}
+	if (tf.incremental && !tf.check_content && !img->preserve_attributes)
+		WARN("incremental without preserve-attributes never finds unchanged files");
 
 	if (img->preserve_attributes) {
 		tf.flags |= ARCHIVE_EXTRACT_OWNER | ARCHIVE_EXTRACT_PERM |
@@ -367,8 +790,16 @@ out:
 			ERROR("copyimage status code is %d", tf.exitval);
 			exitval = -EFAULT;
 		}
+		else if (tf.incremental) {
+			INFO("%s: %u entries written, %u unchanged",
+			     img->fname, tf.written, tf.unchanged);
+		}
 	}
 
+	remove_list = dict_get_value(&img->properties, "incremental-remove");
+	if (!exitval && remove_list && remove_listed(remove_list))
+		exitval = -EFAULT;
+
 	if (pwd[0]) {
 		ret = chdir(pwd);
 		if (ret) {
@@ -397,7 +828,7 @@ __attribute__((constructor))
 void archive_handler(void)
 {
 	register_handler("archive", install_archive_image,
-				IMAGE_HANDLER | FILE_HANDLER, NULL);
+				IMAGE_HANDLER | FILE_HANDLER | STREAM_INPUT_HANDLER, NULL);
 }
 
 /* This is an alias for the parsers */
@@ -405,5 +836,5 @@ __attribute__((constructor))
 void untar_handler(void)
 {
 	register_handler("tar", install_archive_image,
-				IMAGE_HANDLER | FILE_HANDLER, NULL);
+				IMAGE_HANDLER | FILE_HANDLER | STREAM_INPUT_HANDLER, NULL);
 }
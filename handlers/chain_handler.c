@@ -13,12 +13,25 @@
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <unistd.h>
 #include "chained_handler.h"
+#include "bufstream.h"
+#include "handler.h"
 #include "installer.h"
 #include "pctl.h"
 #include "util.h"
 
+#define PIPE_READ  0
+#define PIPE_WRITE 1
+
+/*
+ * Four buffers keep producer and consumer running
+ * while the other one is busy
+ */
+#define CHAIN_STREAM_BUFFERS	4
+#define CHAIN_STREAM_BUFSIZE	(256 * 1024)
+
 /*
  * Thread to start the chained handler.
  * This received from FIFO the reassembled stream with
@@ -31,7 +44,7 @@ void *chain_handler_thread(void *data)
 	unsigned long ret;
 
 	thread_ready();
-	if (img->fdin < 0) {
+	if (img->fdin < 0 && !img->stream) {
 		return (void *)1;
 	}
 
@@ -40,10 +53,104 @@ void *chain_handler_thread(void *data)
 
 	if (ret) {
 		ERROR("Chain handler return with Error");
-		close(img->fdin);
+		if (!img->stream)
+			close(img->fdin);
 	}
 
+	/* The producer must not wait for a consumer that is gone */
+	if (img->stream)
+		bufstream_abort(img->stream);
+
 	return (void *)ret;
 }
 
+/*
+ * Start the handler set in priv->img.type in its own
+ * thread, data are then passed with chain_handler_write()
+ */
+int chain_handler_start(struct chain_handler_data *priv)
+{
+	int pipes[2];
+
+	priv->stream = NULL;
+	priv->fdout = -1;
+	priv->img.stream = NULL;
+	priv->img.fdin = -1;
+
+	if (get_handler_mask(&priv->img) & STREAM_INPUT_HANDLER)
+		priv->stream = bufstream_new(CHAIN_STREAM_BUFFERS, CHAIN_STREAM_BUFSIZE);
+
+	if (priv->stream) {
+		priv->img.stream = priv->stream;
+	} else {
+		if (pipe(pipes) < 0) {
+			ERROR("Could not create pipes for chained handler, existing...");
+			return -EFAULT;
+		}
+		priv->img.fdin = pipes[PIPE_READ];
+		priv->fdout = pipes[PIPE_WRITE];
+		signal(SIGPIPE, SIG_IGN);
+	}
+
+	priv->thread = start_thread(chain_handler_thread, priv);
+	wait_threads_ready();
+
+	return 0;
+}
+
+/*
+ * writeimage callback, out is the struct chain_handler_data
+ */
+int chain_handler_write(void *out, const void *buf, size_t len)
+{
+	struct chain_handler_data *priv = (struct chain_handler_data *)out;
+
+	if (priv->stream)
+		return bufstream_write(priv->stream, buf, len);
+
+	return copy_write(&priv->fdout, buf, len);
+}
+
+/*
+ * Signal the end of data to the chained handler
+ */
+void chain_handler_close(struct chain_handler_data *priv)
+{
+	if (priv->stream) {
+		bufstream_close(priv->stream);
+	} else if (priv->fdout >= 0) {
+		close(priv->fdout);
+		priv->fdout = -1;
+	}
+}
 
+/*
+ * Wait for the chained handler and return its result,
+ * with err set the chained handler is stopped
+ */
+int chain_handler_finish(struct chain_handler_data *priv, int err)
+{
+	void *status;
+	int ret;
+
+	if (err && priv->stream)
+		bufstream_abort(priv->stream);
+	chain_handler_close(priv);
+
+	ret = pthread_join(priv->thread, &status);
+	if (ret) {
+		ERROR("return code from pthread_join() is %d", ret);
+	} else
+		ret = (unsigned long)status;
+
+	if (priv->stream) {
+		bufstream_free(priv->stream);
+		priv->stream = NULL;
+		priv->img.stream = NULL;
+	} else if (!ret) {
+		/* on error, the chained handler has already closed it */
+		close(priv->img.fdin);
+	}
+
+	return err ? err : ret;
+}
@@ -0,0 +1,379 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "sslapi.h"
+#include "util.h"
+#include "chunk_store.h"
+
+#define DIGEST_LEN	(SHA256_HASH_LENGTH * 2)
+#define STORE_BUF_SIZE	(64 * 1024)
+
+struct chunk_entry {
+	char name[DIGEST_LEN + 1];
+	unsigned long long size;
+	struct timespec used;		/* mtime, updated on use */
+	bool pinned;			/* needed by the running update */
+};
+
+struct chunk_store {
+	char *dir;
+	int dirfd;
+	unsigned long long max_size;
+	unsigned long long size;
+	struct chunk_entry *entries;	/* sorted by name */
+	size_t count;
+	size_t alloc;
+	/* statistics */
+	unsigned int hits;
+	unsigned int added;
+	unsigned int evicted;
+};
+
+static bool is_digest(const char *s)
+{
+	size_t i;
+
+	for (i = 0; i < DIGEST_LEN; i++) {
+		if (!((s[i] >= '0' && s[i] <= '9') || (s[i] >= 'a' && s[i] <= 'f')))
+			return false;
+	}
+
+	return s[i] == '\0';
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+	return strcmp(((const struct chunk_entry *)a)->name,
+		      ((const struct chunk_entry *)b)->name);
+}
+
+static int cmp_used(const void *a, const void *b)
+{
+	const struct timespec *t1 = &(*(struct chunk_entry * const *)a)->used;
+	const struct timespec *t2 = &(*(struct chunk_entry * const *)b)->used;
+
+	if (t1->tv_sec != t2->tv_sec)
+		return t1->tv_sec < t2->tv_sec ? -1 : 1;
+	return (t1->tv_nsec > t2->tv_nsec) - (t1->tv_nsec < t2->tv_nsec);
+}
+
+static struct chunk_entry *find_entry(struct chunk_store *cs, const char *digest)
+{
+	struct chunk_entry key;
+
+	if (!cs->count || !is_digest(digest))
+		return NULL;
+	strlcpy(key.name, digest, sizeof(key.name));
+
+	return bsearch(&key, cs->entries, cs->count, sizeof(key), cmp_name);
+}
+
+static void remove_entry(struct chunk_store *cs, struct chunk_entry *e)
+{
+	if (unlinkat(cs->dirfd, e->name, 0) && errno != ENOENT)
+		WARN("Cannot remove chunk %s: %s", e->name, strerror(errno));
+	cs->size -= e->size;
+	cs->count--;
+	memmove(e, e + 1, (cs->entries + cs->count - e) * sizeof(*e));
+}
+
+/*
+ * Drop least recently used chunks until there is room for
+ * needed bytes within the budget
+ */
+static void evict(struct chunk_store *cs, unsigned long long needed)
+{
+	char (*names)[DIGEST_LEN + 1];
+	struct chunk_entry **lru;
+	unsigned long long size = cs->size;
+	size_t i, n = 0;
+
+	if (cs->size + needed <= cs->max_size || !cs->count)
+		return;
+
+	lru = calloc(cs->count, sizeof(*lru));
+	names = calloc(cs->count, sizeof(*names));
+	if (!lru || !names) {
+		free(lru);
+		free(names);
+		return;
+	}
+	for (i = 0; i < cs->count; i++)
+		lru[i] = &cs->entries[i];
+	qsort(lru, cs->count, sizeof(*lru), cmp_used);
+
+	/* entries move while they are removed, collect the names first */
+	for (i = 0; i < cs->count && size + needed > cs->max_size; i++) {
+		if (lru[i]->pinned)
+			continue;
+		size -= lru[i]->size;
+		strlcpy(names[n++], lru[i]->name, sizeof(names[0]));
+	}
+	free(lru);
+
+	for (i = 0; i < n; i++) {
+		remove_entry(cs, find_entry(cs, names[i]));
+		cs->evicted++;
+	}
+	free(names);
+}
+
+static struct chunk_entry *insert_entry(struct chunk_store *cs, const char *digest)
+{
+	struct chunk_entry *e;
+	size_t pos;
+
+	if (cs->count == cs->alloc) {
+		size_t alloc = cs->alloc ? cs->alloc * 2 : 256;
+
+		e = realloc(cs->entries, alloc * sizeof(*e));
+		if (!e)
+			return NULL;
+		cs->entries = e;
+		cs->alloc = alloc;
+	}
+
+	for (pos = cs->count; pos && strcmp(cs->entries[pos - 1].name, digest) > 0; pos--)
+		;
+	e = &cs->entries[pos];
+	memmove(e + 1, e, (cs->count - pos) * sizeof(*e));
+	cs->count++;
+	memset(e, 0, sizeof(*e));
+	strlcpy(e->name, digest, sizeof(e->name));
+
+	return e;
+}
+
+struct chunk_store *chunk_store_open(const char *dir, unsigned long long max_size)
+{
+	struct chunk_store *cs;
+	struct dirent *de;
+	struct stat st;
+	char *path;
+	DIR *d;
+
+#ifndef CONFIG_HASH_VERIFY
+	ERROR("Chunk store %s not available, chunks cannot be verified without hashes", dir);
+	return NULL;
+#endif
+	path = strdup(dir);
+	if (!path || mkpath(path, 0700)) {
+		ERROR("Chunk store %s cannot be created", dir);
+		free(path);
+		return NULL;
+	}
+
+	cs = calloc(1, sizeof(*cs));
+	if (!cs) {
+		free(path);
+		return NULL;
+	}
+	cs->dir = path;
+	cs->max_size = max_size;
+	cs->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	d = cs->dirfd < 0 ? NULL : fdopendir(dup(cs->dirfd));
+	if (!d) {
+		ERROR("Chunk store %s cannot be opened: %s", dir, strerror(errno));
+		chunk_store_close(cs);
+		return NULL;
+	}
+
+	while ((de = readdir(d))) {
+		struct chunk_entry *e;
+
+		if (de->d_name[0] == '.') {
+			/* leftover of an interrupted write */
+			if (!strncmp(de->d_name, ".tmp-", 5))
+				unlinkat(cs->dirfd, de->d_name, 0);
+			continue;
+		}
+		if (!is_digest(de->d_name) ||
+		    fstatat(cs->dirfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) ||
+		    !S_ISREG(st.st_mode))
+			continue;
+		if (cs->count == cs->alloc) {
+			e = realloc(cs->entries, (cs->alloc ? cs->alloc * 2 : 256) * sizeof(*e));
+			if (!e)
+				break;
+			cs->entries = e;
+			cs->alloc = cs->alloc ? cs->alloc * 2 : 256;
+		}
+		e = &cs->entries[cs->count++];
+		memset(e, 0, sizeof(*e));
+		strlcpy(e->name, de->d_name, sizeof(e->name));
+		e->size = st.st_size;
+		e->used = st.st_mtim;
+		cs->size += st.st_size;
+	}
+	closedir(d);
+	if (cs->count)
+		qsort(cs->entries, cs->count, sizeof(*cs->entries), cmp_name);
+
+	TRACE("Chunk store %s: %zu chunks, %llu bytes, budget %llu bytes",
+	      dir, cs->count, cs->size, cs->max_size);
+	/* the budget may have been reduced */
+	evict(cs, 0);
+
+	return cs;
+}
+
+static void touch_entry(struct chunk_entry *e, int fd)
+{
+	struct timespec times[2] = {
+		{ .tv_nsec = UTIME_OMIT },
+		{ .tv_nsec = UTIME_NOW },
+	};
+	struct stat st;
+
+	if (!futimens(fd, times) && !fstat(fd, &st))
+		e->used = st.st_mtim;
+}
+
+/* Check the data of a chunk against its name */
+static bool verify_chunk(int fd, const char *digest)
+{
+	unsigned char hash[SHA256_HASH_LENGTH], md[SHA256_HASH_LENGTH];
+	struct swupdate_digest *dgst;
+	unsigned char *buf;
+	unsigned int mdlen;
+	ssize_t n;
+	bool ok = false;
+
+	if (ascii_to_hash(hash, digest))
+		return false;
+	dgst = swupdate_HASH_init(SHA_DEFAULT);
+	buf = malloc(STORE_BUF_SIZE);
+	if (!dgst || !buf)
+		goto out;
+
+	while ((n = read(fd, buf, STORE_BUF_SIZE)) > 0) {
+		if (swupdate_HASH_update(dgst, buf, n))
+			goto out;
+	}
+	if (n < 0 || swupdate_HASH_final(dgst, md, &mdlen) != 1)
+		goto out;
+	ok = !swupdate_HASH_compare(hash, md);
+
+out:
+	free(buf);
+	if (dgst)
+		swupdate_HASH_cleanup(dgst);
+	return ok;
+}
+
+bool chunk_store_lookup(struct chunk_store *cs, const char *digest, size_t len)
+{
+	struct chunk_entry *e;
+	int fd;
+
+	if (!cs)
+		return false;
+	e = find_entry(cs, digest);
+	if (!e)
+		return false;
+
+	fd = openat(cs->dirfd, e->name, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0 && e->size == len && verify_chunk(fd, digest)) {
+		touch_entry(e, fd);
+		close(fd);
+		e->pinned = true;
+		cs->hits++;
+		return true;
+	}
+
+	WARN("Chunk %s in store is damaged, dropped", digest);
+	if (fd >= 0)
+		close(fd);
+	remove_entry(cs, e);
+
+	return false;
+}
+
+int chunk_store_open_chunk(struct chunk_store *cs, const char *digest)
+{
+	struct chunk_entry *e = cs ? find_entry(cs, digest) : NULL;
+
+	if (!e)
+		return -1;
+
+	return openat(cs->dirfd, e->name, O_RDONLY | O_CLOEXEC);
+}
+
+int chunk_store_add(struct chunk_store *cs, const char *digest,
+		    const void *buf, size_t len)
+{
+	char tmp[DIGEST_LEN + 6];
+	struct chunk_entry *e;
+	struct stat st;
+	int fd, ret = 0;
+
+	if (!cs || !is_digest(digest))
+		return -EINVAL;
+	if (len > cs->max_size)
+		return 0;
+	e = find_entry(cs, digest);
+	if (e)
+		return 0;
+
+	evict(cs, len);
+
+	/* written aside and renamed, a chunk in the store is always complete */
+	snprintf(tmp, sizeof(tmp), ".tmp-%s", digest);
+	fd = openat(cs->dirfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		ERROR("Cannot add chunk to %s: %s", cs->dir, strerror(errno));
+		return -EIO;
+	}
+	if (copy_write(&fd, buf, len) || fstat(fd, &st))
+		ret = -EIO;
+	close(fd);
+	if (!ret && renameat(cs->dirfd, tmp, cs->dirfd, digest))
+		ret = -EIO;
+	if (ret) {
+		WARN("Cannot add chunk %s to %s", digest, cs->dir);
+		unlinkat(cs->dirfd, tmp, 0);
+		return ret;
+	}
+
+	e = insert_entry(cs, digest);
+	if (!e)
+		return -ENOMEM;
+	e->size = len;
+	e->used = st.st_mtim;
+	cs->size += len;
+	cs->added++;
+
+	return 0;
+}
+
+void chunk_store_close(struct chunk_store *cs)
+{
+	if (!cs)
+		return;
+
+	if (cs->dirfd >= 0) {
+		for (size_t i = 0; i < cs->count; i++)
+			cs->entries[i].pinned = false;
+		evict(cs, 0);
+		INFO("Chunk store %s: %u chunks reused, %u added, %u evicted, %llu bytes used",
+		     cs->dir, cs->hits, cs->added, cs->evicted, cs->size);
+		close(cs->dirfd);
+	}
+	free(cs->entries);
+	free(cs->dir);
+	free(cs);
+}
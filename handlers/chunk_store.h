@@ -0,0 +1,36 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Directory of chunks kept across updates, each one in a file named
+ * after the SHA-256 of its data. When the directory exceeds its size
+ * budget, the least recently used chunks are removed.
+ */
+struct chunk_store;
+
+struct chunk_store *chunk_store_open(const char *dir, unsigned long long max_size);
+
+/*
+ * Tell if the chunk with the given digest (hex string) and size is in
+ * the store. Its data are checked against the digest, a damaged chunk
+ * is dropped. A chunk found is marked as used.
+ */
+bool chunk_store_lookup(struct chunk_store *cs, const char *digest, size_t len);
+
+/* Open a chunk for reading, -1 if it is not in the store */
+int chunk_store_open_chunk(struct chunk_store *cs, const char *digest);
+
+/* Add a chunk, older chunks are evicted if the budget is exceeded */
+int chunk_store_add(struct chunk_store *cs, const char *digest,
+		    const void *buf, size_t len);
+
+void chunk_store_close(struct chunk_store *cs);
@@ -17,6 +17,8 @@
 #include <libgen.h>
 #include <mtd/mtd-user.h>
 #include <ftw.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
 #ifdef __FreeBSD__
 #include <sys/disk.h>
 // the ioctls are almost identical except for the name, just alias it
@@ -33,8 +35,8 @@
 #include "chained_handler.h"
 #include "installer.h"
 
-#define PIPE_READ  0
-#define PIPE_WRITE 1
+#define FAST_COPY_CHUNK		(16 * 1024 * 1024)
+#define MAX_COPY_THREADS	16
 
 static void copy_handler(void);
 static void raw_copyimage_handler(void);
@@ -43,16 +45,205 @@ char *copyfrom;
 struct img_type *base_img;
 char *chained_handler;
 
+/*
+ * Files found by a recursive copy that can be copied
+ * in parallel by the fast path
+ */
+struct copy_entry {
+	char *src;
+	char *dst;
+	SIMPLEQ_ENTRY(copy_entry) next;
+};
+SIMPLEQ_HEAD(copy_list, copy_entry);
+
+static struct copy_list copy_queue;
+static bool copy_parallel;
+static pthread_mutex_t copy_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t chain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Check if a block device has a force_ro flag set, like
+ * eMMC boot partitions. These are handled by the raw handler.
+ */
+static bool is_force_ro(const char *device)
+{
+	char abs_path[PATH_MAX];
+	char *sysfs_path;
+	char prot = '0';
+	int fd;
+
+	if (!realpath(device, abs_path) || strncmp(abs_path, "/dev/", 5))
+		return false;
+	if (asprintf(&sysfs_path, "/sys/class/block/%s/force_ro", abs_path + 5) < 0)
+		return false;
+	fd = open(sysfs_path, O_RDONLY);
+	free(sysfs_path);
+	if (fd < 0)
+		return false;
+	if (read(fd, &prot, 1) != 1)
+		prot = '0';
+	close(fd);
+
+	return prot == '1';
+}
+
+/*
+ * Properties of raw and rawfile that change how the data is
+ * written, the fast path does not implement them
+ */
+static const char *fast_copy_unsupported[] = {
+	"atomic-install",
+	"compare",
+	"sparse",
+	"verity",
+};
+
+/*
+ * The fast path replaces the chained handler for raw and rawfile
+ * when they would just write the data, so that the kernel can copy
+ * (or reflink) without passing data through a pipe.
+ */
+static bool fast_copy_allowed(struct img_type *img, const char *chained)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fast_copy_unsupported); i++)
+		if (dict_get_value(&img->properties, fast_copy_unsupported[i]))
+			return false;
+
+	if (!strcmp(chained, "rawfile"))
+		return strlen(img->path) &&
+			!(strlen(img->device) && strlen(img->filesystem));
+
+	if (!strcmp(chained, "raw"))
+		return strlen(img->device) && !is_force_ro(img->device);
+
+	return false;
+}
+
+/*
+ * Copy with reflink, copy_file_range() or sendfile().
+ * Returns -ENOTSUP if nothing was copied and the kernel
+ * cannot copy between the two files.
+ */
+static int copy_fast(int fdin, int fdout, unsigned long long size,
+		     unsigned long long seek, bool report)
+{
+	struct stat stin, stout;
+	loff_t off_in = 0, off_out = seek;
+	unsigned long long copied = 0;
+	unsigned int percent, prevpercent = 0;
+	bool use_cfr = true;
+	ssize_t n;
+
+	if (fstat(fdin, &stin) || fstat(fdout, &stout))
+		return -EFAULT;
+
+#ifdef FICLONE
+	/* Share the extents if the filesystem supports it */
+	if (!seek && S_ISREG(stin.st_mode) && S_ISREG(stout.st_mode) &&
+	    size == (unsigned long long)stin.st_size &&
+	    ioctl(fdout, FICLONE, fdin) == 0) {
+		TRACE("Reflinked %llu bytes", size);
+		return 0;
+	}
+#endif
+
+	while (copied < size) {
+		size_t chunk = min_t(unsigned long long, size - copied, FAST_COPY_CHUNK);
+
+		if (use_cfr) {
+			n = copy_file_range(fdin, &off_in, fdout, &off_out, chunk, 0);
+			if (n < 0 && !copied && errno != EINTR) {
+				use_cfr = false;
+				if (lseek(fdin, 0, SEEK_SET) < 0 ||
+				    lseek(fdout, seek, SEEK_SET) < 0)
+					return -EFAULT;
+				continue;
+			}
+		} else {
+			n = sendfile(fdout, fdin, NULL, chunk);
+			if (n < 0 && !copied && (errno == EINVAL || errno == ENOSYS))
+				return -ENOTSUP;
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			ERROR("Copy failed after %llu bytes: %s", copied, strerror(errno));
+			return -EIO;
+		}
+		if (n == 0) {
+			ERROR("Source ends after %llu bytes, expected %llu", copied, size);
+			return -EFAULT;
+		}
+		copied += n;
+
+		if (report) {
+			percent = (unsigned int)(100ULL * copied / size);
+			if (percent != prevpercent) {
+				prevpercent = percent;
+				swupdate_progress_update(percent);
+			}
+		}
+	}
+
+	TRACE("Copied %llu bytes with %s", copied,
+	      use_cfr ? "copy_file_range" : "sendfile");
+
+	return 0;
+}
+
+static int copy_single_file_fast(int fdin, ssize_t size, struct img_type *img,
+				 const char *chained, bool report)
+{
+	bool rawfile = !strcmp(chained, "rawfile");
+	struct img_type out;
+	int fdout, ret;
+
+	if (rawfile && strtobool(dict_get_value(&img->properties, "create-destination"))) {
+		TRACE("Creating path %s", img->path);
+		if (mkpath(dirname(strdupa(img->path)), 0755) < 0) {
+			ERROR("I cannot create path %s: %s", img->path, strerror(errno));
+			return -EFAULT;
+		}
+	}
+
+	fdout = rawfile ? openfileoutput(img->path) : open(img->device, O_RDWR);
+	if (fdout < 0) {
+		ERROR("%s cannot be opened: %s", rawfile ? img->path : img->device,
+		      strerror(errno));
+		return -ENODEV;
+	}
+
+	/* Fail before copying, as the rawfile handler does */
+	if (rawfile) {
+		memcpy(&out, img, sizeof(out));
+		out.size = size;
+		if (!img_check_free_space(&out, fdout)) {
+			close(fdout);
+			return -ENOSPC;
+		}
+	}
+
+	ret = copy_fast(fdin, fdout, size, rawfile ? 0 : img->seek, report);
+	if (!ret && fsync(fdout) && errno != EINVAL) {
+		ERROR("Error writing %s: %s", rawfile ? img->path : img->device,
+		      strerror(errno));
+		ret = -EIO;
+	}
+
+	close(fdout);
+	return ret;
+}
+
 static int copy_single_file(const char *path, ssize_t size, struct img_type *img, const char *chained)
 {
-	int fdout, fdin, ret;
+	int fdin, ret;
 	struct stat statbuf;
 	struct mtd_info_user	mtdinfo;
 	struct chain_handler_data priv;
 	uint32_t checksum;
-	int pipes[2];
 	unsigned long offset = 0;
-	pthread_t chain_handler_thread_id;
 
 	/*
 	 * Get information about source (size)
@@ -97,32 +288,45 @@ static int copy_single_file(const char *path, ssize_t size, struct img_type *img
 		return -ENODEV;
 	}
 
-	if (pipe(pipes) < 0) {
-		ERROR("Could not create pipes for chained handler, existing...");
-		close(fdin);
-		return -EFAULT;
+	if (fast_copy_allowed(img, chained)) {
+		/* Progress is not reported per file in case of parallel copy */
+		ret = copy_single_file_fast(fdin, size, img, chained, !copy_parallel);
+		if (ret != -ENOTSUP) {
+			close(fdin);
+			return ret;
+		}
+		TRACE("Fast copy not possible for %s, use %s handler", path, chained);
+		if (lseek(fdin, 0, SEEK_SET) < 0) {
+			close(fdin);
+			return -EFAULT;
+		}
 	}
 
+	/*
+	 * Chained handlers are run one at a time, even if the
+	 * fast path was tried from several copy threads.
+	 */
+	pthread_mutex_lock(&chain_lock);
+
 	/* Overwrite some parameters for chained handler */
 	memcpy(&priv.img, img, sizeof(*img));
 	priv.img.compressed = COMPRESSED_FALSE;
 	memset(priv.img.sha256, 0, SHA256_HASH_LENGTH);
-	priv.img.fdin = pipes[PIPE_READ];
 	priv.img.size = size;
 	strlcpy(priv.img.type, chained, sizeof(priv.img.type));
 
-	fdout = pipes[PIPE_WRITE];
-	signal(SIGPIPE, SIG_IGN);
-
-	chain_handler_thread_id = start_thread(chain_handler_thread, &priv);
-	wait_threads_ready();
+	if (chain_handler_start(&priv)) {
+		pthread_mutex_unlock(&chain_lock);
+		close(fdin);
+		return -EFAULT;
+	}
 
 	/*
 	 * Copying from device itself,
 	 * no encryption or compression
 	 */
 	ret = copyfile(fdin,
-			&fdout,
+			&priv,
 			size,
 			&offset,
 			0,
@@ -132,16 +336,12 @@ static int copy_single_file(const char *path, ssize_t size, struct img_type *img
 			0, /* no sha256 */
 			false, /* no encrypted */
 			NULL, /* no IVT */
-			NULL);
+			chain_handler_write);
 
-	close(fdout);
-	void *status;
-	ret = pthread_join(chain_handler_thread_id, &status);
-	if (ret) {
-		ERROR("return code from pthread_join() is %d", ret);
-	} else
-		ret = (unsigned long)status;
+	/* A failing copy stops the chained handler */
+	ret = chain_handler_finish(&priv, ret < 0 ? ret : 0);
 
+	pthread_mutex_unlock(&chain_lock);
 	close(fdin);
 
 	return ret;
@@ -192,6 +392,18 @@ static int recurse_directory(const char *fpath, const struct stat *sb,
 		 * of steps. So increase it before copying.
 		 */
 		swupdate_progress_addstep();
+		if (copy_parallel) {
+			struct copy_entry *entry = calloc(1, sizeof(*entry));
+			if (!entry || !(entry->src = strdup(fpath))) {
+				free(entry);
+				result = FTW_STOP;
+				break;
+			}
+			entry->dst = dst;
+			dst = NULL;
+			SIMPLEQ_INSERT_TAIL(&copy_queue, entry, next);
+			break;
+		}
 		if (copy_single_file(fpath, 0, &cpyimg, chained_handler))
 			result = FTW_STOP;
 	}
@@ -201,6 +413,75 @@ static int recurse_directory(const char *fpath, const struct stat *sb,
 	return result;
 }
 
+static void *copy_thread(void *data)
+{
+	struct copy_entry *entry;
+	struct img_type *cpyimg;
+	long ret = 0;
+
+	(void)data;
+	cpyimg = malloc(sizeof(*cpyimg));
+	if (!cpyimg)
+		return (void *)-ENOMEM;
+
+	for (;;) {
+		pthread_mutex_lock(&copy_queue_lock);
+		entry = SIMPLEQ_FIRST(&copy_queue);
+		if (entry)
+			SIMPLEQ_REMOVE_HEAD(&copy_queue, next);
+		if (entry && !ret)
+			swupdate_progress_inc_step(entry->src, "copy");
+		pthread_mutex_unlock(&copy_queue_lock);
+		if (!entry)
+			break;
+
+		/* After an error, just drain the queue */
+		if (!ret) {
+			memcpy(cpyimg, base_img, sizeof(*cpyimg));
+			strlcpy(cpyimg->path, entry->dst, sizeof(cpyimg->path));
+			ret = copy_single_file(entry->src, 0, cpyimg, chained_handler);
+			pthread_mutex_lock(&copy_queue_lock);
+			swupdate_progress_step_completed();
+			pthread_mutex_unlock(&copy_queue_lock);
+		}
+		free(entry->src);
+		free(entry->dst);
+		free(entry);
+	}
+
+	free(cpyimg);
+	return (void *)ret;
+}
+
+/*
+ * Copy the files collected by nftw() with a pool of threads
+ */
+static int copy_queued_files(unsigned int nthreads)
+{
+	pthread_t threads[MAX_COPY_THREADS];
+	unsigned int i, started = 0;
+	void *status;
+	int ret = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, copy_thread, NULL))
+			break;
+		started++;
+	}
+	if (!started) {
+		WARN("Cannot start copy threads, copying sequentially");
+		return (int)(long)copy_thread(NULL);
+	}
+
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i], &status);
+		if (!ret && status)
+			ret = (int)(long)status;
+	}
+
+	return ret;
+}
+
 static int copy_image_file(struct img_type *img, void *data)
 {
 	int ret = 0;
@@ -284,8 +565,32 @@ static int copy_image_file(struct img_type *img, void *data)
 
 	if (!ret) {
 		if (recursive) {
-			ret = nftw(copyfrom, recurse_directory, 64, FTW_PHYS);
+			char *value = dict_get_value(&img->properties, "threads");
+			unsigned int nthreads = value ? strtoul(value, NULL, 10) :
+					min_t(long, sysconf(_SC_NPROCESSORS_ONLN), 4);
+
+			/*
+			 * Files can be copied in parallel only with the fast path,
+			 * chained handlers could use shared resources (mount points).
+			 */
+			nthreads = min_t(unsigned int, nthreads, MAX_COPY_THREADS);
+			copy_parallel = nthreads > 1 && fast_copy_allowed(img, chained_handler);
+			SIMPLEQ_INIT(&copy_queue);
 
+			ret = nftw(copyfrom, recurse_directory, 64, FTW_PHYS);
+			if (copy_parallel) {
+				if (ret) {
+					struct copy_entry *e;
+					while ((e = SIMPLEQ_FIRST(&copy_queue))) {
+						SIMPLEQ_REMOVE_HEAD(&copy_queue, next);
+						free(e->src);
+						free(e->dst);
+						free(e);
+					}
+				} else
+					ret = copy_queued_files(nthreads);
+				copy_parallel = false;
+			}
 		} else {
 			swupdate_progress_addstep();
 			ret = copy_single_file(copyfrom, size, img, chained_handler);
@@ -41,10 +41,12 @@
 #include "multipart_parser.h"
 #include "installer.h"
 #include "zchunk_range.h"
+#include "chunk_store.h"
 #include "chained_handler.h"
 #include "swupdate_image.h"
 
 #define DEFAULT_MAX_RANGES	150	/* Apache has default = 200 */
+#define DEFAULT_CHUNK_STORE_SIZE	(64 * 1024 * 1024)
 #define BUFF_SIZE		16384
 
 const char *handlername = "delta";
@@ -100,7 +102,6 @@ struct hnd_priv {
 	unsigned long max_ranges;	/* Max allowed ranges (configured via sw-description) */
 	/* Data to be transferred to chain handler */
 	struct img_type img;
-	int fdout;
 	int fdsrc;
 	zckCtx *tgt;
 	/* Structures for downloading chunks */
@@ -118,8 +119,16 @@ struct hnd_priv {
 	bool content_range_received;	/* Flag to indicate that last header is content-range */
 	bool error_in_parser;		/* Flag to report if an error occurred */
 	multipart_parser *parser;	/* pointer to parser, allocated at any download */
+	/* Chunks kept on the device across updates */
+	struct chunk_store *store;
+	bool store_source;		/* keep source chunks not reused */
+	bool *stored;			/* target chunks found in store, by number */
+	unsigned char *storebuf;	/* uncompressed downloaded chunk */
+	size_t storelen;
+	size_t storesize;
 	/* Some nice statistics */
 	size_t bytes_to_be_reused;
+	size_t bytes_from_store;
 	size_t bytes_to_download;
 	size_t totaldwlbytes;		/* bytes downloaded, including headers */
 	/* flags to improve logging */
@@ -128,6 +137,39 @@ struct hnd_priv {
 
 static bool copy_existing_chunks(zckChunk **dstChunk, struct hnd_priv *priv);
 
+/*
+ * A chunk is available on the device if it is in the source
+ * or in the chunk store
+ */
+static bool chunk_is_local(zckChunk *chunk, struct hnd_priv *priv)
+{
+	return zck_get_chunk_valid(chunk) ||
+		(priv->stored && priv->stored[zck_get_chunk_number(chunk)]);
+}
+
+/*
+ * writeimage callback for downloaded chunks: the uncompressed data
+ * are collected to be added to the chunk store
+ */
+static int chain_and_store_write(void *out, const void *buf, size_t len)
+{
+	struct hnd_priv *priv = (struct hnd_priv *)out;
+
+	if (priv->storelen + len > priv->storesize) {
+		size_t size = max(priv->storelen + len, 2 * priv->storesize);
+		unsigned char *tmp = realloc(priv->storebuf, size);
+
+		if (!tmp)
+			return -ENOMEM;
+		priv->storebuf = tmp;
+		priv->storesize = size;
+	}
+	memcpy(priv->storebuf + priv->storelen, buf, len);
+	priv->storelen += len;
+
+	return chain_handler_write(&priv->chain_handler_data, buf, len);
+}
+
 /*
  * Callbacks for multipart parsing.
  */
@@ -162,15 +204,32 @@ static int network_process_data(multipart_parser* p, const char *at, size_t leng
 				TRACE("Copying chunk %ld from NETWORK, size %ld",
 					zck_get_chunk_number(priv->chunk),
 					priv->current.chunksize);
-			if (priv->current.chunksize != 0) {
+			if (priv->current.chunksize != 0 && priv->store) {
+				priv->storelen = 0;
+				ret = copybuffer(priv->current.buf,
+						 priv,
+						 priv->current.chunksize,
+						 COMPRESSED_ZSTD,
+						 hash,
+						 0,
+						 NULL,
+						 chain_and_store_write);
+				if (!ret) {
+					sha = zck_get_chunk_digest_uncompressed(priv->chunk);
+					if (sha)
+						chunk_store_add(priv->store, sha,
+								priv->storebuf, priv->storelen);
+					free(sha);
+				}
+			} else if (priv->current.chunksize != 0) {
 				ret = copybuffer(priv->current.buf,
-						 &priv->fdout,
+						 &priv->chain_handler_data,
 						 priv->current.chunksize,
 						 COMPRESSED_ZSTD,
 						 hash,
 						 0,
 						 NULL,
-						 NULL);
+						 chain_handler_write);
 			} else
 				ret = 0; /* skipping, nothing to be copied */
 			/* Buffer can be discarged */
@@ -190,7 +249,7 @@ static int network_process_data(multipart_parser* p, const char *at, size_t leng
 			priv->chunk = zck_get_next_chunk(priv->chunk);
 			if (!priv->chunk && nbytes > 0) {
 				WARN("Still data in range, but no chunks anymore !");
-				close(priv->fdout);
+				chain_handler_close(&priv->chain_handler_data);
 			}
 			if (!priv->chunk)
 				break;
@@ -268,6 +327,7 @@ static size_t get_total_size(zckCtx *zck, struct hnd_priv *priv) {
 	zckChunk *iter = zck_get_first_chunk(zck);
 	size_t pos = 0;
 	priv->bytes_to_be_reused = 0;
+	priv->bytes_from_store = 0;
 	priv->bytes_to_download = 0;
 	if (priv->debugchunks)
 		TRACE("Index        Typ HASH %*c START(chunk) SIZE(uncomp) Pos(Device) SIZE(comp)",
@@ -277,7 +337,8 @@ static size_t get_total_size(zckCtx *zck, struct hnd_priv *priv) {
 		if (priv->debugchunks)
 			TRACE("%12lu %s %s %12lu %12lu %12lu %12lu",
 				zck_get_chunk_number(iter),
-				zck_get_chunk_valid(iter) ? "SRC" : "DST",
+				zck_get_chunk_valid(iter) ? "SRC" :
+					chunk_is_local(iter, priv) ? "STO" : "DST",
 				zck_get_chunk_digest_uncompressed(iter),
 				zck_get_chunk_start(iter),
 				zck_get_chunk_size(iter),
@@ -285,15 +346,19 @@ static size_t get_total_size(zckCtx *zck, struct hnd_priv *priv) {
 				zck_get_chunk_comp_size(iter));
 
 		pos += zck_get_chunk_size(iter);
-		if (!zck_get_chunk_valid(iter)) {
-			priv->bytes_to_download += zck_get_chunk_comp_size(iter);
-		} else {
+		if (zck_get_chunk_valid(iter)) {
 			priv->bytes_to_be_reused += zck_get_chunk_size(iter);
+		} else if (chunk_is_local(iter, priv)) {
+			priv->bytes_from_store += zck_get_chunk_size(iter);
+		} else {
+			priv->bytes_to_download += zck_get_chunk_comp_size(iter);
 		}
 		iter = zck_get_next_chunk(iter);
 	}
 
 	INFO("Total bytes to be reused     : %12lu\n", priv->bytes_to_be_reused);
+	if (priv->store)
+		INFO("Total bytes from chunk store : %12lu\n", priv->bytes_from_store);
 	INFO("Total bytes to be downloaded : %12lu\n", priv->bytes_to_download);
 
 	return pos;
@@ -334,6 +399,18 @@ static int delta_retrieve_attributes(struct img_type *img, struct hnd_priv *priv
 			priv->srcsize = ustrtoull(srcsize, NULL, 10);
 	}
 
+	char *store = dict_get_value(&img->properties, "chunk-store");
+	if (store) {
+		char *storesize = dict_get_value(&img->properties, "chunk-store-size");
+		unsigned long long size = storesize ? ustrtoull(storesize, NULL, 10) :
+						      DEFAULT_CHUNK_STORE_SIZE;
+
+		/* the update goes on without the store if it cannot be used */
+		priv->store = chunk_store_open(store, size);
+		priv->store_source = strtobool(dict_get_value(&img->properties,
+							      "chunk-store-source"));
+	}
+
 	char *zckloglevel = dict_get_value(&img->properties, "zckloglevel");
 	if (!zckloglevel)
 		return 0;
@@ -536,7 +613,7 @@ static bool trigger_download(struct hnd_priv *priv)
 
 	priv->boundary[0] = '\0';
 
-	range = zchunk_get_missing_range(tgt, priv->chunk, priv->max_ranges);
+	range = zchunk_get_missing_range(tgt, priv->chunk, priv->max_ranges, priv->stored);
 	if (!range)
 		return false;
 	http_range = zchunk_get_range_char(range);
@@ -803,6 +880,116 @@ static bool copy_network_chunks(zckChunk **dstChunk, struct hnd_priv *priv)
 	return !priv->error_in_parser;
 }
 
+/*
+ * This writes a chunk found in the chunk store
+ */
+static bool copy_stored_chunk(zckChunk *chunk, struct hnd_priv *priv)
+{
+	unsigned long offset = 0;
+	uint32_t checksum;
+	unsigned char hash[SHA256_HASH_LENGTH];
+	size_t len = zck_get_chunk_size(chunk);
+	char *sha = zck_get_chunk_digest_uncompressed(chunk);
+	int fd, ret;
+
+	if (!sha) {
+		ERROR("Cannot get hash for chunk %ld", zck_get_chunk_number(chunk));
+		return false;
+	}
+	fd = chunk_store_open_chunk(priv->store, sha);
+	if (fd < 0) {
+		ERROR("Chunk %ld lost from chunk store", zck_get_chunk_number(chunk));
+		free(sha);
+		return false;
+	}
+
+	ascii_to_hash(hash, sha);
+	if (priv->debugchunks)
+		TRACE("Copying chunk %ld from STORE, size %ld",
+			zck_get_chunk_number(chunk), len);
+	ret = copyfile(fd, &priv->chain_handler_data, len, &offset, 0, 0,
+			COMPRESSED_FALSE, &checksum, hash, false, NULL, chain_handler_write);
+
+	close(fd);
+	free(sha);
+
+	return ret == 0;
+}
+
+/*
+ * Find which chunks to be downloaded are in the chunk store
+ */
+static void lookup_stored_chunks(zckCtx *zck, struct hnd_priv *priv)
+{
+	ssize_t count = zck_get_chunk_count(zck);
+	zckChunk *iter;
+
+	if (count <= 0)
+		return;
+	priv->stored = calloc(count, sizeof(*priv->stored));
+	if (!priv->stored)
+		return;
+
+	for (iter = zck_get_first_chunk(zck); iter; iter = zck_get_next_chunk(iter)) {
+		char *sha;
+
+		if (zck_get_chunk_valid(iter) || !zck_get_chunk_size(iter))
+			continue;
+		sha = zck_get_chunk_digest_uncompressed(iter);
+		if (sha && chunk_store_lookup(priv->store, sha, zck_get_chunk_size(iter)))
+			priv->stored[zck_get_chunk_number(iter)] = true;
+		free(sha);
+	}
+}
+
+/*
+ * Keep the chunks of the source that the new image does not use: the
+ * source is overwritten by a later update, and they could serve again.
+ */
+static void store_source_chunks(zckCtx *src, zckCtx *tgt, struct hnd_priv *priv)
+{
+	ssize_t count = zck_get_chunk_count(src);
+	zckChunk *iter;
+	bool *used;
+	unsigned char *buf = NULL;
+	size_t bufsize = 0;
+
+	if (count <= 0)
+		return;
+	used = calloc(count, sizeof(*used));
+	if (!used)
+		return;
+	for (iter = zck_get_first_chunk(tgt); iter; iter = zck_get_next_chunk(iter)) {
+		if (zck_get_chunk_valid(iter))
+			used[zck_get_chunk_number(zck_get_src_chunk(iter))] = true;
+	}
+
+	for (iter = zck_get_first_chunk(src); iter; iter = zck_get_next_chunk(iter)) {
+		size_t len = zck_get_chunk_size(iter);
+		char *sha;
+
+		if (used[zck_get_chunk_number(iter)] || !len)
+			continue;
+		if (len > bufsize) {
+			unsigned char *tmp = realloc(buf, len);
+
+			if (!tmp)
+				break;
+			buf = tmp;
+			bufsize = len;
+		}
+		if (pread(priv->fdsrc, buf, len, zck_get_chunk_start(iter)) != (ssize_t)len)
+			break;
+		sha = zck_get_chunk_digest_uncompressed(iter);
+		if (sha)
+			chunk_store_add(priv->store, sha, buf, len);
+		free(sha);
+	}
+
+	free(buf);
+	free(used);
+}
+
 /*
  * This writes a chunk from an existing copy on the source path
  * The chunk to be copied is retrieved via zck_get_src_chunk()
@@ -814,7 +1001,13 @@ static bool copy_existing_chunks(zckChunk **dstChunk, struct hnd_priv *priv)
 	int ret;
 	unsigned char hash[SHA256_HASH_LENGTH];
 
-	while (*dstChunk && zck_get_chunk_valid(*dstChunk)) {
+	while (*dstChunk && chunk_is_local(*dstChunk, priv)) {
+		if (!zck_get_chunk_valid(*dstChunk)) {
+			if (!copy_stored_chunk(*dstChunk, priv))
+				return false;
+			*dstChunk = zck_get_next_chunk(*dstChunk);
+			continue;
+		}
 		zckChunk *chunk	= zck_get_src_chunk(*dstChunk);
 		size_t len = zck_get_chunk_size(chunk);
 		size_t start = zck_get_chunk_start(chunk);
@@ -841,8 +1034,8 @@ static bool copy_existing_chunks(zckChunk **dstChunk, struct hnd_priv *priv)
 				zck_get_chunk_number(chunk),
 				start,
 				len);
-		ret = copyfile(priv->fdsrc, &priv->fdout, len, &offset, 0, 0, COMPRESSED_FALSE,
-				&checksum, hash, false, NULL, NULL);
+		ret = copyfile(priv->fdsrc, &priv->chain_handler_data, len, &offset, 0, 0,
+				COMPRESSED_FALSE, &checksum, hash, false, NULL, chain_handler_write);
 
 		free(sha);
 		if (ret)
@@ -853,8 +1046,6 @@ static bool copy_existing_chunks(zckChunk **dstChunk, struct hnd_priv *priv)
 	return true;
 }
 
-#define PIPE_READ  0
-#define PIPE_WRITE 1
 /*
  * Handler entry point
  */
@@ -867,8 +1058,7 @@ static int install_delta(struct img_type *img,
 	zckChunk *iter;
 	zckCtx *zckSrc = NULL, *zckDst = NULL;
 	char *FIFO = NULL;
-	pthread_t chain_handler_thread_id;
-	int pipes[2];
+	bool chain_started = false;
 
 	/*
 	 * No streaming allowed
@@ -910,11 +1100,6 @@ static int install_delta(struct img_type *img,
 		goto cleanup;
 	}
 
-	if (pipe(pipes) < 0) {
-		ERROR("Could not create pipes for chained handler, existing...");
-		ret = -EFAULT;
-		goto cleanup;
-	}
 	/*
 	 * Open files
 	 */
@@ -1054,6 +1239,8 @@ static int install_delta(struct img_type *img,
 		zck_generate_hashdb(zckSrc);
 		zck_find_matching_chunks(zckSrc, zckDst);
 	}
+	if (priv->store)
+		lookup_stored_chunks(zckDst, priv);
 
 	size_t uncompressed_size = get_total_size(zckDst, priv);
 	INFO("Size of artifact to be installed : %lu", uncompressed_size);
@@ -1072,16 +1259,14 @@ static int install_delta(struct img_type *img,
 	priv_hnd->img.size = uncompressed_size;
 	memset(priv_hnd->img.sha256, 0, SHA256_HASH_LENGTH);
 	strlcpy(priv_hnd->img.type, priv->chainhandler, sizeof(priv_hnd->img.type));
-	priv_hnd->img.fdin = pipes[PIPE_READ];
 	/* zchunk files are not encrypted, CBC is not suitable for range download */
 	priv_hnd->img.is_encrypted = false;
 
-	signal(SIGPIPE, SIG_IGN);
-
-	chain_handler_thread_id = start_thread(chain_handler_thread, priv_hnd);
-	wait_threads_ready();
-
-	priv->fdout = pipes[PIPE_WRITE];
+	if (chain_handler_start(priv_hnd)) {
+		ret = -EFAULT;
+		goto cleanup;
+	}
+	chain_started = true;
 
 	ret = 0;
 
@@ -1090,7 +1275,7 @@ static int install_delta(struct img_type *img,
 	priv->tgt = zckDst;
 	priv->fdsrc = in_fd;
 	while (iter) {
-		if (zck_get_chunk_valid(iter)) {
+		if (chunk_is_local(iter, priv)) {
 			success = copy_existing_chunks(&iter, priv);
 		} else {
 			success = copy_network_chunks(&iter, priv);
@@ -1102,19 +1287,18 @@ static int install_delta(struct img_type *img,
 		}
 	}
 
-	close(priv->fdout);
-
 	INFO("Total downloaded data : %ld bytes", priv->totaldwlbytes);
 
-	void *status;
-	ret = pthread_join(chain_handler_thread_id, &status);
-	if (ret) {
-		ERROR("return code from pthread_join() is %d", ret);
-	}
-	ret = (unsigned long)status;
+	chain_started = false;
+	ret = chain_handler_finish(&priv->chain_handler_data, 0);
 	TRACE("Chained handler returned %d", ret);
 
+	if (!ret && priv->store && priv->store_source)
+		store_source_chunks(zckSrc, zckDst, priv);
+
 cleanup:
+	if (chain_started)
+		chain_handler_finish(&priv->chain_handler_data, ret);
 	if (zckSrc) zck_free(&zckSrc);
 	if (zckDst) zck_free(&zckDst);
 	if (dst_fd >= 0) close(dst_fd);
@@ -1125,6 +1309,9 @@ cleanup:
 		free(FIFO);
 	}
 	if (priv->answer) free(priv->answer);
+	chunk_store_close(priv->store);
+	free(priv->stored);
+	free(priv->storebuf);
 	free(priv);
 	return ret;
 }
@@ -19,6 +19,7 @@
 #include <libfdisk/libfdisk.h>
 #include <linux/fs.h>
 #include <fs_interface.h>
+#include <blkdev_cache.h>
 #include <uuid/uuid.h>
 #include <dirent.h>
 #include <libgen.h>
@@ -865,6 +866,7 @@ static int diskpart_write_table(struct fdisk_context *cxt, struct create_table *
 			ERROR("Nested partition table cannot be written on disk");
 		if (fdisk_reread_partition_table(cxt))
 			WARN("Nested partition table cannot be reread from the disk, be careful !");
+		blkdev_cache_invalidate(NULL);
 		if (ret)
 			return ret;
 	}
@@ -878,6 +880,7 @@ static int diskpart_write_table(struct fdisk_context *cxt, struct create_table *
 			ERROR("Partition table cannot be written on disk");
 		if (fdisk_reread_partition_table(PARENT(cxt)))
 			WARN("Table cannot be reread from the disk, be careful !");
+		blkdev_cache_invalidate(NULL);
 		if (ret)
 			return ret;
 	}
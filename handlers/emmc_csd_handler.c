@@ -41,26 +41,24 @@ static int emmc_boot_toggle(struct img_type *img, void *data)
 		return -ENODEV;
 	}
 
-	active = emmc_get_active_bootpart(fdin);
-	if (active < 0) {
-		ERROR("Current HW boot partition cannot be retrieved");
-		close(fdin);
-		return -1;
-	}
-
 	/*
-	 * If User Partition is activated, does nothing
-	 * and report this to the user.
+	 * EXT_CSD is read once and the switch is sent together
+	 * with the status check
 	 */
-	if (active > 1) {
+	active = emmc_toggle_bootpart(fdin);
+	if (active < 0) {
+		ERROR("Current HW boot partition cannot be retrieved or changed");
+		ret = -1;
+	} else if (active > 1) {
+		/*
+		 * If User Partition is activated, does nothing
+		 * and report this to the user.
+		 */
 		WARN("Boot device set to User area, no changes !");
 		ret = 0;
 	} else {
-		active = (active == 0) ? 1 : 0;
-		TRACE("Setting Boot to HW Partition %d", active);
-		ret = emmc_write_bootpart(fdin, active);
-		if (ret)
-			ERROR("Failure writing CSD register");
+		TRACE("Boot set to HW Partition %d", active);
+		ret = 0;
 	}
 
 	close(fdin);
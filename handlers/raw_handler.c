@@ -26,6 +26,12 @@
 #include "swupdate_image.h"
 #include "handler.h"
 #include "util.h"
+#include "bootloader.h"
+#include "swupdate_vars.h"
+#include "raw_sparse.h"
+#ifdef CONFIG_HASH_VERIFY
+#include "verity_hash.h"
+#endif
 
 void raw_image_handler(void);
 void raw_file_handler(void);
@@ -115,12 +121,409 @@ blkprotect_out:
 	return ret;
 }
 
+#ifdef CONFIG_HASH_VERIFY
+/*
+ * Output for copyimage() when a dm-verity hash tree is computed
+ * while the image is written. fd must be the first member,
+ * because copyfile() uses it to seek.
+ */
+struct raw_verity_out {
+	int fd;
+	struct verity_hash *v;
+};
+
+static int raw_verity_write(void *out, const void *buf, size_t len)
+{
+	struct raw_verity_out *o = (struct raw_verity_out *)out;
+
+	if (copy_write(&o->fd, buf, len))
+		return -1;
+
+	return verity_hash_update(o->v, buf, len);
+}
+
+static int raw_verity_salt(struct img_type *img, struct verity_hash_cfg *cfg)
+{
+	char *value = dict_get_value(&img->properties, "verity-salt");
+	int fd;
+
+	if (value) {
+		if (!strcmp(value, "-"))
+			return 0;
+		cfg->salt_size = strlen(value) / 2;
+		if (cfg->salt_size > VERITY_MAX_SALT_SIZE ||
+		    ascii_to_bin(cfg->salt, cfg->salt_size, value)) {
+			ERROR("Invalid verity-salt %s", value);
+			return -EINVAL;
+		}
+		return 0;
+	}
+
+	/* Random salt, as veritysetup does */
+	cfg->salt_size = 32;
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0 || read(fd, cfg->salt, cfg->salt_size) != (ssize_t)cfg->salt_size) {
+		ERROR("Cannot generate salt for hash tree");
+		if (fd >= 0)
+			close(fd);
+		return -EFAULT;
+	}
+	close(fd);
+
+	return 0;
+}
+
+static int raw_verity_export(struct img_type *img, const char *property,
+			     const char *defname, const unsigned char *bin,
+			     size_t len)
+{
+	char *name = dict_get_value(&img->properties, property);
+	char ascii[2 * VERITY_MAX_SALT_SIZE + 1];
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		sprintf(&ascii[i * 2], "%02x", bin[i]);
+	ascii[len * 2] = '\0';
+
+	if (!name)
+		name = (char *)defname;
+
+	TRACE("Hash tree: %s = %s", name, ascii);
+	if (swupdate_vars_set(name, ascii, NULL)) {
+		ERROR("Cannot store %s", name);
+		return -EFAULT;
+	}
+	if (strtobool(dict_get_value(&img->properties, "verity-bootenv")) &&
+	    bootloader_env_set(name, ascii)) {
+		ERROR("Cannot set %s in bootloader environment", name);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+/*
+ * Write the image and compute the dm-verity hash tree of the
+ * written data on the fly, saving a second read of the device
+ * after install.
+ */
+static int install_raw_image_verity(struct img_type *img, int fdout)
+{
+	struct verity_hash_cfg cfg;
+	struct raw_verity_out out;
+	unsigned char root[VERITY_MAX_DIGEST_SIZE];
+	long long size = get_output_size(img, true);
+	unsigned long long offset;
+	char *device, *value;
+	int ret;
+
+	if (size <= 0)
+		return -EINVAL;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.algo = dict_get_value(&img->properties, "verity-hash");
+	value = dict_get_value(&img->properties, "verity-data-block-size");
+	cfg.data_block_size = value ? strtoul(value, NULL, 10) : 4096;
+	value = dict_get_value(&img->properties, "verity-hash-block-size");
+	cfg.hash_block_size = value ? strtoul(value, NULL, 10) : 4096;
+	value = dict_get_value(&img->properties, "verity-threads");
+	cfg.threads = value ? strtoul(value, NULL, 10) :
+			(unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+	ret = raw_verity_salt(img, &cfg);
+	if (ret)
+		return ret;
+
+	/* Tree is stored by default after the data on the same device */
+	device = dict_get_value(&img->properties, "verity-device");
+	value = dict_get_value(&img->properties, "verity-offset");
+	if (value)
+		offset = ustrtoull(value, NULL, 0);
+	else if (!device)
+		offset = SWUPDATE_ALIGN(img->seek + size, cfg.hash_block_size);
+	else
+		offset = 0;
+
+	cfg.fd = device ? open(device, O_RDWR) : fdout;
+	if (cfg.fd < 0) {
+		ERROR("Device %s cannot be opened: %s", device, strerror(errno));
+		return -ENODEV;
+	}
+	cfg.offset = offset;
+
+	out.fd = fdout;
+	out.v = verity_hash_init(&cfg, size);
+	if (!out.v) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if ((!device || !strcmp(device, img->device)) &&
+	    offset < img->seek + size &&
+	    offset + verity_hash_tree_size(out.v) > img->seek) {
+		ERROR("Hash tree at %llu overlaps the image", offset);
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	ret = copyimage(&out, img, raw_verity_write);
+	if (!ret)
+		ret = verity_hash_final(out.v, root);
+	if (!ret) {
+		TRACE("Hash tree written to %s at %llu",
+		      device ? device : img->device, offset);
+		ret = raw_verity_export(img, "verity-roothash-var", "verity_roothash",
+					root, verity_hash_digest_size(out.v));
+	}
+	if (!ret)
+		ret = raw_verity_export(img, "verity-salt-var", "verity_salt",
+					cfg.salt, cfg.salt_size);
+
+out_free:
+	verity_hash_free(out.v);
+out:
+	if (device)
+		close(cfg.fd);
+	return ret;
+}
+#endif
+
+#if !defined(__FreeBSD__)
+#define RAW_COMPARE_CHUNK_DEFAULT	(1024 * 1024)
+#define RAW_COMPARE_CHUNK_MIN		(64 * 1024)
+#define RAW_COMPARE_CHUNK_MAX		(16 * 1024 * 1024)
+
+/*
+ * Output for copyimage() when the device is read back and
+ * compared chunk by chunk, writing only chunks that differ.
+ * fd must be the first member, because copyfile() uses it
+ * to seek.
+ */
+struct raw_compare_out {
+	int fd;
+	struct img_type *img;
+	int prot_stat;
+	bool writable;
+	unsigned char *buf;	/* data of the current chunk */
+	unsigned char *dev;	/* device content of the current chunk */
+	size_t chunk;
+	size_t len;
+	unsigned long long offset;	/* device offset of buf */
+	unsigned long long skipped;
+	unsigned long long written;
+};
+
+/*
+ * The device is opened read-only first, so that write
+ * protection is only removed if something has to be written
+ */
+static int raw_compare_make_writable(struct raw_compare_out *o)
+{
+	int fd;
+
+	if (o->writable)
+		return 0;
+
+	o->prot_stat = blkprotect(o->img, false);
+	if (o->prot_stat < 0)
+		return o->prot_stat;
+
+	fd = open(o->img->device, O_RDWR);
+	if (fd < 0) {
+		ERROR("Device %s cannot be opened for writing: %s",
+		      o->img->device, strerror(errno));
+		return -ENODEV;
+	}
+	close(o->fd);
+	o->fd = fd;
+	o->writable = true;
+
+	return 0;
+}
+
+static int raw_compare_flush(struct raw_compare_out *o)
+{
+	ssize_t ret;
+	size_t done;
+
+	if (!o->len)
+		return 0;
+
+	ret = pread(o->fd, o->dev, o->len, o->offset);
+	if (ret == (ssize_t)o->len && !memcmp(o->buf, o->dev, o->len)) {
+		o->skipped += o->len;
+	} else {
+		ret = raw_compare_make_writable(o);
+		if (ret)
+			return ret;
+		for (done = 0; done < o->len; done += ret) {
+			ret = pwrite(o->fd, o->buf + done, o->len - done, o->offset + done);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			if (ret <= 0) {
+				ERROR("cannot write %zu bytes at %llu: %s", o->len - done,
+				      o->offset + done, strerror(errno));
+				return -EIO;
+			}
+		}
+		o->written += o->len;
+	}
+
+	o->offset += o->len;
+	o->len = 0;
+
+	return 0;
+}
+
+/*
+ * Chunks are aligned to the device offset, so that each
+ * rewritten chunk covers whole erase groups
+ */
+static int raw_compare_write(void *out, const void *buf, size_t len)
+{
+	struct raw_compare_out *o = (struct raw_compare_out *)out;
+	const unsigned char *data = buf;
+	size_t n, room;
+	int ret;
+
+	while (len) {
+		room = o->chunk - (o->offset + o->len) % o->chunk;
+		n = min(len, room);
+		memcpy(o->buf + o->len, data, n);
+		o->len += n;
+		data += n;
+		len -= n;
+		if (n == room) {
+			ret = raw_compare_flush(o);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static size_t raw_compare_chunk(struct img_type *img, int fd)
+{
+	char *value = dict_get_value(&img->properties, "compare-chunk");
+	unsigned long long chunk;
+	long unit;
+
+	if (value) {
+		chunk = ustrtoull(value, NULL, 0);
+	} else {
+		char *path = realpath(img->device, NULL);
+		/* Only eMMC knows EXT_CSD, spare the error on other devices */
+		unit = (path && !strncmp(path, "/dev/mmcblk", 11)) ?
+			emmc_get_write_unit(fd) : -ENODEV;
+		free(path);
+		if (unit > 0)
+			TRACE("%s: eMMC write unit %ld bytes", img->device, unit);
+		chunk = unit > 0 ? (unsigned long long)unit : RAW_COMPARE_CHUNK_DEFAULT;
+	}
+
+	chunk = max_t(unsigned long long, chunk, RAW_COMPARE_CHUNK_MIN);
+	return (size_t)min_t(unsigned long long, chunk, RAW_COMPARE_CHUNK_MAX);
+}
+
+/*
+ * Read back the device and rewrite only what differs: this saves
+ * wear and time when a boot partition is updated with a mostly
+ * unchanged bootloader
+ */
+static int install_raw_image_compare(struct img_type *img)
+{
+	struct raw_compare_out out;
+	int ret;
+
+	memset(&out, 0, sizeof(out));
+	out.img = img;
+	out.offset = img->seek;
+	out.fd = open(img->device, O_RDONLY);
+	if (out.fd < 0) {
+		TRACE("Device %s cannot be opened: %s",
+			img->device, strerror(errno));
+		return -ENODEV;
+	}
+
+	out.chunk = raw_compare_chunk(img, out.fd);
+	out.buf = malloc(out.chunk);
+	out.dev = malloc(out.chunk);
+	if (!out.buf || !out.dev) {
+		ERROR("OOM allocating compare buffers");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = copyimage(&out, img, raw_compare_write);
+	if (!ret)
+		ret = raw_compare_flush(&out);
+
+	TRACE("%s: %llu bytes unchanged, %llu bytes written in %zu bytes chunks",
+	      img->device, out.skipped, out.written, out.chunk);
+
+	if (out.writable && fsync(out.fd) && !ret) {
+		ERROR("Error writing %s: %s", img->device, strerror(errno));
+		ret = -EIO;
+	}
+	if (out.prot_stat == 1)
+		blkprotect(img, true);  // no error handling, keep ret from copyimage
+
+out:
+	free(out.buf);
+	free(out.dev);
+	close(out.fd);
+	return ret;
+}
+#endif
+
+#if !defined(__FreeBSD__)
+/*
+ * Write only the blocks of the image that carry data. The hash
+ * of the artifact is still computed by copyimage() over the whole
+ * input, holes included.
+ */
+static int install_raw_image_sparse(struct img_type *img, int fdout)
+{
+	struct raw_sparse_out *out;
+	int ret;
+
+	out = raw_sparse_new(img, fdout);
+	if (!out)
+		return -EINVAL;
+
+	ret = copyimage(out, img, raw_sparse_write);
+	if (!ret)
+		ret = raw_sparse_finish(out);
+
+	raw_sparse_free(out);
+	return ret;
+}
+#endif
+
 static int install_raw_image(struct img_type *img,
 	void __attribute__ ((__unused__)) *data)
 {
 	int ret;
 	int fdout;
 
+#if !defined(__FreeBSD__)
+#ifdef CONFIG_HASH_VERIFY
+	if (raw_sparse_requested(img) &&
+	    strtobool(dict_get_value(&img->properties, "verity"))) {
+		ERROR("%s: sparse images cannot be combined with verity", img->fname);
+		return -EINVAL;
+	}
+#endif
+	if (strtobool(dict_get_value(&img->properties, "compare"))
+#ifdef CONFIG_HASH_VERIFY
+	    && !strtobool(dict_get_value(&img->properties, "verity"))
+#endif
+	    && !raw_sparse_requested(img))
+		return install_raw_image_compare(img);
+#endif
+
 	int prot_stat = blkprotect(img, false);
 	if (prot_stat < 0)
 		return prot_stat;
@@ -134,7 +537,15 @@ static int install_raw_image(struct img_type *img,
 #if defined(__FreeBSD__)
 	ret = copyimage(&fdout, img, copy_write_padded);
 #else
-	ret = copyimage(&fdout, img, NULL);
+#ifdef CONFIG_HASH_VERIFY
+	if (strtobool(dict_get_value(&img->properties, "verity")))
+		ret = install_raw_image_verity(img, fdout);
+	else
+#endif
+	if (raw_sparse_requested(img))
+		ret = install_raw_image_sparse(img, fdout);
+	else
+		ret = copyimage(&fdout, img, NULL);
 #endif
 
 	if (prot_stat == 1) {
@@ -257,12 +668,12 @@ __attribute__((constructor))
 void raw_image_handler(void)
 {
 	register_handler("raw", install_raw_image,
-				IMAGE_HANDLER, NULL);
+				IMAGE_HANDLER | STREAM_INPUT_HANDLER, NULL);
 }
 
 	__attribute__((constructor))
 void raw_file_handler(void)
 {
 	register_handler("rawfile", install_raw_file,
-				FILE_HANDLER, NULL);
+				FILE_HANDLER | STREAM_INPUT_HANDLER, NULL);
 }
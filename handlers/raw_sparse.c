@@ -0,0 +1,1043 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#if !defined(__FreeBSD__)
+#include <linux/fs.h>
+#endif
+
+#include "swupdate_image.h"
+#include "util.h"
+#include "raw_sparse.h"
+
+/* Android sparse format, see libsparse/sparse_format.h */
+#define SPARSE_HEADER_MAGIC	0xed26ff3a
+#define SPARSE_HEADER_LEN	28
+#define CHUNK_HEADER_LEN	12
+#define CHUNK_TYPE_RAW		0xCAC1
+#define CHUNK_TYPE_FILL		0xCAC2
+#define CHUNK_TYPE_DONT_CARE	0xCAC3
+#define CHUNK_TYPE_CRC32	0xCAC4
+
+#define SPARSE_HDR_MAX		64
+#define BMAP_MAX_SIZE		(16 * 1024 * 1024)
+#define ZERO_BUF_SIZE		(64 * 1024)
+
+/* ext4 on-disk layout, see fs/ext4/ext4.h */
+#define EXT4_SB_OFFSET			1024
+#define EXT4_SB_END			2048
+#define EXT4_MAX_BLOCK_SIZE		(64 * 1024)
+#define EXT4_SUPER_MAGIC		0xEF53
+#define EXT4_COMPAT_SPARSE_SUPER2	0x0200
+#define EXT4_INCOMPAT_META_BG		0x0010
+#define EXT4_INCOMPAT_64BIT		0x0080
+#define EXT4_RO_COMPAT_SPARSE_SUPER	0x0001
+#define EXT4_RO_COMPAT_GDT_CSUM		0x0010
+#define EXT4_RO_COMPAT_BIGALLOC		0x0200
+#define EXT4_RO_COMPAT_METADATA_CSUM	0x0400
+#define EXT4_BG_BLOCK_UNINIT		0x0002
+
+enum raw_fill {
+	RAW_FILL_SKIP,
+	RAW_FILL_DISCARD,
+	RAW_FILL_ZEROOUT,
+};
+
+enum sparse_state {
+	SPARSE_FILE_HEADER,
+	SPARSE_CHUNK_HEADER,
+	SPARSE_CHUNK_RAW,
+	SPARSE_CHUNK_FILL,
+	SPARSE_CHUNK_CRC,
+	SPARSE_DONE,
+};
+
+/* Mapped blocks [first, last] of a block map */
+struct raw_range {
+	unsigned long long first;
+	unsigned long long last;
+};
+
+struct ext4_group {
+	unsigned long long block_bitmap;
+	bool uninit;			/* no block in use but metadata */
+	unsigned char *bitmap;		/* copy of the bitmap once streamed */
+};
+
+/*
+ * Allocation map of an ext4 image, built while it streams: the
+ * superblock and the group descriptors come first, the block bitmap
+ * of a group usually before its blocks (always with flex_bg).
+ * Blocks of a group whose bitmap was not seen yet are written.
+ */
+struct ext4_map {
+	bool disabled;			/* not usable, write all blocks */
+	unsigned char sb[EXT4_SB_END];
+	size_t sb_len;
+	unsigned char *stage;		/* partial block between two writes */
+	size_t stage_len;
+
+	unsigned int log_groups;
+	unsigned long long first_data_block;
+	unsigned long long blocks_per_group;
+	unsigned long long gdt_start;
+	unsigned long long gdt_blocks;
+	unsigned char *gdt;
+	unsigned int ngroups;
+	unsigned int desc_size;
+	struct ext4_group *groups;
+	unsigned int low_group;		/* lowest group that can hold a bitmap */
+
+	/* metadata that is always written, sorted */
+	struct raw_range *meta;
+	size_t nmeta;
+	size_t meta_cur;
+
+	/* groups sorted by block bitmap location */
+	unsigned int *by_bitmap;
+	unsigned int bitmap_cur;
+};
+
+struct raw_sparse_out {
+	int fd;				/* must be first, see copyfile() */
+	const char *device;
+	unsigned long long base;	/* offset of the image on the device */
+	unsigned long long pos;		/* logical offset of the next output byte */
+	unsigned long long size;	/* logical size, 0 if not known yet */
+	enum raw_fill fill;
+	bool fill_warned;
+
+	/* hole not yet applied to the device */
+	unsigned long long hole_start;
+	unsigned long long hole_len;
+
+	int (*input)(struct raw_sparse_out *o, const unsigned char *buf, size_t len);
+
+	/* bmap */
+	unsigned int blksz;
+	struct raw_range *ranges;
+	size_t nranges;
+	size_t cur;
+
+	/* Android sparse decoder */
+	enum sparse_state state;
+	unsigned char hdr[SPARSE_HDR_MAX];
+	size_t hdr_len;
+	size_t hdr_need;
+	unsigned int chunk_hdr_sz;
+	unsigned int total_chunks;
+	unsigned int chunks;
+	unsigned long long chunk_left;	/* bytes of the current chunk */
+	unsigned char *pattern;		/* one block filled with the FILL value */
+
+	struct ext4_map *ext4;
+
+	/* stats */
+	unsigned long long written;
+	unsigned long long zeroed;
+	unsigned long long skipped;
+};
+
+static inline uint16_t get_le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, unsigned long long offset)
+{
+	const unsigned char *p = buf;
+	ssize_t ret;
+
+	while (len) {
+		ret = pwrite(fd, p, len, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			ERROR("cannot write %zu bytes at %llu: %s", len, offset,
+			      strerror(errno));
+			return -EIO;
+		}
+		p += ret;
+		offset += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int write_zeroes(struct raw_sparse_out *o, unsigned long long start,
+			unsigned long long len)
+{
+	static const unsigned char zeroes[ZERO_BUF_SIZE];
+	size_t n;
+	int ret;
+
+#ifdef BLKZEROOUT
+	uint64_t range[2] = { o->base + start, len };
+
+	if (!ioctl(o->fd, BLKZEROOUT, &range))
+		return 0;
+#endif
+	/* Not a block device or not supported, write them */
+	while (len) {
+		n = min_t(unsigned long long, len, sizeof(zeroes));
+		ret = pwrite_all(o->fd, zeroes, n, o->base + start);
+		if (ret)
+			return ret;
+		start += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int flush_hole(struct raw_sparse_out *o)
+{
+	unsigned long long start = o->hole_start, len = o->hole_len;
+	int ret = 0;
+
+	if (!len)
+		return 0;
+	o->hole_len = 0;
+	if (o->fill == RAW_FILL_ZEROOUT)
+		o->zeroed += len;
+	else
+		o->skipped += len;
+
+	switch (o->fill) {
+	case RAW_FILL_SKIP:
+		break;
+	case RAW_FILL_DISCARD: {
+#ifdef BLKDISCARD
+		uint64_t range[2] = { o->base + start, len };
+
+		if (!ioctl(o->fd, BLKDISCARD, &range))
+			break;
+#endif
+		if (!o->fill_warned)
+			WARN("%s: discard not supported, holes are skipped", o->device);
+		o->fill_warned = true;
+		break;
+	}
+	case RAW_FILL_ZEROOUT:
+		ret = write_zeroes(o, start, len);
+		break;
+	}
+
+	return ret;
+}
+
+static int emit_hole(struct raw_sparse_out *o, unsigned long long len)
+{
+	int ret;
+
+	if (o->hole_len && o->hole_start + o->hole_len != o->pos) {
+		ret = flush_hole(o);
+		if (ret)
+			return ret;
+	}
+	if (!o->hole_len)
+		o->hole_start = o->pos;
+	o->hole_len += len;
+	o->pos += len;
+
+	return 0;
+}
+
+static int emit_data(struct raw_sparse_out *o, const unsigned char *buf, size_t len)
+{
+	int ret;
+
+	ret = flush_hole(o);
+	if (ret)
+		return ret;
+	ret = pwrite_all(o->fd, buf, len, o->base + o->pos);
+	if (ret)
+		return ret;
+	o->pos += len;
+	o->written += len;
+
+	return 0;
+}
+
+/* Blocks that must read as zero, regardless of the fill mode */
+static int emit_zeroes(struct raw_sparse_out *o, unsigned long long len)
+{
+	int ret;
+
+	ret = flush_hole(o);
+	if (ret)
+		return ret;
+	ret = write_zeroes(o, o->pos, len);
+	if (ret)
+		return ret;
+	o->pos += len;
+	o->zeroed += len;
+
+	return 0;
+}
+
+/*
+ * bmap: the input is the whole image, blocks outside
+ * the mapped ranges are not written
+ */
+static int bmap_input(struct raw_sparse_out *o, const unsigned char *buf, size_t len)
+{
+	unsigned long long start, end;
+	size_t n;
+	int ret;
+
+	while (len) {
+		while (o->cur < o->nranges &&
+		       (o->ranges[o->cur].last + 1) * o->blksz <= o->pos)
+			o->cur++;
+
+		if (o->cur < o->nranges) {
+			start = o->ranges[o->cur].first * o->blksz;
+			end = (o->ranges[o->cur].last + 1) * o->blksz;
+		} else {
+			start = end = ~0ULL;
+		}
+
+		if (o->pos >= start) {
+			n = min_t(unsigned long long, len, end - o->pos);
+			ret = emit_data(o, buf, n);
+		} else {
+			n = min_t(unsigned long long, len, start - o->pos);
+			ret = emit_hole(o, n);
+		}
+		if (ret)
+			return ret;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static char *bmap_tag(char *s, const char *tag, unsigned long long *value)
+{
+	char *p = strstr(s, tag);
+
+	if (!p)
+		return NULL;
+	errno = 0;
+	*value = strtoull(p + strlen(tag), NULL, 10);
+	return errno ? NULL : p;
+}
+
+/*
+ * Parse the few elements needed from a bmaptool block map (XML).
+ * Ranges are "first-last" or "block", in ascending order.
+ */
+static int bmap_load(struct raw_sparse_out *o, const char *fname)
+{
+	unsigned long long value, first, last;
+	struct raw_range *r;
+	char *path, *xml = NULL, *p, *end;
+	struct stat st;
+	size_t count;
+	int fd, ret = -EINVAL;
+
+	if (asprintf(&path, "%s%s", get_tmpdir(), fname) == ENOMEM_ASPRINTF)
+		return -ENOMEM;
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) || st.st_size > BMAP_MAX_SIZE) {
+		ERROR("Block map %s cannot be read", path);
+		goto out;
+	}
+	xml = malloc(st.st_size + 1);
+	if (!xml || read(fd, xml, st.st_size) != st.st_size) {
+		ERROR("Block map %s cannot be read", path);
+		goto out;
+	}
+	xml[st.st_size] = '\0';
+
+	if (!bmap_tag(xml, "<BlockSize>", &value) || !value || value > UINT32_MAX) {
+		ERROR("%s: invalid BlockSize", fname);
+		goto out;
+	}
+	o->blksz = value;
+	if (!bmap_tag(xml, "<ImageSize>", &o->size)) {
+		ERROR("%s: invalid ImageSize", fname);
+		goto out;
+	}
+
+	count = 0;
+	for (p = xml; (p = strstr(p, "<Range")); p++)
+		count++;
+	o->ranges = calloc(count ? count : 1, sizeof(*o->ranges));
+	if (!o->ranges) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (p = xml; (p = strstr(p, "<Range")); p++) {
+		p = strchr(p, '>');
+		if (!p)
+			break;
+		first = strtoull(p + 1, &end, 10);
+		last = (*end == '-') ? strtoull(end + 1, &end, 10) : first;
+		if (last < first || (o->nranges &&
+		    first <= o->ranges[o->nranges - 1].last)) {
+			ERROR("%s: ranges must be ascending", fname);
+			goto out;
+		}
+		r = &o->ranges[o->nranges++];
+		r->first = first;
+		r->last = last;
+	}
+
+	TRACE("Block map %s: %zu ranges of %u bytes blocks, image %llu bytes",
+	      fname, o->nranges, o->blksz, o->size);
+	o->input = bmap_input;
+	ret = 0;
+
+out:
+	if (fd >= 0)
+		close(fd);
+	free(xml);
+	free(path);
+	return ret;
+}
+
+static int sparse_fill(struct raw_sparse_out *o, unsigned long long len)
+{
+	unsigned long long n;
+	uint32_t value = get_le32(o->hdr);
+	unsigned int i;
+	int ret;
+
+	if (!value)
+		return emit_zeroes(o, len);
+
+	if (!o->pattern) {
+		o->pattern = malloc(o->blksz);
+		if (!o->pattern)
+			return -ENOMEM;
+	}
+	for (i = 0; i < o->blksz; i += sizeof(value))
+		memcpy(o->pattern + i, o->hdr, sizeof(value));
+
+	while (len) {
+		n = min_t(unsigned long long, len, o->blksz);
+		ret = emit_data(o, o->pattern, n);
+		if (ret)
+			return ret;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int sparse_header(struct raw_sparse_out *o)
+{
+	unsigned int file_hdr_sz;
+
+	if (get_le32(o->hdr) != SPARSE_HEADER_MAGIC || get_le16(o->hdr + 4) != 1) {
+		ERROR("%s: not an Android sparse image (version 1)", o->device);
+		return -EINVAL;
+	}
+	file_hdr_sz = get_le16(o->hdr + 8);
+	o->chunk_hdr_sz = get_le16(o->hdr + 10);
+	o->blksz = get_le32(o->hdr + 12);
+	o->size = (unsigned long long)get_le32(o->hdr + 16) * o->blksz;
+	o->total_chunks = get_le32(o->hdr + 20);
+	if (file_hdr_sz < SPARSE_HEADER_LEN ||
+	    o->chunk_hdr_sz < CHUNK_HEADER_LEN || o->chunk_hdr_sz > SPARSE_HDR_MAX ||
+	    !o->blksz || o->blksz % 4) {
+		ERROR("%s: invalid sparse header", o->device);
+		return -EINVAL;
+	}
+	TRACE("Sparse image: %u chunks, %llu bytes in %u bytes blocks",
+	      o->total_chunks, o->size, o->blksz);
+
+	/* skip the rest of a larger file header, if any */
+	o->chunk_left = file_hdr_sz - SPARSE_HEADER_LEN;
+	o->state = SPARSE_CHUNK_HEADER;
+	o->hdr_need = o->chunk_hdr_sz;
+
+	return 0;
+}
+
+static int sparse_chunk(struct raw_sparse_out *o)
+{
+	unsigned int type = get_le16(o->hdr);
+	unsigned long long blocks = get_le32(o->hdr + 4);
+	unsigned long long total = get_le32(o->hdr + 8);
+	unsigned long long len = blocks * o->blksz;
+
+	if (++o->chunks > o->total_chunks || o->pos + len > o->size) {
+		ERROR("%s: sparse chunk %u out of the image", o->device, o->chunks);
+		return -EINVAL;
+	}
+
+	/* hdr_len is reset by the caller, the header tail is skipped */
+	o->chunk_left = total - o->chunk_hdr_sz;
+	switch (type) {
+	case CHUNK_TYPE_RAW:
+		if (o->chunk_left != len)
+			break;
+		o->state = SPARSE_CHUNK_RAW;
+		return 0;
+	case CHUNK_TYPE_FILL:
+		if (o->chunk_left != 4)
+			break;
+		o->chunk_left = len;
+		o->state = SPARSE_CHUNK_FILL;
+		o->hdr_need = 4;
+		return 0;
+	case CHUNK_TYPE_DONT_CARE:
+		if (o->chunk_left)
+			break;
+		o->state = SPARSE_CHUNK_HEADER;
+		return emit_hole(o, len);
+	case CHUNK_TYPE_CRC32:
+		if (o->chunk_left != 4)
+			break;
+		o->state = SPARSE_CHUNK_CRC;
+		o->hdr_need = 4;
+		return 0;
+	}
+
+	ERROR("%s: invalid sparse chunk %u (type 0x%x)", o->device, o->chunks, type);
+	return -EINVAL;
+}
+
+/*
+ * Android sparse: decoded while it streams, only RAW and
+ * FILL chunks reach the device
+ */
+static int sparse_input(struct raw_sparse_out *o, const unsigned char *buf, size_t len)
+{
+	size_t n;
+	int ret;
+
+	while (len) {
+		switch (o->state) {
+		case SPARSE_FILE_HEADER:
+		case SPARSE_CHUNK_FILL:
+		case SPARSE_CHUNK_CRC:
+		case SPARSE_CHUNK_HEADER:
+			/* tail of a header larger than the known fields */
+			if (o->state == SPARSE_CHUNK_HEADER && !o->hdr_len && o->chunk_left) {
+				n = min_t(unsigned long long, len, o->chunk_left);
+				o->chunk_left -= n;
+				break;
+			}
+			n = min(len, o->hdr_need - o->hdr_len);
+			memcpy(o->hdr + o->hdr_len, buf, n);
+			o->hdr_len += n;
+			if (o->hdr_len < o->hdr_need)
+				break;
+			o->hdr_len = 0;
+
+			if (o->state == SPARSE_FILE_HEADER) {
+				ret = sparse_header(o);
+			} else if (o->state == SPARSE_CHUNK_HEADER) {
+				ret = sparse_chunk(o);
+				if (!ret && o->state == SPARSE_CHUNK_HEADER)
+					o->hdr_need = o->chunk_hdr_sz;
+			} else {
+				ret = (o->state == SPARSE_CHUNK_FILL) ?
+					sparse_fill(o, o->chunk_left) : 0;
+				o->chunk_left = 0;
+				o->state = SPARSE_CHUNK_HEADER;
+				o->hdr_need = o->chunk_hdr_sz;
+			}
+			if (ret)
+				return ret;
+			if (o->chunks == o->total_chunks && o->state == SPARSE_CHUNK_HEADER)
+				o->state = SPARSE_DONE;
+			break;
+		case SPARSE_CHUNK_RAW:
+			n = min_t(unsigned long long, len, o->chunk_left);
+			ret = emit_data(o, buf, n);
+			if (ret)
+				return ret;
+			o->chunk_left -= n;
+			if (!o->chunk_left) {
+				o->state = (o->chunks == o->total_chunks) ?
+					SPARSE_DONE : SPARSE_CHUNK_HEADER;
+				o->hdr_need = o->chunk_hdr_sz;
+			}
+			break;
+		case SPARSE_DONE:
+		default:
+			ERROR("%s: data after the end of the sparse image", o->device);
+			return -EINVAL;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static bool ext4_has_super(struct ext4_map *e, unsigned int group,
+			   uint32_t compat, uint32_t ro_compat)
+{
+	const unsigned char *sb = e->sb + EXT4_SB_OFFSET;
+	unsigned int n;
+
+	if (group == 0)
+		return true;
+	if (compat & EXT4_COMPAT_SPARSE_SUPER2)
+		return group == get_le32(sb + 0x24C) || group == get_le32(sb + 0x250);
+	if (group == 1 || !(ro_compat & EXT4_RO_COMPAT_SPARSE_SUPER))
+		return true;
+	/* powers of 3, 5 and 7 */
+	for (unsigned int base = 3; base <= 7; base += 2) {
+		for (n = base; n < group; n *= base)
+			;
+		if (n == group)
+			return true;
+	}
+	return false;
+}
+
+static int cmp_range(const void *a, const void *b)
+{
+	const struct raw_range *r1 = a, *r2 = b;
+
+	return (r1->first > r2->first) - (r1->first < r2->first);
+}
+
+static struct ext4_group *sort_groups;
+
+static int cmp_bitmap(const void *a, const void *b)
+{
+	unsigned long long b1 = sort_groups[*(const unsigned int *)a].block_bitmap;
+	unsigned long long b2 = sort_groups[*(const unsigned int *)b].block_bitmap;
+
+	return (b1 > b2) - (b1 < b2);
+}
+
+/* Parse the superblock, return false if the map cannot be used */
+static bool ext4_parse_sb(struct raw_sparse_out *o)
+{
+	struct ext4_map *e = o->ext4;
+	const unsigned char *sb = e->sb + EXT4_SB_OFFSET;
+	uint32_t incompat, ro_compat, log_bs;
+	unsigned long long blocks;
+
+	if (get_le16(sb + 0x38) != EXT4_SUPER_MAGIC) {
+		WARN("%s: not an ext2/3/4 image, all blocks are written", o->device);
+		return false;
+	}
+	incompat = get_le32(sb + 0x60);
+	ro_compat = get_le32(sb + 0x64);
+	log_bs = get_le32(sb + 0x18);
+	if (log_bs > 6 || (incompat & EXT4_INCOMPAT_META_BG) ||
+	    (ro_compat & EXT4_RO_COMPAT_BIGALLOC)) {
+		WARN("%s: ext4 layout not supported (meta_bg, bigalloc), all blocks are written",
+		     o->device);
+		return false;
+	}
+
+	o->blksz = 1024 << log_bs;
+	blocks = get_le32(sb + 0x04);
+	e->desc_size = 32;
+	if (incompat & EXT4_INCOMPAT_64BIT) {
+		blocks |= (unsigned long long)get_le32(sb + 0x150) << 32;
+		e->desc_size = get_le16(sb + 0xFE);
+	}
+	e->first_data_block = get_le32(sb + 0x14);
+	e->blocks_per_group = get_le32(sb + 0x20);
+	if (e->desc_size < 32 || e->desc_size > 1024 || !e->blocks_per_group ||
+	    e->blocks_per_group > 8ULL * o->blksz || blocks <= e->first_data_block)
+		return false;
+
+	e->ngroups = (blocks - e->first_data_block + e->blocks_per_group - 1) /
+			e->blocks_per_group;
+	e->gdt_start = e->first_data_block + 1;
+	e->gdt_blocks = ((unsigned long long)e->ngroups * e->desc_size +
+			 o->blksz - 1) / o->blksz;
+	e->gdt = malloc(e->gdt_blocks * o->blksz);
+	e->groups = calloc(e->ngroups, sizeof(*e->groups));
+	e->stage = malloc(o->blksz);
+	if (!e->gdt || !e->groups || !e->stage)
+		return false;
+
+	TRACE("ext4 image: %llu blocks of %u bytes, %u groups",
+	      blocks, o->blksz, e->ngroups);
+
+	return true;
+}
+
+/* The group descriptors are complete: build the metadata map */
+static bool ext4_parse_gdt(struct raw_sparse_out *o)
+{
+	struct ext4_map *e = o->ext4;
+	const unsigned char *sb = e->sb + EXT4_SB_OFFSET;
+	uint32_t compat = get_le32(sb + 0x5C);
+	uint32_t ro_compat = get_le32(sb + 0x64);
+	bool csum = ro_compat & (EXT4_RO_COMPAT_GDT_CSUM | EXT4_RO_COMPAT_METADATA_CSUM);
+	bool is64 = e->desc_size >= 64;
+	unsigned int inode_size = get_le32(sb + 0x4C) ? get_le16(sb + 0x58) : 128;
+	unsigned long long itable_blocks, reserved = get_le16(sb + 0xCE);
+	struct raw_range *r;
+	unsigned int g;
+
+	itable_blocks = ((unsigned long long)get_le32(sb + 0x28) * inode_size +
+			 o->blksz - 1) / o->blksz;
+
+	e->meta = calloc(4 * (size_t)e->ngroups, sizeof(*e->meta));
+	e->by_bitmap = calloc(e->ngroups, sizeof(*e->by_bitmap));
+	if (!e->meta || !e->by_bitmap)
+		return false;
+
+	for (g = 0; g < e->ngroups; g++) {
+		const unsigned char *d = e->gdt + (size_t)g * e->desc_size;
+		struct ext4_group *grp = &e->groups[g];
+		unsigned long long ib, it;
+
+		grp->block_bitmap = get_le32(d + 0x00);
+		ib = get_le32(d + 0x04);
+		it = get_le32(d + 0x08);
+		if (is64) {
+			grp->block_bitmap |= (unsigned long long)get_le32(d + 0x20) << 32;
+			ib |= (unsigned long long)get_le32(d + 0x24) << 32;
+			it |= (unsigned long long)get_le32(d + 0x28) << 32;
+		}
+		grp->uninit = csum && (get_le16(d + 0x12) & EXT4_BG_BLOCK_UNINIT);
+		e->by_bitmap[g] = g;
+
+		r = &e->meta[e->nmeta++];
+		r->first = r->last = grp->block_bitmap;
+		r = &e->meta[e->nmeta++];
+		r->first = r->last = ib;
+		r = &e->meta[e->nmeta++];
+		r->first = it;
+		r->last = it + itable_blocks - 1;
+		/* superblock and descriptors, primary or backup */
+		if (ext4_has_super(e, g, compat, ro_compat)) {
+			r = &e->meta[e->nmeta++];
+			r->first = g ? e->first_data_block + g * e->blocks_per_group : 0;
+			r->last = e->first_data_block + g * e->blocks_per_group +
+				  e->gdt_blocks + reserved;
+		}
+	}
+
+	qsort(e->meta, e->nmeta, sizeof(*e->meta), cmp_range);
+	sort_groups = e->groups;
+	qsort(e->by_bitmap, e->ngroups, sizeof(*e->by_bitmap), cmp_bitmap);
+	sort_groups = NULL;
+
+	return true;
+}
+
+static void ext4_disable(struct ext4_map *e)
+{
+	e->disabled = true;
+	for (unsigned int g = 0; e->groups && g < e->ngroups; g++) {
+		free(e->groups[g].bitmap);
+		e->groups[g].bitmap = NULL;
+	}
+}
+
+/* Collect metadata from block blk and tell if it must be written */
+static bool ext4_block_used(struct raw_sparse_out *o, unsigned long long blk,
+			    const unsigned char *data)
+{
+	struct ext4_map *e = o->ext4;
+	struct ext4_group *grp;
+	unsigned long long bit;
+	unsigned int g;
+
+	if (e->disabled)
+		return true;
+
+	/* group descriptors are taken before they are needed */
+	if (blk >= e->gdt_start && blk < e->gdt_start + e->gdt_blocks) {
+		memcpy(e->gdt + (blk - e->gdt_start) * o->blksz, data, o->blksz);
+		if (blk == e->gdt_start + e->gdt_blocks - 1 && !ext4_parse_gdt(o)) {
+			WARN("%s: cannot map ext4 groups, all blocks are written",
+			     o->device);
+			ext4_disable(e);
+		}
+		return true;
+	}
+	if (!e->meta || blk < e->first_data_block)
+		return true;
+
+	/* keep a copy of bitmaps streamed before their group */
+	while (e->bitmap_cur < e->ngroups &&
+	       e->groups[e->by_bitmap[e->bitmap_cur]].block_bitmap < blk)
+		e->bitmap_cur++;
+	while (e->bitmap_cur < e->ngroups &&
+	       e->groups[e->by_bitmap[e->bitmap_cur]].block_bitmap == blk) {
+		grp = &e->groups[e->by_bitmap[e->bitmap_cur++]];
+		if (grp->uninit || e->by_bitmap[e->bitmap_cur - 1] < e->low_group)
+			continue;
+		grp->bitmap = malloc(o->blksz);
+		if (!grp->bitmap) {
+			ext4_disable(e);
+			return true;
+		}
+		memcpy(grp->bitmap, data, o->blksz);
+	}
+
+	while (e->meta_cur < e->nmeta && e->meta[e->meta_cur].last < blk)
+		e->meta_cur++;
+	if (e->meta_cur < e->nmeta && e->meta[e->meta_cur].first <= blk)
+		return true;
+
+	g = (blk - e->first_data_block) / e->blocks_per_group;
+	if (g >= e->ngroups)
+		return true;
+	/* the bitmaps of groups already passed are not needed anymore */
+	for (; e->low_group < g; e->low_group++) {
+		free(e->groups[e->low_group].bitmap);
+		e->groups[e->low_group].bitmap = NULL;
+	}
+
+	grp = &e->groups[g];
+	if (grp->uninit)
+		return false;
+	if (!grp->bitmap)
+		return true;
+	bit = (blk - e->first_data_block) % e->blocks_per_group;
+	return grp->bitmap[bit / 8] & (1 << (bit % 8));
+}
+
+/* Whole blocks, runs of used and unused blocks are merged */
+static int ext4_blocks(struct raw_sparse_out *o, const unsigned char *buf, size_t nblocks)
+{
+	size_t i, run = 0;
+	bool used = true, cur;
+	int ret;
+
+	for (i = 0; i < nblocks; i++) {
+		cur = ext4_block_used(o, o->pos / o->blksz + run,
+				      buf + (i * o->blksz));
+		if (run && cur != used) {
+			ret = used ? emit_data(o, buf + (i - run) * o->blksz, run * o->blksz) :
+				     emit_hole(o, run * o->blksz);
+			if (ret)
+				return ret;
+			run = 0;
+		}
+		used = cur;
+		run++;
+	}
+	if (!run)
+		return 0;
+
+	return used ? emit_data(o, buf + (i - run) * o->blksz, run * o->blksz) :
+		      emit_hole(o, run * o->blksz);
+}
+
+static int ext4_feed(struct raw_sparse_out *o, const unsigned char *buf, size_t len)
+{
+	struct ext4_map *e = o->ext4;
+	size_t n;
+	int ret;
+
+	while (len) {
+		if (e->stage_len || len < o->blksz) {
+			n = min(len, o->blksz - e->stage_len);
+			memcpy(e->stage + e->stage_len, buf, n);
+			e->stage_len += n;
+			if (e->stage_len == o->blksz) {
+				e->stage_len = 0;
+				ret = ext4_blocks(o, e->stage, 1);
+				if (ret)
+					return ret;
+			}
+		} else {
+			n = len - len % o->blksz;
+			ret = ext4_blocks(o, buf, n / o->blksz);
+			if (ret)
+				return ret;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int ext4_input(struct raw_sparse_out *o, const unsigned char *buf, size_t len)
+{
+	struct ext4_map *e = o->ext4;
+	size_t n;
+	int ret;
+
+	if (e->sb_len < EXT4_SB_END) {
+		n = min(len, EXT4_SB_END - e->sb_len);
+		memcpy(e->sb + e->sb_len, buf, n);
+		e->sb_len += n;
+		buf += n;
+		len -= n;
+		if (e->sb_len < EXT4_SB_END)
+			return 0;
+
+		if (!ext4_parse_sb(o)) {
+			ext4_disable(e);
+			o->blksz = EXT4_SB_END;
+			free(e->stage);
+			e->stage = malloc(o->blksz);
+			if (!e->stage)
+				return -ENOMEM;
+		}
+		ret = ext4_feed(o, e->sb, EXT4_SB_END);
+		if (ret)
+			return ret;
+	}
+
+	return ext4_feed(o, buf, len);
+}
+
+static void ext4_free(struct ext4_map *e)
+{
+	if (!e)
+		return;
+	ext4_disable(e);
+	free(e->stage);
+	free(e->gdt);
+	free(e->groups);
+	free(e->meta);
+	free(e->by_bitmap);
+	free(e);
+}
+
+bool raw_sparse_requested(struct img_type *img)
+{
+	return dict_get_value(&img->properties, "sparse") != NULL;
+}
+
+struct raw_sparse_out *raw_sparse_new(struct img_type *img, int fd)
+{
+	struct raw_sparse_out *o;
+	char *type = dict_get_value(&img->properties, "sparse");
+	char *fill = dict_get_value(&img->properties, "sparse-fill");
+	char *bmap;
+
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		return NULL;
+	o->fd = fd;
+	o->device = img->device;
+	o->base = img->seek;
+
+	if (!fill || !strcmp(fill, "skip")) {
+		o->fill = RAW_FILL_SKIP;
+	} else if (!strcmp(fill, "discard")) {
+		o->fill = RAW_FILL_DISCARD;
+	} else if (!strcmp(fill, "zeroout")) {
+		o->fill = RAW_FILL_ZEROOUT;
+	} else {
+		ERROR("Unknown sparse-fill %s", fill);
+		goto err;
+	}
+
+	if (!strcmp(type, "android")) {
+		o->input = sparse_input;
+		o->state = SPARSE_FILE_HEADER;
+		o->hdr_need = SPARSE_HEADER_LEN;
+	} else if (!strcmp(type, "bmap")) {
+		bmap = dict_get_value(&img->properties, "sparse-bmap");
+		if (!bmap) {
+			ERROR("sparse = bmap requires the property sparse-bmap");
+			goto err;
+		}
+		if (bmap_load(o, bmap))
+			goto err;
+	} else if (!strcmp(type, "ext4")) {
+		o->ext4 = calloc(1, sizeof(*o->ext4));
+		if (!o->ext4)
+			goto err;
+		o->input = ext4_input;
+	} else {
+		ERROR("Unknown sparse format %s", type);
+		goto err;
+	}
+
+	return o;
+
+err:
+	raw_sparse_free(o);
+	return NULL;
+}
+
+int raw_sparse_write(void *out, const void *buf, size_t len)
+{
+	struct raw_sparse_out *o = (struct raw_sparse_out *)out;
+
+	return o->input(o, buf, len);
+}
+
+int raw_sparse_finish(struct raw_sparse_out *o)
+{
+	struct stat st;
+	int ret;
+
+	if (o->input == sparse_input && o->state != SPARSE_DONE) {
+		ERROR("%s: sparse image truncated", o->device);
+		return -EINVAL;
+	}
+	if (o->ext4) {
+		if (o->ext4->sb_len < EXT4_SB_END) {
+			ERROR("%s: ext4 image truncated", o->device);
+			return -EINVAL;
+		}
+		/* the image may be padded behind the filesystem */
+		if (o->ext4->stage_len) {
+			ret = emit_data(o, o->ext4->stage, o->ext4->stage_len);
+			if (ret)
+				return ret;
+		}
+		o->size = o->pos;
+	}
+	if (o->pos != o->size) {
+		ERROR("%s: image is %llu bytes, %llu expected", o->device,
+		      o->pos, o->size);
+		return -EINVAL;
+	}
+
+	ret = flush_hole(o);
+	if (ret)
+		return ret;
+
+	/* A regular file must still get the whole logical size */
+	if (!fstat(o->fd, &st) && S_ISREG(st.st_mode) &&
+	    (unsigned long long)st.st_size < o->base + o->size &&
+	    ftruncate(o->fd, o->base + o->size)) {
+		ERROR("%s: cannot extend to %llu bytes", o->device, o->base + o->size);
+		return -EIO;
+	}
+
+	INFO("%s: %llu bytes written, %llu zeroed, %llu not written",
+	     o->device, o->written, o->zeroed, o->skipped);
+
+	return 0;
+}
+
+void raw_sparse_free(struct raw_sparse_out *o)
+{
+	if (!o)
+		return;
+	free(o->ranges);
+	free(o->pattern);
+	ext4_free(o->ext4);
+	free(o);
+}
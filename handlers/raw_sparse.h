@@ -0,0 +1,31 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include "swupdate_image.h"
+
+/*
+ * Writer for copyimage() that only writes the blocks of an image
+ * holding data. Which blocks those are is told by the input format
+ * (Android sparse), by a block map shipped with the image (bmap) or
+ * by the allocation bitmaps of the filesystem in the image (ext4).
+ */
+struct raw_sparse_out;
+
+/* Returns true if img asks for sparse writing */
+bool raw_sparse_requested(struct img_type *img);
+
+/*
+ * fd is the opened device. The returned pointer is passed as output
+ * to copyimage(): its first member is the fd, as copyfile() expects.
+ */
+struct raw_sparse_out *raw_sparse_new(struct img_type *img, int fd);
+int raw_sparse_write(void *out, const void *buf, size_t len);
+int raw_sparse_finish(struct raw_sparse_out *o);
+void raw_sparse_free(struct raw_sparse_out *o);
@@ -6,10 +6,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #ifdef __FreeBSD__
 #include <sys/disk.h>
 // the ioctls are almost identical except for the name, just alias it
@@ -20,11 +23,46 @@
 
 #include "handler.h"
 #include "swupdate_image.h"
+#include "sslapi.h"
 #include "util.h"
+#include "verity_hash.h"
+
+#define READBACK_BUFFERS	2
+#define READBACK_BLOCKSIZE	(1024 * 1024)
+#define READBACK_ALIGN		4096
 
 void readback_handler(void);
 static int readback_postinst(struct img_type *img);
 
+/*
+ * A region of the device to be verified
+ */
+struct readback_region {
+	unsigned long long offset;
+	unsigned long long size;
+	unsigned char hash[SHA256_HASH_LENGTH];
+};
+
+/*
+ * The device is read by a separate thread, so that
+ * reading and hashing overlap
+ */
+struct readback_reader {
+	int fd;
+	unsigned long long offset;
+	unsigned long long size;
+	size_t blocksize;
+	unsigned char *buf[READBACK_BUFFERS];
+	size_t len[READBACK_BUFFERS];
+	unsigned int produced;
+	unsigned int consumed;
+	bool done;
+	bool stop;
+	int error;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
 static int readback(struct img_type *img, void *data)
 {
 	if (!data)
@@ -40,80 +78,371 @@ static int readback(struct img_type *img, void *data)
 	}
 }
 
+static void *readback_read_thread(void *data)
+{
+	struct readback_reader *r = (struct readback_reader *)data;
+	unsigned long long done = 0;
+	int error = 0;
+
+	while (done < r->size) {
+		unsigned char *buf;
+		size_t toread, len = 0;
+		ssize_t n;
+
+		pthread_mutex_lock(&r->lock);
+		while (!r->stop && r->produced - r->consumed == READBACK_BUFFERS)
+			pthread_cond_wait(&r->cond, &r->lock);
+		pthread_mutex_unlock(&r->lock);
+		if (r->stop)
+			break;
+
+		buf = r->buf[r->produced % READBACK_BUFFERS];
+		toread = r->blocksize;
+		while (len < toread && done + len < r->size) {
+			n = pread(r->fd, buf + len, toread - len, r->offset + done + len);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n < 0) {
+				ERROR("Readback: read error: %s", strerror(errno));
+				error = -EIO;
+				break;
+			}
+			if (n == 0) {
+				ERROR("Readback: device ends before %llu bytes",
+				      r->size);
+				error = -EFAULT;
+				break;
+			}
+			len += n;
+		}
+		if (error)
+			break;
+
+		len = min_t(unsigned long long, len, r->size - done);
+		done += len;
+
+		pthread_mutex_lock(&r->lock);
+		r->len[r->produced % READBACK_BUFFERS] = len;
+		r->produced++;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->error = error;
+	r->done = true;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+/*
+ * Read a region of the device and pass the data to
+ * the consumer (plain hash or hash tree)
+ */
+typedef int (*readback_consumer)(void *ctx, const unsigned char *buf, size_t len);
+
+static int readback_region_read(int fd, unsigned long long offset,
+				unsigned long long size, size_t blocksize,
+				readback_consumer consume, void *ctx)
+{
+	struct readback_reader r;
+	pthread_t reader;
+	int ret = 0;
+	int i;
+
+	memset(&r, 0, sizeof(r));
+	r.fd = fd;
+	r.offset = offset;
+	r.size = size;
+	r.blocksize = blocksize;
+	for (i = 0; i < READBACK_BUFFERS; i++) {
+		if (posix_memalign((void **)&r.buf[i], READBACK_ALIGN, blocksize)) {
+			ERROR("Readback: OOM allocating %zu bytes", blocksize);
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+	pthread_mutex_init(&r.lock, NULL);
+	pthread_cond_init(&r.cond, NULL);
+
+	if (pthread_create(&reader, NULL, readback_read_thread, &r)) {
+		ERROR("Readback: cannot start reader thread");
+		ret = -EFAULT;
+		goto out_destroy;
+	}
+
+	for (;;) {
+		unsigned int idx;
+
+		pthread_mutex_lock(&r.lock);
+		while (r.consumed == r.produced && !r.done)
+			pthread_cond_wait(&r.cond, &r.lock);
+		if (r.consumed == r.produced) {
+			pthread_mutex_unlock(&r.lock);
+			break;
+		}
+		idx = r.consumed % READBACK_BUFFERS;
+		pthread_mutex_unlock(&r.lock);
+
+		ret = consume(ctx, r.buf[idx], r.len[idx]);
+
+		pthread_mutex_lock(&r.lock);
+		r.consumed++;
+		if (ret)
+			r.stop = true;
+		pthread_cond_broadcast(&r.cond);
+		pthread_mutex_unlock(&r.lock);
+		if (ret)
+			break;
+	}
+
+	pthread_join(reader, NULL);
+	if (!ret)
+		ret = r.error;
+
+out_destroy:
+	pthread_mutex_destroy(&r.lock);
+	pthread_cond_destroy(&r.cond);
+out:
+	for (i = 0; i < READBACK_BUFFERS; i++)
+		free(r.buf[i]);
+
+	return ret;
+}
+
+static int consume_hash(void *ctx, const unsigned char *buf, size_t len)
+{
+	return swupdate_HASH_update((struct swupdate_digest *)ctx, buf, len);
+}
+
+static int consume_hash_tree(void *ctx, const unsigned char *buf, size_t len)
+{
+	return verity_hash_update((struct verity_hash *)ctx, buf, len);
+}
+
+static int readback_verify_hash(int fd, struct readback_region *region,
+				size_t blocksize)
+{
+	struct swupdate_digest *dgst;
+	unsigned char md_value[SHA256_HASH_LENGTH];
+	unsigned int md_len;
+	int ret;
+
+	dgst = swupdate_HASH_init(SHA_DEFAULT);
+	if (!dgst)
+		return -EFAULT;
+
+	ret = readback_region_read(fd, region->offset, region->size, blocksize,
+				   consume_hash, dgst);
+	if (!ret && swupdate_HASH_final(dgst, md_value, &md_len) != 1)
+		ret = -EFAULT;
+	swupdate_HASH_cleanup(dgst);
+	if (ret)
+		return ret;
+
+	if (swupdate_HASH_compare(region->hash, md_value)) {
+		char computed[SHA256_HASH_LENGTH * 2 + 1];
+		hash_to_ascii(md_value, computed);
+		ERROR("Readback: hash mismatch at offset %llu, computed %s",
+		      region->offset, computed);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+/*
+ * Compute the root hash of a dm-verity hash tree on the data
+ * of the region, hashing the data blocks in parallel
+ */
+static int readback_verify_hash_tree(int fd, struct readback_region *region,
+				     size_t blocksize, struct img_type *img)
+{
+	struct verity_hash_cfg cfg;
+	struct verity_hash *v;
+	unsigned char root[VERITY_MAX_DIGEST_SIZE];
+	unsigned char expected[VERITY_MAX_DIGEST_SIZE];
+	char *value;
+	int ret;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.fd = -1;
+	cfg.algo = dict_get_value(&img->properties, "verity-hash");
+	value = dict_get_value(&img->properties, "verity-data-block-size");
+	cfg.data_block_size = value ? strtoul(value, NULL, 10) : 4096;
+	value = dict_get_value(&img->properties, "verity-hash-block-size");
+	cfg.hash_block_size = value ? strtoul(value, NULL, 10) : 4096;
+	value = dict_get_value(&img->properties, "verity-salt");
+	if (value) {
+		cfg.salt_size = strlen(value) / 2;
+		if (cfg.salt_size > VERITY_MAX_SALT_SIZE ||
+		    ascii_to_bin(cfg.salt, cfg.salt_size, value)) {
+			ERROR("Readback: invalid verity-salt");
+			return -EINVAL;
+		}
+	}
+	value = dict_get_value(&img->properties, "threads");
+	cfg.threads = value ? strtoul(value, NULL, 10) :
+			(unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	v = verity_hash_init(&cfg, region->size);
+	if (!v)
+		return -EINVAL;
+
+	value = dict_get_value(&img->properties, "roothash");
+	if (!value || ascii_to_bin(expected, verity_hash_digest_size(v), value)) {
+		ERROR("Readback: invalid roothash");
+		verity_hash_free(v);
+		return -EINVAL;
+	}
+
+	ret = readback_region_read(fd, region->offset, region->size, blocksize,
+				   consume_hash_tree, v);
+	if (!ret)
+		ret = verity_hash_final(v, root);
+	if (!ret && memcmp(root, expected, verity_hash_digest_size(v))) {
+		ERROR("Readback: root hash mismatch");
+		ret = -EFAULT;
+	}
+
+	verity_hash_free(v);
+	return ret;
+}
+
+static unsigned long long get_device_size(int fd)
+{
+	unsigned long long size = 0;
+	struct stat st;
+
+	if (ioctl(fd, BLKGETSIZE64, &size) == 0)
+		return size;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+		return st.st_size;
+
+	return 0;
+}
+
+/*
+ * Properties sha256, size and offset can be lists to verify
+ * multiple regions of the same device. The Nth region gets
+ * the Nth element of each list.
+ */
+static char *get_list_elem(struct dict_list *list, unsigned int n)
+{
+	struct dict_list_elem *elem;
+
+	if (!list)
+		return NULL;
+
+	LIST_FOREACH(elem, list, next) {
+		if (!n--)
+			return elem->value;
+	}
+
+	return NULL;
+}
+
 static int readback_postinst(struct img_type *img)
 {
-	/* Get property: partition hash */
-	unsigned char hash[SHA256_HASH_LENGTH];
-	char *ascii_hash = dict_get_value(&img->properties, "sha256");
-	if (!ascii_hash || ascii_to_hash(hash, ascii_hash) < 0 || !IsValidHash(hash)) {
+	struct dict_list *hashes = dict_get_list(&img->properties, "sha256");
+	struct dict_list *sizes = dict_get_list(&img->properties, "size");
+	struct dict_list *offsets = dict_get_list(&img->properties, "offset");
+	bool hash_tree = dict_get_value(&img->properties, "roothash") != NULL;
+	struct readback_region region;
+	unsigned long long devsize;
+	unsigned int n;
+	size_t blocksize = READBACK_BLOCKSIZE;
+	int flags = O_RDONLY;
+	char *value;
+	int status = 0;
+
+	if (!hashes && !hash_tree) {
 		ERROR("Invalid hash");
 		return -EINVAL;
 	}
 
-	/* Get property: partition size */
-	unsigned int size = 0;
-	char *value = dict_get_value(&img->properties, "size");
+	/* Get property: size of each read */
+	value = dict_get_value(&img->properties, "blocksize");
 	if (value) {
-		size = strtoul(value, NULL, 10);
-	} else {
-		TRACE("Property size not found, use partition size");
+		blocksize = SWUPDATE_ALIGN(ustrtoull(value, NULL, 10), READBACK_ALIGN);
+		if (!blocksize)
+			blocksize = READBACK_BLOCKSIZE;
 	}
 
-	/* Get property: offset */
-	unsigned long offset = 0;
-	value = dict_get_value(&img->properties, "offset");
-	if (value) {
-		offset = strtoul(value, NULL, 10);
-	} else {
-		TRACE("Property offset not found, use default 0");
-	}
+	/* Bypass the page cache to read what is really stored */
+	if (strtobool(dict_get_value(&img->properties, "direct")))
+		flags |= O_DIRECT;
 
 	/* Open the device (partition) */
-	int fdin = open(img->device, O_RDONLY);
+	int fdin = open(img->device, flags);
+	if (fdin < 0 && (flags & O_DIRECT)) {
+		WARN("O_DIRECT not supported on %s, use buffered reads", img->device);
+		flags &= ~O_DIRECT;
+		fdin = open(img->device, flags);
+	}
 	if (fdin < 0) {
 		ERROR("Failed to open %s: %s", img->device, strerror(errno));
 		return -ENODEV;
 	}
 
-	/* Get the real size of the partition, if size is not set. */
-	if (size == 0) {
-		if (ioctl(fdin, BLKGETSIZE64, &size) < 0) {
-			ERROR("Cannot get size of %s", img->device);
-			close(fdin);
-			return -EFAULT;
+	devsize = get_device_size(fdin);
+
+	for (n = 0; status == 0; n++) {
+		char *ascii_hash = get_list_elem(hashes, n);
+
+		if (n > 0 && !ascii_hash)
+			break;
+
+		memset(&region, 0, sizeof(region));
+		if (!hash_tree && (ascii_to_hash(region.hash, ascii_hash) < 0 ||
+				   !IsValidHash(region.hash))) {
+			ERROR("Invalid hash");
+			status = -EINVAL;
+			break;
 		}
-		TRACE("Partition size: %u", size);
-	}
 
-	/* 
-	 * Seek the file descriptor before passing it to copyfile().
-	 * This is necessary because copyfile() only accepts streams,
-	 * so the file descriptor shall be already at the right position.
-	 */
-	if (lseek(fdin, offset, SEEK_SET) < 0) {
-		ERROR("Seek %lu bytes failed: %s", offset, strerror(errno));
-		close(fdin);
-		return -EFAULT;
+		/* Get property: offset */
+		value = get_list_elem(offsets, n);
+		if (value) {
+			region.offset = ustrtoull(value, NULL, 10);
+		} else {
+			TRACE("Property offset not found, use default 0");
+		}
+
+		/* Get property: size, the rest of the device if not set */
+		value = get_list_elem(sizes, n);
+		if (value)
+			region.size = ustrtoull(value, NULL, 10);
+		if (region.size == 0) {
+			if (devsize <= region.offset) {
+				ERROR("Cannot get size of %s", img->device);
+				status = -EFAULT;
+				break;
+			}
+			region.size = devsize - region.offset;
+			TRACE("Property size not found, use partition size: %llu",
+			      region.size);
+		}
+
+		if ((flags & O_DIRECT) && (region.offset % READBACK_ALIGN)) {
+			ERROR("Offset %llu not aligned to %d for direct reads",
+			      region.offset, READBACK_ALIGN);
+			status = -EINVAL;
+			break;
+		}
+
+		if (hash_tree)
+			status = readback_verify_hash_tree(fdin, &region, blocksize, img);
+		else
+			status = readback_verify_hash(fdin, &region, blocksize);
+
+		/* A hash tree covers just one region */
+		if (hash_tree)
+			break;
 	}
 
-	/*
-	 * Perform hash verification. We do not need to pass an output device to
-	 * the copyfile() function, because we only want it to verify the hash of
-	 * the input device.
-	 */
-	unsigned long offset_out = 0;
-	int status = copyfile(fdin,
-			NULL,  /* no output */
-			size,
-			&offset_out,
-			0,     /* no output seek */
-			1,     /* skip file, do not write to the output */
-			0,     /* no compressed */
-			NULL,  /* no checksum */
-			hash,
-			false,     /* no encrypted */
-			NULL,     /* no IVT */
-			NULL); /* no callback */
 	if (status == 0) {
 		INFO("Readback verification success");
 	} else {
@@ -13,6 +13,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <zmq.h>
 
 #include "handler.h"
@@ -25,6 +27,15 @@
 
 #define REMOTE_IPC_TIMEOUT	2000
 
+/*
+ * Windowed mode: the remote grants a number of DATA
+ * messages that can be sent without waiting for the ACK
+ */
+#define REMOTE_CAPABILITIES	"WINDOW"
+#define REMOTE_FRAME_SIZE	(256 * 1024)
+#define REMOTE_MAX_FRAME_SIZE	(4 * 1024 * 1024)
+#define REMOTE_MAX_WINDOW	64
+
 static int timeout = REMOTE_IPC_TIMEOUT;
 
 struct RHmsg {
@@ -35,7 +46,30 @@ struct remote_command {
 	char *cmd;
 };
 
+struct remote_conn;
+
+struct remote_buffer {
+	char *data;
+	bool busy;	/* owned by zeromq until released */
+	struct remote_conn *conn;
+};
+
+struct remote_conn {
+	void *request;
+	unsigned int window;	/* 0 = stop-and-wait */
+	size_t framesize;
+	struct remote_buffer *buffers;	/* REMOTE_MAX_WINDOW slots */
+	unsigned int nbuffers;		/* slots with data allocated */
+	unsigned int cur;
+	size_t filled;
+	unsigned long long seq;		/* last DATA sent */
+	unsigned long long acked;	/* last DATA acknowledged */
+	pthread_mutex_t lock;
+	pthread_cond_t released;
+};
+
 void remote_handler(void);
+static int remote_alloc_buffers(struct remote_conn *conn);
 
 static void RHset_command(struct RHmsg *self, const char *key)
 {
@@ -54,29 +88,73 @@ static void RHset_payload(struct RHmsg *self, const void *body, size_t size)
     }
 }
 
+/*
+ * Called by zeromq when a buffer passed without copy
+ * is not needed anymore, it can be called by the I/O thread
+ */
+static void RHrelease_buffer(void __attribute__ ((__unused__)) *data, void *hint)
+{
+	struct remote_buffer *buf = (struct remote_buffer *)hint;
+
+	pthread_mutex_lock(&buf->conn->lock);
+	buf->busy = false;
+	pthread_cond_signal(&buf->conn->released);
+	pthread_mutex_unlock(&buf->conn->lock);
+}
+
+static int RHset_payload_nocopy(struct RHmsg *self, struct remote_buffer *buf,
+				size_t size)
+{
+	buf->busy = true;
+	if (zmq_msg_init_data(&self->frame[FRAME_BODY], buf->data, size,
+			      RHrelease_buffer, buf)) {
+		buf->busy = false;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
 static int RHmsg_send_cmd(struct RHmsg *self, void *request)
 {
 	int i;
 	int ret;
 
+	/*
+	 * The socket is a DEALER, add the empty delimiter
+	 * that a REQ socket adds, so that REP remotes work
+	 */
+	if (zmq_send(request, "", 0, ZMQ_SNDMORE) < 0) {
+		ret = errno;
+		for (i = 0; i < MSG_FRAMES; i++)
+			zmq_msg_close(&self->frame[i]);
+		return ret;
+	}
+
 	for (i = 0; i < MSG_FRAMES; i++) {
 		ret = zmq_msg_send (&self->frame[i], request,
 			(i < MSG_FRAMES - 1)? ZMQ_SNDMORE: 0);
-		if (ret < 0 )
-			return errno;
+		if (ret < 0 ) {
+			ret = errno;
+			for (; i < MSG_FRAMES; i++)
+				zmq_msg_close(&self->frame[i]);
+			return ret;
+		}
 	}
 
 	return 0;
 }
 
-static int RHmsg_get_ack(struct RHmsg *self, void *request)
+/*
+ * Receive the answer from the remote as a null terminated string,
+ * skipping the empty delimiter sent by REP or ROUTER sockets
+ */
+static int RHmsg_recv(struct RHmsg *self, void *request, char **answer)
 {
 	int rc;
-	unsigned long size;
+	size_t size;
 	zmq_pollitem_t zpoll;
 	char *string;
-	int newtimeout;
-	int len;
 
 	zpoll.socket = request;
 	zpoll.events = ZMQ_POLLIN;
@@ -89,39 +167,62 @@ static int RHmsg_get_ack(struct RHmsg *self, void *request)
 	if (rc <= 0)
 		return -EFAULT;
 
-	zmq_msg_init (&self->frame[0]);
-	if (zmq_msg_recv(&self->frame[0], request, 0) == -1) {
+	do {
+		zmq_msg_init (&self->frame[0]);
+		if (zmq_msg_recv(&self->frame[0], request, 0) == -1) {
+			zmq_msg_close(&self->frame[0]);
+			return -EFAULT;
+		}
+		size = zmq_msg_size(&self->frame[0]);
+		if (size || !zmq_msg_more(&self->frame[0]))
+			break;
 		zmq_msg_close(&self->frame[0]);
-		return -EFAULT;
-	}
+	} while (1);
 
-	size = zmq_msg_size(&self->frame[0]);
 	string = malloc (size + 1);
-	if (!string)
+	if (!string) {
+		zmq_msg_close(&self->frame[0]);
 		return -ENOMEM;
+	}
 	memcpy (string, zmq_msg_data (&self->frame[0]), size);
 	string[size] = '\0';
-	zmq_msg_close(&self->frame[0]);
 
-	/*
-	 * Check if the remote send a new timeout
-	 */
-	len = size;
+	/* Drop any further frame */
+	while (zmq_msg_more(&self->frame[0])) {
+		zmq_msg_close(&self->frame[0]);
+		zmq_msg_init(&self->frame[0]);
+		if (zmq_msg_recv(&self->frame[0], request, 0) == -1)
+			break;
+	}
+	zmq_msg_close(&self->frame[0]);
 
-	if (strchr(string, ':'))
-		len = (strchr(string, ':') - string - 1);
-	if (strncmp(string, "ACK", len) != 0) {
+	if (strncmp(string, "ACK", 3) || (string[3] != '\0' && string[3] != ':')) {
 		ERROR("Remote Handler returns error, exiting");
 		free(string);
 		return -EFAULT;
 	}
 
+	*answer = string;
+
+	return 0;
+}
+
+static int RHmsg_get_ack(struct RHmsg *self, void *request)
+{
+	char *string;
+	int newtimeout;
+	int ret;
+
+	ret = RHmsg_recv(self, request, &string);
+	if (ret)
+		return ret;
+
 	/*
 	 * Check if the remote ask to wait longer
 	 * we get ack, check the rest of the received
 	 * string
 	 */
-	if ((size > 4) && (string[3] == ':')) {
+	if (string[3] == ':') {
 		newtimeout = strtoul(&string[4], NULL, 10);
 		if (newtimeout > 0)
 			timeout = newtimeout;
@@ -132,36 +233,272 @@ static int RHmsg_get_ack(struct RHmsg *self, void *request)
 	return 0;
 }
 
+/*
+ * Answer to INIT in windowed mode:
+ *	ACK:<timeout>:WINDOW:<messages>[:<frame size>]
+ * Remotes that do not know the windowed mode answer just ACK[:<timeout>]
+ */
+static int RHget_init_ack(struct RHmsg *self, struct remote_conn *conn)
+{
+	char *string, *p;
+	unsigned long val;
+	int newtimeout;
+	int ret;
+
+	ret = RHmsg_recv(self, conn->request, &string);
+	if (ret)
+		return ret;
+
+	if (string[3] == ':') {
+		newtimeout = strtoul(&string[4], &p, 10);
+		if (newtimeout > 0)
+			timeout = newtimeout;
+		if (!strncmp(p, ":WINDOW:", 8)) {
+			val = strtoul(p + 8, &p, 10);
+			conn->window = min_t(unsigned long, val, REMOTE_MAX_WINDOW);
+			if (*p == ':') {
+				val = strtoul(p + 1, NULL, 10);
+				if (val > 0)
+					conn->framesize = min_t(unsigned long, val,
+								REMOTE_MAX_FRAME_SIZE);
+			}
+		}
+	}
+
+	free(string);
+
+	return 0;
+}
+
+/*
+ * Answer to DATA in windowed mode:
+ *	ACK:<sequence>[:<messages>[:<timeout>]]
+ * ACKs are cumulative, the remote can acknowledge
+ * several DATA messages at once and change the window.
+ */
+static int RHget_window_ack(struct remote_conn *conn)
+{
+	struct RHmsg RHmessage;
+	unsigned long long seq;
+	unsigned long val;
+	char *string, *p;
+	int ret;
+
+	ret = RHmsg_recv(&RHmessage, conn->request, &string);
+	if (ret)
+		return ret;
+
+	if (string[3] != ':') {
+		ERROR("Remote Handler sends ACK without sequence number");
+		free(string);
+		return -EFAULT;
+	}
+
+	seq = strtoull(&string[4], &p, 10);
+	if (seq > conn->seq) {
+		ERROR("Remote Handler acknowledges %llu, last sent %llu",
+		      seq, conn->seq);
+		free(string);
+		return -EFAULT;
+	}
+	if (seq > conn->acked)
+		conn->acked = seq;
+
+	if (*p == ':') {
+		val = strtoul(p + 1, &p, 10);
+		if (val > 0)
+			conn->window = min_t(unsigned long, val, REMOTE_MAX_WINDOW);
+		if (*p == ':') {
+			val = strtoul(p + 1, NULL, 10);
+			if (val > 0)
+				timeout = val;
+		}
+	}
+
+	free(string);
+
+	/* The remote can grant more messages than at INIT */
+	return remote_alloc_buffers(conn);
+}
+
+static int remote_send_frame(struct remote_conn *conn)
+{
+	struct remote_buffer *buf = &conn->buffers[conn->cur];
+	struct RHmsg RHmessage;
+	char bufcmd[32];
+	int ret;
+
+	if (!conn->filled)
+		return 0;
+
+	/* Wait until a credit is available */
+	while (conn->seq - conn->acked >= conn->window) {
+		ret = RHget_window_ack(conn);
+		if (ret)
+			return ret;
+	}
+
+	snprintf(bufcmd, sizeof(bufcmd), "DATA:%llu", conn->seq + 1);
+	RHset_command(&RHmessage, bufcmd);
+	if (RHset_payload_nocopy(&RHmessage, buf, conn->filled)) {
+		zmq_msg_close(&RHmessage.frame[FRAME_CMD]);
+		return -ENOMEM;
+	}
+	ret = RHmsg_send_cmd(&RHmessage, conn->request);
+	if (ret)
+		return -ret;
+
+	conn->seq++;
+	conn->filled = 0;
+	conn->cur = (conn->cur + 1) % conn->nbuffers;
+
+	return 0;
+}
+
+static int forward_data_window(struct remote_conn *conn, const void *buf, size_t len)
+{
+	const char *data = buf;
+	struct remote_buffer *rbuf;
+	size_t n;
+	int ret;
+
+	while (len) {
+		rbuf = &conn->buffers[conn->cur];
+		if (!conn->filled) {
+			/* zeromq could still own the buffer */
+			pthread_mutex_lock(&conn->lock);
+			while (rbuf->busy)
+				pthread_cond_wait(&conn->released, &conn->lock);
+			pthread_mutex_unlock(&conn->lock);
+		}
+		n = min_t(size_t, len, conn->framesize - conn->filled);
+		memcpy(rbuf->data + conn->filled, data, n);
+		conn->filled += n;
+		data += n;
+		len -= n;
+
+		if (conn->filled == conn->framesize) {
+			ret = remote_send_frame(conn);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
 static int forward_data(void *request, const void *buf, size_t len)
 {
+	struct remote_conn *conn = (struct remote_conn *)request;
 	struct RHmsg RHmessage;
 	int ret;
 
-	if (!request)
+	if (!conn)
 		return -EFAULT;
 
+	if (conn->window)
+		return forward_data_window(conn, buf, len);
+
 	RHset_command(&RHmessage, "DATA");
 	RHset_payload(&RHmessage, buf, len);
-	ret = RHmsg_send_cmd(&RHmessage, request);
+	ret = RHmsg_send_cmd(&RHmessage, conn->request);
 	if (ret)
 		return ret;
 
-	ret = RHmsg_get_ack(&RHmessage, request);
+	ret = RHmsg_get_ack(&RHmessage, conn->request);
 
 	return ret;
 }
 
+/*
+ * Send the last partial frame and wait until
+ * all DATA messages are acknowledged
+ */
+static int remote_flush(struct remote_conn *conn)
+{
+	int ret;
+
+	ret = remote_send_frame(conn);
+	if (ret)
+		return ret;
+
+	while (conn->acked < conn->seq) {
+		ret = RHget_window_ack(conn);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Allocate a buffer for each message of the window. The window
+ * can grow during the transfer, the slots are allocated once
+ * for the maximum window so that buffers owned by zeromq do
+ * not move. The window is never bigger than the buffers.
+ */
+static int remote_alloc_buffers(struct remote_conn *conn)
+{
+	struct remote_buffer *buf;
+
+	if (!conn->buffers) {
+		conn->buffers = calloc(REMOTE_MAX_WINDOW, sizeof(*conn->buffers));
+		if (!conn->buffers)
+			return -ENOMEM;
+	}
+
+	while (conn->nbuffers < conn->window) {
+		buf = &conn->buffers[conn->nbuffers];
+		buf->data = malloc(conn->framesize);
+		if (!buf->data)
+			break;
+		buf->conn = conn;
+		conn->nbuffers++;
+	}
+
+	if (!conn->nbuffers)
+		return -ENOMEM;
+	if (conn->window > conn->nbuffers) {
+		WARN("Window reduced to %u messages, not enough memory",
+		     conn->nbuffers);
+		conn->window = conn->nbuffers;
+	}
+
+	return 0;
+}
+
+static void remote_free_buffers(struct remote_conn *conn)
+{
+	unsigned int i;
+
+	if (!conn->buffers)
+		return;
+
+	for (i = 0; i < conn->nbuffers; i++)
+		free(conn->buffers[i].data);
+	free(conn->buffers);
+	conn->buffers = NULL;
+}
+
 static int install_remote_image(struct img_type *img,
 	void __attribute__ ((__unused__)) *data)
 {
 	void *context = zmq_ctx_new();
-	void *request = zmq_socket (context, ZMQ_REQ);
+	void *request = zmq_socket (context, ZMQ_DEALER);
 	char *connect_string;
 	int len;
 	int ret = 0;
+	int linger = 0;
 	struct RHmsg RHmessage;
+	struct remote_conn conn;
 	char bufcmd[80];
 
+	memset(&conn, 0, sizeof(conn));
+	conn.request = request;
+	conn.framesize = REMOTE_FRAME_SIZE;
+	pthread_mutex_init(&conn.lock, NULL);
+	pthread_cond_init(&conn.released, NULL);
+
 	len = strlen(img->type_data) + strlen(get_tmpdir()) + strlen("ipc://") + 4;
 
 	/*
@@ -170,11 +507,13 @@ static int install_remote_image(struct img_type *img,
 	connect_string = malloc(len);
 	if (!connect_string) {
 		ERROR("Not enough memory");
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto cleanup;
 	}
 	snprintf(connect_string, len, "ipc://%s%s", get_tmpdir(),
 			img->type_data);
 
+	zmq_setsockopt(request, ZMQ_LINGER, &linger, sizeof(linger));
 	ret = zmq_connect(request, connect_string);
 	if (ret < 0) {
 		ERROR("Connection with %s cannot be established",
@@ -186,19 +525,41 @@ static int install_remote_image(struct img_type *img,
 	/* Initialize default timeout */
 	timeout = REMOTE_IPC_TIMEOUT;
 
-	/* Send initialization string */
+	/*
+	 * Send initialization string, the body announces
+	 * the windowed mode. Old remotes ignore it.
+	 */
 	snprintf(bufcmd, sizeof(bufcmd), "INIT:%lld", img->size);
 	RHset_command(&RHmessage, bufcmd);
-	RHset_payload(&RHmessage, NULL, 0);
+	RHset_payload(&RHmessage, REMOTE_CAPABILITIES, strlen(REMOTE_CAPABILITIES));
 	RHmsg_send_cmd(&RHmessage, request);
-	if (RHmsg_get_ack(&RHmessage, request))
-		return -ENODEV;
+	if (RHget_init_ack(&RHmessage, &conn)) {
+		ret = -ENODEV;
+		goto cleanup;
+	}
+
+	if (conn.window) {
+		TRACE("Remote %s: window %u messages of %zu bytes",
+		      img->type_data, conn.window, conn.framesize);
+		ret = remote_alloc_buffers(&conn);
+		if (ret) {
+			ERROR("Not enough memory");
+			goto cleanup;
+		}
+	}
 
-	ret = copyimage(request, img, forward_data);
+	ret = copyimage(&conn, img, forward_data);
+	if (!ret && conn.window)
+		ret = remote_flush(&conn);
 
 cleanup:
+	free(connect_string);
 	zmq_close(request);
+	/* Buffers are released by zeromq when the context is terminated */
 	zmq_ctx_destroy(context);
+	remote_free_buffers(&conn);
+	pthread_cond_destroy(&conn.released);
+	pthread_mutex_destroy(&conn.lock);
 
 	return ret;
 }
@@ -269,15 +269,57 @@ local img_type = {
     -- The `callback = function(chunk) ... end` is repeatedly called with
     -- chunked artifact data of type `string` in its `chunk` parameter as
     -- long as there is data available.
+    -- If `chunksize` is given, `chunk` is instead a `swupdate.buffer`
+    -- holding `chunksize` bytes (less for the last one), clamped to
+    -- 4 KiB .. 16 MiB. The same buffer is refilled for each call and
+    -- must not be used after the callback returns.
     -- The callback function must completely consume the artifact data so
     -- that SWUpdate can continue with the stream's next artifact after
     -- the Lua Handler returns.
     --
-    --- @param  self      img_type  This `img_type` instance
-    --- @param  callback  function  Callback `function(chunk) ... end` that is fed the current image artifact in chunks.
-    --- @return number              # 0 on success, -1 on error
-    --- @return string | nil        # nil on success, error message on failure
-    ['read'] = function(self, callback) end,
+    --- @param  self       img_type  This `img_type` instance
+    --- @param  callback   function  Callback `function(chunk) ... end` that is fed the current image artifact in chunks.
+    --- @param  chunksize  number?   Size of the `swupdate.buffer` passed to `callback`
+    --- @return number               # 0 on success, -1 on error
+    --- @return string | nil         # nil on success, error message on failure
+    ['read'] = function(self, callback, chunksize) end,
+}
+
+
+--- Byte buffer passed to `img_type:read()` callbacks if a chunk size is given.
+--- `#buffer` is the number of valid bytes, `tostring(buffer)` copies them into a string.
+--- Indices follow `string.sub()` rules.
+--- @class swupdate.buffer
+local buffer = {
+    --- @param  self  swupdate.buffer
+    --- @return number                 # Number of valid bytes
+    ['len'] = function(self) end,
+
+    --- @param  self  swupdate.buffer
+    --- @param  i     number?          # Start index, default 1
+    --- @param  j     number?          # End index, default -1
+    --- @return string                 # Copy of the slice
+    ['sub'] = function(self, i, j) end,
+
+    --- @param  self  swupdate.buffer
+    --- @param  i     number?          # Start index, default 1
+    --- @param  j     number?          # End index, default `i`
+    --- @return number ...             # Byte values of the slice
+    ['byte'] = function(self, i, j) end,
+
+    --- Write (a slice of) the buffer without creating a Lua string.
+    --
+    --- @param  self  swupdate.buffer
+    --- @param  f     number | file*   # File descriptor number or Lua file handle
+    --- @param  i     number?          # Start index, default 1
+    --- @param  j     number?          # End index, default -1
+    --- @return swupdate.buffer | nil  # The buffer on success, nil on error
+    --- @return string | nil           # Error message on failure
+    ['write'] = function(self, f, i, j) end,
+
+    --- @param  self  swupdate.buffer
+    --- @return string                 # Copy of the whole buffer
+    ['tostring'] = function(self) end,
 }
 
 
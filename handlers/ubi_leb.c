@@ -0,0 +1,146 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "util.h"
+#include "ubi_leb.h"
+
+static int ubi_leb_flush(struct ubi_leb_out *o)
+{
+	off_t offset = (off_t)o->lnum * o->leb_size;
+	ssize_t ret;
+	int done;
+
+	if (!o->len)
+		return 0;
+
+	ret = pread(o->fd, o->old, o->len, offset);
+	if (ret == o->len && !memcmp(o->buf, o->old, o->len)) {
+		o->skipped++;
+	} else {
+		/*
+		 * UBI writes the new data to a free PEB and switches
+		 * the LEB to it only when it is complete: a power cut
+		 * leaves either the old or the new LEB.
+		 */
+		if (ubi_leb_change_start(o->libubi, o->fd, o->lnum, o->len)) {
+			ERROR("cannot start change of LEB %d: %s", o->lnum,
+			      strerror(errno));
+			return -EIO;
+		}
+		for (done = 0; done < o->len; done += ret) {
+			ret = write(o->fd, o->buf + done, o->len - done);
+			if (ret < 0 && errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			if (ret <= 0) {
+				ERROR("cannot write LEB %d: %s", o->lnum,
+				      strerror(errno));
+				return -EIO;
+			}
+		}
+		o->changed++;
+	}
+
+	o->lnum++;
+	o->len = 0;
+
+	return 0;
+}
+
+struct ubi_leb_out *ubi_leb_new(libubi_t libubi, int fd, int leb_size)
+{
+	struct ubi_leb_out *o;
+
+	if (leb_size <= 0)
+		return NULL;
+
+	o = calloc(1, sizeof(*o));
+	if (!o)
+		return NULL;
+	o->fd = fd;
+	o->libubi = libubi;
+	o->leb_size = leb_size;
+	o->buf = malloc(leb_size);
+	o->old = malloc(leb_size);
+	if (!o->buf || !o->old) {
+		ERROR("OOM allocating LEB buffers");
+		ubi_leb_free(o);
+		return NULL;
+	}
+
+	return o;
+}
+
+int ubi_leb_write(void *out, const void *buf, size_t len)
+{
+	struct ubi_leb_out *o = (struct ubi_leb_out *)out;
+	const unsigned char *data = buf;
+	size_t n;
+	int ret;
+
+	while (len) {
+		n = min_t(size_t, len, o->leb_size - o->len);
+		memcpy(o->buf + o->len, data, n);
+		o->len += n;
+		data += n;
+		len -= n;
+		if (o->len == o->leb_size) {
+			ret = ubi_leb_flush(o);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+int ubi_leb_finish(struct ubi_leb_out *o, long long bytes, int rsvd_lebs)
+{
+	int lebs, ret;
+
+	ret = ubi_leb_flush(o);
+	if (ret)
+		return ret;
+
+	lebs = (bytes + o->leb_size - 1) / o->leb_size;
+	if (o->lnum != lebs) {
+		ERROR("%d LEBs written, %d expected", o->lnum, lebs);
+		return -EIO;
+	}
+
+	/*
+	 * A full update leaves the rest of the volume empty,
+	 * drop stale data behind the image in the same way
+	 */
+	for (; o->lnum < rsvd_lebs; o->lnum++) {
+		if (ubi_is_mapped(o->fd, o->lnum) <= 0)
+			continue;
+		if (ubi_leb_unmap(o->fd, o->lnum)) {
+			ERROR("cannot unmap LEB %d: %s", o->lnum, strerror(errno));
+			return -EIO;
+		}
+		o->unmapped++;
+	}
+
+	return 0;
+}
+
+void ubi_leb_free(struct ubi_leb_out *o)
+{
+	if (!o)
+		return;
+	free(o->buf);
+	free(o->old);
+	free(o);
+}
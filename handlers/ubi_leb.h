@@ -0,0 +1,41 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <libubi.h>
+
+/*
+ * Writer for copyimage() that updates a dynamic UBI volume LEB by LEB:
+ * each LEB is read back and replaced with an atomic LEB change only
+ * if it differs. fd must be the first member, because copyfile()
+ * uses it to seek.
+ */
+struct ubi_leb_out {
+	int fd;
+	libubi_t libubi;
+	unsigned char *buf;	/* data of the current LEB */
+	unsigned char *old;	/* volume content of the current LEB */
+	int leb_size;
+	int len;
+	int lnum;
+	unsigned int changed;
+	unsigned int skipped;
+	unsigned int unmapped;
+};
+
+/* fd is the opened volume, leb_size its LEB size */
+struct ubi_leb_out *ubi_leb_new(libubi_t libubi, int fd, int leb_size);
+int ubi_leb_write(void *out, const void *buf, size_t len);
+
+/*
+ * Write the last LEB, check that the image filled the LEBs for bytes
+ * and unmap the LEBs after it, up to rsvd_lebs
+ */
+int ubi_leb_finish(struct ubi_leb_out *o, long long bytes, int rsvd_lebs);
+void ubi_leb_free(struct ubi_leb_out *o);
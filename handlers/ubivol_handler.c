@@ -13,12 +13,14 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <mntent.h>
 
 #include <mtd/mtd-user.h>
 #include "swupdate_image.h"
 #include "handler.h"
 #include "flash.h"
 #include "util.h"
+#include "ubi_leb.h"
 
 void ubi_handler(void);
 
@@ -171,6 +173,70 @@ static bool check_ubi_alwaysremove(struct img_type *img)
 	return strtobool(dict_get_value(&img->properties, "always-remove"));
 }
 
+/*
+ * A volume that is mounted or attached to a ubiblock device belongs
+ * to the running system. Changing it LEB by LEB is not safe against
+ * power loss: it would be left with old and new LEBs, and it is not
+ * flagged as being updated.
+ */
+static bool volume_in_use(struct ubi_vol_info *vol)
+{
+	char path[64], node[32], name[UBI_MAX_VOLUME_NAME + 16];
+	struct mntent *ent;
+	const char *src;
+	bool used = false;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/sys/block/ubiblock%d_%d",
+		 vol->dev_num, vol->vol_id);
+	if (!access(path, F_OK))
+		return true;
+
+	fp = setmntent("/proc/self/mounts", "r");
+	if (!fp)
+		return false;
+	snprintf(node, sizeof(node), "ubi%d_%d", vol->dev_num, vol->vol_id);
+	snprintf(name, sizeof(name), "ubi%d:%s", vol->dev_num, vol->name);
+	while (!used && (ent = getmntent(fp))) {
+		src = ent->mnt_fsname;
+		if (!strncmp(src, "/dev/", 5))
+			src += 5;
+		used = !strcmp(src, node) || !strcmp(src, name) ||
+			(!strncmp(src, "ubi:", 4) && !strcmp(src + 4, vol->name));
+	}
+	endmntent(fp);
+
+	return used;
+}
+
+/*
+ * Update a dynamic volume rewriting only the LEBs that changed.
+ * ubi_update_start() is not used, so the volume is not flagged
+ * as corrupted while the update runs: this is only done on a
+ * volume that is not in use, consistency after a power cut
+ * relies on the update transaction, as for the raw handler.
+ */
+static int update_volume_lebs(libubi_t libubi, struct img_type *img,
+	struct ubi_vol_info *vol, int fd, long long bytes)
+{
+	struct ubi_leb_out *out;
+	int ret;
+
+	out = ubi_leb_new(libubi, fd, vol->leb_size);
+	if (!out)
+		return -ENOMEM;
+
+	ret = copyimage(out, img, ubi_leb_write);
+	if (!ret)
+		ret = ubi_leb_finish(out, bytes, vol->rsvd_lebs);
+	if (!ret)
+		INFO("%s: %u LEBs changed, %u unchanged, %u unmapped",
+		     vol->name, out->changed, out->skipped, out->unmapped);
+
+	ubi_leb_free(out);
+	return ret;
+}
+
 static int update_volume(libubi_t libubi, struct img_type *img,
 	struct ubi_vol_info *vol)
 {
@@ -181,6 +247,7 @@ static int update_volume(libubi_t libubi, struct img_type *img,
 	char sbuf[128];
 	char *rn_vol;
 	struct ubi_vol_info *repl_vol;
+	bool compare;
 
 	bytes = get_output_size(img, true);
 	if (bytes <= 0)
@@ -220,24 +287,48 @@ static int update_volume(libubi_t libubi, struct img_type *img,
 	if(check_replace(img, vol, &repl_vol, &rn_vol))
 		return -1;
 
+	/*
+	 * The kernel refuses atomic LEB changes on static volumes,
+	 * they carry a CRC of the whole data and are always rewritten
+	 */
+	compare = strtobool(dict_get_value(&img->properties, "compare"));
+	if (compare && vol->type != UBI_DYNAMIC_VOLUME) {
+		INFO("%s is a static volume, it is updated as a whole", vol->name);
+		compare = false;
+	}
+	if (compare && volume_in_use(vol)) {
+		ERROR("%s is in use, \"compare\" is only allowed on the inactive copy",
+		      vol->name);
+		return -1;
+	}
+
 	fdout = open(node, O_RDWR);
 	if (fdout < 0) {
 		ERROR("cannot open UBI volume \"%s\"", node);
 		return -1;
 	}
-	err = ubi_update_start(libubi, fdout, bytes);
-	if (err) {
-		ERROR("cannot start volume \"%s\" update", node);
-		return -1;
+	if (!compare) {
+		err = ubi_update_start(libubi, fdout, bytes);
+		if (err) {
+			ERROR("cannot start volume \"%s\" update", node);
+			close(fdout);
+			return -1;
+		}
 	}
 
 	snprintf(sbuf, sizeof(sbuf), "Installing image %s into volume %s(%s)",
 		img->fname, node, img->volname);
 	notify(RUN, RECOVERY_NO_ERROR, INFOLEVEL, sbuf);
 
-	TRACE("Updating UBI : %s %lld",
-			img->fname, bytes);
-	if (copyimage(&fdout, img, NULL) < 0) {
+	TRACE("Updating UBI : %s %lld%s",
+			img->fname, bytes, compare ? " (changed LEBs only)" : "");
+	if (compare) {
+		if (update_volume_lebs(libubi, img, vol, fdout, bytes)) {
+			ERROR("Error updating LEBs of \"%s\"", node);
+			close(fdout);
+			return -1;
+		}
+	} else if (copyimage(&fdout, img, NULL) < 0) {
 		ERROR("Error copying extracted file");
 		err = -1;
 	}
@@ -597,7 +688,7 @@ __attribute__((constructor))
 void ubi_handler(void)
 {
 	register_handler("ubivol", install_ubivol_image,
-				IMAGE_HANDLER, NULL);
+				IMAGE_HANDLER | STREAM_INPUT_HANDLER, NULL);
 	register_handler("ubipartition", adjust_volume,
 				PARTITION_HANDLER | NO_DATA_HANDLER, NULL);
 	register_handler("ubiswap", swap_volume,
@@ -54,6 +54,16 @@
  *      prog =  "/dev/gpiochip0:39:false";
  * }
  *
+ * Several identical microcontrollers can be programmed concurrently
+ * with the same image: the optional "devices" property lists their
+ * UARTs (instead of "device"), and "reset" and "prog" list one GPIO
+ * for each of them, in the same order.
+ *
+ * Optionally, up to "window" packages are sent before waiting for
+ * the $READY; of the first one, and the UART speed is raised after
+ * $READY; with $BAUD;<rate>; to the first rate out of "baudrates"
+ * the microcontroller acknowledges with $READY;.
+ *
  */
 
 #include <stdio.h>
@@ -79,6 +89,9 @@
 #define RESET_CONSUMER	"swupdate-uc-handler"
 #define PROG_CONSUMER	RESET_CONSUMER
 #define DEFAULT_TIMEOUT 2
+#define DEFAULT_BAUDRATE	115200
+#define MAX_TARGETS	16
+#define MAX_WINDOW	16
 
 /*
  * Use GPIOD_LINE_BULK_MAX_LINES in order to determine,
@@ -113,62 +126,127 @@ enum {
 	ACTIVELOW
 };
 
-struct handler_priv {
+/*
+ * One microcontroller, connected via its own UART
+ * and GPIOs
+ */
+struct uc_target {
+	char device[SWUPDATE_GENERAL_STRING_SIZE];
 	struct mode_setup reset;
 	struct mode_setup prog;
 	int fduart;
+	char rx[128];		/* received, not yet complete message */
+	unsigned int rxlen;
+	unsigned int pending;	/* messages sent and not yet acknowledged */
+	bool accepted;		/* last message was acknowledged with $READY; */
+	bool completed;		/* $COMPLETED; was received */
+};
+
+struct handler_priv {
+	struct uc_target targets[MAX_TARGETS];
+	unsigned int ntargets;
 	bool debug;
+	bool negotiate;		/* a refused message is not an error */
 	unsigned int timeout;
+	unsigned int window;
+	unsigned long baudrates[8];
+	unsigned int nbaudrates;
 	char buf[1024];	/* enough for 3 records */
 	unsigned int nbytes;
 };
 
+static const struct {
+	unsigned long rate;
+	speed_t speed;
+} uart_speeds[] = {
+	{ 9600, B9600 },
+	{ 19200, B19200 },
+	{ 38400, B38400 },
+	{ 57600, B57600 },
+	{ 115200, B115200 },
+	{ 230400, B230400 },
+#ifdef B460800
+	{ 460800, B460800 },
+#endif
+#ifdef B921600
+	{ 921600, B921600 },
+#endif
+#ifdef B1000000
+	{ 1000000, B1000000 },
+#endif
+#ifdef B1500000
+	{ 1500000, B1500000 },
+#endif
+#ifdef B2000000
+	{ 2000000, B2000000 },
+#endif
+#ifdef B3000000
+	{ 3000000, B3000000 },
+#endif
+#ifdef B4000000
+	{ 4000000, B4000000 },
+#endif
+};
+
+static speed_t rate_to_speed(unsigned long rate)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(uart_speeds); i++)
+		if (uart_speeds[i].rate == rate)
+			return uart_speeds[i].speed;
+
+	return B0;
+}
+
 #ifdef USE_GPIOD_API_V1
-static void free_gpios(struct handler_priv *priv) {
-	if (priv->prog.chip && (priv->prog.chip != priv->reset.chip)){
-		gpiod_chip_close(priv->prog.chip);
-		priv->reset.chip = NULL;
+static void free_gpios(struct uc_target *t) {
+	if (t->prog.chip && (t->prog.chip != t->reset.chip)){
+		gpiod_chip_close(t->prog.chip);
 	}
-	if (priv->reset.chip) {
-		gpiod_chip_close(priv->reset.chip);
-		priv->reset.chip = NULL;
+	t->prog.chip = NULL;
+	t->prog.line = NULL;
+	if (t->reset.chip) {
+		gpiod_chip_close(t->reset.chip);
+		t->reset.chip = NULL;
 	}
+	t->reset.line = NULL;
 }
 
-static int register_gpios(struct handler_priv *priv){
+static int register_gpios(struct uc_target *t){
 	int ret = 0;
 	int status;
 
-	priv->reset.chip = gpiod_chip_open(priv->reset.gpiodev);
-	if (strcmp(priv->reset.gpiodev, priv->prog.gpiodev))
-		priv->prog.chip = gpiod_chip_open(priv->prog.gpiodev);
+	t->reset.chip = gpiod_chip_open(t->reset.gpiodev);
+	if (strcmp(t->reset.gpiodev, t->prog.gpiodev))
+		t->prog.chip = gpiod_chip_open(t->prog.gpiodev);
 	else
-		priv->prog.chip = priv->reset.chip;
+		t->prog.chip = t->reset.chip;
 
-	if (!priv->reset.chip || !priv->prog.chip) {
+	if (!t->reset.chip || !t->prog.chip) {
 		ERROR("Cannot open gpio driver");
 		ret  =-ENODEV;
 		goto freegpios;
 	}
 
-	priv->reset.line = gpiod_chip_get_line(priv->reset.chip, priv->reset.offset);
-	priv->prog.line = gpiod_chip_get_line(priv->prog.chip, priv->prog.offset);
+	t->reset.line = gpiod_chip_get_line(t->reset.chip, t->reset.offset);
+	t->prog.line = gpiod_chip_get_line(t->prog.chip, t->prog.offset);
 
-	if (!priv->reset.line || !priv->prog.line) {
+	if (!t->reset.line || !t->prog.line) {
 		ERROR("Cannot get requested GPIOs: %d on %s and %d on %s",
-			priv->reset.offset, priv->reset.gpiodev,
-			priv->prog.offset, priv->prog.gpiodev);
+			t->reset.offset, t->reset.gpiodev,
+			t->prog.offset, t->prog.gpiodev);
 		ret  =-ENODEV;
 		goto freegpios;
 	}
 
-	status = gpiod_line_request_output(priv->reset.line, RESET_CONSUMER, 0);
+	status = gpiod_line_request_output(t->reset.line, RESET_CONSUMER, 0);
 	if (status) {
 		ret  =-ENODEV;
 		ERROR("Cannot request reset line");
 		goto freegpios;
 	}
-	status = gpiod_line_request_output(priv->prog.line, PROG_CONSUMER, 0);
+	status = gpiod_line_request_output(t->prog.line, PROG_CONSUMER, 0);
 	if (status) {
 		ret  =-ENODEV;
 		ERROR("Cannot request prog line");
@@ -177,60 +255,33 @@ static int register_gpios(struct handler_priv *priv){
 
 	return ret;
 freegpios:
-	free_gpios(priv);
+	free_gpios(t);
 	return ret;
 }
 
-static int switch_mode(struct handler_priv *priv, int mode)
+static int set_line(struct mode_setup *gpio, int value)
 {
-	int ret = 0;
-	if (!priv->reset.line || !priv->prog.line) return -ENODEV;
-
-	/*
-	 * A reset is always done
-	 */
-	ret = gpiod_line_set_value(priv->reset.line, 0);
-	if (ret){
-		ERROR("unable to set reset to 0");
-		return ret;
-	}
-
-	/* Set programming mode */
-	ret = gpiod_line_set_value(priv->prog.line, mode);
-	if (ret){
-		ERROR("unable to set prog to %i",mode);
-		return ret;
-	}
-
-	usleep(20000);
-
-	/* Remove reset */
-	ret = gpiod_line_set_value(priv->reset.line, 1);
-	if (ret){
-		ERROR("unable to set reset to 1");
-		return ret;
-	}
-
-	usleep(20000);
+	if (!gpio->line)
+		return -ENODEV;
 
-	return ret;
+	return gpiod_line_set_value(gpio->line, value);
 }
 
 #else
 /* Implementation for LIBGPIOD V2 api*/
 
-static void free_gpios(struct handler_priv *priv) {
-	if(priv->reset.request){
-		gpiod_line_request_release(priv->reset.request);
-		priv->reset.request = NULL;
+static void free_gpios(struct uc_target *t) {
+	if(t->reset.request){
+		gpiod_line_request_release(t->reset.request);
+		t->reset.request = NULL;
 	}
-	if(priv->prog.request){
-		gpiod_line_request_release(priv->prog.request);
-		priv->prog.request = NULL;
+	if(t->prog.request){
+		gpiod_line_request_release(t->prog.request);
+		t->prog.request = NULL;
 	}
 }
 
-static int register_gpios(struct handler_priv *priv) {
+static int register_gpios(struct uc_target *t) {
 	struct gpiod_line_settings *settings;
 	struct gpiod_request_config *req_cfg;
 	struct gpiod_line_config *reset_cfg, *prog_cfg;
@@ -258,7 +309,7 @@ static int register_gpios(struct handler_priv *priv) {
 		ret  =-ENODEV;
 		goto freerequestconfig;
 	}
-	ret = gpiod_line_config_add_line_settings(reset_cfg, &priv->reset.offset, 1, settings);
+	ret = gpiod_line_config_add_line_settings(reset_cfg, &t->reset.offset, 1, settings);
 	if (ret) {
 		ERROR("Unable to add reset line settings");
 		goto freeresetconfig;
@@ -271,47 +322,48 @@ static int register_gpios(struct handler_priv *priv) {
 		goto freeresetconfig;
 	}
 
-	ret = gpiod_line_config_add_line_settings(prog_cfg, &priv->prog.offset, 1, settings);
+	ret = gpiod_line_config_add_line_settings(prog_cfg, &t->prog.offset, 1, settings);
 	if (ret) {
 		ERROR("Unable to add reset line settings");
 		goto freeprogconfig;
 	}
 
 	TRACE("Request lines for reset");
-	chip = gpiod_chip_open(priv->reset.gpiodev);
+	chip = gpiod_chip_open(t->reset.gpiodev);
 	if (!chip) {
-		ERROR("Unable to open chip '%s'",priv->reset.gpiodev);
+		ERROR("Unable to open chip '%s'",t->reset.gpiodev);
 		ret  =-ENODEV;
 		goto freeprogconfig;
 	}
 
-	priv->reset.request = gpiod_chip_request_lines(chip, req_cfg, reset_cfg);
+	t->reset.request = gpiod_chip_request_lines(chip, req_cfg, reset_cfg);
 	gpiod_chip_close(chip);
-	if (!priv->reset.request) {
-		ERROR("Unable to request lines on chip '%s'", priv->reset.gpiodev);
+	if (!t->reset.request) {
+		ERROR("Unable to request lines on chip '%s'", t->reset.gpiodev);
+		ret  =-ENODEV;
 		goto freeprogconfig;
 	}
 
 	TRACE("Request lines for prog");
-	chip = gpiod_chip_open(priv->prog.gpiodev);
+	chip = gpiod_chip_open(t->prog.gpiodev);
 	if (!chip) {
-		ERROR("Unable to open chip '%s'", priv->prog.gpiodev);
+		ERROR("Unable to open chip '%s'", t->prog.gpiodev);
 		ret  =-ENODEV;
 		goto freelinerequest;
 	}
 
-	priv->prog.request = gpiod_chip_request_lines(chip, req_cfg, prog_cfg);
+	t->prog.request = gpiod_chip_request_lines(chip, req_cfg, prog_cfg);
 	gpiod_chip_close(chip);
-	if (!priv->prog.request) {
-		ERROR("unable to request lines on chip '%s'", priv->prog.gpiodev);
+	if (!t->prog.request) {
+		ERROR("unable to request lines on chip '%s'", t->prog.gpiodev);
 		ret  =-ENODEV;
 	}
 
 	goto freeprogconfig; // clean up everything except for the gpiod_line_requests
 
 freelinerequest:
-	gpiod_line_request_release(priv->reset.request);
-	priv->reset.request = NULL;
+	gpiod_line_request_release(t->reset.request);
+	t->reset.request = NULL;
 freeprogconfig:
 	gpiod_line_config_free(prog_cfg);
 freeresetconfig:
@@ -323,42 +375,58 @@ freesettings:
 	return ret;
 }
 
+static int set_line(struct mode_setup *gpio, int value)
+{
+	if (!gpio->request)
+		return -ENODEV;
 
+	return gpiod_line_request_set_value(gpio->request, gpio->offset, value);
+}
+#endif
+
+/*
+ * All microcontrollers are reset at the same time,
+ * so that the settling time is spent only once
+ */
 static int switch_mode(struct handler_priv *priv, int mode)
 {
-
+	struct uc_target *t;
+	unsigned int i;
 	int ret = 0;
 
 	/*
 	 * A reset is always done
 	 */
-	ret = gpiod_line_request_set_value(priv->reset.request, priv->reset.offset, 0);
-	if (ret){
-		ERROR("Unable to set reset to 0");
-		return ret;
-	}
+	for (i = 0; i < priv->ntargets; i++) {
+		t = &priv->targets[i];
+		if (set_line(&t->reset, 0)) {
+			ERROR("%s: unable to set reset to 0", t->device);
+			ret = -ENODEV;
+			continue;
+		}
 
-	/* Set programming mode */
-	ret = gpiod_line_request_set_value(priv->prog.request, priv->prog.offset, mode);
-	if (ret){
-		ERROR("Unable to set prog to %i", mode);
-		return ret;
+		/* Set programming mode */
+		if (set_line(&t->prog, mode)) {
+			ERROR("%s: unable to set prog to %i", t->device, mode);
+			ret = -ENODEV;
+		}
 	}
 
 	usleep(20000);
 
 	/* Remove reset */
-	ret = gpiod_line_request_set_value(priv->reset.request, priv->reset.offset, 1);
-	if (ret){
-		ERROR("Unable to set reset to 1");
-		return ret;
+	for (i = 0; i < priv->ntargets; i++) {
+		t = &priv->targets[i];
+		if (set_line(&t->reset, 1)) {
+			ERROR("%s: unable to set reset to 1", t->device);
+			ret = -ENODEV;
+		}
 	}
 
 	usleep(20000);
 
 	return ret;
 }
-#endif
 
 static bool verify_chksum(char *buf, unsigned int *size)
 {
@@ -413,7 +481,7 @@ static int insert_chksum(char *buf, unsigned int len)
 	return len;
 }
 
-static int set_uart (int fd)
+static int set_uart (int fd, speed_t speed)
 {
 	struct termios tty;
 
@@ -422,8 +490,8 @@ static int set_uart (int fd)
 		return -1;
 	}
 
-	 cfsetospeed (&tty, (speed_t) B115200);
-	 cfsetispeed (&tty, (speed_t) B115200);
+	 cfsetospeed (&tty, speed);
+	 cfsetispeed (&tty, speed);
 
 	 tty.c_cflag |= (CLOCAL | CREAD);	/* ignore modem controls */
 	 tty.c_cflag &= ~CSIZE;
@@ -481,92 +549,256 @@ static void dump_ascii(bool rxdir, char *buf, int count)
 	free(outbuf);
 }
 
-static int receive_msg(int fd, char *rx, size_t size,
-			unsigned int timeout, bool debug)
+/*
+ * Evaluate a complete message from a microcontroller
+ */
+static int handle_msg(struct handler_priv *priv, struct uc_target *t,
+		      char *msg, unsigned int count)
 {
-	fd_set fds;
-	struct timeval tv;
-	int ret;
-	unsigned int count;
-
-	/* Initialize structures for select */
-	FD_ZERO(&fds);
-	FD_SET(fd, &fds);
+	if (priv->debug)
+		dump_ascii(true, msg, count);
 
 	/*
-	 * Microcontrolle answers very fast,
-	 * Timeout is just to take care if no answer is
-	 * sent
+	 * Try some syntax check
 	 */
-	tv.tv_sec = timeout;
-	tv.tv_usec = 0; /* Check for not more as 10 mSec */
+	if (msg[0] != '$') {
+		ERROR("%s: first byte is not '$' but '%c'", t->device, msg[0]);
+		return -EBADMSG;
+	}
 
-	ret = select(fd + 1, &fds, NULL, NULL, &tv);
-	if (ret == 0) {
-		ERROR("Timeout, no answer from microcontroller");
-		return -EPROTO;
+	if (!verify_chksum(msg, &count)) {
+		return -EBADMSG;
 	}
 
-	ret = read(fd, rx, size);
-	if (ret < 3) {
-		ERROR("Error in read: %d", ret);
+	if (!t->pending) {
+		ERROR("%s: unexpected message %s", t->device, msg);
 		return -EBADMSG;
 	}
-	count = ret;
 
-	if (debug)
-		dump_ascii(true, rx, count);
+	if (!strcmp(msg, "$COMPLETED;")) {
+		t->completed = true;
+		t->pending = 0;
+		return 0;
+	}
 
-	/*
-	 * Try some syntax check
-	 */
-	if (rx[0] != '$') {
-		ERROR("First byte is not '$' but '%c'", rx[0]);
+	t->pending--;
+	t->accepted = !strcmp(msg, "$READY;");
+	if (!t->accepted && !priv->negotiate) {
+		ERROR("%s: unexpected answer %s", t->device, msg);
 		return -EBADMSG;
 	}
 
-	if (!verify_chksum(rx, &count)) {
+	return 0;
+}
+
+/*
+ * Read what the microcontroller sent, messages
+ * are terminated by <CR><LF>
+ */
+static int receive_msgs(struct handler_priv *priv, struct uc_target *t)
+{
+	char *eol;
+	unsigned int len;
+	ssize_t ret;
+	int err;
+
+	ret = read(t->fduart, &t->rx[t->rxlen], sizeof(t->rx) - t->rxlen);
+	if (ret <= 0) {
+		ERROR("%s: error in read: %zd", t->device, ret);
+		return -EBADMSG;
+	}
+	t->rxlen += ret;
+
+	while ((eol = memchr(t->rx, '\n', t->rxlen)) != NULL) {
+		len = eol - t->rx + 1;
+		char msg[sizeof(t->rx) + 1];
+		memcpy(msg, t->rx, len);
+		msg[len] = '\0';
+		t->rxlen -= len;
+		memmove(t->rx, &t->rx[len], t->rxlen);
+
+		err = handle_msg(priv, t, msg, len);
+		if (err)
+			return err;
+	}
+
+	if (t->rxlen == sizeof(t->rx)) {
+		ERROR("%s: message too long", t->device);
 		return -EBADMSG;
 	}
 
 	return 0;
 }
 
-static int write_data(int fd, char *buf, size_t size)
+/*
+ * Wait until no microcontroller has more than
+ * limit unacknowledged messages
+ */
+static int wait_acks(struct handler_priv *priv, unsigned int limit)
+{
+	fd_set fds;
+	struct timeval tv;
+	struct uc_target *t;
+	unsigned int i;
+	bool waiting;
+	int maxfd, ret;
+
+	for (;;) {
+		FD_ZERO(&fds);
+		maxfd = -1;
+		waiting = false;
+		for (i = 0; i < priv->ntargets; i++) {
+			t = &priv->targets[i];
+			if (!t->pending)
+				continue;
+			FD_SET(t->fduart, &fds);
+			maxfd = max(maxfd, t->fduart);
+			if (t->pending > limit)
+				waiting = true;
+		}
+		if (!waiting)
+			return 0;
+
+		/*
+		 * Microcontrolle answers very fast,
+		 * Timeout is just to take care if no answer is
+		 * sent
+		 */
+		tv.tv_sec = priv->timeout;
+		tv.tv_usec = 0;
+
+		ret = select(maxfd + 1, &fds, NULL, NULL, &tv);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (ret == 0) {
+			for (i = 0; i < priv->ntargets; i++) {
+				t = &priv->targets[i];
+				if (t->pending <= limit)
+					continue;
+				if (!priv->negotiate) {
+					ERROR("%s: timeout, no answer from microcontroller",
+					      t->device);
+					return -EPROTO;
+				}
+				t->pending = 0;
+				t->accepted = false;
+			}
+			continue;
+		}
+
+		for (i = 0; i < priv->ntargets; i++) {
+			t = &priv->targets[i];
+			if (t->pending && FD_ISSET(t->fduart, &fds)) {
+				ret = receive_msgs(priv, t);
+				if (ret < 0)
+					return ret;
+			}
+		}
+	}
+}
+
+static int write_data(struct handler_priv *priv, struct uc_target *t,
+		      char *buf, size_t size)
 {
-	size_t written;
-	written = write(fd, buf, size);
-	if (written != size) {
-		ERROR("Error in write %zu", written);
+	ssize_t written;
+
+	if (priv->debug)
+		dump_ascii(false, buf, size);
+
+	written = write(t->fduart, buf, size);
+	if (written < 0 || (size_t)written != size) {
+		ERROR("%s: error in write %zd", t->device, written);
 		return -EFAULT;
 	}
+	t->pending++;
 
 	return 0;
 }
 
-static int write_msg(int fd, const char *msg)
+static int write_msg(struct handler_priv *priv, struct uc_target *t,
+		     const char *msg)
 {
-	int len, ret;
-	char *buf;
+	char buf[80];
+	int len;
+
+	len = snprintf(buf, sizeof(buf) - 4, "%s", msg);
+	len = insert_chksum(buf, len);
+	return write_data(priv, t, buf, len);
+}
+
+/*
+ * Ask for faster transfers, the highest rate
+ * acknowledged by a microcontroller is used
+ */
+static int negotiate_baudrate(struct handler_priv *priv)
+{
+	struct uc_target *t;
+	unsigned int i, n;
+	bool switched[MAX_TARGETS] = { false };
+	char msg[32];
+	int ret = 0;
 
-	buf = strdup(msg);
+	for (n = 0; n < priv->nbaudrates; n++) {
+		speed_t speed = rate_to_speed(priv->baudrates[n]);
+		bool pending = false;
 
-	len = insert_chksum(buf, strlen(buf));
-	ret = write_data(fd, buf, len);
-	free(buf);
+		snprintf(msg, sizeof(msg), "$BAUD;%lu;", priv->baudrates[n]);
+		priv->negotiate = true;
+		for (i = 0; i < priv->ntargets; i++) {
+			if (switched[i])
+				continue;
+			ret = write_msg(priv, &priv->targets[i], msg);
+			if (ret < 0)
+				goto out;
+			pending = true;
+		}
+		if (!pending)
+			break;
+		ret = wait_acks(priv, 0);
+		priv->negotiate = false;
+		if (ret < 0)
+			goto out;
+
+		for (i = 0; i < priv->ntargets; i++) {
+			t = &priv->targets[i];
+			if (switched[i] || !t->accepted)
+				continue;
+			tcdrain(t->fduart);
+			if (set_uart(t->fduart, speed)) {
+				ret = -EFAULT;
+				goto out;
+			}
+			/* Confirm that the link works at the new speed */
+			ret = write_msg(priv, t, "$PROG;");
+			if (ret < 0)
+				goto out;
+			switched[i] = true;
+			INFO("%s: switching to %lu baud", t->device,
+			     priv->baudrates[n]);
+		}
+		ret = wait_acks(priv, 0);
+		if (ret < 0)
+			goto out;
+	}
+
+out:
+	priv->negotiate = false;
 	return ret;
 }
 
-static int prepare_update(struct handler_priv *priv, 
-			  struct img_type *img)
+static int prepare_update(struct handler_priv *priv)
 {
+	struct uc_target *t;
+	unsigned int i;
 	int ret;
-	char msg[128];
-	int len;
 
-	ret = register_gpios(priv);
-	if (ret < 0) {
-		return -ENODEV;
+	for (i = 0; i < priv->ntargets; i++) {
+		ret = register_gpios(&priv->targets[i]);
+		if (ret < 0) {
+			return -ENODEV;
+		}
 	}
 
 	ret = switch_mode(priv, MODE_PROG);
@@ -574,35 +806,44 @@ static int prepare_update(struct handler_priv *priv,
 		return -ENODEV;
 	}
 
-	DEBUG("Using %s", img->device);
+	for (i = 0; i < priv->ntargets; i++) {
+		t = &priv->targets[i];
+		DEBUG("Using %s", t->device);
 
-	priv->fduart = open(img->device, O_RDWR);
+		t->fduart = open(t->device, O_RDWR);
 
-	if (priv->fduart < 0) {
-		ERROR("Cannot open UART %s", img->device);
-		return -ENODEV;
-	}
+		if (t->fduart < 0) {
+			ERROR("Cannot open UART %s", t->device);
+			return -ENODEV;
+		}
+
+		set_uart(t->fduart, B115200);
 
-	set_uart(priv->fduart);
+		ret = write_msg(priv, t, "$PROG;");
+		if (ret < 0)
+			return ret;
+	}
 
 	/* No FW data to be sent */
 	priv->nbytes = 0;
 
-	write_msg(priv->fduart, "$PROG;");
-
-	len = receive_msg(priv->fduart, msg, sizeof(msg), priv->timeout, priv->debug);
-	if (len < 0 || strcmp(msg, "$READY;"))
+	ret = wait_acks(priv, 0);
+	if (ret < 0)
 		return -EBADMSG;
 
-	return 0;
+	return negotiate_baudrate(priv);
 }
 
+/*
+ * The same package is sent to all microcontrollers,
+ * up to window packages can be in flight
+ */
 static int update_fw(void *data, const void *buffer, size_t size)
 {
 	int cnt = 0;
 	char c;
 	int ret;
-	char msg[80];
+	unsigned int i;
 	struct handler_priv *priv = (struct handler_priv *)data;
 	const char *buf = (const char *)buffer;
 
@@ -610,97 +851,119 @@ static int update_fw(void *data, const void *buffer, size_t size)
 		c = buf[cnt++];
 		priv->buf[priv->nbytes++] = c;
 		size--;
-		if (c == '\n') {
-			/* Send data */
-			if (priv->debug)
-				dump_ascii(false, priv->buf, priv->nbytes);
-			ret = write_data(priv->fduart, priv->buf, priv->nbytes);
-			if (ret < 0)
-				return ret;
-			priv->buf[priv->nbytes] = '\0';
-			msg[0] = '\0';
-			ret = receive_msg(priv->fduart, msg, sizeof(msg),
-					  priv->timeout, priv->debug);
-			priv->nbytes = 0;
-			if (ret < 0) {
-				return ret;
+		if (c != '\n') {
+			if (priv->nbytes == sizeof(priv->buf)) {
+				ERROR("Package exceeds %zu bytes", sizeof(priv->buf));
+				return -EINVAL;
 			}
-			if (!strcmp(msg, "$READY;"))
+			continue;
+		}
+
+		ret = wait_acks(priv, priv->window - 1);
+		if (ret < 0)
+			return ret;
+
+		/* Send data */
+		for (i = 0; i < priv->ntargets; i++) {
+			if (priv->targets[i].completed)
 				continue;
-			if (!strcmp(msg, "$COMPLETED;"))
-				return 0;
+			ret = write_data(priv, &priv->targets[i], priv->buf, priv->nbytes);
+			if (ret < 0)
+				return ret;
 		}
+		priv->nbytes = 0;
 	}
 	return 0;
 }
 
 static int finish_update(struct handler_priv *priv)
 {
+	unsigned int i;
 	int ret;
 
-	close(priv->fduart);
+	for (i = 0; i < priv->ntargets; i++) {
+		if (priv->targets[i].fduart >= 0)
+			close(priv->targets[i].fduart);
+	}
 	ret = switch_mode(priv, MODE_NORMAL);
-	free_gpios(priv);
+	for (i = 0; i < priv->ntargets; i++)
+		free_gpios(&priv->targets[i]);
 	if (ret < 0) {
 		return -ENODEV;
 	}
 	return 0;
 }
 
-static int get_gpio_from_property(struct dict_list *prop, struct mode_setup *gpio)
+static int get_gpio_from_property(const char *value, struct mode_setup *gpio)
 {
-	struct dict_list_elem *entry;
-	int i;
+	char *sstore = strdup(value);
+	char *s = sstore;
+	int i, ret = 0;
 
-	memset(gpio, 0, sizeof(*gpio));
-
-	LIST_FOREACH(entry, prop, next) {
-		char *sstore = strdup(entry->value);
-		char *s = sstore;
-		for (i = 0; i < 3; i++) {
-			char *t = strchr(s, ':');
+	if (!sstore)
+		return -ENOMEM;
 
-			if (t) *t = '\0';
-			switch (i) {
-			case 0:
-				strlcpy(gpio->gpiodev, s, sizeof(gpio->gpiodev));
-				break;
-			case 1:
-				errno = 0;
-				gpio->offset = strtoul(s,  NULL, 10);
-				if (errno == EINVAL)
-					return -EINVAL;
-				break;
-			case 2:
-				gpio->active_low = strtobool(s);
-				break;
-			}
+	memset(gpio, 0, sizeof(*gpio));
 
-			if (!t)
-				break;
-			s = ++t;
+	for (i = 0; i < 3; i++) {
+		char *t = strchr(s, ':');
+
+		if (t) *t = '\0';
+		switch (i) {
+		case DEVGPIO:
+			strlcpy(gpio->gpiodev, s, sizeof(gpio->gpiodev));
+			break;
+		case GPIONUM:
+			errno = 0;
+			gpio->offset = strtoul(s,  NULL, 10);
+			if (errno == EINVAL)
+				ret = -EINVAL;
+			break;
+		case ACTIVELOW:
+			gpio->active_low = strtobool(s);
+			break;
 		}
-		free(sstore);
+
+		if (!t || ret)
+			break;
+		s = ++t;
 	}
+	free(sstore);
 
-	return 0;
+	return ret;
 }
 
-static int install_uc_firmware_image(struct img_type *img,
-	void __attribute__ ((__unused__)) *data)
+static int get_targets_from_properties(struct img_type *img,
+				       struct handler_priv *priv)
 {
-	struct handler_priv hnd_data;
-	struct dict_list *properties;
+	struct dict_list *devices, *properties;
 	struct dict_list_elem *entry;
-	unsigned int cnt;
-	int ret = 0;
 	struct mode_setup *gpio;
-
-	memset(&hnd_data, 0, sizeof(hnd_data));
-	hnd_data.timeout = DEFAULT_TIMEOUT;
+	unsigned int cnt, i;
+	int ret;
 
 	const char *properties_list[] = { "reset", "prog"};
 
+	devices = dict_get_list(&img->properties, "devices");
+	if (devices) {
+		LIST_FOREACH(entry, devices, next) {
+			if (priv->ntargets == MAX_TARGETS) {
+				ERROR("Too many devices, max %d", MAX_TARGETS);
+				return -EINVAL;
+			}
+			strlcpy(priv->targets[priv->ntargets++].device, entry->value,
+				sizeof(priv->targets[0].device));
+		}
+	} else if (img->device[0]) {
+		strlcpy(priv->targets[0].device, img->device,
+			sizeof(priv->targets[0].device));
+		priv->ntargets = 1;
+	}
+	if (!priv->ntargets) {
+		ERROR("No UART set for microcontroller");
+		return -EINVAL;
+	}
+
 	for (cnt = 0; cnt < ARRAY_SIZE(properties_list); cnt++) {
 		/*
 		 * Getting GPIOs from sw-description
@@ -712,42 +975,112 @@ static int install_uc_firmware_image(struct img_type *img,
 			return -EINVAL;
 		}
 
-		gpio = (cnt == 0) ? &hnd_data.reset : &hnd_data.prog;
+		i = 0;
+		LIST_FOREACH(entry, properties, next) {
+			if (i == priv->ntargets)
+				break;
+			gpio = (cnt == 0) ? &priv->targets[i].reset : &priv->targets[i].prog;
 
-		ret = get_gpio_from_property(properties, gpio) < 0;
-		if (ret < 0) {
-			ERROR("Cannot extract GPIO from properties");
-			return ret;
+			ret = get_gpio_from_property(entry->value, gpio);
+			if (ret < 0) {
+				ERROR("Cannot extract GPIO from properties");
+				return ret;
+			}
+
+			DEBUG("%s: line %s : device %s, num = %d, active_low = %s",
+				priv->targets[i].device,
+				properties_list[cnt],
+				gpio->gpiodev,
+				gpio->offset,
+				gpio->active_low ? "true" : "false");
+			i++;
+		}
+		if (i != priv->ntargets || entry) {
+			ERROR("%d %s GPIOs required, one for each device",
+			      priv->ntargets, properties_list[cnt]);
+			return -EINVAL;
 		}
+	}
 
-		DEBUG("line %s : device %s, num = %d, active_low = %s",
-			properties_list[cnt],
-			gpio->gpiodev,
-			gpio->offset,
-			gpio->active_low ? "true" : "false");
+	return 0;
+}
+
+static int install_uc_firmware_image(struct img_type *img,
+	void __attribute__ ((__unused__)) *data)
+{
+	struct handler_priv *hnd_data;
+	struct dict_list *properties;
+	struct dict_list_elem *entry;
+	unsigned int i;
+	int ret = 0;
+
+	hnd_data = calloc(1, sizeof(*hnd_data));
+	if (!hnd_data) {
+		ERROR("OOM allocating handler data");
+		return -ENOMEM;
+	}
+	hnd_data->timeout = DEFAULT_TIMEOUT;
+	hnd_data->window = 1;
+	for (i = 0; i < MAX_TARGETS; i++)
+		hnd_data->targets[i].fduart = -1;
+
+	ret = get_targets_from_properties(img, hnd_data);
+	if (ret < 0) {
+		free(hnd_data);
+		return ret;
 	}
 
 	properties = dict_get_list(&img->properties, "debug");
 	if (properties) {
 		entry = LIST_FIRST(properties);
 		if (entry && strtobool(entry->value))
-			hnd_data.debug = true;
+			hnd_data->debug = true;
 	}
 
 	properties = dict_get_list(&img->properties, "timeout");
 	if (properties) {
 		entry = LIST_FIRST(properties);
 		if (entry && (strtoul(entry->value, NULL, 10) > 0))
-			hnd_data.timeout = strtoul(entry->value, NULL, 10);
+			hnd_data->timeout = strtoul(entry->value, NULL, 10);
+	}
+
+	properties = dict_get_list(&img->properties, "window");
+	if (properties) {
+		entry = LIST_FIRST(properties);
+		if (entry && (strtoul(entry->value, NULL, 10) > 0))
+			hnd_data->window = min_t(unsigned long,
+						 strtoul(entry->value, NULL, 10),
+						 MAX_WINDOW);
+	}
+
+	properties = dict_get_list(&img->properties, "baudrates");
+	if (properties) {
+		LIST_FOREACH(entry, properties, next) {
+			unsigned long rate = strtoul(entry->value, NULL, 10);
+			if (rate_to_speed(rate) == B0) {
+				WARN("Baudrate %s not supported, skipping", entry->value);
+				continue;
+			}
+			if (rate == DEFAULT_BAUDRATE ||
+			    hnd_data->nbaudrates == ARRAY_SIZE(hnd_data->baudrates))
+				continue;
+			/* Keep the list sorted, highest rate first */
+			for (i = hnd_data->nbaudrates; i > 0 && hnd_data->baudrates[i - 1] < rate; i--)
+				hnd_data->baudrates[i] = hnd_data->baudrates[i - 1];
+			hnd_data->baudrates[i] = rate;
+			hnd_data->nbaudrates++;
+		}
 	}
 
-	ret = prepare_update(&hnd_data, img);
+	ret = prepare_update(hnd_data);
 	if (ret) {
 		ERROR("Prepare failed !!");
 		goto handler_exit;
 	}
 
-	ret = copyimage(&hnd_data, img, update_fw);
+	ret = copyimage(hnd_data, img, update_fw);
+	if (!ret)
+		ret = wait_acks(hnd_data, 0);
 	if (ret) {
 		ERROR("Transferring image to uController was not successful");
 		goto handler_exit;
@@ -756,7 +1089,8 @@ static int install_uc_firmware_image(struct img_type *img,
 handler_exit:
 
 
-	finish_update(&hnd_data);
+	finish_update(hnd_data);
+	free(hnd_data);
 	return ret;
 }
 
@@ -19,11 +19,11 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
-#include <blkid/blkid.h>
 #include <sys/types.h>
 #include "swupdate_image.h"
 #include "handler.h"
 #include "util.h"
+#include "blkdev_cache.h"
 
 void uniqueuuid_handler(void);
 
@@ -32,10 +32,9 @@ static int uniqueuuid(struct img_type *img,
 {
 	struct dict_list *uuids;
 	struct dict_list_elem *uuid;
-	blkid_cache cache = NULL;
-	blkid_dev_iterate	iter;
-	blkid_dev		dev;
+	char **devices;
 	int ret = 0;
+	int i;
 
 	uuids = dict_get_list(&img->properties, "fs-uuid");
 	if (!uuids) {
@@ -43,23 +42,17 @@ static int uniqueuuid(struct img_type *img,
 		return -EINVAL;
 	}
 
-	blkid_get_cache(&cache, NULL);
-
-	blkid_probe_all(cache);
-
 	LIST_FOREACH(uuid, uuids, next) {
-		iter = blkid_dev_iterate_begin(cache);
-		blkid_dev_set_search(iter, "UUID", uuid->value);
+		devices = blkdev_cache_find_tag("UUID", uuid->value);
+		if (!devices)
+			continue;
 
-		while (blkid_dev_next(iter, &dev) == 0) {
-			dev = blkid_verify(cache, dev);
-			if (!dev)
-				continue;
+		for (i = 0; devices[i]; i++) {
 			ERROR("UUID=%s not unique on %s !", uuid->value,
-				blkid_dev_devname(dev));
+				devices[i]);
 			ret = -EAGAIN;
 		}
-		blkid_dev_iterate_end(iter);
+		free_string_array(devices);
 	}
 
 	return ret;
@@ -160,7 +160,8 @@ char *zchunk_get_range_char(zck_range *range) {
 	return output;
 }
 
-zck_range *zchunk_get_missing_range(zckCtx *zck, zckChunk *first, int max_ranges) {
+zck_range *zchunk_get_missing_range(zckCtx *zck, zckChunk *first, int max_ranges,
+				    const bool *skip) {
 	if (!zck)
 		return NULL;
 	zck_range *range = calloc(1, sizeof(zck_range));
@@ -172,6 +173,8 @@ zck_range *zchunk_get_missing_range(zckCtx *zck, zckChunk *first, int max_ranges
 	for(zckChunk *chk = first ? first : zck_get_first_chunk(zck); chk; chk = zck_get_next_chunk(chk)) {
 		if (zck_get_chunk_valid(chk))
 			continue;
+		if (skip && skip[zck_get_chunk_number(chk)])
+			continue;
 		if(!range_add(range, chk)) {
 			zchunk_range_free(&range);
 			return NULL;
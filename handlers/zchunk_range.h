@@ -28,8 +28,12 @@ typedef struct zck_range {
 
 /* exported function */
 
-/* Get a Range from a zck context */
-zck_range *zchunk_get_missing_range(zckCtx *zck, zckChunk *chk, int max_ranges);
+/*
+ * Get a Range from a zck context. Chunks flagged in skip (indexed by
+ * chunk number, can be NULL) are available locally and not requested.
+ */
+zck_range *zchunk_get_missing_range(zckCtx *zck, zckChunk *chk, int max_ranges,
+				    const bool *skip);
 
 /* Return number of ranges */
 int zchunk_get_range_count(zck_range *range);
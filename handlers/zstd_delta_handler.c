@@ -0,0 +1,301 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+/*
+ * Handler for deltas generated by "zstd --patch-from=<old> <new>".
+ * The old image, taken from the source device or file, is the prefix
+ * the delta refers to; the rebuilt image is passed to a chained handler.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if defined(__FreeBSD__)
+#include <sys/disk.h>
+#define BLKGETSIZE64 DIOCGMEDIASIZE
+#else
+#include <linux/fs.h>
+#endif
+#include <zstd.h>
+
+#include "swupdate_image.h"
+#include "handler.h"
+#include "util.h"
+#include "chained_handler.h"
+
+static const char *handlername = "zstd-delta";
+
+/* Window accepted by the zstd decoder without further setup */
+#define ZSTD_DELTA_WINDOWLOG_DEFAULT	27
+
+void zstd_delta_handler(void);
+
+struct zstd_delta {
+	struct img_type *img;
+	const char *srcdev;
+	const char *chained;
+	unsigned long long size;	/* of the new image */
+	unsigned long long seek;	/* for the chained handler */
+	ZSTD_DCtx *dctx;
+	ZSTD_outBuffer out;
+	const void *ref;
+	size_t refsize;
+	bool frame_done;
+	bool chain_started;
+	unsigned long long written;
+	struct chain_handler_data chain;
+};
+
+/*
+ * The chained handler needs the size of the new image: zstd stores
+ * it in the frame header when it is known, so the chained handler is
+ * started with the first data.
+ */
+static int zstd_delta_start_chain(struct zstd_delta *z, const void *buf, size_t len)
+{
+	struct img_type *img = z->img;
+	unsigned long long size = z->size;
+
+	if (!size) {
+		size = ZSTD_getFrameContentSize(buf, len);
+		if (size == ZSTD_CONTENTSIZE_ERROR) {
+			ERROR("%s is not a zstd delta", img->fname);
+			return -EINVAL;
+		}
+		if (size == ZSTD_CONTENTSIZE_UNKNOWN || !size) {
+			ERROR("Size of the image to be rebuilt unknown, set decompressed-size");
+			return -EINVAL;
+		}
+		z->size = size;
+	}
+
+	INFO("Applying zstd delta %s on %s (%zu bytes), result %llu bytes",
+	     img->fname, z->srcdev, z->refsize, size);
+
+	memcpy(&z->chain.img, img, sizeof(*img));
+	z->chain.img.compressed = COMPRESSED_FALSE;
+	z->chain.img.is_encrypted = false;
+	z->chain.img.size = size;
+	z->chain.img.seek = z->seek;
+	memset(z->chain.img.sha256, 0, SHA256_HASH_LENGTH);
+	strlcpy(z->chain.img.type, z->chained, sizeof(z->chain.img.type));
+
+	if (chain_handler_start(&z->chain))
+		return -EFAULT;
+	z->chain_started = true;
+
+	return 0;
+}
+
+/*
+ * writeimage callback: decompress the delta and pass the result on
+ */
+static int zstd_delta_write(void *out, const void *buf, size_t len)
+{
+	struct zstd_delta *z = (struct zstd_delta *)out;
+	ZSTD_inBuffer in = { .src = buf, .size = len, .pos = 0 };
+	size_t ret;
+
+	if (!z->chain_started && zstd_delta_start_chain(z, buf, len))
+		return -EINVAL;
+
+	while (in.pos < in.size) {
+		if (z->frame_done) {
+			/* the prefix only applies to the first frame */
+			ERROR("Data after the end of the zstd delta frame");
+			return -EINVAL;
+		}
+		z->out.pos = 0;
+		ret = ZSTD_decompressStream(z->dctx, &z->out, &in);
+		if (ZSTD_isError(ret)) {
+			ERROR("Applying zstd delta failed: %s", ZSTD_getErrorName(ret));
+			return -EINVAL;
+		}
+		if (z->out.pos) {
+			if (chain_handler_write(&z->chain, z->out.dst, z->out.pos) < 0)
+				return -EFAULT;
+			z->written += z->out.pos;
+		}
+		if (!ret)
+			z->frame_done = true;
+	}
+
+	return 0;
+}
+
+static int map_source(struct zstd_delta *z, const char *srcdev, unsigned long long srcsize)
+{
+	unsigned long long size;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(srcdev, O_RDONLY);
+	if (fd < 0) {
+		ERROR("%s cannot be opened: %s", srcdev, strerror(errno));
+		return -ENODEV;
+	}
+	if (fstat(fd, &st)) {
+		ERROR("Cannot get information on %s", srcdev);
+		close(fd);
+		return -ENODEV;
+	}
+	if (S_ISREG(st.st_mode)) {
+		size = st.st_size;
+	} else if (!S_ISBLK(st.st_mode) || ioctl(fd, BLKGETSIZE64, &size) < 0) {
+		ERROR("Size cannot be detected for %s", srcdev);
+		close(fd);
+		return -ENODEV;
+	}
+
+	if (srcsize) {
+		if (srcsize > size) {
+			ERROR("source-size %llu exceeds %s (%llu bytes)", srcsize, srcdev, size);
+			close(fd);
+			return -EINVAL;
+		}
+		size = srcsize;
+	}
+	if (!size || size > SIZE_MAX) {
+		ERROR("Cannot use %s of %llu bytes as reference", srcdev, size);
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		ERROR("Cannot map %s: %s", srcdev, strerror(errno));
+		return -ENOMEM;
+	}
+	/* The reference is read once, mostly in order */
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	z->ref = map;
+	z->refsize = size;
+
+	return 0;
+}
+
+/*
+ * The window of a patch-from frame covers reference and new image,
+ * so it is bigger than the decoder accepts by default.
+ */
+static int zstd_delta_window(struct zstd_delta *z, const char *prop)
+{
+	ZSTD_bounds bounds = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+	int wlog;
+
+	if (prop) {
+		wlog = strtoul(prop, NULL, 10);
+	} else {
+		for (wlog = ZSTD_DELTA_WINDOWLOG_DEFAULT;
+		     wlog < bounds.upperBound && (1ULL << wlog) < 2ULL * z->refsize;
+		     wlog++)
+			;
+	}
+	if (wlog < bounds.lowerBound || wlog > bounds.upperBound) {
+		ERROR("max-window-log %d out of range [%d, %d]", wlog,
+		      bounds.lowerBound, bounds.upperBound);
+		return -EINVAL;
+	}
+	TRACE("zstd delta: window log up to %d", wlog);
+
+	if (ZSTD_isError(ZSTD_DCtx_setParameter(z->dctx, ZSTD_d_windowLogMax, wlog)))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int install_zstd_delta(struct img_type *img,
+	void __attribute__ ((__unused__)) *data)
+{
+	struct zstd_delta *z;
+	char *srcdev = dict_get_value(&img->properties, "source");
+	char *chained = dict_get_value(&img->properties, "chain");
+	char *srcsize = dict_get_value(&img->properties, "source-size");
+	char *size = dict_get_value(&img->properties, "decompressed-size");
+	int ret;
+
+	if (!srcdev || !chained || !strcmp(chained, handlername)) {
+		ERROR("Wrong Attributes in sw-description: source=%s, chain=%s",
+		      srcdev, chained);
+		return -EINVAL;
+	}
+
+	z = calloc(1, sizeof(*z));
+	if (!z)
+		return -ENOMEM;
+	z->img = img;
+	z->srcdev = srcdev;
+	z->chained = chained;
+	if (size)
+		z->size = ustrtoull(size, NULL, 10);
+
+	ret = map_source(z, srcdev, srcsize ? ustrtoull(srcsize, NULL, 10) : 0);
+	if (ret)
+		goto cleanup;
+
+	z->dctx = ZSTD_createDCtx();
+	z->out.size = ZSTD_DStreamOutSize();
+	z->out.dst = malloc(z->out.size);
+	if (!z->dctx || !z->out.dst) {
+		ret = -ENOMEM;
+		goto cleanup;
+	}
+	ret = zstd_delta_window(z, dict_get_value(&img->properties, "max-window-log"));
+	if (ret)
+		goto cleanup;
+	if (ZSTD_isError(ZSTD_DCtx_refPrefix(z->dctx, z->ref, z->refsize))) {
+		ERROR("Cannot use %s as zstd prefix", srcdev);
+		ret = -EINVAL;
+		goto cleanup;
+	}
+
+	/* seek applies to the output of the chained handler */
+	z->seek = img->seek;
+	img->seek = 0;
+	ret = copyimage(z, img, zstd_delta_write);
+	img->seek = z->seek;
+	if (!ret && !z->frame_done) {
+		ERROR("zstd delta %s is truncated", img->fname);
+		ret = -EINVAL;
+	}
+	if (!ret && z->written != z->size) {
+		ERROR("zstd delta %s rebuilt %llu bytes, %llu expected",
+		      img->fname, z->written, z->size);
+		ret = -EINVAL;
+	}
+
+	if (z->chain_started) {
+		ret = chain_handler_finish(&z->chain, ret < 0 ? ret : 0);
+		TRACE("Chained handler returned %d", ret);
+	}
+
+cleanup:
+	if (z->ref)
+		munmap((void *)z->ref, z->refsize);
+	ZSTD_freeDCtx(z->dctx);
+	free(z->out.dst);
+	free(z);
+
+	return ret;
+}
+
+__attribute__((constructor))
+void zstd_delta_handler(void)
+{
+	register_handler(handlername, install_zstd_delta,
+				IMAGE_HANDLER | FILE_HANDLER, NULL);
+}
@@ -0,0 +1,22 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+/*
+ * Cache of the block device metadata (TYPE, UUID, LABEL, PARTUUID)
+ * detected by libblkid. All block devices in /proc/partitions are
+ * probed in parallel at the first access, results are kept until
+ * the partitions change or the cache is invalidated.
+ */
+#if defined(CONFIG_BLKDEV_CACHE)
+char *blkdev_cache_get_tag(const char *device, const char *tag);
+char **blkdev_cache_find_tag(const char *tag, const char *value);
+void blkdev_cache_invalidate(const char *device);
+#else
+static inline void blkdev_cache_invalidate(const char __attribute__ ((__unused__)) *device) {}
+#endif
@@ -0,0 +1,36 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * In-process stream between one producer and one consumer thread:
+ * a bounded ring of large buffers. The consumer gets pointers into
+ * the ring and releases what it has processed, so data is not copied
+ * through the kernel as with a pipe.
+ */
+struct bufstream;
+
+struct bufstream *bufstream_new(unsigned int nbufs, size_t bufsize);
+void bufstream_free(struct bufstream *s);
+
+/* Producer side */
+void *bufstream_get_wbuf(struct bufstream *s, size_t *size);
+int bufstream_commit(struct bufstream *s, size_t len);
+int bufstream_write(void *out, const void *buf, size_t len);
+void bufstream_close(struct bufstream *s);
+
+/* Consumer side */
+ssize_t bufstream_peek(struct bufstream *s, const void **data);
+void bufstream_consume(struct bufstream *s, size_t len);
+ssize_t bufstream_read(struct bufstream *s, void *buf, size_t len);
+
+/* Either side gives up, the other one gets -EPIPE */
+void bufstream_abort(struct bufstream *s);
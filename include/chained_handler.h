@@ -7,9 +7,25 @@
 
 #pragma once
 
+#include <pthread.h>
 #include "swupdate_image.h"
+
+struct bufstream;
+
 struct chain_handler_data {
 	struct img_type img;
+	/*
+	 * Data are passed to the chained handler in memory if it
+	 * reads them only via copyimage(), else via a pipe
+	 */
+	struct bufstream *stream;
+	int fdout;
+	pthread_t thread;
 };
 
 extern void *chain_handler_thread(void *data);
+
+int chain_handler_start(struct chain_handler_data *priv);
+int chain_handler_write(void *out, const void *buf, size_t len);
+void chain_handler_close(struct chain_handler_data *priv);
+int chain_handler_finish(struct chain_handler_data *priv, int err);
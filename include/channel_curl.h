@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "swupdate_status.h"
+#include "channel.h"
 
 /** Curl Channel Implementation Header File.
  *
@@ -93,5 +94,21 @@ typedef struct {
 	unsigned int max_download_speed;
 	size_t	upload_filesize;
 	char *range; /* Range request for get_file in any */
+	char **peers;		/* LAN peers asked for the file before url, NULL terminated */
+	char *peer_key;		/* SHA-256 of the file, its name on peers */
+	char *peer_cache;	/* keep the downloaded file here to serve it to peers */
+	char **mirrors;		/* other URLs of the same file, NULL terminated */
+	unsigned int mirror_min_speed;	/* B/s, a slower mirror is left for the next one, 0: from the probe */
 	void *user;
 } channel_data_t;
+
+/*
+ * Asynchronous operations on a curl multi handle (CURLM): the transfer
+ * is added to multi by channel_curl_start(), and priv is set as its
+ * CURLINFO_PRIVATE. channel_curl_finish() must be called with the
+ * transfer's result (CURLcode) when curl_multi_info_read() reports it
+ * as done. A channel runs one operation at a time.
+ */
+channel_op_res_t channel_curl_start(channel_t *this, channel_data_t *channel_data,
+				    channel_method_t method, void *multi, void *priv);
+channel_op_res_t channel_curl_finish(channel_t *this, void *multi, int curlrc);
@@ -54,6 +54,10 @@ long long get_mtd_size(int mtdnum);
 int flash_erase(int mtdnum);
 int flash_erase_sector(int mtdnum, off_t start, size_t size);
 
+struct imglist;
+int flash_preerase_start(struct imglist *images);
+void flash_preerase_stop(void);
+
 struct flash_description *get_flash_info(void);
 #define isNand(flash, index) \
 	(flash->mtd_info[index].mtd.type == MTD_NANDFLASH || \
@@ -0,0 +1,72 @@
+/*
+ *
+ * Automatically generated file; DO NOT EDIT.
+ * SWUpdate Configuration
+ *
+ */
+#define CONFIG_DELTA 1
+#define CONFIG_UNIQUEUUID 1
+#define CONFIG_DISKPART_FORMAT 1
+#define CONFIG_LIBCONFIG 1
+#define CONFIG_SSL_IMPL_OPENSSL 1
+#define CONFIG_PARSERROOT ""
+#define CONFIG_READBACKHANDLER 1
+#define CONFIG_UBIVIDOFFSET 0
+#define CONFIG_LOCALE 1
+#define CONFIG_HW_COMPATIBILITY_FILE "/etc/hwrevision"
+#define CONFIG_LUASCRIPTHANDLER 1
+#define CONFIG_CHANNEL_CURL 1
+#define CONFIG_MTD 1
+#define CONFIG_SW_VERSIONS_FILE "/etc/sw-versions"
+#define CONFIG_GUNZIP 1
+#define CONFIG_LUAEXTERNAL 1
+#define CONFIG_SURICATTA_SSL 1
+#define CONFIG_MONGOOSEIPV6 1
+#define CONFIG_UBIBLACKLIST ""
+#define CONFIG_BOOTLOADER_DEFAULT_NONE 1
+#define CONFIG_DEFAULT_CONFIG_FILE "/etc/swupdate.cfg"
+#define CONFIG_SWUFORWARDER_HANDLER 1
+#define CONFIG_EXTRA_CFLAGS "-g"
+#define CONFIG_CHANNEL_CURL_SSL 1
+#define CONFIG_ENCRYPTED_IMAGES 1
+#define CONFIG_SHELLSCRIPTHANDLER 1
+#define CONFIG_SSBLSWITCH 1
+#define CONFIG_HASH_VERIFY 1
+#define CONFIG_LUAPKG "lua5.2"
+#define CONFIG_RAW 1
+#define CONFIG_DISKFORMAT_HANDLER 1
+#define CONFIG_UBIATTACH 1
+#define CONFIG_EXT_FILESYSTEM 1
+#define CONFIG_CURL_SSL 1
+#define CONFIG_ZSTD 1
+#define CONFIG_HW_COMPATIBILITY 1
+#define CONFIG_BLKDEV_CACHE 1
+#define CONFIG_LUA 1
+#define CONFIG_BOOTLOADERHANDLER 1
+#define CONFIG_SOCKET_CTRL_PATH ""
+#define CONFIG_ARCHIVE 1
+#define CONFIG_SCRIPTS 1
+#define CONFIG_FAT_FILESYSTEM 1
+#define CONFIG_DISKPART 1
+#define CONFIG_SYSROOT ""
+#define CONFIG_UPDATE_STATE_CHOICE_BOOTLOADER 1
+#define CONFIG_UPDATE_STATE_BOOTLOADER "ustate"
+#define CONFIG_DISKFORMAT 1
+#define CONFIG_CURL 1
+#define CONFIG_UCFWHANDLER 1
+#define CONFIG_UBIWHITELIST ""
+#define CONFIG_SOCKET_PROGRESS_PATH ""
+#define CONFIG_REMOTE_HANDLER 1
+#define CONFIG_RDIFFHANDLER 1
+#define CONFIG_BOOTLOADER_NONE 1
+#define CONFIG_CFI 1
+#define CONFIG_SURICATTA_HAWKBIT 1
+#define CONFIG_EXTRA_LDFLAGS ""
+#define CONFIG_EXTRA_LDLIBS ""
+#define CONFIG_DOWNLOAD 1
+#define CONFIG_CROSS_COMPILE ""
+#define CONFIG_MONGOOSE 1
+#define CONFIG_SURICATTA 1
+#define CONFIG_WEBSERVER 1
+#define CONFIG_MONGOOSESSL 1
+#define CONFIG_UBIVOL 1
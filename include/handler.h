@@ -35,7 +35,8 @@ typedef enum {
 	SCRIPT_HANDLER = 4,
 	BOOTLOADER_HANDLER = 8,
 	PARTITION_HANDLER = 16,
-	NO_DATA_HANDLER = 32
+	NO_DATA_HANDLER = 32,
+	STREAM_INPUT_HANDLER = 64	/* input is read only via copyimage() */
 } HANDLER_MASK;
 
 /*
@@ -0,0 +1,78 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Distribution of a SWU to many devices with a single UDP multicast
+ * transmission.
+ *
+ * The SWU is split into blocks of the same size, the last one padded
+ * with zeroes. Blocks are sent in groups of k data blocks followed by
+ * r parity blocks: any k blocks of a group are enough to rebuild it.
+ * The sender repeats the whole SWU for a number of rounds, so that a
+ * receiver gets in a later round a group it could not rebuild.
+ */
+#define MCAST_MAGIC		0x53574d43	/* "SWMC" */
+#define MCAST_VERSION		1
+#define MCAST_DEFAULT_GROUP	"239.255.0.83"
+#define MCAST_DEFAULT_PORT	5083
+#define MCAST_DEFAULT_BLOCK	1400
+#define MCAST_DEFAULT_K		32
+#define MCAST_DEFAULT_R		8
+#define MCAST_MAX_BLOCK		8192
+
+/* All fields in network byte order, followed by block_size bytes */
+struct mcast_hdr {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t k;		/* data blocks in a group, the last one can have less */
+	uint8_t r;		/* parity blocks in a group */
+	uint8_t index;		/* data blocks of the group first, then parity */
+	uint32_t session;	/* changes each time the sender is started */
+	uint32_t group;
+	uint16_t block_size;
+	uint16_t reserved;
+	uint64_t size;		/* of the SWU */
+} __attribute__((packed));
+
+static inline uint32_t mcast_groups(uint64_t size, unsigned int block_size, unsigned int k)
+{
+	uint64_t blocks = (size + block_size - 1) / block_size;
+
+	return (blocks + k - 1) / k;
+}
+
+/* Number of data blocks in a group */
+static inline unsigned int mcast_group_blocks(uint64_t size, unsigned int block_size,
+					      unsigned int k, uint32_t group)
+{
+	uint64_t left = (size + block_size - 1) / block_size - (uint64_t)group * k;
+
+	return left < k ? left : k;
+}
+
+/*
+ * Systematic Reed-Solomon code over GF(2^8) with a Cauchy matrix,
+ * k + r must not exceed FEC_MAX_BLOCKS.
+ */
+#define FEC_MAX_BLOCKS		255
+
+void fec_encode(unsigned int k, unsigned int r, unsigned char * const *data,
+		unsigned char **parity, size_t len);
+
+/*
+ * blocks has k + r entries, present tells which ones were received.
+ * The missing data blocks are rebuilt in place from any k blocks
+ * received. Returns -1 if less than k blocks are present.
+ */
+int fec_decode(unsigned int k, unsigned int r, unsigned char **blocks,
+	       const bool *present, size_t len);
@@ -0,0 +1,15 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+/*
+ * This is used by swupdate to start the Multicast Receiver Process
+ */
+int start_multicast_receiver(const char *cfgfname, int argc, char *argv[]);
+
+void multicast_print_help(void);
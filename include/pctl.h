@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <time.h>
 #include <swupdate_status.h>
 #include <sys/types.h>
 #include "util.h"
@@ -23,6 +24,7 @@ struct swupdate_task {
 	int	pipe;
 	sourcetype	type;
 	const char	*name;
+	struct timespec	started;	/* fork() time, CLOCK_MONOTONIC */
 };
 
 pthread_t start_thread(void *(* start_routine) (void *), void *arg);
@@ -30,6 +32,9 @@ pthread_t start_thread(void *(* start_routine) (void *), void *arg);
 void thread_ready(void);
 void wait_threads_ready(void);
 
+void deferred_init_ready(void);
+void wait_deferred_init(void);
+
 typedef int (*swupdate_process)(const char *cfgname, int argc, char **argv);
 typedef server_op_res_t(*server_ipc_fn)(int fd);
 
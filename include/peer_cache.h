@@ -0,0 +1,54 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Updates downloaded by a device are kept in a cache directory, named
+ * after the SHA-256 of the SWU, and served by the Webserver under
+ * /peer/<sha256>. Other devices in the LAN ask the peers for the SWU
+ * before going to the origin server.
+ */
+#define PEER_CACHE_URI	"/peer/"
+
+struct peer_cache;
+
+#if defined(CONFIG_PEER_CACHE)
+/*
+ * Start to cache a download in dir. key is the expected SHA-256 (hex)
+ * of the SWU, if it is known. Returns NULL if the SWU cannot be cached,
+ * the download goes on anyway.
+ */
+struct peer_cache *peer_cache_start(const char *dir, const char *key);
+void peer_cache_write(struct peer_cache *pc, const void *buf, size_t len);
+
+/*
+ * The SWU is kept only if the download succeeded and its data match
+ * the key. It replaces the SWU cached before.
+ */
+void peer_cache_finish(struct peer_cache *pc, bool success);
+
+/* key must be a SHA-256 in hex, it is used as file name */
+bool peer_cache_valid_key(const char *key);
+
+/* URL of the SWU on a peer, to be freed by the caller */
+char *peer_cache_url(const char *peer, const char *key);
+#else
+static inline struct peer_cache *peer_cache_start(const char __attribute__ ((__unused__)) *dir,
+						   const char __attribute__ ((__unused__)) *key)
+{
+	return NULL;
+}
+static inline void peer_cache_write(struct peer_cache __attribute__ ((__unused__)) *pc,
+				    const void __attribute__ ((__unused__)) *buf,
+				    size_t __attribute__ ((__unused__)) len) {}
+static inline void peer_cache_finish(struct peer_cache __attribute__ ((__unused__)) *pc,
+				     bool __attribute__ ((__unused__)) success) {}
+#endif
@@ -39,6 +39,8 @@ struct sw_version {
 
 LIST_HEAD(swver, sw_version);
 
+struct bufstream;
+
 struct img_type {
 	struct sw_version id;		/* This is used to compare versions */
 	char type[SWUPDATE_GENERAL_STRING_SIZE]; /* Handler name */
@@ -71,6 +73,7 @@ struct img_type {
 
 	long long partsize;
 	int fdin;	/* Used for streaming file */
+	struct bufstream *stream;	/* In-process input of chained handlers, see STREAM_INPUT_HANDLER */
 	off_t offset;	/* offset in cpio file */
 	long long size;
 	unsigned int checksum;
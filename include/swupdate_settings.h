@@ -8,6 +8,7 @@
 #pragma once
 
 #include <unistd.h>
+#include <stdbool.h>
 
 typedef int (*settings_callback)(void *elem, void *data);
 
@@ -17,6 +18,7 @@ typedef int (*settings_callback)(void *elem, void *data);
 
 typedef struct {
 	config_t cfg;
+	config_t *shared;	/* settings parsed once, shared with other handles */
 } swupdate_cfg_handle;
 
 void swupdate_cfg_init(swupdate_cfg_handle *handle);
@@ -34,7 +34,8 @@ typedef enum {
 	SOURCE_SURICATTA,
 	SOURCE_DOWNLOADER,
 	SOURCE_LOCAL,
-	SOURCE_CHUNKS_DOWNLOADER
+	SOURCE_CHUNKS_DOWNLOADER,
+	SOURCE_MULTICAST
 } sourcetype;
 
 #ifdef __cplusplus
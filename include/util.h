@@ -86,6 +86,7 @@ typedef enum {
 typedef enum {
 	CANCELUPDATE=LASTLOGLEVEL + 1,
 	CHANGE,
+	MIRRORS,
 } NOTIFY_CAUSE;
 
 enum {
@@ -274,5 +275,13 @@ int swupdate_umount(const char *dir);
 char *swupdate_time_iso8601(struct timeval *tv);
 
 /* eMMC functions */
+struct emmc_extcsd_value {
+	uint8_t index;
+	uint8_t value;
+};
 int emmc_write_bootpart(int fd, int bootpart);
 int emmc_get_active_bootpart(int fd);
+int emmc_toggle_bootpart(int fd);
+int emmc_write_extcsd_values(int fd, const struct emmc_extcsd_value *values,
+			     unsigned int n);
+long emmc_get_write_unit(int fd);
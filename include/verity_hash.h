@@ -0,0 +1,40 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define VERITY_MAX_DIGEST_SIZE	32
+#define VERITY_MAX_SALT_SIZE	256
+#define VERITY_MAX_THREADS	16
+
+/*
+ * Setup of a dm-verity hash tree (format version 1,
+ * tree without superblock as with veritysetup --no-superblock)
+ */
+struct verity_hash_cfg {
+	const char *algo;		/* "sha256" or "sha1" */
+	unsigned int data_block_size;
+	unsigned int hash_block_size;
+	unsigned char salt[VERITY_MAX_SALT_SIZE];
+	size_t salt_size;
+	unsigned int threads;		/* threads used to hash data blocks */
+	int fd;				/* tree is written here, -1 to just compute the root hash */
+	off_t offset;			/* offset of the tree in fd */
+};
+
+struct verity_hash;
+
+struct verity_hash *verity_hash_init(struct verity_hash_cfg *cfg,
+				     unsigned long long data_size);
+int verity_hash_update(struct verity_hash *v, const unsigned char *buf, size_t len);
+int verity_hash_final(struct verity_hash *v, unsigned char *root_hash);
+unsigned int verity_hash_digest_size(struct verity_hash *v);
+unsigned long long verity_hash_tree_size(struct verity_hash *v);
+void verity_hash_free(struct verity_hash *v);
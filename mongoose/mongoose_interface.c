@@ -30,6 +30,7 @@
 #include <swupdate_settings.h>
 #include <pctl.h>
 #include <progress.h>
+#include <peer_cache.h>
 
 #include "mongoose.h"
 #include "mongoose_multipart.h"
@@ -48,6 +49,7 @@ struct mongoose_options {
 	char *port;
 	char *global_auth_file;
 	char *auth_domain;
+	char *peer_cache;
 #if MG_ENABLE_SSL
 	char *ssl_cert;
 	char *ssl_key;
@@ -69,6 +71,7 @@ static unsigned int watchdog_conn = 0;
 static struct mg_http_serve_opts s_http_server_opts;
 const char *global_auth_domain;
 const char *global_auth_file;
+static const char *peer_cache_dir;
 #if MG_ENABLE_SSL
 static bool ssl;
 static struct mg_tls_opts tls_opts;
@@ -679,6 +682,36 @@ static void upload_handler(struct mg_connection *nc, int ev, void *ev_data,
 	}
 }
 
+#if defined(CONFIG_PEER_CACHE)
+/*
+ * Serve an SWU of the peer cache to another device, Range requests
+ * included so that a peer can resume
+ */
+static void peer_handler(struct mg_connection *nc, struct mg_http_message *hm)
+{
+	struct mg_http_serve_opts opts = {
+		.root_dir = peer_cache_dir,
+	};
+	size_t len = strlen(PEER_CACHE_URI);
+	char key[SHA256_HASH_LENGTH * 2 + 1];
+	char path[PATH_MAX];
+
+	if (hm->uri.len - len >= sizeof(key)) {
+		mg_http_reply(nc, 404, "", "Not found\n");
+		return;
+	}
+	memcpy(key, hm->uri.ptr + len, hm->uri.len - len);
+	key[hm->uri.len - len] = '\0';
+	if (!peer_cache_valid_key(key)) {
+		mg_http_reply(nc, 404, "", "Not found\n");
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", peer_cache_dir, key);
+	mg_http_serve_file(nc, hm, path, &opts);
+}
+#endif
+
 static void websocket_handler(struct mg_connection *nc, void *ev_data)
 {
 	struct mg_http_message *hm = (struct mg_http_message *) ev_data;
@@ -695,6 +728,10 @@ static void ev_handler(struct mg_connection *nc, int ev, void *ev_data, void *fn
 			websocket_handler(nc, ev_data);
 		else if (mg_http_match_uri(hm, "/restart"))
 			restart_handler(nc, ev_data);
+#if defined(CONFIG_PEER_CACHE)
+		else if (peer_cache_dir && mg_http_match_uri(hm, PEER_CACHE_URI "*"))
+			peer_handler(nc, hm);
+#endif
 		else
 			mg_http_serve_dir(nc, ev_data, &s_http_server_opts);
 	} else if (nc->data[0] != 'M' && ev == MG_EV_READ) {
@@ -768,6 +805,10 @@ static int mongoose_settings(void *elem, void  __attribute__ ((__unused__)) *dat
 	if (strlen(tmp)) {
 		opts->auth_domain = strdup(tmp);
 	}
+	GET_FIELD_STRING_RESET(LIBCFG_PARSER, elem, "peer-cache", tmp);
+	if (strlen(tmp)) {
+		opts->peer_cache = strdup(tmp);
+	}
 	get_field(LIBCFG_PARSER, elem, "run-postupdate", &run_postupdate);
 
 	get_field(LIBCFG_PARSER, elem, "timeout", &watchdog_conn);
@@ -898,6 +939,7 @@ int start_mongoose(const char *cfgfname, int argc, char *argv[])
 		s_http_server_opts.fs = &fs_posix_no_list;
 	global_auth_file = opts.global_auth_file;
 	global_auth_domain = opts.auth_domain;
+	peer_cache_dir = opts.peer_cache;
 
 #if MG_ENABLE_SSL
 	if (ssl) {
@@ -147,7 +147,23 @@ static channel_data_t channel_data_defaults = {.debug = false,
 					       .received_headers = NULL
 						};
 
-static struct timeval server_time;
+/*
+ * Cancel / skip requests are polled by a watcher thread while the
+ * artifact is downloaded, so that the curl write callback never
+ * waits for the server. abort_dwl is accessed atomically, lock
+ * also guards the fields of server_hawkbit that the watcher sets
+ * (cancel_url, stop_id, update_action and cancelDuringUpdate).
+ */
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool running;
+	bool stop;
+	bool abort_dwl;
+} dwl_watch = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
 /*
  * Just called once to setup the tokens
@@ -249,21 +265,36 @@ static const char *json_get_deployment_update_action(json_object *json_reply)
 	return deployment_update_action.skip;
 }
 
+static const char *get_update_action(void)
+{
+	const char *update_action;
+
+	pthread_mutex_lock(&dwl_watch.lock);
+	update_action = server_hawkbit.update_action;
+	pthread_mutex_unlock(&dwl_watch.lock);
+
+	return update_action;
+}
+
 static void check_action_changed(int action_id, const char *update_action)
 {
+	bool changed;
 
 	if (!update_action)
 		return;
 
-	if (update_action != server_hawkbit.update_action) {
+	pthread_mutex_lock(&dwl_watch.lock);
+	changed = update_action != server_hawkbit.update_action;
+	server_hawkbit.update_action = update_action;
+	pthread_mutex_unlock(&dwl_watch.lock);
+
+	if (changed) {
 		char *notifybuf = NULL;
-		server_hawkbit.update_action = update_action;
-		INFO("Update classified as '%s' by server.",
-			server_hawkbit.update_action);
+		INFO("Update classified as '%s' by server.", update_action);
 
 		if (ENOMEM_ASPRINTF ==
 		    asprintf(&notifybuf, "{ \"id\" : \"%d\", \"update\" : \"%s\"}",
-				action_id, server_hawkbit.update_action)) {
+				action_id, update_action)) {
 			notify(SUBPROCESS, CHANGE, DEBUGLEVEL, "Update type changed by server");
 		}  else {
 			notify(SUBPROCESS, CHANGE, DEBUGLEVEL, notifybuf);
@@ -280,7 +311,7 @@ server_op_res_t server_send_cancel_reply(channel_t *channel, const int action_id
 
 	/* First retry cancel URL to get stopId */
 	channel_data_t channel_data_reply = channel_data_defaults;
-	int stop_id = server_hawkbit.stop_id;
+	int stop_id;
 
 	/* clang-format off */
 	static const char* const json_hawkbit_cancelation_feedback = STRINGIFY(
@@ -300,10 +331,13 @@ server_op_res_t server_send_cancel_reply(channel_t *channel, const int action_id
 	server_op_res_t result = SERVER_OK;
 	char *url = NULL;
 	char *json_reply_string = NULL;
+	int ret;
 
-	if (ENOMEM_ASPRINTF ==
-	    asprintf(&url, "%s/feedback",
-		     server_hawkbit.cancel_url)) {
+	pthread_mutex_lock(&dwl_watch.lock);
+	stop_id = server_hawkbit.stop_id;
+	ret = asprintf(&url, "%s/feedback", server_hawkbit.cancel_url);
+	pthread_mutex_unlock(&dwl_watch.lock);
+	if (ENOMEM_ASPRINTF == ret) {
 		ERROR("hawkBit server reply cannot be sent because of OOM.");
 		result = SERVER_EINIT;
 		goto cleanup;
@@ -502,16 +536,6 @@ static unsigned int server_get_polling_interval(void)
 	return server_hawkbit.polling_interval;
 }
 
-static void server_get_current_time(struct timeval *tv)
-{
-	struct timespec ts;
-
-	/* use timespec for monotonic clock */
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-
-	TIMESPEC_TO_TIMEVAL(tv, &ts);
-}
-
 server_op_res_t server_set_config_data(json_object *json_root)
 {
 	char *tmp;
@@ -591,6 +615,8 @@ static server_op_res_t server_get_deployment_info(channel_t *channel, channel_da
 	server_op_res_t result = SERVER_OK;
 	char *url_deployment_base = NULL;
 	char *url_cancel = NULL;
+	char *cancel_url;
+	int stop_id;
 	channel_data_t channel_data_device_info = channel_data_defaults;
 	if ((result = server_get_device_info(channel, &channel_data_device_info)) !=
 	    SERVER_OK) {
@@ -600,9 +626,11 @@ static server_op_res_t server_get_deployment_info(channel_t *channel, channel_da
 					    "cancelAction")) != NULL) {
 		update_status = SERVER_UPDATE_CANCELED;
 		channel_data->url = url_cancel;
-		if (server_hawkbit.cancel_url)
-			free(server_hawkbit.cancel_url);
-		server_hawkbit.cancel_url = strdup(url_cancel);
+		cancel_url = strdup(url_cancel);
+		pthread_mutex_lock(&dwl_watch.lock);
+		free(server_hawkbit.cancel_url);
+		server_hawkbit.cancel_url = cancel_url;
+		pthread_mutex_unlock(&dwl_watch.lock);
 		TRACE("Cancel action available at %s", url_cancel);
 	} else if ((url_deployment_base =
 			json_get_data_url(channel_data_device_info.json_reply,
@@ -633,7 +661,7 @@ static server_op_res_t server_get_deployment_info(channel_t *channel, channel_da
 	/*
 	 * Read stopId if cancelUpdate is detected
 	 */
-	server_hawkbit.stop_id = *action_id;
+	stop_id = *action_id;
 	if (update_status == SERVER_UPDATE_CANCELED) {
 		json_data = json_get_path_key(
 		    channel_data->json_reply, (const char *[]){"cancelAction", "stopId", NULL});
@@ -642,9 +670,12 @@ static server_op_res_t server_get_deployment_info(channel_t *channel, channel_da
 			DEBUG("Got JSON: %s",
 			      json_object_to_json_string(channel_data->json_reply));
 		} else {
-			server_hawkbit.stop_id = json_object_get_int(json_data);
+			stop_id = json_object_get_int(json_data);
 		}
 	}
+	pthread_mutex_lock(&dwl_watch.lock);
+	server_hawkbit.stop_id = stop_id;
+	pthread_mutex_unlock(&dwl_watch.lock);
 	TRACE("Associated Action ID for Update Action is %d", *action_id);
 	result = update_status;
 
@@ -668,59 +699,38 @@ static size_t server_check_during_dwl(char  __attribute__ ((__unused__)) *stream
                                       size_t nmemb,
                                       void  __attribute__ ((__unused__)) *data)
 {
-	struct timeval now;
-	channel_data_t channel_data = channel_data_defaults;
-	int action_id;
-	int ret = size * nmemb;
-	const char *update_action;
-
-	server_get_current_time(&now);
-
-	/*
-	 * The download can take a very long time
-	 * In the meantime, check with current polling time
-	 * if something on the server was changed and a cancel
-	 * was requested
-	 */
-	if ((now.tv_sec - server_time.tv_sec) < ((int)server_get_polling_interval()))
-		return ret;
+	/* Returning less than the data size makes curl stop */
+	if (__atomic_load_n(&dwl_watch.abort_dwl, __ATOMIC_ACQUIRE))
+		return 0;
 
-	/* Update current server time */
-	server_time = now;
-
-	/*
-	 * We need a separate channel because we want to run
-	 * a connection parallel to the download
-	 */
-	channel_t *channel = channel_new();
-	if (!channel)
-		return ret;
+	return size * nmemb;
+}
 
-	if (channel->open(channel, &channel_data_defaults) != CHANNEL_OK) {
-		/*
-		 * it is not possible to check for a cancelUpdate,
-		 * go on downloading
-		 */
-		channel->close(channel);
-		free(channel);
-		return ret;
-	}
+/*
+ * Ask the server if the running deployment was canceled or skipped.
+ * Returns true if the download must be stopped.
+ */
+static bool server_dwl_must_stop(channel_t *channel)
+{
+	channel_data_t channel_data = channel_data_defaults;
+	const char *update_action;
+	int action_id;
+	bool stop = false;
 
-	/*
-	 * Send a device Info to the hawkBit Server
-	 */
 	server_op_res_t result =
 	    server_get_deployment_info(channel, &channel_data, &action_id);
 	if (result == SERVER_UPDATE_CANCELED) {
 		/* Mark that an update was cancelled by the server */
+		pthread_mutex_lock(&dwl_watch.lock);
 		server_hawkbit.cancelDuringUpdate = true;
-		ret = 0;
+		pthread_mutex_unlock(&dwl_watch.lock);
+		stop = true;
 	}
 	update_action = json_get_deployment_update_action(channel_data.json_reply);
 
 	/* if the deployment is skipped then stop downloading */
 	if (update_action == deployment_update_action.skip)
-		ret = 0;
+		stop = true;
 
 	check_action_changed(action_id, update_action);
 
@@ -729,10 +739,103 @@ static size_t server_check_during_dwl(char  __attribute__ ((__unused__)) *stream
 	    json_object_put(channel_data.json_reply) != JSON_OBJECT_FREED) {
 		ERROR("JSON object should be freed but was not.");
 	}
-	channel->close(channel);
-	free(channel);
 
-	return ret;
+	return stop;
+}
+
+static void *dwl_watch_thread(void __attribute__ ((__unused__)) *data)
+{
+	channel_t *channel = NULL;
+	struct timespec deadline;
+	bool stop_dwl;
+
+	pthread_mutex_lock(&dwl_watch.lock);
+	while (!dwl_watch.stop) {
+		/*
+		 * The download can take a very long time.
+		 * In the meantime, check with current polling time
+		 * if something on the server was changed and a cancel
+		 * was requested
+		 */
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += server_get_polling_interval();
+		while (!dwl_watch.stop &&
+		       pthread_cond_timedwait(&dwl_watch.cond, &dwl_watch.lock,
+					      &deadline) != ETIMEDOUT)
+			;
+		if (dwl_watch.stop)
+			break;
+		pthread_mutex_unlock(&dwl_watch.lock);
+
+		/*
+		 * We need a separate channel because we want to run
+		 * a connection parallel to the download. It is kept
+		 * open, so that the connection is reused by next polls.
+		 */
+		if (!channel) {
+			channel = channel_new();
+			if (channel && channel->open(channel, &channel_data_defaults) != CHANNEL_OK) {
+				/*
+				 * it is not possible to check for a cancelUpdate,
+				 * go on downloading and retry next time
+				 */
+				channel->close(channel);
+				free(channel);
+				channel = NULL;
+			}
+		}
+		stop_dwl = channel && server_dwl_must_stop(channel);
+
+		pthread_mutex_lock(&dwl_watch.lock);
+		if (stop_dwl) {
+			__atomic_store_n(&dwl_watch.abort_dwl, true, __ATOMIC_RELEASE);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dwl_watch.lock);
+
+	if (channel) {
+		channel->close(channel);
+		free(channel);
+	}
+
+	return NULL;
+}
+
+static void dwl_watch_start(void)
+{
+	pthread_condattr_t attr;
+
+	__atomic_store_n(&dwl_watch.abort_dwl, false, __ATOMIC_RELEASE);
+	dwl_watch.stop = false;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&dwl_watch.cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	dwl_watch.running = !pthread_create(&dwl_watch.thread, NULL,
+					    dwl_watch_thread, NULL);
+	if (!dwl_watch.running) {
+		WARN("Cannot start thread, cancel requests are not checked during download");
+		pthread_cond_destroy(&dwl_watch.cond);
+	}
+}
+
+static void dwl_watch_stop(void)
+{
+	if (!dwl_watch.running)
+		return;
+
+	pthread_mutex_lock(&dwl_watch.lock);
+	dwl_watch.stop = true;
+	pthread_cond_signal(&dwl_watch.cond);
+	pthread_mutex_unlock(&dwl_watch.lock);
+
+	if (pthread_join(dwl_watch.thread, NULL))
+		ERROR("return code from pthread_join()");
+	pthread_cond_destroy(&dwl_watch.cond);
+	dwl_watch.running = false;
 }
 
 static server_op_res_t server_has_pending_action(int *action_id)
@@ -1127,6 +1230,9 @@ server_op_res_t server_process_update_artifact(int action_id,
 		json_object *json_data_artifact_sha1hash =
 		    json_get_path_key(json_data_artifact_item,
 				      (const char *[]){"hashes", "sha1", NULL});
+		json_object *json_data_artifact_sha256hash =
+		    json_get_path_key(json_data_artifact_item,
+				      (const char *[]){"hashes", "sha256", NULL});
 		json_object *json_data_artifact_size = json_get_path_key(
 		    json_data_artifact_item, (const char *[]){"size", NULL});
 
@@ -1222,6 +1328,13 @@ server_op_res_t server_process_update_artifact(int action_id,
 
 		channel_data.dwlwrdata = server_check_during_dwl;
 
+		/*
+		 * The SHA-256 names the artifact on the peers, if any
+		 */
+		if (json_data_artifact_sha256hash)
+			channel_data.peer_key =
+			    strdup(json_object_get_string(json_data_artifact_sha256hash));
+
 		/*
 		 * There is no authorizytion token when file is loaded, because SWU
 		 * can be on a different server as hawkBit with a different
@@ -1237,14 +1350,6 @@ server_op_res_t server_process_update_artifact(int action_id,
 		if (server_hawkbit.cached_file)
 			channel_data.cached_file = server_hawkbit.cached_file;
 
-		/*
-		 * Retrieve current time to check download time
-		 * This is used in the callback to ask again the hawkBit
-		 * server if the download is longer as the polling time
-		 */
-
-		server_get_current_time(&server_time);
-
 		/*
 		 * Start background task to collect logs and
 		 * send to hawkBit server
@@ -1259,8 +1364,15 @@ server_op_res_t server_process_update_artifact(int action_id,
 		thread_ret = pthread_create(&notify_to_hawkbit_thread, &attr,
 				process_notification_thread, &action_id);
 
+		/*
+		 * Ask again the hawkBit server for a cancel or skip
+		 * if the download is longer as the polling time
+		 */
+		dwl_watch_start();
+
 		channel_op_res_t cresult =
 		    channel->get_file(channel, (void *)&channel_data);
+		dwl_watch_stop();
 		if ((result = map_channel_retcode(cresult)) != SERVER_OK) {
 			/* this is called to collect errors */
 			ipc_wait_for_complete(server_update_status_callback);
@@ -1313,6 +1425,7 @@ server_op_res_t server_process_update_artifact(int action_id,
 		if (channel_data.info != NULL) {
 			free(channel_data.info);
 		}
+		free(channel_data.peer_key);
 		if (result != SERVER_OK) {
 			break;
 		}
@@ -1334,6 +1447,7 @@ cleanup:
 static server_op_res_t server_install_update(void)
 {
 	int action_id;
+	bool cancelled;
 	channel_data_t channel_data = channel_data_defaults;
 	server_op_res_t result =
 	    server_get_deployment_info(server_hawkbit.channel, &channel_data, &action_id);
@@ -1352,10 +1466,12 @@ static server_op_res_t server_install_update(void)
 		goto cleanup;
 	}
 
+	pthread_mutex_lock(&dwl_watch.lock);
 	server_hawkbit.update_action = NULL;
+	pthread_mutex_unlock(&dwl_watch.lock);
 	const char *update_action = json_get_deployment_update_action(channel_data.json_reply);
 	check_action_changed(action_id, update_action);
-	if (server_hawkbit.update_action == deployment_update_action.skip) {
+	if (get_update_action() == deployment_update_action.skip) {
 		const char *details = "Skipped Update.";
 		if (server_send_deployment_reply(
 			server_hawkbit.channel,
@@ -1449,10 +1565,12 @@ static server_op_res_t server_install_update(void)
 		assert(json_object_get_type(json_data_chunk_artifacts) ==
 		       json_type_array);
 		/* reset flag, will be set if a cancel is detected */
+		pthread_mutex_lock(&dwl_watch.lock);
 		server_hawkbit.cancelDuringUpdate = false;
+		pthread_mutex_unlock(&dwl_watch.lock);
 		result =
 		    server_process_update_artifact(action_id, json_data_chunk_artifacts,
-				server_hawkbit.update_action,
+				get_update_action(),
 				json_object_get_string(json_data_chunk_part),
 				json_object_get_string(json_data_chunk_version),
 				json_object_get_string(json_data_chunk_name));
@@ -1460,7 +1578,10 @@ static server_op_res_t server_install_update(void)
 		if (result != SERVER_OK) {
 
 			/* Check if failed because it was cancelled */
-			if (server_hawkbit.cancelDuringUpdate) {
+			pthread_mutex_lock(&dwl_watch.lock);
+			cancelled = server_hawkbit.cancelDuringUpdate;
+			pthread_mutex_unlock(&dwl_watch.lock);
+			if (cancelled) {
 				TRACE("Acknowledging cancelled update.");
 				(void)server_send_cancel_reply(server_hawkbit.channel, action_id);
 				/* Inform the installer that a CANCEL was received */
@@ -11,8 +11,13 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <curl/curl.h>
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -51,6 +56,7 @@ extern channel_op_res_t channel_curl_init(void);
 typedef struct {
 	channel_data_t *channel_data;
 	channel_t *channel;
+	bool busy;	/* asynchronous operation in progress */
 } udchannel;
 
 
@@ -120,6 +126,27 @@ static int func_registry[SURICATTA_FUNC_LAST] = { SURICATTA_FUNC_NULL };
 static const char **ipc_journal = NULL;
 
 
+/*
+ * Progress messages collected while installation is in-flight.
+ * Subsequent PROGRESS messages for the same step replace each other
+ * while queued, so that the ring does not fill up on fast installs.
+ *
+ * @see progress_collector_thread()
+ * @see progress_offloader_thread()
+ * */
+#define PROGRESS_RING_SIZE 32
+#define PROGRESS_RECONNECT_MIN_MS 10
+#define PROGRESS_RECONNECT_MAX_MS 5000
+struct progress_ring_t {
+	struct progress_msg entries[PROGRESS_RING_SIZE];
+	struct progress_msg batch[PROGRESS_RING_SIZE];
+	unsigned int head;
+	unsigned int count;
+	unsigned int dropped;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
 /*
  * Data passed to the Lua callback function C wrappers
  * while installation is in-flight.
@@ -128,19 +155,14 @@ static const char **ipc_journal = NULL;
  * @see progress_offloader_thread()
  * @see progress_collector_thread()
  * */
-struct msgq_data_t {
-	struct progress_msg entry;
-	STAILQ_ENTRY(msgq_data_t) entries;
-};
-STAILQ_HEAD(messageq_head_t, msgq_data_t);
 typedef struct {
 	lua_State *L;
 	pthread_mutex_t *lua_lock;
 	pthread_t *thread_collector;
 	pthread_t *thread_offloader;
-	struct messageq_head_t progress_msgq;
-	pthread_mutex_t *progress_msgq_lock;
+	struct progress_ring_t *progress_ring;
 	bool drain_progress_msgq;
+	unsigned int progress_interval;
 	int lua_check_cancel_func;
 	int fdout;
 } callback_data_t;
@@ -664,101 +686,140 @@ static bool channel_set_header_options(lua_State *L, struct dict *headers,
 
 
 /**
- * @brief Helper function actually executing a channel operation.
+ * @brief Helper function setting up a channel operation.
  *
- * See lua_channel_get() and lua_channel_put() for Lua
- * parameter and return values.
+ * Pops the channel options Lua Table from the stack.
  *
- * @param L   The Lua state.
- * @param op  What channel operation to perform.
+ * @param L               The Lua state.
+ * @param udc             The channel.
+ * @param channel_data    Channel data to set up from channel defaults and options.
+ * @param header_send     HTTP headers to send.
+ * @param header_receive  Received HTTP headers.
  */
-static int channel_do_operation(lua_State *L, channel_method_t op)
+static void channel_setup_operation(lua_State *L, udchannel *udc,
+				    channel_data_t *channel_data,
+				    struct dict *header_send,
+				    struct dict *header_receive)
 {
-	luaL_checktype(L, -1, LUA_TTABLE);
-	udchannel *udc = (udchannel *)lua_touserdata(L, lua_upvalueindex(1));
-
-	if (!udc->channel) {
-		ERROR("Called GET/PUT channel operation on a closed channel.");
-		lua_pushnil(L);
-		lua_pushinteger(L, SERVER_EINIT);
-		lua_newtable(L);
-		return 3;
-	}
-
-	__attribute__((cleanup(channel_free_options))) channel_data_t channel_data = { 0 };
-	(void)memcpy(&channel_data, udc->channel_data, sizeof(*udc->channel_data));
-	channel_set_options(L, &channel_data);
+	(void)memcpy(channel_data, udc->channel_data, sizeof(*udc->channel_data));
+	channel_set_options(L, channel_data);
 
-	struct dict header_send;
-	LIST_INIT(&header_send);
+	LIST_INIT(header_send);
 	/* Set HTTP headers as specified while channel creation. */
 	if (udc->channel_data->headers_to_send) {
 		struct dict_entry *entry;
 		LIST_FOREACH(entry, udc->channel_data->headers_to_send, next) {
-			(void)dict_insert_value(&header_send,
+			(void)dict_insert_value(header_send,
 						dict_entry_get_key(entry),
 						dict_entry_get_value(entry));
 		}
 
 	}
 	/* Set HTTP headers as specified for this operation. */
-	(void)channel_set_header_options(L, &header_send, "headers_to_send");
-	channel_data.headers_to_send = &header_send;
+	(void)channel_set_header_options(L, header_send, "headers_to_send");
+	channel_data->headers_to_send = header_send;
 
 	/* Setup received HTTP headers dict. */
-	struct dict header_receive;
-	LIST_INIT(&header_receive);
-	channel_data.received_headers = &header_receive;
+	LIST_INIT(header_receive);
+	channel_data->received_headers = header_receive;
 
 	lua_pop(L, 1);
+}
 
-	/* Perform the operation. */
-	server_op_res_t result = map_channel_retcode(
-	    op == CHANNEL_GET
-		? udc->channel->get(udc->channel, (void *)&channel_data)
-		: udc->channel->put(udc->channel, (void *)&channel_data));
 
+/**
+ * @brief Helper function pushing a channel operation's result.
+ *
+ * See lua_channel_get() and lua_channel_put() for Lua return values.
+ *
+ * @param L             The Lua state.
+ * @param result        The operation's result.
+ * @param channel_data  The operation's channel data.
+ */
+static void channel_push_result(lua_State *L, server_op_res_t result,
+				channel_data_t *channel_data)
+{
 	/* Assemble result for passing back to the Lua realm. */
 	push_result(L, result);
 	lua_pushinteger(L, result);
 	lua_newtable(L);
-	push_to_table(L, "http_response_code", channel_data.http_response_code);
-	push_to_table(L, "format",             channel_data.format);
-	if (channel_data.format == CHANNEL_PARSE_JSON) {
+	push_to_table(L, "http_response_code", channel_data->http_response_code);
+	push_to_table(L, "format",             channel_data->format);
+	if (channel_data->format == CHANNEL_PARSE_JSON) {
 		lua_pushstring(L, "json_reply");
-		if (!channel_data.json_reply ||
-			!json_to_table(L, channel_data.json_reply)) {
+		if (!channel_data->json_reply ||
+			!json_to_table(L, channel_data->json_reply)) {
 			lua_pushnil(L);
 		}
 		lua_settable(L, -3);
 
-		if (channel_data.json_reply &&
-			json_object_put(channel_data.json_reply) != 1) {
+		if (channel_data->json_reply &&
+			json_object_put(channel_data->json_reply) != 1) {
 			ERROR("JSON object should be freed but was not.");
 		}
+		channel_data->json_reply = NULL;
 	}
-	if (channel_data.format == CHANNEL_PARSE_RAW) {
+	if (channel_data->format == CHANNEL_PARSE_RAW) {
 		lua_pushstring(L, "raw_reply");
-		if (!channel_data.raw_reply) {
+		if (!channel_data->raw_reply) {
 			lua_pushnil(L);
 		} else {
-			lua_pushstring(L, channel_data.raw_reply);
-			free(channel_data.raw_reply);
+			lua_pushstring(L, channel_data->raw_reply);
+			free(channel_data->raw_reply);
+			channel_data->raw_reply = NULL;
 		}
 		lua_settable(L, -3);
 	}
 
 	lua_pushstring(L, "received_headers");
 	lua_newtable(L);
-	if (!LIST_EMPTY(channel_data.received_headers)) {
+	if (!LIST_EMPTY(channel_data->received_headers)) {
 		struct dict_entry *entry;
-		LIST_FOREACH(entry, channel_data.received_headers, next) {
+		LIST_FOREACH(entry, channel_data->received_headers, next) {
 			lua_pushstring(L, dict_entry_get_key(entry));
 			lua_pushstring(L, dict_entry_get_value(entry));
 			lua_settable(L, -3);
 		}
 	}
 	lua_settable(L, -3);
+}
+
+
+/**
+ * @brief Helper function actually executing a channel operation.
+ *
+ * See lua_channel_get() and lua_channel_put() for Lua
+ * parameter and return values.
+ *
+ * @param L   The Lua state.
+ * @param op  What channel operation to perform.
+ */
+static int channel_do_operation(lua_State *L, channel_method_t op)
+{
+	luaL_checktype(L, -1, LUA_TTABLE);
+	udchannel *udc = (udchannel *)lua_touserdata(L, lua_upvalueindex(1));
+
+	if (!udc->channel || udc->busy) {
+		ERROR("Called GET/PUT channel operation on a %s channel.",
+		      udc->channel ? "busy" : "closed");
+		lua_pushnil(L);
+		lua_pushinteger(L, SERVER_EINIT);
+		lua_newtable(L);
+		return 3;
+	}
+
+	__attribute__((cleanup(channel_free_options))) channel_data_t channel_data = { 0 };
+	struct dict header_send;
+	struct dict header_receive;
+	channel_setup_operation(L, udc, &channel_data, &header_send, &header_receive);
+
+	/* Perform the operation. */
+	server_op_res_t result = map_channel_retcode(
+	    op == CHANNEL_GET
+		? udc->channel->get(udc->channel, (void *)&channel_data)
+		: udc->channel->put(udc->channel, (void *)&channel_data));
+
+	channel_push_result(L, result, &channel_data);
 	dict_drop_db(&header_send);
 	dict_drop_db(&header_receive);
 
@@ -794,6 +855,381 @@ static int lua_channel_put(lua_State *L)
 }
 
 
+/*
+ * Event loop running Lua coroutines ("tasks") which wait for
+ * asynchronous channel operations on a curl multi handle or
+ * for timers, see suricatta.async in suricatta/suricatta.lua.
+ */
+#define ASYNC_MAX_WAIT_MS 1000
+
+struct async_task {
+	lua_State *co;
+	int ref;		/* Registry reference anchoring the coroutine. */
+	int nargs;		/* Number of values passed on next resume. */
+	bool waiting;		/* Waiting for a transfer or timer. */
+	bool timer;
+	struct timespec wakeup;
+	LIST_ENTRY(async_task) next;
+};
+LIST_HEAD(async_tasklist, async_task);
+
+struct async_transfer {
+	struct async_task *task;
+	udchannel *udc;
+	channel_data_t channel_data;
+	struct dict header_send;
+	struct dict header_receive;
+};
+
+static struct {
+	CURLM *multi;
+	struct async_tasklist tasks;
+	unsigned int errors;
+} async_loop;
+
+#if LUA_VERSION_NUM >= 504
+#define lua_resume_task(co, from, nargs) ({ int _nres; lua_resume(co, from, nargs, &_nres); })
+#elif LUA_VERSION_NUM > 501
+#define lua_resume_task(co, from, nargs) lua_resume(co, from, nargs)
+#else
+#define lua_resume_task(co, from, nargs) lua_resume(co, nargs)
+#endif
+
+
+/**
+ * @brief Find the task running the coroutine.
+ *
+ * @param  L  The coroutine's Lua state.
+ * @return The task or NULL if L is not run by the event loop.
+ */
+static struct async_task *async_find_task(lua_State *L)
+{
+	struct async_task *task;
+
+	LIST_FOREACH(task, &async_loop.tasks, next) {
+		if (task->co == L) {
+			return task;
+		}
+	}
+	return NULL;
+}
+
+
+static void async_transfer_free(struct async_transfer *transfer)
+{
+	channel_free_options(&transfer->channel_data);
+	dict_drop_db(&transfer->header_send);
+	dict_drop_db(&transfer->header_receive);
+	free(transfer);
+}
+
+
+/**
+ * @brief Resume a task and remove it if it has finished.
+ *
+ * @param L     The Lua state running the event loop.
+ * @param task  The task to resume.
+ */
+static void async_resume(lua_State *L, struct async_task *task)
+{
+	int nargs = task->nargs;
+
+	task->nargs = 0;
+	switch (lua_resume_task(task->co, L, nargs)) {
+	case LUA_YIELD:
+		if (!task->waiting) {
+			/* Plain coroutine.yield(): resume in next loop iteration. */
+			lua_settop(task->co, 0);
+		}
+		return;
+	case LUA_OK:
+		break;
+	default:
+		ERROR("[Lua suricatta] Async task failed: %s",
+		      lua_tostring(task->co, -1));
+		async_loop.errors++;
+		break;
+	}
+	LIST_REMOVE(task, next);
+	luaL_unref(L, LUA_REGISTRYINDEX, task->ref);
+	free(task);
+}
+
+
+/**
+ * @brief Hand a finished transfer's result to the waiting task.
+ *
+ * @param transfer  The finished transfer.
+ * @param curlrc    The transfer's CURLcode.
+ */
+static void async_transfer_done(struct async_transfer *transfer, CURLcode curlrc)
+{
+	struct async_task *task = transfer->task;
+	server_op_res_t result = map_channel_retcode(
+	    channel_curl_finish(transfer->udc->channel, async_loop.multi, curlrc));
+
+	transfer->udc->busy = false;
+	channel_push_result(task->co, result, &transfer->channel_data);
+	task->nargs = 3;
+	task->waiting = false;
+	async_transfer_free(transfer);
+}
+
+
+static long async_ms_until(struct timespec *wakeup, struct timespec *now)
+{
+	return (wakeup->tv_sec - now->tv_sec) * 1000 +
+	       (wakeup->tv_nsec - now->tv_nsec) / 1000000;
+}
+
+
+/**
+ * @brief Run the tasks until all of them have finished.
+ *
+ * @param L  The Lua state running the event loop.
+ */
+static void async_run_loop(lua_State *L)
+{
+	struct async_task *task, *tmp;
+	struct timespec now;
+	CURLMsg *msg;
+	int running, pending;
+	long timeout;
+
+	while (!LIST_EMPTY(&async_loop.tasks)) {
+		LIST_FOREACH_SAFE(task, &async_loop.tasks, next, tmp) {
+			if (!task->waiting) {
+				async_resume(L, task);
+			}
+		}
+		if (LIST_EMPTY(&async_loop.tasks)) {
+			break;
+		}
+
+		(void)clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout = ASYNC_MAX_WAIT_MS;
+		LIST_FOREACH(task, &async_loop.tasks, next) {
+			if (!task->waiting) {
+				timeout = 0;
+				break;
+			}
+			if (task->timer) {
+				long ms = max(async_ms_until(&task->wakeup, &now), 0L);
+				timeout = min(timeout, ms);
+			}
+		}
+
+		#if LIBCURL_VERSION_NUM >= 0x074200
+		(void)curl_multi_poll(async_loop.multi, NULL, 0, (int)timeout, NULL);
+		#else
+		int numfds = 0;
+		(void)curl_multi_wait(async_loop.multi, NULL, 0, (int)timeout, &numfds);
+		if (numfds == 0 && timeout > 0) {
+			(void)usleep(min(timeout, 100L) * 1000);
+		}
+		#endif
+		(void)curl_multi_perform(async_loop.multi, &running);
+		while ((msg = curl_multi_info_read(async_loop.multi, &pending))) {
+			struct async_transfer *transfer = NULL;
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			CURLcode curlrc = msg->data.result;
+			(void)curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&transfer);
+			if (transfer) {
+				async_transfer_done(transfer, curlrc);
+			}
+		}
+
+		(void)clock_gettime(CLOCK_MONOTONIC, &now);
+		LIST_FOREACH(task, &async_loop.tasks, next) {
+			if (task->waiting && task->timer &&
+			    async_ms_until(&task->wakeup, &now) <= 0) {
+				task->timer = false;
+				task->waiting = false;
+			}
+		}
+	}
+}
+
+
+/**
+ * @brief Helper function starting an asynchronous channel operation.
+ *
+ * The calling task is suspended until the operation has finished.
+ *
+ * @param L   The Lua state of the calling task.
+ * @param op  What channel operation to perform.
+ */
+static int channel_do_async_operation(lua_State *L, channel_method_t op)
+{
+	luaL_checktype(L, -1, LUA_TTABLE);
+	udchannel *udc = (udchannel *)lua_touserdata(L, lua_upvalueindex(1));
+	struct async_task *task = async_find_task(L);
+
+	if (!task) {
+		return luaL_error(L, "Asynchronous channel operation outside of a suricatta.async task.");
+	}
+
+	struct async_transfer *transfer = NULL;
+	if (!udc->channel || udc->busy || !(transfer = calloc(1, sizeof(*transfer)))) {
+		ERROR("Cannot start asynchronous GET/PUT channel operation on %s channel.",
+		      !udc->channel ? "a closed" : udc->busy ? "a busy" : "the");
+		lua_pushnil(L);
+		lua_pushinteger(L, SERVER_EINIT);
+		lua_newtable(L);
+		return 3;
+	}
+	transfer->task = task;
+	transfer->udc = udc;
+	channel_setup_operation(L, udc, &transfer->channel_data,
+				&transfer->header_send, &transfer->header_receive);
+
+	channel_method_t method = op == CHANNEL_GET
+		? CHANNEL_GET : (channel_method_t)transfer->channel_data.method;
+	channel_op_res_t result = CHANNEL_EINIT;
+	if (op != CHANNEL_GET && method == CHANNEL_GET) {
+		TRACE("Channel method (POST, PUT, PATCH) is not set !");
+	} else {
+		result = channel_curl_start(udc->channel, &transfer->channel_data,
+					    method, async_loop.multi, transfer);
+	}
+	if (result != CHANNEL_OK) {
+		channel_push_result(L, map_channel_retcode(result), &transfer->channel_data);
+		async_transfer_free(transfer);
+		return 3;
+	}
+
+	udc->busy = true;
+	task->waiting = true;
+	return lua_yield(L, 0);
+}
+
+
+/**
+ * @brief GET from remote server without blocking other tasks.
+ *
+ * Must be called from a suricatta.async task.
+ *
+ * @see lua_channel_get() for parameter and return values.
+ */
+static int lua_channel_get_async(lua_State *L)
+{
+	return channel_do_async_operation(L, CHANNEL_GET);
+}
+
+
+/**
+ * @brief PUT to remote server without blocking other tasks.
+ *
+ * Must be called from a suricatta.async task.
+ *
+ * @see lua_channel_put() for parameter and return values.
+ */
+static int lua_channel_put_async(lua_State *L)
+{
+	return channel_do_async_operation(L, CHANNEL_PUT);
+}
+
+
+/**
+ * @brief Add a task to the event loop.
+ *
+ * @param  [Lua] Function to run as task.
+ * @param  [Lua] Parameters to pass to the function, if any.
+ * @return [Lua] True.
+ */
+static int lua_async_spawn(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	if (!async_loop.multi) {
+		return luaL_error(L, "suricatta.async.spawn() called outside of suricatta.async.run().");
+	}
+
+	struct async_task *task = calloc(1, sizeof(*task));
+	if (!task) {
+		return luaL_error(L, "Cannot allocate async task memory.");
+	}
+	int nargs = lua_gettop(L);
+	task->co = lua_newthread(L);
+	task->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_xmove(L, task->co, nargs);
+	task->nargs = nargs - 1;
+	LIST_INSERT_HEAD(&async_loop.tasks, task, next);
+
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+
+/**
+ * @brief Run a function as task in the event loop.
+ *
+ * Returns when this task and all tasks spawned in the meantime
+ * have finished.
+ *
+ * @param  [Lua] Function to run as task.
+ * @param  [Lua] Parameters to pass to the function, if any.
+ * @return [Lua] True, or, in case of a task raising an error, nil.
+ */
+static int lua_async_run(lua_State *L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	if (async_loop.multi) {
+		return luaL_error(L, "suricatta.async.run() is already running.");
+	}
+	if (!(async_loop.multi = curl_multi_init())) {
+		ERROR("Cannot initialize curl multi handle.");
+		lua_pushnil(L);
+		return 1;
+	}
+	LIST_INIT(&async_loop.tasks);
+	async_loop.errors = 0;
+
+	(void)lua_async_spawn(L);
+	lua_pop(L, 1);
+	async_run_loop(L);
+
+	(void)curl_multi_cleanup(async_loop.multi);
+	async_loop.multi = NULL;
+
+	async_loop.errors == 0 ? lua_pushboolean(L, true) : lua_pushnil(L);
+	return 1;
+}
+
+
+/**
+ * @brief Suspend the calling task without blocking other tasks.
+ *
+ * Must be called from a suricatta.async task.
+ *
+ * @param  [Lua] Number of seconds to sleep, fractions are allowed.
+ */
+static int lua_async_sleep(lua_State *L)
+{
+	struct async_task *task = async_find_task(L);
+	lua_Number seconds = luaL_checknumber(L, -1);
+
+	if (!task) {
+		return luaL_error(L, "suricatta.async.sleep() called outside of a suricatta.async task.");
+	}
+	if (seconds < 0) {
+		seconds = 0;
+	}
+	(void)clock_gettime(CLOCK_MONOTONIC, &task->wakeup);
+	task->wakeup.tv_sec += (time_t)seconds;
+	task->wakeup.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+	if (task->wakeup.tv_nsec >= 1000000000L) {
+		task->wakeup.tv_sec++;
+		task->wakeup.tv_nsec -= 1000000000L;
+	}
+	task->timer = true;
+	task->waiting = true;
+	lua_pop(L, 1);
+	return lua_yield(L, 0);
+}
+
+
 /**
  * @brief Get SWUpdate's temporary working directory.
  *
@@ -875,9 +1311,132 @@ static int ipc_wait_for_complete_cb(ipc_message *msg)
 }
 
 
+/**
+ * @brief Check whether a queued progress message can be replaced by a newer one.
+ *
+ * @param  queued   The progress message in the ring.
+ * @param  message  The new progress message.
+ * @return true if only the percentage(s) differ.
+ */
+static bool progress_msg_coalesce(struct progress_msg *queued, struct progress_msg *message)
+{
+	return queued->status == PROGRESS && message->status == PROGRESS &&
+	       queued->infolen == 0 && message->infolen == 0 &&
+	       queued->source == message->source &&
+	       queued->nsteps == message->nsteps &&
+	       queued->cur_step == message->cur_step &&
+	       (queued->dwl_percent < 100) == (message->dwl_percent < 100) &&
+	       strcmp(queued->cur_image, message->cur_image) == 0 &&
+	       strcmp(queued->hnd_name, message->hnd_name) == 0;
+}
+
+
+/**
+ * @brief Queue a progress message into the ring.
+ *
+ * If the ring is full, the oldest PROGRESS message without
+ * additional information is dropped, or the oldest message
+ * if there is none.
+ *
+ * @param  ring     The progress message ring.
+ * @param  message  The progress message to queue.
+ */
+static void progress_ring_put(struct progress_ring_t *ring, struct progress_msg *message)
+{
+	unsigned int i, idx;
+
+	(void)pthread_mutex_lock(&ring->lock);
+	if (ring->count > 0) {
+		idx = (ring->head + ring->count - 1) % PROGRESS_RING_SIZE;
+		if (progress_msg_coalesce(&ring->entries[idx], message)) {
+			(void)memcpy(&ring->entries[idx], message, sizeof(*message));
+			(void)pthread_mutex_unlock(&ring->lock);
+			return;
+		}
+	}
+	if (ring->count == PROGRESS_RING_SIZE) {
+		for (i = 0; i < ring->count; i++) {
+			idx = (ring->head + i) % PROGRESS_RING_SIZE;
+			if (ring->entries[idx].status == PROGRESS &&
+			    ring->entries[idx].infolen == 0)
+				break;
+		}
+		if (i == ring->count)
+			i = 0;
+		/* Close the gap moving the older messages forward. */
+		for (; i > 0; i--) {
+			(void)memcpy(&ring->entries[(ring->head + i) % PROGRESS_RING_SIZE],
+				     &ring->entries[(ring->head + i - 1) % PROGRESS_RING_SIZE],
+				     sizeof(*message));
+		}
+		ring->head = (ring->head + 1) % PROGRESS_RING_SIZE;
+		ring->count--;
+		ring->dropped++;
+	}
+	idx = (ring->head + ring->count) % PROGRESS_RING_SIZE;
+	(void)memcpy(&ring->entries[idx], message, sizeof(*message));
+	ring->count++;
+	(void)pthread_cond_signal(&ring->cond);
+	(void)pthread_mutex_unlock(&ring->lock);
+}
+
+
+/**
+ * @brief Cleanup handler for the progress messages offloader thread.
+ *
+ * Releases the ring's lock if cancelled while waiting for messages.
+ *
+ * @param lock  Pointer to the ring's mutex.
+ */
+static void progress_offloader_thread_cleanup(void *lock)
+{
+	(void)pthread_mutex_unlock((pthread_mutex_t *)lock);
+}
+
+
+/**
+ * @brief Push a progress message as Table on the Lua stack.
+ *
+ * @param L        The Lua state.
+ * @param message  The progress message.
+ */
+static void push_progress_msg(lua_State *L, struct progress_msg *message)
+{
+	lua_newtable(L);
+	push_to_table(L, "apiversion",  message->apiversion);
+	push_to_table(L, "status",      message->status);
+	push_to_table(L, "dwl_percent", message->dwl_percent);
+	push_to_table(L, "nsteps",      message->nsteps);
+	push_to_table(L, "cur_step",    message->cur_step);
+	push_to_table(L, "cur_percent", message->cur_percent);
+	push_to_table(L, "cur_image",   (char*)message->cur_image);
+	push_to_table(L, "hnd_name",    (char*)message->hnd_name);
+	push_to_table(L, "source",      message->source);
+	push_to_table(L, "info",        (char*)message->info);
+	if (message->infolen > 0) {
+		lua_pushstring(L, "jsoninfo");
+		struct json_object *json_root = json_tokener_parse(
+		    message->info);
+		if (!json_root ||
+		    !json_to_table(L, json_root)) {
+			lua_pushnil(L);
+		}
+		if (json_root && json_object_put(json_root) != 1) {
+			ERROR("Progress JSON object should be freed but was not.");
+		}
+		lua_settable(L, -3);
+	}
+}
+
+
 /**
  * @brief Thread offloading collected progress messages to the server.
  *
+ * The messages queued in the ring are taken as batch and handed to
+ * the Lua callback one after the other, holding the Lua state lock once
+ * per batch. If progress_interval is set, batches are delivered at most
+ * every progress_interval milliseconds.
+ *
  * Note: The "original" suricatta Lua state is suspended here in the
  * call to suricatta.{install,download}(), so that it's safe to reuse
  * the Lua state to report progress to the server, mutex'd with other
@@ -890,55 +1449,52 @@ static int ipc_wait_for_complete_cb(ipc_message *msg)
 static void *progress_offloader_thread(void *data)
 {
 	callback_data_t *thread_data = (callback_data_t *)data;
+	struct progress_ring_t *ring = thread_data->progress_ring;
+	unsigned int count, dropped, i;
 
 	while (true) {
-		(void)pthread_mutex_lock(thread_data->progress_msgq_lock);
-		if (STAILQ_EMPTY(&thread_data->progress_msgq)) {
-			(void)pthread_mutex_unlock(thread_data->progress_msgq_lock);
-			/* Accept cancellation on empty progress message queue. */
-			(void)pthread_testcancel();
-		} else {
-			(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
-			struct msgq_data_t *qitem = STAILQ_FIRST(
-			    &thread_data->progress_msgq);
-			struct progress_msg *message = &qitem->entry;
-
-			(void)pthread_mutex_lock(thread_data->lua_lock);
-			lua_newtable(thread_data->L);
-			push_to_table(thread_data->L, "apiversion",  message->apiversion);
-			push_to_table(thread_data->L, "status",      message->status);
-			push_to_table(thread_data->L, "dwl_percent", message->dwl_percent);
-			push_to_table(thread_data->L, "nsteps",      message->nsteps);
-			push_to_table(thread_data->L, "cur_step",    message->cur_step);
-			push_to_table(thread_data->L, "cur_percent", message->cur_percent);
-			push_to_table(thread_data->L, "cur_image",   (char*)message->cur_image);
-			push_to_table(thread_data->L, "hnd_name",    (char*)message->hnd_name);
-			push_to_table(thread_data->L, "source",      message->source);
-			push_to_table(thread_data->L, "info",        (char*)message->info);
-			if (message->infolen > 0) {
-				lua_pushstring(thread_data->L, "jsoninfo");
-				struct json_object *json_root = json_tokener_parse(
-				    message->info);
-				if (!json_root ||
-				    !json_to_table(thread_data->L, json_root)) {
-					lua_pushnil(thread_data->L);
-				}
-				if (json_root && json_object_put(json_root) != 1) {
-					ERROR("Progress JSON object should be freed but was not.");
-				}
-				lua_settable(thread_data->L, -3);
-			}
-			STAILQ_REMOVE_HEAD(&thread_data->progress_msgq, entries);
-			free(qitem);
-			(void)pthread_mutex_unlock(thread_data->progress_msgq_lock);
+		(void)pthread_mutex_lock(&ring->lock);
+		pthread_cleanup_push(progress_offloader_thread_cleanup, (void *)&ring->lock);
+		/* Accept cancellation on empty progress message ring. */
+		while (ring->count == 0) {
+			(void)pthread_cond_wait(&ring->cond, &ring->lock);
+		}
+		pthread_cleanup_pop(0);
+		(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		for (count = 0; ring->count > 0; count++) {
+			(void)memcpy(&ring->batch[count], &ring->entries[ring->head],
+				     sizeof(struct progress_msg));
+			ring->head = (ring->head + 1) % PROGRESS_RING_SIZE;
+			ring->count--;
+		}
+		dropped = ring->dropped;
+		ring->dropped = 0;
+		(void)pthread_mutex_unlock(&ring->lock);
+
+		if (dropped > 0) {
+			DEBUG("Dropped %u progress messages.", dropped);
+		}
+
+		(void)pthread_mutex_lock(thread_data->lua_lock);
+		for (i = 0; i < count; i++) {
+			push_progress_msg(thread_data->L, &ring->batch[i]);
 			(void)call_lua_func(thread_data->L, SURICATTA_FUNC_CALLBACK_PROGRESS, 1);
-			(void)pthread_mutex_unlock(thread_data->lua_lock);
-			(void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		}
+		(void)pthread_mutex_unlock(thread_data->lua_lock);
+		(void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 
-			if (thread_data->drain_progress_msgq == false) {
-				/* Accept cancellation if messages mustn't be flushed completely. */
-				(void)pthread_testcancel();
+		if (thread_data->drain_progress_msgq == false) {
+			/* Accept cancellation if messages mustn't be flushed completely. */
+			(void)pthread_testcancel();
+		}
+
+		if (thread_data->progress_interval > 0) {
+			/* Don't get cancelled while sleeping if messages must be flushed. */
+			if (thread_data->drain_progress_msgq == true) {
+				(void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 			}
+			(void)usleep(thread_data->progress_interval * 1000);
+			(void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 		}
 	}
 	return NULL;
@@ -959,6 +1515,45 @@ static void progress_collector_thread_cleanup(void *pfd)
 }
 
 
+/**
+ * @brief Connect to the progress interface.
+ *
+ * Attempts are spaced by an exponential backoff. A lost connection
+ * is logged once and so is the reconnection, not every attempt.
+ *
+ * @param pfd  Pointer to the progress file descriptor, set on return.
+ */
+static void progress_collector_connect(int *pfd)
+{
+	struct sockaddr_un servaddr = { .sun_family = AF_LOCAL };
+	unsigned int backoff_ms = PROGRESS_RECONNECT_MIN_MS;
+	bool retrying = false;
+
+	(void)strncpy(servaddr.sun_path, get_prog_socket(), sizeof(servaddr.sun_path) - 1);
+	while (true) {
+		*pfd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (*pfd >= 0 &&
+		    connect(*pfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) == 0) {
+			if (retrying) {
+				DEBUG("Connected to progress interface.");
+			}
+			return;
+		}
+		if (!retrying) {
+			DEBUG("Cannot connect to progress interface: %s, retrying.",
+			      strerror(errno));
+			retrying = true;
+		}
+		if (*pfd >= 0) {
+			(void)close(*pfd);
+			*pfd = -1;
+		}
+		(void)usleep(backoff_ms * 1000);
+		backoff_ms = min(backoff_ms * 2, PROGRESS_RECONNECT_MAX_MS);
+	}
+}
+
+
 /**
  * @brief Thread collecting progress messages for offload by another thread.
  *
@@ -976,10 +1571,7 @@ static void *progress_collector_thread(void *data)
 
 	while (true) {
 		if (progress_fd < 0) {
-			if ((progress_fd = progress_ipc_connect(true)) < 0) {
-				usleep(250000);
-				continue;
-			}
+			progress_collector_connect(&progress_fd);
 		}
 
 		if (progress_ipc_receive(&progress_fd, &message) <= 0) {
@@ -996,11 +1588,7 @@ static void *progress_collector_thread(void *data)
 		message.hnd_name[sizeof(message.hnd_name) - 1] = '\0';
 		message.cur_image[sizeof(message.cur_image) - 1] = '\0';
 
-		struct msgq_data_t *qentry = malloc(sizeof(struct msgq_data_t));
-		(void)memcpy(&qentry->entry, &message, sizeof(struct progress_msg));
-		(void)pthread_mutex_lock(thread_data->progress_msgq_lock);
-		STAILQ_INSERT_TAIL(&thread_data->progress_msgq, qentry, entries);
-		(void)pthread_mutex_unlock(thread_data->progress_msgq_lock);
+		progress_ring_put(thread_data->progress_ring, &message);
 	}
 
 	pthread_cleanup_pop(1);
@@ -1069,6 +1657,7 @@ static void do_install(lua_State *L, int fdout)
 	lua_pop(L, 3);
 	channel_set_options(L, &channel_data);
 	get_from_table(L, "drain_messages", callback_data.drain_progress_msgq);
+	get_from_table(L, "progress_interval", callback_data.progress_interval);
 	lua_pop(L, 1);
 
 	channel_data.noipc = fdout == -1 ? false : true;
@@ -1092,22 +1681,26 @@ static void do_install(lua_State *L, int fdout)
 	}
 
 	/* Setup progress message handling threads and Lua callback function. */
-	pthread_mutex_t _progress_msgq_lock;
 	pthread_t _thread_progress_collector;
 	pthread_t _thread_progress_offloader;
 	if (push_registered_lua_func(L, SURICATTA_FUNC_CALLBACK_PROGRESS)) {
 		lua_pop(L, 1);
 
-		/* Initialize progress messages (tail) queue. */
-		STAILQ_INIT(&callback_data.progress_msgq);
-
-		/* Initialize progress messages (tail) queue synchronization mutex. */
-		if (pthread_mutex_init(&_progress_msgq_lock, NULL)) {
-			ERROR("Error creating progress message queue mutex.");
+		/* Allocate progress messages ring once for the whole operation. */
+		struct progress_ring_t *ring = calloc(1, sizeof(*ring));
+		if (!ring) {
+			ERROR("Error allocating progress message ring.");
+			lua_pop(L, 1);
+			goto error;
+		}
+		if (pthread_mutex_init(&ring->lock, NULL) ||
+		    pthread_cond_init(&ring->cond, NULL)) {
+			ERROR("Error creating progress message ring synchronization.");
+			free(ring);
 			lua_pop(L, 1);
 			goto error;
 		}
-		callback_data.progress_msgq_lock = &_progress_msgq_lock;
+		callback_data.progress_ring = ring;
 
 		/* Spawn threads handling progress notification to server. */
 		if ((pthread_create(&_thread_progress_collector, NULL,
@@ -1134,13 +1727,6 @@ static void do_install(lua_State *L, int fdout)
 	if (callback_data.thread_collector && callback_data.thread_offloader) {
 		join_progress_threads(callback_data.thread_offloader, "progress_offloader");
 		join_progress_threads(callback_data.thread_collector, "progress_collector");
-
-		while (!STAILQ_EMPTY(&callback_data.progress_msgq)) {
-			struct msgq_data_t *entry = STAILQ_FIRST(
-			    &callback_data.progress_msgq);
-			STAILQ_REMOVE_HEAD(&callback_data.progress_msgq, entries);
-			free(entry);
-		}
 	}
 
 	if (result == SERVER_OK) {
@@ -1166,10 +1752,12 @@ error:
 	lua_pushinteger(L, SERVER_EINIT);
 	lua_newtable(L);
 done:
-	if (callback_data.progress_msgq_lock) {
-		if (pthread_mutex_destroy(callback_data.progress_msgq_lock) != 0) {
-			ERROR("Mutex deallocation for progress message queue failed!");
+	if (callback_data.progress_ring) {
+		if (pthread_mutex_destroy(&callback_data.progress_ring->lock) != 0) {
+			ERROR("Mutex deallocation for progress message ring failed!");
 		}
+		(void)pthread_cond_destroy(&callback_data.progress_ring->cond);
+		free(callback_data.progress_ring);
 	}
 	if (callback_data.lua_lock) {
 		if (pthread_mutex_destroy(callback_data.lua_lock) != 0) {
@@ -1286,6 +1874,10 @@ static int lua_channel_close(lua_State *L)
 	if (!udc->channel && !udc->channel_data) {
 		ERROR("Called CLOSE operation on a closed channel.");
 	}
+	if (udc->busy) {
+		ERROR("Called CLOSE operation on a channel with operation in progress.");
+		return 0;
+	}
 	do_channel_close(udc->channel, udc->channel_data);
 	return 0;
 }
@@ -1328,9 +1920,11 @@ static int lua_channel_open(lua_State *L)
 	lua_pop(L, 1);
 
 	luaL_Reg lua_funcs_channel[] = {
-		{ "get",   lua_channel_get   },
-		{ "put",   lua_channel_put   },
-		{ "close", lua_channel_close },
+		{ "get",       lua_channel_get       },
+		{ "put",       lua_channel_put       },
+		{ "get_async", lua_channel_get_async },
+		{ "put_async", lua_channel_put_async },
+		{ "close",     lua_channel_close     },
 		{ NULL, NULL }
 	};
 
@@ -1356,6 +1950,7 @@ static int lua_channel_open(lua_State *L)
 	udchannel *udc = lua_newuserdata(L, sizeof(udchannel));
 	udc->channel = channel;
 	udc->channel_data = channel_data;
+	udc->busy = false;
 	lua_pushvalue(L, -1);
 	lua_insert(L, -3);
 	luaL_setfuncs(L, lua_funcs_channel, 1);
@@ -1537,6 +2132,17 @@ static int suricatta_lua_module(lua_State *L)
 	#undef MAP
 	lua_settable(L, -3);
 
+	luaL_Reg lua_funcs_async[] = {
+		{ "run",   lua_async_run   },
+		{ "spawn", lua_async_spawn },
+		{ "sleep", lua_async_sleep },
+		{ NULL, NULL }
+	};
+	lua_pushstring(L, "async");
+	lua_newtable(L);
+	luaL_setfuncs(L, lua_funcs_async, 0);
+	lua_settable(L, -3);
+
 	luaL_Reg lua_funcs_bootloader[] = {
 		{ "is",  lua_bootloader_is  },
 		{ "get", lua_bootloader_get },
@@ -1575,6 +2181,7 @@ static int suricatta_lua_module(lua_State *L)
 	push_to_table(L, "SOURCE_DOWNLOADER", SOURCE_DOWNLOADER);
 	push_to_table(L, "SOURCE_LOCAL", SOURCE_LOCAL);
 	push_to_table(L, "SOURCE_CHUNKS_DOWNLOADER", SOURCE_CHUNKS_DOWNLOADER);
+	push_to_table(L, "SOURCE_MULTICAST", SOURCE_MULTICAST);
 	lua_settable(L, -3);
 	lua_pushstring(L, "RECOVERY_STATUS");
 	lua_newtable(L);
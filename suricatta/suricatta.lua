@@ -192,6 +192,8 @@ suricatta.server.register = function(function_p, purpose) end
 --- @field options  suricatta.channel.options                                                                               Channel creation-time set options as in `include/channel_curl.h`.
 --- @field get      fun(options: suricatta.channel.options): boolean, suricatta.status, suricatta.channel_operation_result  Channel get operation
 --- @field put      fun(options: suricatta.channel.options): boolean, suricatta.status, suricatta.channel_operation_result  Channel put operation
+--- @field get_async fun(options: suricatta.channel.options): boolean, suricatta.status, suricatta.channel_operation_result Channel get operation suspending the calling `suricatta.async` task
+--- @field put_async fun(options: suricatta.channel.options): boolean, suricatta.status, suricatta.channel_operation_result Channel put operation suspending the calling `suricatta.async` task
 --- @field close    fun()                                                                                                   Channel close operation
 
 --- @class suricatta.channel
@@ -269,6 +271,7 @@ suricatta.channel = {
 --- @class suricatta.operation_channel
 --- @field channel          suricatta.open_channel           Channel table as returned by `suricatta.channel.open()`
 --- @field drain_messages   boolean  | nil                   Whether to flush all progress messages or only those while in-flight operation (default)
+--- @field progress_interval number | nil                    Minimum interval in milliseconds between progress message batches (default: 0)
 --- @field ∈                suricatta.channel.options | nil  Channel options to override for this operation
 
 --- Install an update artifact from remote server or local file.
@@ -308,6 +311,35 @@ suricatta.download = function(download_channel, localpath) end
 suricatta.sleep = function(seconds) end
 
 
+--- Single-threaded event loop running Lua coroutines ("tasks").
+--
+-- Tasks may call a channel's `get_async()` and `put_async()` functions
+-- which suspend the calling task until the request has finished while
+-- the other tasks continue to run. One request at a time per channel.
+--
+--- @class suricatta.async
+suricatta.async = {}
+
+--- Run a function as task until it and all spawned tasks have finished.
+--
+--- @param  fn  function  # Function to run as task
+--- @param  ... any       # Parameters passed to `fn`
+--- @return boolean | nil # `true`, or, if a task raised an error, `nil`
+suricatta.async.run = function(fn, ...) end
+
+--- Add a task to the running event loop.
+--
+--- @param  fn  function  # Function to run as task
+--- @param  ... any       # Parameters passed to `fn`
+--- @return boolean       # `true`
+suricatta.async.spawn = function(fn, ...) end
+
+--- Suspend the calling task for a number of seconds.
+--
+--- @param seconds number  # Number of seconds to sleep, fractions allowed
+suricatta.async.sleep = function(seconds) end
+
+
 --- Get TMPDIR from SWUpdate.
 --
 -- @see `core/util.c` :: get_tmpdir()
@@ -342,7 +374,8 @@ suricatta.ipc.sourcetype = {
     SOURCE_SURICATTA         = 2,
     SOURCE_DOWNLOADER        = 3,
     SOURCE_LOCAL             = 4,
-    SOURCE_CHUNKS_DOWNLOADER = 5
+    SOURCE_CHUNKS_DOWNLOADER = 5,
+    SOURCE_MULTICAST         = 6
 }
 
 --- @enum suricatta.ipc.RECOVERY_STATUS
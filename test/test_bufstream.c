@@ -0,0 +1,207 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "util.h"
+#include "bufstream.h"
+
+#define STREAM_SIZE	(1024 * 1024 + 7)
+
+static unsigned char pattern(size_t i)
+{
+	return (i * 31 + (i >> 8)) & 0xff;
+}
+
+static void fill(unsigned char *buf, size_t pos, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		buf[i] = pattern(pos + i);
+}
+
+static void check(const unsigned char *buf, size_t pos, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		if (buf[i] != pattern(pos + i))
+			fail();
+}
+
+static void test_bufstream_new(void **state)
+{
+	(void)state;
+	assert_null(bufstream_new(0, 100));
+	assert_null(bufstream_new(4, 0));
+}
+
+/* Reads return at most the rest of the current slot */
+static void test_bufstream_short_read(void **state)
+{
+	struct bufstream *s = bufstream_new(3, 100);
+	unsigned char buf[300];
+	const void *data;
+
+	(void)state;
+	assert_non_null(s);
+	fill(buf, 0, 250);
+	assert_int_equal(bufstream_write(s, buf, 250), 0);
+
+	assert_int_equal(bufstream_read(s, buf, 70), 70);
+	check(buf, 0, 70);
+	assert_int_equal(bufstream_read(s, buf, 70), 30);
+	check(buf, 70, 30);
+	assert_int_equal(bufstream_peek(s, &data), 100);
+	check(data, 100, 100);
+	bufstream_consume(s, 40);
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 60);
+	check(buf, 140, 60);
+
+	/* the last 50 bytes are not passed until the slot is full or closed */
+	bufstream_close(s);
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 50);
+	check(buf, 200, 50);
+	bufstream_free(s);
+}
+
+/* The producer reuses the slots released by the consumer */
+static void test_bufstream_wrap(void **state)
+{
+	struct bufstream *s = bufstream_new(3, 100);
+	unsigned char buf[100];
+	size_t wpos = 0, rpos = 0, size;
+	void *wbuf;
+
+	(void)state;
+	assert_non_null(s);
+	for (unsigned int round = 0; round < 10; round++) {
+		/* fill all free slots */
+		for (unsigned int i = 0; i < (round ? 2 : 3); i++) {
+			wbuf = bufstream_get_wbuf(s, &size);
+			assert_non_null(wbuf);
+			assert_int_equal(size, 100);
+			fill(wbuf, wpos, 60);
+			assert_int_equal(bufstream_commit(s, 60), 0);
+			wbuf = bufstream_get_wbuf(s, &size);
+			assert_int_equal(size, 40);
+			fill(wbuf, wpos + 60, 40);
+			assert_int_equal(bufstream_commit(s, 40), 0);
+			wpos += 100;
+		}
+		/* release two slots */
+		for (unsigned int i = 0; i < 2; i++) {
+			assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 100);
+			check(buf, rpos, 100);
+			rpos += 100;
+		}
+	}
+	bufstream_close(s);
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 100);
+	check(buf, rpos, 100);
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 0);
+	bufstream_free(s);
+}
+
+static void test_bufstream_eof(void **state)
+{
+	struct bufstream *s = bufstream_new(2, 100);
+	unsigned char buf[100];
+	size_t size;
+
+	(void)state;
+	assert_non_null(s);
+
+	/* end of data on a slot boundary */
+	fill(buf, 0, 100);
+	assert_int_equal(bufstream_write(s, buf, 100), 0);
+	bufstream_close(s);
+	assert_null(bufstream_get_wbuf(s, &size));
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 100);
+	check(buf, 0, 100);
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 0);
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 0);
+	bufstream_free(s);
+
+	/* no data at all */
+	s = bufstream_new(2, 100);
+	assert_non_null(s);
+	bufstream_close(s);
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), 0);
+	bufstream_free(s);
+}
+
+static void test_bufstream_abort(void **state)
+{
+	struct bufstream *s = bufstream_new(2, 100);
+	unsigned char buf[150] = { 0 };
+
+	(void)state;
+	assert_non_null(s);
+	assert_int_equal(bufstream_write(s, buf, 150), 0);
+	bufstream_abort(s);
+	assert_int_equal(bufstream_read(s, buf, sizeof(buf)), -EPIPE);
+	assert_int_equal(bufstream_write(s, buf, 10), -EPIPE);
+	bufstream_free(s);
+}
+
+static void *producer(void *data)
+{
+	struct bufstream *s = data;
+	unsigned char buf[1500];
+	size_t pos, n;
+
+	for (pos = 0; pos < STREAM_SIZE; pos += n) {
+		n = min_t(size_t, 1 + pos % sizeof(buf), STREAM_SIZE - pos);
+		fill(buf, pos, n);
+		if (bufstream_write(s, buf, n))
+			return (void *)-1;
+	}
+	bufstream_close(s);
+
+	return NULL;
+}
+
+/* Producer and consumer in different threads, the ring wraps many times */
+static void test_bufstream_threads(void **state)
+{
+	struct bufstream *s = bufstream_new(4, 1000);
+	unsigned char buf[777];
+	pthread_t thread;
+	size_t pos = 0;
+	void *res;
+	ssize_t n;
+
+	(void)state;
+	assert_non_null(s);
+	assert_int_equal(pthread_create(&thread, NULL, producer, s), 0);
+	while ((n = bufstream_read(s, buf, 1 + pos % sizeof(buf))) > 0) {
+		check(buf, pos, n);
+		pos += n;
+	}
+	assert_int_equal(pthread_join(thread, &res), 0);
+	assert_null(res);
+	assert_int_equal(n, 0);
+	assert_int_equal(pos, STREAM_SIZE);
+	bufstream_free(s);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest bufstream_tests[] = {
+		cmocka_unit_test(test_bufstream_new),
+		cmocka_unit_test(test_bufstream_short_read),
+		cmocka_unit_test(test_bufstream_wrap),
+		cmocka_unit_test(test_bufstream_eof),
+		cmocka_unit_test(test_bufstream_abort),
+		cmocka_unit_test(test_bufstream_threads),
+	};
+	error_count += cmocka_run_group_tests_name("bufstream", bufstream_tests,
+						   NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,247 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "util.h"
+#include "sslapi.h"
+#include "../handlers/chunk_store.h"
+
+#define CHUNK_SIZE	1000
+#define NCHUNKS		4
+
+static char dir[] = "/tmp/chunks-XXXXXX";
+static unsigned char chunks[NCHUNKS][CHUNK_SIZE];
+static char digests[NCHUNKS][SHA256_HASH_LENGTH * 2 + 1];
+
+static void set_chunk(unsigned int n)
+{
+	unsigned char md[SHA256_HASH_LENGTH];
+	struct swupdate_digest *dgst;
+	unsigned int mdlen;
+
+	for (unsigned int i = 0; i < CHUNK_SIZE; i++)
+		chunks[n][i] = (i * 7 + n * 101) & 0xff;
+	dgst = swupdate_HASH_init(SHA_DEFAULT);
+	assert_non_null(dgst);
+	assert_int_equal(swupdate_HASH_update(dgst, chunks[n], CHUNK_SIZE), 0);
+	assert_int_equal(swupdate_HASH_final(dgst, md, &mdlen), 1);
+	swupdate_HASH_cleanup(dgst);
+	for (unsigned int i = 0; i < SHA256_HASH_LENGTH; i++)
+		sprintf(digests[n] + i * 2, "%02x", md[i]);
+}
+
+static bool in_dir(unsigned int n)
+{
+	char path[sizeof(dir) + sizeof(digests[0]) + 1];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, digests[n]);
+	return !stat(path, &st);
+}
+
+/* Mark a chunk as last used at the given time */
+static void set_used(unsigned int n, time_t t)
+{
+	char path[sizeof(dir) + sizeof(digests[0]) + 1];
+	struct timespec times[2] = { { .tv_sec = t }, { .tv_sec = t } };
+
+	snprintf(path, sizeof(path), "%s/%s", dir, digests[n]);
+	assert_int_equal(utimensat(AT_FDCWD, path, times, 0), 0);
+}
+
+static unsigned int count_files(void)
+{
+	unsigned int count = 0;
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	assert_non_null(d);
+	while ((de = readdir(d)))
+		if (de->d_name[0] != '.')
+			count++;
+	closedir(d);
+
+	return count;
+}
+
+static int setup(void **state)
+{
+	(void)state;
+	strcpy(dir, "/tmp/chunks-XXXXXX");
+	if (!mkdtemp(dir))
+		return -1;
+	for (unsigned int i = 0; i < NCHUNKS; i++)
+		set_chunk(i);
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	char path[sizeof(dir) + sizeof(digests[0]) + 8];
+	struct dirent *de;
+	DIR *d = opendir(dir);
+
+	(void)state;
+	while (d && (de = readdir(d))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		unlink(path);
+	}
+	if (d)
+		closedir(d);
+	rmdir(dir);
+
+	return 0;
+}
+
+static void test_chunk_store_add_lookup(void **state)
+{
+	struct chunk_store *cs;
+	unsigned char buf[CHUNK_SIZE + 1];
+	int fd;
+
+	(void)state;
+	cs = chunk_store_open(dir, 100 * CHUNK_SIZE);
+	assert_non_null(cs);
+	assert_false(chunk_store_lookup(cs, digests[0], CHUNK_SIZE));
+	assert_int_equal(chunk_store_open_chunk(cs, digests[0]), -1);
+	assert_int_equal(chunk_store_add(cs, digests[0], chunks[0], CHUNK_SIZE), 0);
+	assert_int_equal(chunk_store_add(cs, digests[1], chunks[1], CHUNK_SIZE), 0);
+	/* adding it again is a no-op */
+	assert_int_equal(chunk_store_add(cs, digests[0], chunks[0], CHUNK_SIZE), 0);
+	assert_true(chunk_store_lookup(cs, digests[0], CHUNK_SIZE));
+	assert_false(chunk_store_lookup(cs, digests[2], CHUNK_SIZE));
+	chunk_store_close(cs);
+	assert_int_equal(count_files(), 2);
+
+	/* the chunks are found again after reopening */
+	cs = chunk_store_open(dir, 100 * CHUNK_SIZE);
+	assert_non_null(cs);
+	assert_true(chunk_store_lookup(cs, digests[1], CHUNK_SIZE));
+	fd = chunk_store_open_chunk(cs, digests[1]);
+	assert_true(fd >= 0);
+	assert_int_equal(read(fd, buf, sizeof(buf)), CHUNK_SIZE);
+	assert_memory_equal(buf, chunks[1], CHUNK_SIZE);
+	close(fd);
+	chunk_store_close(cs);
+}
+
+/* The least recently used chunks are evicted, not the ones in use */
+static void test_chunk_store_eviction(void **state)
+{
+	struct chunk_store *cs;
+
+	(void)state;
+	cs = chunk_store_open(dir, 3 * CHUNK_SIZE);
+	assert_non_null(cs);
+	for (unsigned int i = 0; i < 3; i++)
+		assert_int_equal(chunk_store_add(cs, digests[i], chunks[i], CHUNK_SIZE), 0);
+	chunk_store_close(cs);
+	set_used(0, 1000);
+	set_used(1, 2000);
+	set_used(2, 3000);
+
+	cs = chunk_store_open(dir, 3 * CHUNK_SIZE);
+	assert_non_null(cs);
+	/* chunk 0 is the oldest, but it is used now */
+	assert_true(chunk_store_lookup(cs, digests[0], CHUNK_SIZE));
+	assert_int_equal(chunk_store_add(cs, digests[3], chunks[3], CHUNK_SIZE), 0);
+	assert_true(in_dir(0));
+	assert_false(in_dir(1));
+	assert_true(in_dir(2));
+	assert_true(in_dir(3));
+	assert_false(chunk_store_lookup(cs, digests[1], CHUNK_SIZE));
+
+	/* a chunk larger than the budget is not stored */
+	assert_int_equal(chunk_store_add(cs, digests[1], chunks[1], 4 * CHUNK_SIZE), 0);
+	assert_false(in_dir(1));
+	chunk_store_close(cs);
+	assert_int_equal(count_files(), 3);
+
+	/* a reduced budget evicts at open, the most recently used are kept */
+	set_used(0, 1000);
+	set_used(2, 3000);
+	set_used(3, 2000);
+	cs = chunk_store_open(dir, 2 * CHUNK_SIZE);
+	assert_non_null(cs);
+	assert_int_equal(count_files(), 2);
+	assert_false(in_dir(0));
+	assert_true(in_dir(2));
+	assert_true(in_dir(3));
+	chunk_store_close(cs);
+}
+
+/* A chunk whose data do not match its name is dropped */
+static void test_chunk_store_bad_digest(void **state)
+{
+	char path[sizeof(dir) + sizeof(digests[0]) + 1];
+	struct chunk_store *cs;
+	int fd;
+
+	(void)state;
+	cs = chunk_store_open(dir, 100 * CHUNK_SIZE);
+	assert_non_null(cs);
+	assert_int_equal(chunk_store_add(cs, digests[0], chunks[0], CHUNK_SIZE), 0);
+	assert_int_equal(chunk_store_add(cs, digests[1], chunks[1], CHUNK_SIZE), 0);
+	chunk_store_close(cs);
+
+	/* corrupt chunk 0, and store chunk 2 under the name of chunk 1 */
+	snprintf(path, sizeof(path), "%s/%s", dir, digests[0]);
+	fd = open(path, O_WRONLY);
+	assert_true(fd >= 0);
+	assert_int_equal(pwrite(fd, "x", 1, CHUNK_SIZE / 2), 1);
+	close(fd);
+	snprintf(path, sizeof(path), "%s/%s", dir, digests[1]);
+	fd = open(path, O_WRONLY | O_TRUNC);
+	assert_true(fd >= 0);
+	assert_int_equal(write(fd, chunks[2], CHUNK_SIZE), CHUNK_SIZE);
+	close(fd);
+
+	cs = chunk_store_open(dir, 100 * CHUNK_SIZE);
+	assert_non_null(cs);
+	assert_false(chunk_store_lookup(cs, digests[0], CHUNK_SIZE));
+	assert_false(in_dir(0));
+	assert_false(chunk_store_lookup(cs, digests[1], CHUNK_SIZE));
+	assert_false(in_dir(1));
+	assert_int_equal(chunk_store_open_chunk(cs, digests[1]), -1);
+
+	/* a size different from the expected one is also a damaged chunk */
+	assert_int_equal(chunk_store_add(cs, digests[2], chunks[2], CHUNK_SIZE), 0);
+	assert_false(chunk_store_lookup(cs, digests[2], CHUNK_SIZE - 1));
+	assert_false(in_dir(2));
+
+	/* names that are not a SHA-256 are refused */
+	assert_int_equal(chunk_store_add(cs, "1234", chunks[0], CHUNK_SIZE), -EINVAL);
+	digests[3][0] = 'X';
+	assert_int_equal(chunk_store_add(cs, digests[3], chunks[3], CHUNK_SIZE), -EINVAL);
+	assert_false(chunk_store_lookup(cs, digests[3], CHUNK_SIZE));
+	chunk_store_close(cs);
+	assert_int_equal(count_files(), 0);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest chunk_store_tests[] = {
+		cmocka_unit_test_setup_teardown(test_chunk_store_add_lookup, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_chunk_store_eviction, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_chunk_store_bad_digest, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("chunk_store", chunk_store_tests,
+						   NULL, NULL);
+	return error_count;
+}
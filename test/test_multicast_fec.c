@@ -0,0 +1,223 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "util.h"
+#include "multicast.h"
+
+#define BLOCK_SIZE	100
+
+/* Reproducible pseudo random numbers */
+static unsigned int seed;
+
+static unsigned int rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 16;
+}
+
+struct group {
+	unsigned int k;
+	unsigned int r;
+	unsigned char *blocks[FEC_MAX_BLOCKS];
+	unsigned char *orig[FEC_MAX_BLOCKS];
+	bool present[FEC_MAX_BLOCKS];
+};
+
+static void group_init(struct group *g, unsigned int k, unsigned int r)
+{
+	g->k = k;
+	g->r = r;
+	for (unsigned int i = 0; i < k + r; i++) {
+		g->blocks[i] = malloc(BLOCK_SIZE);
+		g->orig[i] = malloc(BLOCK_SIZE);
+		assert_non_null(g->blocks[i]);
+		assert_non_null(g->orig[i]);
+		g->present[i] = true;
+	}
+	for (unsigned int i = 0; i < k; i++)
+		for (unsigned int n = 0; n < BLOCK_SIZE; n++)
+			g->blocks[i][n] = rnd();
+	fec_encode(k, r, g->blocks, &g->blocks[k], BLOCK_SIZE);
+	for (unsigned int i = 0; i < k + r; i++)
+		memcpy(g->orig[i], g->blocks[i], BLOCK_SIZE);
+}
+
+static void group_free(struct group *g)
+{
+	for (unsigned int i = 0; i < g->k + g->r; i++) {
+		free(g->blocks[i]);
+		free(g->orig[i]);
+	}
+}
+
+static void erase(struct group *g, unsigned int i)
+{
+	g->present[i] = false;
+	memset(g->blocks[i], 0xa5, BLOCK_SIZE);
+}
+
+static void check_data(struct group *g)
+{
+	for (unsigned int i = 0; i < g->k; i++)
+		assert_memory_equal(g->blocks[i], g->orig[i], BLOCK_SIZE);
+}
+
+/* Without erasure, the data blocks are left as they are */
+static void test_fec_no_erasure(void **state)
+{
+	struct group g;
+
+	(void)state;
+	seed = 1;
+	group_init(&g, 32, 8);
+	assert_int_equal(fec_decode(g.k, g.r, g.blocks, g.present, BLOCK_SIZE), 0);
+	check_data(&g);
+	group_free(&g);
+}
+
+/* Any k blocks out of k + r rebuild the data */
+static void test_fec_erasures(void **state)
+{
+	static const unsigned int geometry[][2] = {
+		{ 1, 1 }, { 5, 3 }, { 17, 2 }, { 32, 8 }, { 8, 32 }, { 200, 55 },
+	};
+
+	(void)state;
+	seed = 2;
+	for (unsigned int c = 0; c < ARRAY_SIZE(geometry); c++) {
+		for (unsigned int it = 0; it < 20; it++) {
+			struct group g;
+			unsigned int lost = 0, x;
+
+			group_init(&g, geometry[c][0], geometry[c][1]);
+			/* from no loss up to r losses */
+			while (lost < it % (g.r + 1)) {
+				x = rnd() % (g.k + g.r);
+				if (g.present[x]) {
+					erase(&g, x);
+					lost++;
+				}
+			}
+			assert_int_equal(fec_decode(g.k, g.r, g.blocks, g.present,
+						    BLOCK_SIZE), 0);
+			check_data(&g);
+			group_free(&g);
+		}
+	}
+}
+
+/* The first r data blocks lost, only the parity blocks replace them */
+static void test_fec_data_lost(void **state)
+{
+	struct group g;
+
+	(void)state;
+	seed = 3;
+	group_init(&g, 8, 8);
+	for (unsigned int i = 0; i < 8; i++)
+		erase(&g, i);
+	assert_int_equal(fec_decode(g.k, g.r, g.blocks, g.present, BLOCK_SIZE), 0);
+	check_data(&g);
+	group_free(&g);
+}
+
+static void test_fec_too_many_erasures(void **state)
+{
+	struct group g;
+
+	(void)state;
+	seed = 4;
+	group_init(&g, 32, 8);
+	for (unsigned int i = 0; i < 9; i++)
+		erase(&g, i * 4);
+	assert_int_equal(fec_decode(g.k, g.r, g.blocks, g.present, BLOCK_SIZE), -1);
+	group_free(&g);
+}
+
+/*
+ * Loopback of a file through the sender's split into groups and a
+ * lossy network: the groups are rebuilt from what got through.
+ */
+static void test_fec_loopback(void **state)
+{
+	const unsigned int k = MCAST_DEFAULT_K, r = MCAST_DEFAULT_R;
+	const uint64_t size = 100 * 1000 + 33;
+	unsigned char *file, *out;
+	uint32_t groups;
+
+	(void)state;
+	seed = 5;
+	file = malloc(size);
+	out = calloc(1, size);
+	assert_non_null(file);
+	assert_non_null(out);
+	for (uint64_t i = 0; i < size; i++)
+		file[i] = rnd();
+
+	groups = mcast_groups(size, BLOCK_SIZE, k);
+	assert_int_equal(groups, (size + BLOCK_SIZE * k - 1) / (BLOCK_SIZE * k));
+	for (uint32_t group = 0; group < groups; group++) {
+		unsigned int n = mcast_group_blocks(size, BLOCK_SIZE, k, group);
+		uint64_t start = (uint64_t)group * k * BLOCK_SIZE;
+		unsigned char *blocks[FEC_MAX_BLOCKS];
+		bool present[FEC_MAX_BLOCKS];
+		unsigned int lost = 0;
+		size_t len;
+
+		assert_in_range(n, 1, k);
+		for (unsigned int i = 0; i < n + r; i++) {
+			blocks[i] = calloc(1, BLOCK_SIZE);
+			assert_non_null(blocks[i]);
+		}
+		/* the last block is padded with zeroes */
+		for (unsigned int i = 0; i < n; i++) {
+			len = min_t(uint64_t, BLOCK_SIZE, size - start - i * BLOCK_SIZE);
+			memcpy(blocks[i], file + start + i * BLOCK_SIZE, len);
+		}
+		fec_encode(n, r, blocks, &blocks[n], BLOCK_SIZE);
+
+		/* about 15% of the packets are lost, at most r per group */
+		for (unsigned int i = 0; i < n + r; i++) {
+			present[i] = lost >= r || rnd() % 100 >= 15;
+			if (!present[i]) {
+				memset(blocks[i], 0, BLOCK_SIZE);
+				lost++;
+			}
+		}
+		assert_int_equal(fec_decode(n, r, blocks, present, BLOCK_SIZE), 0);
+
+		for (unsigned int i = 0; i < n; i++) {
+			len = min_t(uint64_t, BLOCK_SIZE, size - start - i * BLOCK_SIZE);
+			memcpy(out + start + i * BLOCK_SIZE, blocks[i], len);
+		}
+		for (unsigned int i = 0; i < n + r; i++)
+			free(blocks[i]);
+	}
+	assert_memory_equal(out, file, size);
+	free(file);
+	free(out);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest fec_tests[] = {
+		cmocka_unit_test(test_fec_no_erasure),
+		cmocka_unit_test(test_fec_erasures),
+		cmocka_unit_test(test_fec_data_lost),
+		cmocka_unit_test(test_fec_too_many_erasures),
+		cmocka_unit_test(test_fec_loopback),
+	};
+	error_count += cmocka_run_group_tests_name("multicast_fec", fec_tests,
+						   NULL, NULL);
+	return error_count;
+}
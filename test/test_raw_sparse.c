@@ -0,0 +1,563 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "util.h"
+#include "swupdate_dict.h"
+#include "swupdate_image.h"
+#include "../handlers/raw_sparse.h"
+
+#define DATADIR		"test/data/"
+#define BLOCK		4096
+#define BLOCKS		16
+#define OLD		0xAA	/* content of the device before the update */
+#define EXT4_BLOCK	1024
+#define EXT4_BLOCKS	320
+
+/*
+ * test/data/sparse.simg is a sparse image of 16 blocks of 4096 bytes:
+ *	RAW 2, DONT_CARE 3, FILL 2 (0x12345678), FILL 1 (0), RAW 1,
+ *	CRC32, DONT_CARE 7
+ * test/data/sparse.bmap maps blocks 0-1, 4 and 7-8 of 10 blocks.
+ * Data blocks hold pattern() of their block number.
+ *
+ * test/data/ext4.simg is, as a sparse image, an ext4 filesystem of
+ * 320 blocks of 1024 bytes in two groups with flex_bg, created by
+ *	mkfs.ext4 -b 1024 -g 256 -N 16 -I 128 -m 0 \
+ *		-O ^has_journal,^resize_inode -d <two files> ext4.img 320
+ * Blocks 100-103 and 280-283 are free but hold stale data.
+ */
+enum block_content { DATA, HOLE, FILL, ZERO };
+
+static const enum block_content android_map[BLOCKS] = {
+	DATA, DATA, HOLE, HOLE, HOLE, FILL, FILL, ZERO,
+	DATA, HOLE, HOLE, HOLE, HOLE, HOLE, HOLE, HOLE,
+};
+
+static const enum block_content bmap_map[] = {
+	DATA, DATA, HOLE, HOLE, DATA, HOLE, HOLE, DATA, DATA, HOLE,
+};
+
+/* free blocks of ext4.simg as listed by dumpe2fs */
+static const struct {
+	unsigned int first;
+	unsigned int last;
+} ext4_free[] = {
+	{ 29, 256 },
+	{ 259, 319 },
+};
+
+static unsigned char pattern(unsigned int blk, unsigned int i)
+{
+	return ((blk * BLOCK + i) * 7 + blk) & 0xff;
+}
+
+static unsigned char *read_data(const char *fname, size_t *len)
+{
+	unsigned char *buf;
+	struct stat st;
+	int fd;
+
+	fd = open(fname, O_RDONLY);
+	assert_true(fd >= 0);
+	assert_int_equal(fstat(fd, &st), 0);
+	buf = malloc(st.st_size);
+	assert_non_null(buf);
+	assert_int_equal(read(fd, buf, st.st_size), st.st_size);
+	close(fd);
+	*len = st.st_size;
+
+	return buf;
+}
+
+/* Output file with the old content of the device */
+static int old_device(size_t size)
+{
+	char tmpl[] = "/tmp/sparse-XXXXXX";
+	unsigned char buf[BLOCK];
+	int fd;
+
+	fd = mkstemp(tmpl);
+	assert_true(fd >= 0);
+	unlink(tmpl);
+	memset(buf, OLD, sizeof(buf));
+	for (size_t pos = 0; pos < size; pos += sizeof(buf))
+		assert_int_equal(write(fd, buf, sizeof(buf)), sizeof(buf));
+
+	return fd;
+}
+
+static void set_img(struct img_type *img, const char *type, const char *fill)
+{
+	memset(img, 0, sizeof(*img));
+	strcpy(img->device, "test");
+	if (type)
+		assert_int_equal(dict_set_value(&img->properties, "sparse", type), 0);
+	if (fill)
+		assert_int_equal(dict_set_value(&img->properties, "sparse-fill", fill), 0);
+}
+
+/* Stream the input in chunks, as copyimage() does */
+static int install(struct img_type *img, const unsigned char *in, size_t len,
+		   size_t chunk, int fd)
+{
+	struct raw_sparse_out *o;
+	size_t pos, n;
+	int ret = 0;
+
+	o = raw_sparse_new(img, fd);
+	if (!o)
+		return -1;
+	for (pos = 0; !ret && pos < len; pos += n) {
+		n = min_t(size_t, chunk, len - pos);
+		ret = raw_sparse_write(o, in + pos, n);
+	}
+	if (!ret)
+		ret = raw_sparse_finish(o);
+	raw_sparse_free(o);
+
+	return ret;
+}
+
+static void check_output(int fd, const enum block_content *map,
+			 unsigned int nblocks, bool zeroout)
+{
+	unsigned char buf[BLOCK], expected;
+	struct stat st;
+
+	assert_int_equal(fstat(fd, &st), 0);
+	assert_true(st.st_size >= (off_t)nblocks * BLOCK);
+	for (unsigned int blk = 0; blk < nblocks; blk++) {
+		assert_int_equal(pread(fd, buf, BLOCK, (off_t)blk * BLOCK), BLOCK);
+		for (unsigned int i = 0; i < BLOCK; i++) {
+			switch (map[blk]) {
+			case DATA:
+				expected = pattern(blk, i);
+				break;
+			case HOLE:
+				expected = zeroout ? 0 : OLD;
+				break;
+			case FILL:
+				expected = (0x12345678 >> (8 * (i % 4))) & 0xff;
+				break;
+			case ZERO:
+			default:
+				expected = 0;
+				break;
+			}
+			if (buf[i] != expected)
+				fail();
+		}
+	}
+}
+
+static void test_sparse_android(void **state)
+{
+	static const size_t chunks[] = { 1, 13, 4095, 4096 + 28, 1024 * 1024 };
+	struct img_type img;
+	unsigned char *in;
+	size_t len;
+	int fd;
+
+	(void)state;
+	in = read_data(DATADIR "sparse.simg", &len);
+	set_img(&img, "android", NULL);
+
+	/* headers and data split anywhere between two writes */
+	for (unsigned int i = 0; i < ARRAY_SIZE(chunks); i++) {
+		fd = old_device(BLOCKS * BLOCK);
+		assert_int_equal(install(&img, in, len, chunks[i], fd), 0);
+		check_output(fd, android_map, BLOCKS, false);
+		close(fd);
+	}
+
+	/* the file gets the size of the image, even if it ends with a hole */
+	fd = old_device(0);
+	assert_int_equal(install(&img, in, len, len, fd), 0);
+	assert_int_equal(lseek(fd, 0, SEEK_END), BLOCKS * BLOCK);
+	close(fd);
+
+	dict_drop_db(&img.properties);
+	set_img(&img, "android", "zeroout");
+	fd = old_device(BLOCKS * BLOCK);
+	assert_int_equal(install(&img, in, len, 1000, fd), 0);
+	check_output(fd, android_map, BLOCKS, true);
+	close(fd);
+
+	dict_drop_db(&img.properties);
+	free(in);
+}
+
+static void test_sparse_android_truncated(void **state)
+{
+	/* in the file header, a chunk header, RAW data, after a chunk */
+	static const size_t cuts[] = { 0, 10, 28 + 5, 28 + 12 + 100,
+				       28 + 12 + 2 * BLOCK };
+	struct img_type img;
+	unsigned char *in;
+	size_t len;
+	int fd;
+
+	(void)state;
+	in = read_data(DATADIR "sparse.simg", &len);
+	set_img(&img, "android", NULL);
+	for (unsigned int i = 0; i < ARRAY_SIZE(cuts); i++) {
+		fd = old_device(BLOCKS * BLOCK);
+		assert_true(install(&img, in, cuts[i], 100, fd) < 0);
+		close(fd);
+	}
+	/* the last chunk is missing */
+	fd = old_device(BLOCKS * BLOCK);
+	assert_true(install(&img, in, len - 12, 100, fd) < 0);
+	close(fd);
+
+	dict_drop_db(&img.properties);
+	free(in);
+}
+
+static void put_le16(unsigned char *p, unsigned int v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void put_le32(unsigned char *p, unsigned int v)
+{
+	put_le16(p, v & 0xffff);
+	put_le16(p + 2, v >> 16);
+}
+
+static void test_sparse_android_malformed(void **state)
+{
+	/* offset of the field and wrong value */
+	static const struct {
+		size_t offset;
+		unsigned int size;
+		unsigned int value;
+	} faults[] = {
+		{ 0, 4, 0xed26ff3b },			/* magic */
+		{ 4, 2, 2 },				/* major version */
+		{ 8, 2, 20 },				/* file header size */
+		{ 10, 2, 8 },				/* chunk header size */
+		{ 10, 2, 1024 },
+		{ 12, 4, 0 },				/* block size */
+		{ 12, 4, 4098 },
+		{ 16, 4, 15 },				/* total blocks */
+		{ 20, 4, 6 },				/* total chunks */
+		{ 20, 4, 8 },
+		{ 28, 2, 0xCAC5 },			/* chunk type */
+		{ 28 + 4, 4, 3 },			/* RAW blocks */
+		{ 28 + 8, 4, 12 + BLOCK },		/* RAW total size */
+		{ 28 + 12 + 2 * BLOCK + 4, 4, 1000 },	/* DONT_CARE blocks */
+		{ 28 + 12 + 2 * BLOCK + 8, 4, 16 },	/* DONT_CARE total size */
+		{ 28 + 24 + 2 * BLOCK + 8, 4, 20 },	/* FILL total size */
+	};
+	struct img_type img;
+	unsigned char *in;
+	size_t len;
+	int fd;
+
+	(void)state;
+	in = read_data(DATADIR "sparse.simg", &len);
+	set_img(&img, "android", NULL);
+	for (unsigned int i = 0; i < ARRAY_SIZE(faults); i++) {
+		unsigned char *bad = malloc(len);
+
+		assert_non_null(bad);
+		memcpy(bad, in, len);
+		if (faults[i].size == 2)
+			put_le16(bad + faults[i].offset, faults[i].value);
+		else
+			put_le32(bad + faults[i].offset, faults[i].value);
+		fd = old_device(BLOCKS * BLOCK);
+		if (install(&img, bad, len, 777, fd) >= 0)
+			fail_msg("fault %u not detected", i);
+		close(fd);
+		free(bad);
+	}
+
+	/* data after the last chunk */
+	in = realloc(in, len + 1);
+	assert_non_null(in);
+	fd = old_device(BLOCKS * BLOCK);
+	assert_true(install(&img, in, len + 1, len + 1, fd) < 0);
+	close(fd);
+
+	dict_drop_db(&img.properties);
+	free(in);
+}
+
+/* bmap_load() looks for the block map in TMPDIR */
+static void put_bmap(const char *name, const char *xml, size_t len)
+{
+	char *path;
+	int fd;
+
+	assert_true(asprintf(&path, "%s%s", get_tmpdir(), name) > 0);
+	fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	assert_true(fd >= 0);
+	assert_int_equal(write(fd, xml, len), len);
+	close(fd);
+	free(path);
+}
+
+static void drop_bmap(const char *name)
+{
+	char *path;
+
+	assert_true(asprintf(&path, "%s%s", get_tmpdir(), name) > 0);
+	unlink(path);
+	free(path);
+}
+
+static unsigned char *bmap_image(unsigned int nblocks)
+{
+	unsigned char *in = malloc((size_t)nblocks * BLOCK);
+
+	assert_non_null(in);
+	for (unsigned int blk = 0; blk < nblocks; blk++)
+		for (unsigned int i = 0; i < BLOCK; i++)
+			in[blk * BLOCK + i] = pattern(blk, i);
+
+	return in;
+}
+
+static void test_sparse_bmap(void **state)
+{
+	static const size_t chunks[] = { 1, 4095, 3 * BLOCK + 1, 10 * BLOCK };
+	unsigned int nblocks = ARRAY_SIZE(bmap_map);
+	struct img_type img;
+	unsigned char *xml, *in;
+	size_t len;
+	int fd;
+
+	(void)state;
+	xml = read_data(DATADIR "sparse.bmap", &len);
+	put_bmap("test.bmap", (char *)xml, len);
+	in = bmap_image(nblocks);
+
+	set_img(&img, "bmap", NULL);
+	assert_int_equal(dict_set_value(&img.properties, "sparse-bmap", "test.bmap"), 0);
+	for (unsigned int i = 0; i < ARRAY_SIZE(chunks); i++) {
+		fd = old_device(nblocks * BLOCK);
+		assert_int_equal(install(&img, in, nblocks * BLOCK, chunks[i], fd), 0);
+		check_output(fd, bmap_map, nblocks, false);
+		close(fd);
+	}
+
+	/* the image does not match the size in the block map */
+	fd = old_device(nblocks * BLOCK);
+	assert_true(install(&img, in, nblocks * BLOCK - 1, BLOCK, fd) < 0);
+	close(fd);
+	in = realloc(in, (nblocks + 1) * BLOCK);
+	assert_non_null(in);
+	fd = old_device(nblocks * BLOCK);
+	assert_true(install(&img, in, (nblocks + 1) * BLOCK, BLOCK, fd) < 0);
+	close(fd);
+
+	dict_drop_db(&img.properties);
+	drop_bmap("test.bmap");
+	free(in);
+	free(xml);
+}
+
+static void test_sparse_bmap_malformed(void **state)
+{
+	static const char *bmaps[] = {
+		/* no BlockSize */
+		"<bmap><ImageSize>40960</ImageSize>"
+		"<BlockMap><Range>0-1</Range></BlockMap></bmap>",
+		/* BlockSize 0 */
+		"<bmap><ImageSize>40960</ImageSize><BlockSize>0</BlockSize>"
+		"<BlockMap><Range>0-1</Range></BlockMap></bmap>",
+		/* no ImageSize */
+		"<bmap><BlockSize>4096</BlockSize>"
+		"<BlockMap><Range>0-1</Range></BlockMap></bmap>",
+		/* descending ranges */
+		"<bmap><ImageSize>40960</ImageSize><BlockSize>4096</BlockSize>"
+		"<BlockMap><Range>4</Range><Range>0-1</Range></BlockMap></bmap>",
+		/* overlapping ranges */
+		"<bmap><ImageSize>40960</ImageSize><BlockSize>4096</BlockSize>"
+		"<BlockMap><Range>0-4</Range><Range>4-5</Range></BlockMap></bmap>",
+		/* last before first */
+		"<bmap><ImageSize>40960</ImageSize><BlockSize>4096</BlockSize>"
+		"<BlockMap><Range>5-2</Range></BlockMap></bmap>",
+	};
+	struct img_type img;
+
+	(void)state;
+	set_img(&img, "bmap", NULL);
+	/* block map not given or not found */
+	assert_null(raw_sparse_new(&img, -1));
+	assert_int_equal(dict_set_value(&img.properties, "sparse-bmap", "test.bmap"), 0);
+	drop_bmap("test.bmap");
+	assert_null(raw_sparse_new(&img, -1));
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(bmaps); i++) {
+		put_bmap("test.bmap", bmaps[i], strlen(bmaps[i]));
+		if (raw_sparse_new(&img, -1))
+			fail_msg("block map %u accepted", i);
+	}
+
+	dict_drop_db(&img.properties);
+	drop_bmap("test.bmap");
+}
+
+static bool ext4_block_free(unsigned int blk)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(ext4_free); i++)
+		if (blk >= ext4_free[i].first && blk <= ext4_free[i].last)
+			return true;
+
+	return false;
+}
+
+static unsigned char *ext4_image(void)
+{
+	struct img_type img;
+	unsigned char *simg, *in;
+	size_t len;
+	int fd;
+
+	simg = read_data(DATADIR "ext4.simg", &len);
+	set_img(&img, "android", NULL);
+	fd = old_device(0);
+	assert_int_equal(install(&img, simg, len, len, fd), 0);
+	in = malloc(EXT4_BLOCKS * EXT4_BLOCK);
+	assert_non_null(in);
+	assert_int_equal(pread(fd, in, EXT4_BLOCKS * EXT4_BLOCK, 0),
+			 EXT4_BLOCKS * EXT4_BLOCK);
+	close(fd);
+	dict_drop_db(&img.properties);
+	free(simg);
+
+	return in;
+}
+
+/* Used blocks are written, free blocks are left as they are */
+static void check_ext4(int fd, const unsigned char *in, bool zeroout)
+{
+	unsigned char buf[EXT4_BLOCK], hole[EXT4_BLOCK];
+	unsigned int skipped = 0;
+
+	memset(hole, zeroout ? 0 : OLD, sizeof(hole));
+	for (unsigned int blk = 0; blk < EXT4_BLOCKS; blk++) {
+		assert_int_equal(pread(fd, buf, EXT4_BLOCK, (off_t)blk * EXT4_BLOCK),
+				 EXT4_BLOCK);
+		if (ext4_block_free(blk)) {
+			assert_memory_equal(buf, hole, EXT4_BLOCK);
+			skipped++;
+		} else {
+			assert_memory_equal(buf, in + blk * EXT4_BLOCK, EXT4_BLOCK);
+		}
+	}
+	assert_int_equal(skipped, 289);
+}
+
+static void test_sparse_ext4(void **state)
+{
+	static const size_t chunks[] = { 1000, EXT4_BLOCK, 3 * EXT4_BLOCK + 7,
+					 EXT4_BLOCKS * EXT4_BLOCK };
+	unsigned char *in = ext4_image();
+	struct img_type img;
+	int fd;
+
+	(void)state;
+	/* free blocks with stale data must not be written */
+	for (unsigned int i = 0; i < EXT4_BLOCK; i++)
+		if (!in[100 * EXT4_BLOCK + i])
+			fail();
+
+	set_img(&img, "ext4", NULL);
+	for (unsigned int i = 0; i < ARRAY_SIZE(chunks); i++) {
+		fd = old_device(EXT4_BLOCKS * EXT4_BLOCK);
+		assert_int_equal(install(&img, in, EXT4_BLOCKS * EXT4_BLOCK,
+					 chunks[i], fd), 0);
+		check_ext4(fd, in, false);
+		close(fd);
+	}
+	dict_drop_db(&img.properties);
+
+	set_img(&img, "ext4", "zeroout");
+	fd = old_device(EXT4_BLOCKS * EXT4_BLOCK);
+	assert_int_equal(install(&img, in, EXT4_BLOCKS * EXT4_BLOCK, 4096, fd), 0);
+	check_ext4(fd, in, true);
+	close(fd);
+	dict_drop_db(&img.properties);
+
+	free(in);
+}
+
+static void test_sparse_ext4_invalid(void **state)
+{
+	unsigned char *in = ext4_image(), *out;
+	struct img_type img;
+	int fd;
+
+	(void)state;
+	set_img(&img, "ext4", NULL);
+
+	/* shorter than the superblock */
+	fd = old_device(EXT4_BLOCKS * EXT4_BLOCK);
+	assert_true(install(&img, in, 2000, 100, fd) < 0);
+	close(fd);
+
+	/* not an ext4 filesystem: everything is written */
+	in[1024 + 0x38] ^= 0xff;
+	fd = old_device(EXT4_BLOCKS * EXT4_BLOCK);
+	assert_int_equal(install(&img, in, EXT4_BLOCKS * EXT4_BLOCK, 5000, fd), 0);
+	out = malloc(EXT4_BLOCKS * EXT4_BLOCK);
+	assert_non_null(out);
+	assert_int_equal(pread(fd, out, EXT4_BLOCKS * EXT4_BLOCK, 0),
+			 EXT4_BLOCKS * EXT4_BLOCK);
+	assert_memory_equal(out, in, EXT4_BLOCKS * EXT4_BLOCK);
+	close(fd);
+
+	dict_drop_db(&img.properties);
+	free(out);
+	free(in);
+}
+
+static void test_sparse_properties(void **state)
+{
+	struct img_type img;
+
+	(void)state;
+	set_img(&img, NULL, NULL);
+	assert_false(raw_sparse_requested(&img));
+	set_img(&img, "qcow", NULL);
+	assert_true(raw_sparse_requested(&img));
+	assert_null(raw_sparse_new(&img, -1));
+	dict_drop_db(&img.properties);
+	set_img(&img, "android", "trim");
+	assert_null(raw_sparse_new(&img, -1));
+	dict_drop_db(&img.properties);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest sparse_tests[] = {
+		cmocka_unit_test(test_sparse_properties),
+		cmocka_unit_test(test_sparse_android),
+		cmocka_unit_test(test_sparse_android_truncated),
+		cmocka_unit_test(test_sparse_android_malformed),
+		cmocka_unit_test(test_sparse_bmap),
+		cmocka_unit_test(test_sparse_bmap_malformed),
+		cmocka_unit_test(test_sparse_ext4),
+		cmocka_unit_test(test_sparse_ext4_invalid),
+	};
+	error_count += cmocka_run_group_tests_name("raw_sparse", sparse_tests,
+						   NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,263 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <zmq.h>
+#include "util.h"
+#include "handler.h"
+#include "swupdate_image.h"
+
+/* Same limit as the remote handler */
+#define MAX_WINDOW	64
+#define FRAME_SIZE	4096
+#define IMAGE_SIZE	(1024 * 1024 + 123)
+
+/*
+ * The remote is simulated by mocking the zeromq I/O functions:
+ * it answers INIT, checks the sequence of the DATA messages and
+ * acknowledges all of them each time the handler waits for an ACK,
+ * changing the window as given by the schedule.
+ */
+static struct {
+	const char *init_answer;
+	const unsigned int *schedule;
+	unsigned int nschedule;
+	unsigned int next;
+	unsigned int window;
+	unsigned long long received;
+	unsigned long long acked;
+	unsigned int max_inflight;
+	bool body;
+	bool error;
+	unsigned char *out;
+	size_t outlen;
+} remote;
+
+static unsigned char pattern(size_t i)
+{
+	return (i * 13 + (i >> 10)) & 0xff;
+}
+
+void *__wrap_zmq_ctx_new(void);
+void *__wrap_zmq_ctx_new(void)
+{
+	return &remote;
+}
+
+int __wrap_zmq_ctx_destroy(void *context);
+int __wrap_zmq_ctx_destroy(void *context)
+{
+	(void)context;
+	return 0;
+}
+
+void *__wrap_zmq_socket(void *context, int type);
+void *__wrap_zmq_socket(void *context, int type)
+{
+	(void)type;
+	return context;
+}
+
+int __wrap_zmq_close(void *socket);
+int __wrap_zmq_close(void *socket)
+{
+	(void)socket;
+	return 0;
+}
+
+int __wrap_zmq_setsockopt(void *socket, int option, const void *val, size_t len);
+int __wrap_zmq_setsockopt(void *socket, int option, const void *val, size_t len)
+{
+	(void)socket;
+	(void)option;
+	(void)val;
+	(void)len;
+	return 0;
+}
+
+int __wrap_zmq_connect(void *socket, const char *endpoint);
+int __wrap_zmq_connect(void *socket, const char *endpoint)
+{
+	(void)socket;
+	(void)endpoint;
+	return 0;
+}
+
+int __wrap_zmq_send(void *socket, const void *buf, size_t len, int flags);
+int __wrap_zmq_send(void *socket, const void *buf, size_t len, int flags)
+{
+	(void)socket;
+	(void)buf;
+	(void)flags;
+	return len;
+}
+
+int __wrap_zmq_poll(zmq_pollitem_t *items, int nitems, long tout);
+int __wrap_zmq_poll(zmq_pollitem_t *items, int nitems, long tout)
+{
+	(void)items;
+	(void)tout;
+	return nitems;
+}
+
+int __wrap_zmq_msg_send(zmq_msg_t *msg, void *socket, int flags);
+int __wrap_zmq_msg_send(zmq_msg_t *msg, void *socket, int flags)
+{
+	size_t size = zmq_msg_size(msg);
+	char cmd[32];
+	unsigned long long seq;
+
+	(void)socket;
+	if (flags & ZMQ_SNDMORE) {
+		snprintf(cmd, sizeof(cmd), "%.*s", (int)size, (char *)zmq_msg_data(msg));
+		remote.body = !strncmp(cmd, "DATA", 4);
+		if (remote.body && remote.init_answer[3] == ':') {
+			seq = strtoull(cmd + 5, NULL, 10);
+			if (seq != remote.received + 1)
+				remote.error = true;
+		}
+		if (remote.body) {
+			remote.received++;
+			if (remote.received - remote.acked > remote.max_inflight)
+				remote.max_inflight = remote.received - remote.acked;
+		}
+	} else if (remote.body) {
+		if (remote.outlen + size > IMAGE_SIZE) {
+			remote.error = true;
+		} else {
+			memcpy(remote.out + remote.outlen, zmq_msg_data(msg), size);
+			remote.outlen += size;
+		}
+	}
+	/* the buffer is not needed anymore once sent */
+	zmq_msg_close(msg);
+
+	return size;
+}
+
+int __wrap_zmq_msg_recv(zmq_msg_t *msg, void *socket, int flags);
+int __wrap_zmq_msg_recv(zmq_msg_t *msg, void *socket, int flags)
+{
+	char answer[64];
+	size_t len;
+
+	(void)socket;
+	(void)flags;
+	if (!remote.received) {
+		snprintf(answer, sizeof(answer), "%s", remote.init_answer);
+	} else if (remote.init_answer[3] != ':') {
+		snprintf(answer, sizeof(answer), "ACK");
+	} else {
+		remote.acked = remote.received;
+		remote.window = remote.schedule[remote.next];
+		if (remote.next < remote.nschedule - 1)
+			remote.next++;
+		snprintf(answer, sizeof(answer), "ACK:%llu:%u",
+			 remote.acked, remote.window);
+	}
+
+	len = strlen(answer);
+	zmq_msg_close(msg);
+	zmq_msg_init_size(msg, len);
+	memcpy(zmq_msg_data(msg), answer, len);
+
+	return len;
+}
+
+/* The image is fed in chunks that are not aligned to the frames */
+int __wrap_copyimage(void *out, struct img_type *img, writeimage callback);
+int __wrap_copyimage(void *out, struct img_type *img, writeimage callback)
+{
+	unsigned char buf[10000];
+	size_t pos, n;
+	int ret;
+
+	for (pos = 0; pos < (size_t)img->size; pos += n) {
+		n = min_t(size_t, sizeof(buf), img->size - pos);
+		for (size_t i = 0; i < n; i++)
+			buf[i] = pattern(pos + i);
+		ret = callback(out, buf, n);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void run_remote(const char *init_answer, const unsigned int *schedule,
+		       unsigned int nschedule)
+{
+	struct installer_handler *hnd;
+	struct img_type img;
+
+	memset(&remote, 0, sizeof(remote));
+	remote.init_answer = init_answer;
+	remote.schedule = schedule;
+	remote.nschedule = nschedule;
+	remote.out = malloc(IMAGE_SIZE);
+	assert_non_null(remote.out);
+
+	memset(&img, 0, sizeof(img));
+	strcpy(img.type, "remote");
+	strcpy(img.type_data, "test");
+	img.size = IMAGE_SIZE;
+	hnd = find_handler(&img);
+	assert_non_null(hnd);
+
+	assert_int_equal(hnd->installer(&img, hnd->data), 0);
+	assert_false(remote.error);
+	assert_int_equal(remote.outlen, IMAGE_SIZE);
+	for (size_t i = 0; i < IMAGE_SIZE; i++)
+		if (remote.out[i] != pattern(i))
+			fail();
+	free(remote.out);
+}
+
+static void test_remote_stop_and_wait(void **state)
+{
+	(void)state;
+	run_remote("ACK", NULL, 0);
+	assert_int_equal(remote.received, (IMAGE_SIZE + 9999) / 10000);
+}
+
+static void test_remote_window(void **state)
+{
+	static const unsigned int schedule[] = { 4 };
+
+	(void)state;
+	run_remote("ACK:2000:WINDOW:4:4096", schedule, ARRAY_SIZE(schedule));
+	assert_int_equal(remote.received, (IMAGE_SIZE + FRAME_SIZE - 1) / FRAME_SIZE);
+	assert_int_equal(remote.max_inflight, 4);
+}
+
+/* The remote grows and shrinks the window after INIT */
+static void test_remote_window_growth(void **state)
+{
+	static const unsigned int schedule[] = { 8, 32, 3, 1000, 1, 16 };
+
+	(void)state;
+	run_remote("ACK:2000:WINDOW:2:4096", schedule, ARRAY_SIZE(schedule));
+	assert_int_equal(remote.received, (IMAGE_SIZE + FRAME_SIZE - 1) / FRAME_SIZE);
+	assert_int_equal(remote.max_inflight, MAX_WINDOW);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest remote_tests[] = {
+		cmocka_unit_test(test_remote_stop_and_wait),
+		cmocka_unit_test(test_remote_window),
+		cmocka_unit_test(test_remote_window_growth),
+	};
+	error_count += cmocka_run_group_tests_name("remote_handler", remote_tests,
+						   NULL, NULL);
+	return error_count;
+}
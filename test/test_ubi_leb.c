@@ -0,0 +1,225 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "util.h"
+#include "../handlers/ubi_leb.h"
+
+#define LEB_SIZE	512
+#define NLEBS		8
+#define CHUNK		100	/* not a divisor of LEB_SIZE */
+
+/* The volume is a file, the LEB changes and unmaps are recorded */
+static int fd = -1;
+static bool mapped[NLEBS];
+static bool changed[NLEBS];
+
+static void fill_leb(int lnum, int c)
+{
+	unsigned char buf[LEB_SIZE];
+
+	memset(buf, c, sizeof(buf));
+	assert_int_equal(pwrite(fd, buf, sizeof(buf), (off_t)lnum * LEB_SIZE),
+			 LEB_SIZE);
+}
+
+int __wrap_ubi_leb_change_start(libubi_t desc, int fd, int lnum, int bytes);
+int __wrap_ubi_leb_change_start(libubi_t desc, int vfd, int lnum, int bytes)
+{
+	(void)desc;
+	assert_int_equal(vfd, fd);
+	assert_in_range(lnum, 0, NLEBS - 1);
+	assert_in_range(bytes, 1, LEB_SIZE);
+	/* the data is written to an erased LEB */
+	fill_leb(lnum, 0xff);
+	assert_int_equal(lseek(fd, (off_t)lnum * LEB_SIZE, SEEK_SET),
+			 (off_t)lnum * LEB_SIZE);
+	changed[lnum] = true;
+	mapped[lnum] = true;
+
+	return 0;
+}
+
+int __wrap_ubi_is_mapped(int fd, int lnum);
+int __wrap_ubi_is_mapped(int vfd, int lnum)
+{
+	assert_int_equal(vfd, fd);
+	assert_in_range(lnum, 0, NLEBS - 1);
+
+	return mapped[lnum];
+}
+
+int __wrap_ubi_leb_unmap(int fd, int lnum);
+int __wrap_ubi_leb_unmap(int vfd, int lnum)
+{
+	assert_int_equal(vfd, fd);
+	assert_in_range(lnum, 0, NLEBS - 1);
+	fill_leb(lnum, 0xff);
+	mapped[lnum] = false;
+
+	return 0;
+}
+
+static void image(unsigned char *img, size_t len, unsigned int seed)
+{
+	for (size_t i = 0; i < len; i++)
+		img[i] = (i * 13 + seed) & 0xff;
+}
+
+/* The volume holds img in all its LEBs */
+static int setup(void **state)
+{
+	unsigned char img[NLEBS * LEB_SIZE];
+	char name[] = "/tmp/ubi_leb-XXXXXX";
+
+	(void)state;
+	fd = mkstemp(name);
+	if (fd < 0)
+		return -1;
+	unlink(name);
+	image(img, sizeof(img), 0);
+	if (pwrite(fd, img, sizeof(img), 0) != sizeof(img))
+		return -1;
+	for (unsigned int i = 0; i < NLEBS; i++) {
+		mapped[i] = true;
+		changed[i] = false;
+	}
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	(void)state;
+	close(fd);
+	fd = -1;
+
+	return 0;
+}
+
+static struct ubi_leb_out *write_image(const unsigned char *img, size_t len)
+{
+	struct ubi_leb_out *o = ubi_leb_new(NULL, fd, LEB_SIZE);
+
+	assert_non_null(o);
+	for (size_t off = 0; off < len; off += CHUNK)
+		assert_int_equal(ubi_leb_write(o, img + off,
+					       min_t(size_t, CHUNK, len - off)), 0);
+
+	return o;
+}
+
+static void check_volume(const unsigned char *img, size_t len)
+{
+	unsigned char buf[NLEBS * LEB_SIZE];
+
+	assert_int_equal(pread(fd, buf, sizeof(buf), 0), sizeof(buf));
+	assert_memory_equal(buf, img, len);
+}
+
+/* The same image again: nothing is written */
+static void test_ubi_leb_unchanged(void **state)
+{
+	unsigned char img[NLEBS * LEB_SIZE];
+	struct ubi_leb_out *o;
+
+	(void)state;
+	image(img, sizeof(img), 0);
+	o = write_image(img, sizeof(img));
+	assert_int_equal(ubi_leb_finish(o, sizeof(img), NLEBS), 0);
+	assert_int_equal(o->changed, 0);
+	assert_int_equal(o->skipped, NLEBS);
+	assert_int_equal(o->unmapped, 0);
+	ubi_leb_free(o);
+	for (unsigned int i = 0; i < NLEBS; i++)
+		assert_false(changed[i]);
+	check_volume(img, sizeof(img));
+}
+
+/* Only the LEBs with a difference are changed */
+static void test_ubi_leb_changed(void **state)
+{
+	unsigned char img[NLEBS * LEB_SIZE];
+	struct ubi_leb_out *o;
+
+	(void)state;
+	image(img, sizeof(img), 0);
+	img[0] ^= 1;				/* first byte of LEB 0 */
+	img[3 * LEB_SIZE + LEB_SIZE / 2] ^= 1;	/* inside LEB 3 */
+	img[NLEBS * LEB_SIZE - 1] ^= 1;		/* last byte of the last LEB */
+	o = write_image(img, sizeof(img));
+	assert_int_equal(ubi_leb_finish(o, sizeof(img), NLEBS), 0);
+	assert_int_equal(o->changed, 3);
+	assert_int_equal(o->skipped, NLEBS - 3);
+	assert_int_equal(o->unmapped, 0);
+	ubi_leb_free(o);
+	for (unsigned int i = 0; i < NLEBS; i++)
+		assert_int_equal(changed[i], i == 0 || i == 3 || i == NLEBS - 1);
+	check_volume(img, sizeof(img));
+}
+
+/*
+ * A shorter image ends in the middle of a LEB: the LEBs behind it
+ * are unmapped, those already unmapped are not counted.
+ */
+static void test_ubi_leb_shorter(void **state)
+{
+	const size_t len = 3 * LEB_SIZE + 17;
+	unsigned char img[NLEBS * LEB_SIZE];
+	struct ubi_leb_out *o;
+
+	(void)state;
+	image(img, sizeof(img), 0);
+	mapped[6] = false;
+	o = write_image(img, len);
+	assert_int_equal(ubi_leb_finish(o, len, NLEBS), 0);
+	/* the last, partial LEB matches the start of the old one */
+	assert_int_equal(o->changed, 0);
+	assert_int_equal(o->skipped, 4);
+	assert_int_equal(o->unmapped, NLEBS - 4 - 1);
+	ubi_leb_free(o);
+	for (unsigned int i = 0; i < NLEBS; i++)
+		assert_int_equal(mapped[i], i < 4);
+	check_volume(img, len);
+}
+
+/* An image that does not fill the expected LEBs is an error */
+static void test_ubi_leb_short_image(void **state)
+{
+	unsigned char img[NLEBS * LEB_SIZE];
+	struct ubi_leb_out *o;
+
+	(void)state;
+	image(img, sizeof(img), 1);
+	o = write_image(img, 2 * LEB_SIZE);
+	assert_int_equal(ubi_leb_finish(o, 4 * LEB_SIZE, NLEBS), -EIO);
+	assert_int_equal(o->changed, 2);
+	ubi_leb_free(o);
+	/* nothing after the written LEBs was unmapped */
+	for (unsigned int i = 0; i < NLEBS; i++)
+		assert_true(mapped[i]);
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest ubi_leb_tests[] = {
+		cmocka_unit_test_setup_teardown(test_ubi_leb_unchanged, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_ubi_leb_changed, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_ubi_leb_shorter, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_ubi_leb_short_image, setup, teardown),
+	};
+	error_count += cmocka_run_group_tests_name("ubi_leb", ubi_leb_tests,
+						   NULL, NULL);
+	return error_count;
+}
@@ -0,0 +1,196 @@
+// SPDX-FileCopyrightText: 2026 agent <agent@local>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "util.h"
+#include "sslapi.h"
+#include "verity_hash.h"
+
+#define DATA_SIZE	(1024 * 1024)
+
+/*
+ * Root hashes and trees of DATA_SIZE bytes of data(), salt 00 01 .. 1f,
+ * computed with a separate implementation of the dm-verity format 1.
+ * They are what
+ *   veritysetup format --no-superblock --format=1 --hash=<algo> \
+ *	--data-block-size=<dbs> --hash-block-size=<hbs> --salt=<salt> data tree
+ * reports and writes for the same data.
+ */
+struct verity_vector {
+	const char *algo;
+	unsigned int data_block_size;
+	unsigned int hash_block_size;
+	bool salt;
+	const char *root_hash;
+	unsigned long long tree_size;
+	const char *tree_sha256;
+};
+
+static const struct verity_vector vectors[] = {
+	{ "sha256", 4096, 4096, true,
+	  "ad0eb6d1c18906c4209cd02343b74de30dec5a9edbee6ee7f5bbea7b48d47748", 12288,
+	  "0a9f8ec58750f52a86e74ae45ea2d2686e9f0132fc0ebb480c2fa6bc640b7027" },
+	{ "sha256", 512, 4096, true,
+	  "7ee1cbe2b8797741f88a1ac749887ce0cddecdc48b4ab31590680d73dcc79e80", 69632,
+	  "a357827751e317e2c5f83db605928b71223990a4436c77d62c26c2213e3133a8" },
+	{ "sha256", 4096, 512, true,
+	  "391c407f49c49c645ec33319f3764ed66b3e8f0ff2b17117fecc8df83401764b", 8704,
+	  "bda11f58d7e0a1156185f8a173f789a16de7bb4e5a7f3fe69e9f89048910bb32" },
+	{ "sha1", 4096, 4096, false,
+	  "bac3cae1ff6733b47963140e376ba228dd489157", 12288, NULL },
+};
+
+static unsigned char *data(void)
+{
+	unsigned char *buf = malloc(DATA_SIZE);
+
+	for (unsigned int i = 0; buf && i < DATA_SIZE; i++)
+		buf[i] = (i * 7 + (i >> 12)) & 0xff;
+
+	return buf;
+}
+
+static void hex(const unsigned char *buf, unsigned int len, char *out)
+{
+	for (unsigned int i = 0; i < len; i++)
+		sprintf(out + i * 2, "%02x", buf[i]);
+}
+
+/* Feed the data in chunks that are not aligned to the blocks */
+static void compute(const struct verity_vector *t, unsigned int threads,
+		    size_t chunk, int fd, char *root)
+{
+	struct verity_hash_cfg cfg = {
+		.algo = t->algo,
+		.data_block_size = t->data_block_size,
+		.hash_block_size = t->hash_block_size,
+		.threads = threads,
+		.fd = fd,
+	};
+	unsigned char hash[VERITY_MAX_DIGEST_SIZE];
+	unsigned char *buf = data();
+	struct verity_hash *v;
+
+	assert_non_null(buf);
+	if (t->salt) {
+		for (unsigned int i = 0; i < 32; i++)
+			cfg.salt[i] = i;
+		cfg.salt_size = 32;
+	}
+	v = verity_hash_init(&cfg, DATA_SIZE);
+	assert_non_null(v);
+	assert_int_equal(verity_hash_tree_size(v), t->tree_size);
+	for (size_t pos = 0; pos < DATA_SIZE; pos += chunk)
+		assert_int_equal(verity_hash_update(v, buf + pos,
+						    min_t(size_t, chunk, DATA_SIZE - pos)), 0);
+	assert_int_equal(verity_hash_final(v, hash), 0);
+	hex(hash, verity_hash_digest_size(v), root);
+	verity_hash_free(v);
+	free(buf);
+}
+
+static void test_verity_root_hash(void **state)
+{
+	char root[VERITY_MAX_DIGEST_SIZE * 2 + 1];
+
+	(void)state;
+	for (unsigned int i = 0; i < ARRAY_SIZE(vectors); i++) {
+		compute(&vectors[i], 1, DATA_SIZE, -1, root);
+		assert_string_equal(root, vectors[i].root_hash);
+		compute(&vectors[i], 1, 1000, -1, root);
+		assert_string_equal(root, vectors[i].root_hash);
+	}
+}
+
+static void test_verity_threads(void **state)
+{
+	char root[VERITY_MAX_DIGEST_SIZE * 2 + 1];
+
+	(void)state;
+	for (unsigned int i = 0; i < ARRAY_SIZE(vectors); i++) {
+		compute(&vectors[i], 4, 65536 + 3, -1, root);
+		assert_string_equal(root, vectors[i].root_hash);
+	}
+}
+
+static void test_verity_tree(void **state)
+{
+	char root[VERITY_MAX_DIGEST_SIZE * 2 + 1];
+	unsigned char md[SHA256_HASH_LENGTH];
+	char tree_hash[SHA256_HASH_LENGTH * 2 + 1];
+	char tmpl[] = "/tmp/verity-XXXXXX";
+	struct swupdate_digest *dgst;
+	unsigned char *tree;
+	unsigned int mdlen;
+	int fd;
+
+	(void)state;
+	for (unsigned int i = 0; i < ARRAY_SIZE(vectors); i++) {
+		const struct verity_vector *t = &vectors[i];
+
+		if (!t->tree_sha256)
+			continue;
+		strcpy(tmpl, "/tmp/verity-XXXXXX");
+		fd = mkstemp(tmpl);
+		assert_true(fd >= 0);
+		unlink(tmpl);
+		compute(t, 2, 4096 * 3 + 1, fd, root);
+		assert_string_equal(root, t->root_hash);
+
+		tree = malloc(t->tree_size);
+		assert_non_null(tree);
+		assert_int_equal(pread(fd, tree, t->tree_size, 0), t->tree_size);
+		close(fd);
+		dgst = swupdate_HASH_init("sha256");
+		assert_non_null(dgst);
+		assert_int_equal(swupdate_HASH_update(dgst, tree, t->tree_size), 0);
+		assert_int_equal(swupdate_HASH_final(dgst, md, &mdlen), 1);
+		swupdate_HASH_cleanup(dgst);
+		hex(md, SHA256_HASH_LENGTH, tree_hash);
+		assert_string_equal(tree_hash, t->tree_sha256);
+		free(tree);
+	}
+}
+
+static void test_verity_short_data(void **state)
+{
+	struct verity_hash_cfg cfg = {
+		.data_block_size = 4096,
+		.hash_block_size = 4096,
+		.fd = -1,
+	};
+	unsigned char hash[VERITY_MAX_DIGEST_SIZE];
+	unsigned char buf[4096] = { 0 };
+	struct verity_hash *v;
+
+	(void)state;
+	v = verity_hash_init(&cfg, 3 * sizeof(buf));
+	assert_non_null(v);
+	assert_int_equal(verity_hash_update(v, buf, sizeof(buf)), 0);
+	assert_true(verity_hash_final(v, hash) < 0);
+	verity_hash_free(v);
+
+	cfg.data_block_size = 1000;
+	assert_null(verity_hash_init(&cfg, sizeof(buf)));
+}
+
+int main(void)
+{
+	int error_count = 0;
+	const struct CMUnitTest verity_tests[] = {
+		cmocka_unit_test(test_verity_root_hash),
+		cmocka_unit_test(test_verity_threads),
+		cmocka_unit_test(test_verity_tree),
+		cmocka_unit_test(test_verity_short_data),
+	};
+	error_count += cmocka_run_group_tests_name("verity_hash", verity_tests,
+						   NULL, NULL);
+	return error_count;
+}
@@ -98,6 +98,8 @@ static void usage_dwlurl(const char *program) {
 	fprintf(stdout,
 		"\t\t-u, --url <url>         : URL to be passed to the downloader\n"
 		"\t\t-c, --userpassword user:pass : user / password to be used to download\n"
+		"\t\t-k, --sha256 <hash>     : SHA-256 of the SWU, to get it from peers\n"
+		"\t\t-m, --mirrors <urls>    : other URLs of the SWU, comma separated\n"
 		"\t\t-h, --help              : print this help and exit\n"
 		);
 }
@@ -214,6 +216,8 @@ static struct option dwlurl_options[] = {
 	{"help", no_argument, NULL, 'h'},
 	{"url", required_argument, NULL, 'u'},
 	{"userpassword", required_argument, NULL, 'c'},
+	{"sha256", required_argument, NULL, 'k'},
+	{"mirrors", required_argument, NULL, 'm'},
 	{NULL, 0, NULL, 0}
 };
 
@@ -223,8 +227,8 @@ static int dwlurl(cmd_t  __attribute__((__unused__)) *cmd, int argc, char *argv[
 	size_t size, len;
 	char *buf;
 	int c;
-	int opt_u = 0, opt_c = 0;
-	char *url = NULL, *user = NULL;
+	int opt_u = 0, opt_c = 0, opt_k = 0, opt_m = 0;
+	char *url = NULL, *user = NULL, *sha256 = NULL, *mirrors = NULL;
 
 	memset(&msg, 0, sizeof(msg));
 	msg.data.procmsg.source = SOURCE_DOWNLOADER;
@@ -235,7 +239,7 @@ static int dwlurl(cmd_t  __attribute__((__unused__)) *cmd, int argc, char *argv[
 	buf = msg.data.procmsg.buf;
 
 	/* Process options with getopt */
-	while ((c = getopt_long(argc, argv, "u:c:",
+	while ((c = getopt_long(argc, argv, "u:c:k:m:",
 				dwlurl_options, NULL)) != EOF) {
 		switch (c) {
 		case 'u':
@@ -248,6 +252,16 @@ static int dwlurl(cmd_t  __attribute__((__unused__)) *cmd, int argc, char *argv[
 			if (user) free(user);
 			user = strdup(optarg);
 			break;
+		case 'k':
+			opt_k = 1;
+			if (sha256) free(sha256);
+			sha256 = strdup(optarg);
+			break;
+		case 'm':
+			opt_m = 1;
+			if (mirrors) free(mirrors);
+			mirrors = strdup(optarg);
+			break;
 		}
 	}
 
@@ -267,13 +281,21 @@ static int dwlurl(cmd_t  __attribute__((__unused__)) *cmd, int argc, char *argv[
 		fprintf(stderr, "URL is too long : %s\n", url);
 		exit(1);
 	}
-	if (opt_c) {
-		len += snprintf(buf + len, size - len, ", \"userpassword\" : \"%s\" }",
+	if (opt_c && len < size) {
+		len += snprintf(buf + len, size - len, ", \"userpassword\" : \"%s\"",
 				user);
-	} else {
-		len += snprintf(buf + len, size - len, "}");
 	}
-	if (len == size) {
+	if (opt_k && len < size) {
+		len += snprintf(buf + len, size - len, ", \"sha256\" : \"%s\"",
+				sha256);
+	}
+	if (opt_m && len < size) {
+		len += snprintf(buf + len, size - len, ", \"mirrors\" : \"%s\"",
+				mirrors);
+	}
+	if (len < size)
+		len += snprintf(buf + len, size - len, "}");
+	if (len >= size) {
 		fprintf(stderr, "URL + credentials too long, not supported\n");
 		exit(1);
 	}
@@ -607,6 +629,9 @@ static int sysrestart(cmd_t  __attribute__((__unused__)) *cmd, int argc, char *a
 			case SOURCE_DOWNLOADER:
 				fprintf(stdout, "DOWNLOADER\n\n");
 				break;
+			case SOURCE_MULTICAST:
+				fprintf(stdout, "MULTICAST\n\n");
+				break;
 			case SOURCE_LOCAL:
 				fprintf(stdout, "LOCAL\n\n");
 				break;
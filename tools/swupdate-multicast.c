@@ -0,0 +1,263 @@
+/*
+ * (C) Copyright 2026
+ * agent, agent@local.
+ *
+ * SPDX-License-Identifier:     GPL-2.0-only
+ */
+
+/*
+ * Sender for the multicast source of SWUpdate (swupdate -D).
+ * The SWU is sent to a multicast group as groups of data blocks
+ * followed by parity blocks, repeated for a number of rounds.
+ * All devices listening to the group receive the same transmission.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "multicast.h"
+
+#define DEFAULT_RATE	10000	/* kbit/s */
+#define DEFAULT_ROUNDS	3
+#define DEFAULT_TTL	1
+
+static struct option long_options[] = {
+	{"group", required_argument, NULL, 'g'},
+	{"port", required_argument, NULL, 'p'},
+	{"interface", required_argument, NULL, 'i'},
+	{"ttl", required_argument, NULL, 'T'},
+	{"block-size", required_argument, NULL, 'b'},
+	{"data-blocks", required_argument, NULL, 'k'},
+	{"parity-blocks", required_argument, NULL, 'r'},
+	{"rate", required_argument, NULL, 'R'},
+	{"rounds", required_argument, NULL, 'n'},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+static void usage(char *program)
+{
+	fprintf(stdout, "%s [OPTIONS] <image .swu>\n", program);
+	fprintf(stdout,
+		" Available OPTIONS\n"
+		" -g, --group <address>      : multicast group (default: " MCAST_DEFAULT_GROUP ")\n"
+		" -p, --port <port>          : UDP port (default: %d)\n"
+		" -i, --interface <address>  : address of the interface to send from\n"
+		" -T, --ttl <hops>           : TTL of the packets (default: %d)\n"
+		" -b, --block-size <bytes>   : payload of a packet (default: %d, max %d)\n"
+		" -k, --data-blocks <n>      : data blocks in a group (default: %d)\n"
+		" -r, --parity-blocks <n>    : parity blocks in a group (default: %d)\n"
+		" -R, --rate <kbit/s>        : transmission rate (default: %d)\n"
+		" -n, --rounds <n>           : times the SWU is sent (default: %d)\n"
+		" -h, --help                 : print this help and exit\n",
+		MCAST_DEFAULT_PORT, DEFAULT_TTL, MCAST_DEFAULT_BLOCK, MCAST_MAX_BLOCK,
+		MCAST_DEFAULT_K, MCAST_DEFAULT_R, DEFAULT_RATE, DEFAULT_ROUNDS);
+}
+
+static void pace(struct timespec *next, unsigned long long ns)
+{
+	next->tv_nsec += ns % 1000000000ULL;
+	next->tv_sec += ns / 1000000000ULL + next->tv_nsec / 1000000000L;
+	next->tv_nsec %= 1000000000L;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR)
+		;
+}
+
+static int read_group(int fd, uint64_t offset, unsigned char *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = pread(fd, buf + done, len - done, offset + done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!n)
+			break;
+		done += n;
+	}
+	/* the last block is padded */
+	memset(buf + done, 0, len - done);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *group = MCAST_DEFAULT_GROUP, *iface = NULL;
+	unsigned int port = MCAST_DEFAULT_PORT, ttl = DEFAULT_TTL;
+	unsigned int block_size = MCAST_DEFAULT_BLOCK;
+	unsigned int k = MCAST_DEFAULT_K, r = MCAST_DEFAULT_R;
+	unsigned long rate = DEFAULT_RATE;
+	unsigned int rounds = DEFAULT_ROUNDS;
+	unsigned char *data[FEC_MAX_BLOCKS], *blocks, *pkt;
+	struct mcast_hdr *hdr;
+	struct sockaddr_in dst;
+	struct timespec next;
+	unsigned long long ns;
+	uint32_t session, groups;
+	struct stat st;
+	int c, fd, sock;
+
+	while ((c = getopt_long(argc, argv, "g:p:i:T:b:k:r:R:n:h",
+				long_options, NULL)) != EOF) {
+		switch (c) {
+		case 'g':
+			group = optarg;
+			break;
+		case 'p':
+			port = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			iface = optarg;
+			break;
+		case 'T':
+			ttl = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			block_size = strtoul(optarg, NULL, 10);
+			break;
+		case 'k':
+			k = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			r = strtoul(optarg, NULL, 10);
+			break;
+		case 'R':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (!block_size || block_size > MCAST_MAX_BLOCK || !k || k + r > FEC_MAX_BLOCKS ||
+	    !port || port > 65535 || !rate || !rounds) {
+		fprintf(stderr, "Wrong parameters\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) || !st.st_size) {
+		fprintf(stderr, "Cannot read %s\n", argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&dst, 0, sizeof(dst));
+	dst.sin_family = AF_INET;
+	dst.sin_port = htons(port);
+	if (inet_pton(AF_INET, group, &dst.sin_addr) != 1 ||
+	    !IN_MULTICAST(ntohl(dst.sin_addr.s_addr))) {
+		fprintf(stderr, "%s is not a multicast address\n", group);
+		exit(EXIT_FAILURE);
+	}
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		fprintf(stderr, "Cannot create socket: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	if (iface) {
+		struct in_addr addr;
+
+		if (inet_pton(AF_INET, iface, &addr) != 1 ||
+		    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr))) {
+			fprintf(stderr, "Cannot send from %s\n", iface);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	blocks = malloc((size_t)(k + r) * block_size);
+	pkt = malloc(sizeof(*hdr) + block_size);
+	if (!blocks || !pkt) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	for (unsigned int i = 0; i < k + r; i++)
+		data[i] = blocks + (size_t)i * block_size;
+
+	srandom(time(NULL) ^ getpid());
+	session = random();
+	groups = mcast_groups(st.st_size, block_size, k);
+	/* time between two packets, headers included */
+	ns = (sizeof(*hdr) + block_size) * 8ULL * 1000000ULL / rate;
+
+	hdr = (struct mcast_hdr *)pkt;
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = htonl(MCAST_MAGIC);
+	hdr->version = MCAST_VERSION;
+	hdr->k = k;
+	hdr->r = r;
+	hdr->session = htonl(session);
+	hdr->block_size = htons(block_size);
+	hdr->size = htobe64(st.st_size);
+
+	fprintf(stdout, "Sending %s (%llu bytes) to %s:%u, session %08x, %u groups of %u+%u blocks\n",
+		argv[optind], (unsigned long long)st.st_size, group, port,
+		session, groups, k, r);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (unsigned int round = 0; round < rounds; round++) {
+		fprintf(stdout, "Round %u/%u\n", round + 1, rounds);
+		for (uint32_t g = 0; g < groups; g++) {
+			unsigned int n = mcast_group_blocks(st.st_size, block_size, k, g);
+
+			if (read_group(fd, (uint64_t)g * k * block_size, blocks,
+				       (size_t)n * block_size)) {
+				fprintf(stderr, "Cannot read %s: %s\n", argv[optind],
+					strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			/* parity follows the data blocks of the group */
+			fec_encode(n, r, data, &data[n], block_size);
+
+			hdr->group = htonl(g);
+			for (unsigned int i = 0; i < n + r; i++) {
+				hdr->index = i;
+				memcpy(pkt + sizeof(*hdr), data[i], block_size);
+				if (sendto(sock, pkt, sizeof(*hdr) + block_size, 0,
+					   (struct sockaddr *)&dst, sizeof(dst)) < 0 &&
+				    errno != ENOBUFS) {
+					fprintf(stderr, "Cannot send: %s\n", strerror(errno));
+					exit(EXIT_FAILURE);
+				}
+				pace(&next, ns);
+			}
+		}
+	}
+
+	close(sock);
+	close(fd);
+	free(blocks);
+	free(pkt);
+
+	exit(EXIT_SUCCESS);
+}
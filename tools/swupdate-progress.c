@@ -323,6 +323,9 @@ int main(int argc, char **argv)
 				case SOURCE_CHUNKS_DOWNLOADER:
 					fprintf(stdout, "CHUNKS DOWNLOADER\n\n");
 					break;
+				case SOURCE_MULTICAST:
+					fprintf(stdout, "MULTICAST\n\n");
+					break;
 				case SOURCE_LOCAL:
 					fprintf(stdout, "LOCAL\n\n");
 					break;